@@ -22,6 +22,8 @@ last_comment = None
 interface = None
 method = None
 method_comment = None
+# Whether method is a signal.
+signal = False
 args = None
 output_file = None
 
@@ -70,6 +72,7 @@ def start_element(name, attrs):
     global interface
     global method
     global method_comment
+    global signal
     global args
     global output_file
 
@@ -97,17 +100,21 @@ def start_element(name, attrs):
         if last_comment is not None:
             output_file.write (fix_whitespace (last_comment, 4))
 
-    elif name == 'method':
+    elif name in ('method', 'signal'):
         if interface is None:
-            raise ValueError ("<method>s outside of <interface>s not allowed.")
+            raise ValueError ("<" + name + ">s outside of <interface>s"
+                              + " not allowed.")
         if method is not None:
-            raise ValueError ("Nest <method>s not allowed.")
+            raise ValueError ("Nest <" + name + ">s not allowed.")
 
         method = attrs['name']
+        signal = name == 'signal'
 
         if last_comment is None:
             last_comment = ""
         method_comment = fix_whitespace (last_comment, 8)
+        if signal:
+            method_comment = "        This is a signal.\n\n" + method_comment
 
         args = []
 
@@ -118,9 +125,10 @@ def start_element(name, attrs):
         if last_comment is None:
             last_comment = ""
 
+        # A signal's arguments are always out arguments.
         method_comment = method_comment \
             + "        :param " \
-            + attrs.get ('direction', 'in') + " " \
+            + attrs.get ('direction', 'out' if signal else 'in') + " " \
             + attrs.get ('name', '') + " " \
             + attrs.get ('type', '') + ":\n" \
             + fix_whitespace (last_comment, 12)
@@ -164,10 +172,10 @@ def end_element(name):
 
     name = name.lower ()
 
-    if name == 'method':
+    if name in ('method', 'signal'):
         # Create the header (function (args)) and flush the comment.
         if method is None:
-            raise ValueError ("</method>, but no <method>.")
+            raise ValueError ("</" + name + ">, but no <" + name + ">.")
 
         output_file.write ("    .. function:: %s (" % (method,))
         for i in range (len (args)):
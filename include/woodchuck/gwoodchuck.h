@@ -97,6 +97,35 @@ struct gwoodchuck_vtable
 				const char *object_identifier,
 				const char *filenames[],
 				gpointer user_data);
+
+      /* Like object_transfer, but woodchuck has a local file,
+	 LOCAL_COPY, whose content is identical to the object's (e.g.,
+	 because another application already transferred it).  It may
+	 be hard linked or copied instead of transferring the object.
+	 It belongs to another object and must not be modified or
+	 moved.
+
+	 If NULL, object_transfer is called instead.  */
+      uint32_t (*object_transfer_local_copy) (const char *stream_identifier,
+					      const char *object_identifier,
+					      uint32_t target_quality,
+					      const char *local_copy,
+					      gpointer user_data);
+
+      /* Woodchuck compressed some of the files of the object
+	 identified by STREAM_IDENTIFIER and OBJECT_IDENTIFIER.  This
+	 is only done if all of the object's files are dedicated to it
+	 and have the deletion policy
+	 WOODCHUCK_DELETION_POLICY_COMPRESS_WITHOUT_CONSULTATION.
+	 FILENAMES is a NULL terminated array of the files' old names
+	 and NEW_FILENAMES of their new names.  OBJECT_SIZE is the
+	 object's new size in bytes.  */
+      void (*object_files_compressed) (const char *stream_identifier,
+				       const char *object_identifier,
+				       const char *filenames[],
+				       const char *new_filenames[],
+				       uint64_t object_size,
+				       gpointer user_data);
     };
 
     /* Reserve space for future expansion.  */
@@ -109,13 +138,40 @@ struct gwoodchuck_vtable
    identify the application (e.g., 'Foo EMail Client', 'Bar Podcast
    Manager').  DBUS_SERVICE_NAME is application's dbus service name.
    This is used as a unique identifier for the application and the end
-   point used for upcalls.  */
+   point used for upcalls.
+
+   The functions below may be called from any thread, e.g., from a
+   downloader's worker threads.  Upcalls and the callbacks of the
+   asynchronous functions are run from the main loop.  The
+   application must initialize thread support by calling
+   g_thread_init (NULL) and dbus_g_thread_init () at the start of
+   main, before it calls any other GLib or D-Bus function.  */
 extern GWoodchuck *gwoodchuck_new (const char *human_readable_name,
 				   const char *dbus_service_name,
 				   struct gwoodchuck_vtable *vtable,
 				   gpointer user_data,
 				   GError **error);
 
+enum
+  {
+    /* Load all of the manager's streams and objects when the client
+       object is created and keep the copy up to date.  Looking up a
+       stream or an object that does not exist is then answered
+       locally.  This is useful for applications that register many
+       objects or that report the status of many objects at start
+       up.  */
+    GWOODCHUCK_PREFETCH = 1 << 0,
+  };
+
+/* Like gwoodchuck_new, but FLAGS is a bit-wise or of the
+   GWOODCHUCK_* flags above.  */
+extern GWoodchuck *gwoodchuck_new_full (const char *human_readable_name,
+					const char *dbus_service_name,
+					struct gwoodchuck_vtable *vtable,
+					gpointer user_data,
+					uint32_t flags,
+					GError **error);
+
 #define GWOODCHUCK_STREAM_UPDATE_HOURLY (60 * 60)
 #define GWOODCHUCK_STREAM_UPDATE_EVERY_FEW_HOURS (6 * 60 * 60)
 #define GWOODCHUCK_STREAM_UPDATE_DAILY (24 * 60 * 60)
@@ -313,6 +369,94 @@ extern gboolean gwoodchuck_object_files_deleted
   (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
    enum woodchuck_deletion_response response, uint64_t arg,
    GError **error);
+
+/* Asynchronous variants.
+
+   The above functions block until murmeltier replies.  The following
+   functions instead queue the request and return immediately.  The
+   requests are sent from the main loop, in the order in which they
+   were queued, and several are kept in flight.  When a request
+   completes, CALLBACK (if not NULL) is called from the main loop with
+   USER_DATA.  ERROR is NULL if the request succeeded; it is owned by
+   the library.  The strings and arrays that are passed are copied.
+
+   A synchronous call does not wait for queued asynchronous requests to
+   complete.  */
+typedef void (*gwoodchuck_ready_callback) (GWoodchuck *wc,
+					   const GError *error,
+					   gpointer user_data);
+
+extern void gwoodchuck_stream_register_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   const char *human_readable_name, uint32_t freshness,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_stream_updated_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   uint64_t transferred, uint32_t duration,
+   uint32_t new_objects, uint32_t updated_objects, uint32_t objects_inline,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_stream_updated_full_async
+  (GWoodchuck *wc, const char *stream_identifier, uint32_t indicator_mask,
+   uint64_t transferred_up, uint64_t transferred_down,
+   uint64_t start, uint32_t duration,
+   uint32_t new_objects, uint32_t updated_objects, uint32_t objects_inline,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_stream_update_failed_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   uint32_t reason, uint32_t transferred,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_stream_unregister_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_register_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   const char *object_identifier, const char *human_readable_name,
+   int64_t expected_size, uint64_t expected_transfer_up,
+   uint64_t expected_transfer_down, uint32_t transfer_frequency,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_unregister_async
+  (GWoodchuck *wc, const char *stream_identifier,
+   const char *object_identifier,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_transferred_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint32_t indicator_mask, uint64_t object_size,
+   uint32_t transfer_duration, const char *filename,
+   uint32_t deletion_policy,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_transferred_full_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint32_t indicator_mask, uint64_t transferred_up, uint64_t transferred_down,
+   uint64_t transfer_time, uint32_t transfer_duration, uint64_t object_size,
+   struct gwoodchuck_object_transferred_file *files, int files_count,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_transfer_failed_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint32_t reason, uint32_t transferred,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_used_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_used_full_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint64_t start, uint64_t duration, uint64_t use_mask,
+   gwoodchuck_ready_callback callback, gpointer user_data);
+
+extern void gwoodchuck_object_files_deleted_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   enum woodchuck_deletion_response response, uint64_t arg,
+   gwoodchuck_ready_callback callback, gpointer user_data);
 						   
 						 
 
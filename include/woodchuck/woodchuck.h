@@ -137,6 +137,13 @@ enum woodchuck_deletion_policy
     /* This file may be deleted, but must be done by the application.
        In this case, the "object_delete" upcall will be invoked.  */
     WOODCHUCK_DELETION_POLICY_DELETE_WITH_CONSULTATION = 2,
+    /* Woodchuck may compress this file with gzip without consulting
+       the application, provided the file is dedicated to the object.
+       The file FILE is replaced by FILE.gz and the
+       "object_files_compressed" upcall is invoked.  Otherwise, the
+       file is treated as if its policy were
+       WOODCHUCK_DELETION_POLICY_DELETE_WITH_CONSULTATION.  */
+    WOODCHUCK_DELETION_POLICY_COMPRESS_WITHOUT_CONSULTATION = 3,
   };
 
 enum woodchuck_deletion_response
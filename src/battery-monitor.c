@@ -40,6 +40,7 @@
 #include "dbus-util.h"
 #include "util.h"
 #include "debug.h"
+#include "timers.h"
 
 struct _WCBattery
 {
@@ -255,7 +256,8 @@ battery_properties_modified_cb (DBusGProxy *proxy,
 	      /* Don't use an idle handler.  Allow changes to
 		 accumulate to reduce d-bus traffic.  */
 	      b->properties_reread
-		= g_timeout_add (1000, battery_properties_reread, b);
+		= timer_add ("battery", 1000, 1000,
+			     battery_properties_reread, b);
 
 	    break;
 	  }
@@ -0,0 +1,181 @@
+# dispatch-gen.awk - Generate murmeltier's D-Bus dispatch table.
+# Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+#
+# Woodchuck is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 3, or (at
+# your option) any later version.
+#
+# Woodchuck is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see
+# <http://www.gnu.org/licenses/>.
+
+# Reads D-Bus introspection files and writes a C header with an enum
+# of the interfaces, an enum of the methods, and a table of the
+# methods indexed by a perfect hash of "INTERFACE.MEMBER".  Each entry
+# includes the method's input signature.
+#
+# The hash is computed the same way by dispatch_lookup in the
+# generated code: h = seed; h = h * 31 + c (modulo 2^32) for each
+# character; slot = (h + (h >> 16)) modulo the table size.  We search
+# for a seed for which no two methods share a slot.  Only POSIX awk
+# arithmetic is used so that the hash can be computed exactly.
+
+function attribute(line, name,    m) {
+  if (! match(line, name "=\"[^\"]*\""))
+    return "";
+  m = substr(line, RSTART + length(name) + 2);
+  return substr(m, 1, index(m, "\"") - 1);
+}
+
+function identifier(s) {
+  s = tolower(s);
+  gsub(/[.]/, "_", s);
+  return s;
+}
+
+function hash(s, seed,    h, i) {
+  h = seed;
+  for (i = 1; i <= length(s); i ++)
+    h = (h * 31 + ord[substr(s, i, 1)]) % 4294967296;
+  return (h + int(h / 65536)) % size;
+}
+
+BEGIN {
+  for (i = 1; i < 128; i ++)
+    ord[sprintf("%c", i)] = i;
+  interfaces = 0;
+  methods = 0;
+}
+
+# Skip comments.
+in_comment {
+  if (index($0, "-->"))
+    in_comment = 0;
+  next;
+}
+/<!--/ {
+  if (! index($0, "-->"))
+    in_comment = 1;
+  next;
+}
+
+/<interface / {
+  interface = attribute($0, "name");
+  interface_names[++ interfaces] = interface;
+  next;
+}
+/<method / {
+  in_method = 1;
+  method = attribute($0, "name");
+  signature = "";
+  next;
+}
+in_method && /<arg / {
+  direction = attribute($0, "direction");
+  if (direction == "" || direction == "in")
+    signature = signature attribute($0, "type");
+  next;
+}
+/<\/method>/ {
+  in_method = 0;
+  methods ++;
+  method_interface[methods] = interface;
+  method_member[methods] = method;
+  method_signature[methods] = signature;
+  next;
+}
+
+END {
+  size = 1;
+  while (size < 4 * methods)
+    size *= 2;
+
+  for (seed = 0; ; seed ++)
+    {
+      split("", used);
+      for (i = 1; i <= methods; i ++)
+	{
+	  slot = hash(method_interface[i] "." method_member[i], seed);
+	  if (slot in used)
+	    break;
+	  used[slot] = i;
+	}
+      if (i > methods)
+	break;
+    }
+
+  print "/* Automatically generated by dispatch-gen.awk.  Do not edit.  */";
+  print "";
+  print "#include <stdint.h>";
+  print "#include <string.h>";
+  print "";
+  print "enum dispatch_interface";
+  print "  {";
+  for (i = 1; i <= interfaces; i ++)
+    printf("    %s%s,\n", identifier(interface_names[i]), i == 1 ? " = 1" : "");
+  print "  };";
+  print "";
+  print "enum dispatch_method";
+  print "  {";
+  for (i = 1; i <= methods; i ++)
+    printf("    %s_%s%s,\n", identifier(method_interface[i]), method_member[i],
+	   i == 1 ? " = 1" : "");
+  print "  };";
+  print "";
+  print "/* The number of methods.  Method values are between 1 and this.  */";
+  printf("#define DISPATCH_METHODS %d\n", methods);
+  print "";
+  print "struct dispatch_entry";
+  print "{";
+  print "  const char *interface_name;";
+  print "  const char *member;";
+  print "  /* The method's input signature.  */";
+  print "  const char *signature;";
+  print "  enum dispatch_interface interface;";
+  print "  enum dispatch_method method;";
+  print "};";
+  print "";
+  printf("#define DISPATCH_TABLE_SIZE %d\n", size);
+  printf("#define DISPATCH_HASH_SEED %du\n", seed);
+  print "";
+  print "static const struct dispatch_entry dispatch_table[DISPATCH_TABLE_SIZE] =";
+  print "  {";
+  for (slot = 0; slot < size; slot ++)
+    if (slot in used)
+      {
+	i = used[slot];
+	printf("    [%d] = { \"%s\", \"%s\", \"%s\",\n", slot,
+	       method_interface[i], method_member[i], method_signature[i]);
+	printf("             %s, %s_%s },\n", identifier(method_interface[i]),
+	       identifier(method_interface[i]), method_member[i]);
+      }
+  print "  };";
+  print "";
+  print "/* Return the entry for the method MEMBER of INTERFACE or NULL if";
+  print "   there is no such method.  */";
+  print "static inline const struct dispatch_entry *";
+  print "dispatch_lookup (const char *interface, const char *member)";
+  print "{";
+  print "  uint32_t h = DISPATCH_HASH_SEED;";
+  print "  const char *p;";
+  print "  for (p = interface; *p; p ++)";
+  print "    h = h * 31 + (unsigned char) *p;";
+  print "  h = h * 31 + '.';";
+  print "  for (p = member; *p; p ++)";
+  print "    h = h * 31 + (unsigned char) *p;";
+  print "";
+  print "  const struct dispatch_entry *entry";
+  print "    = &dispatch_table[(h + (h >> 16)) & (DISPATCH_TABLE_SIZE - 1)];";
+  print "  if (entry->member";
+  print "      && strcmp (entry->member, member) == 0";
+  print "      && strcmp (entry->interface_name, interface) == 0)";
+  print "    return entry;";
+  print "  return NULL;";
+  print "}";
+}
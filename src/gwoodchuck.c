@@ -57,12 +57,25 @@ static gboolean org_woodchuck_upcall_object_transfer
    GValueArray *version_strct, const char *filename, uint32_t quality,
    GError **error);
 
+static gboolean org_woodchuck_upcall_object_transfer_local_copy
+  (GWoodchuck *wc, const char *manager_uuid, const char *manager_cookie,
+   const char *stream_uuid, const char *stream_cookie,
+   const char *object_uuid, const char *object_cookie,
+   GValueArray *version_strct, const char *filename, uint32_t quality,
+   const char *local_copy, GError **error);
+
 static gboolean org_woodchuck_upcall_object_delete_files
   (GWoodchuck *wc, const char *manager_uuid, const char *manager_cookie,
    const char *stream_uuid, const char *stream_cookie,
    const char *object_uuid, const char *object_cookie,
    GPtrArray *filenames, GError **error);
 
+static gboolean org_woodchuck_upcall_object_files_compressed
+  (GWoodchuck *wc, const char *manager_uuid, const char *manager_cookie,
+   const char *stream_uuid, const char *stream_cookie,
+   const char *object_uuid, const char *object_cookie,
+   GPtrArray *files, uint64_t object_size, GError **error);
+
 #include "org.woodchuck.upcall.server-stubs.h"
 
 #define G_WOODCHUCK_ERROR gwoodchuck_error_quark ()
@@ -75,12 +88,18 @@ gwoodchuck_error_quark (void)
 /* An object or a stream.  */
 struct object
 {
+  char *uuid;
   char *human_readable_name;
   char *cookie;
   DBusGProxy *proxy;
+  /* If an object, the stream that it belongs to.  */
+  struct object *parent;
   /* If a stream object, a hash from object identifiers to struct
      object *.  */
   GHashTable *hash;
+  /* If a stream object, whether HASH contains all of the stream's
+     objects (see GWOODCHUCK_PREFETCH).  */
+  gboolean complete;
   char data[];
 };
 
@@ -90,6 +109,11 @@ struct _GWoodchuck
 
   /* Session bus.  */
   DBusGConnection *session_bus;
+  /* A direct connection to murmeltier (see
+     org.woodchuck.PeerAddress) or NULL, if we talk to it via the
+     session bus.  The proxies use this connection if it is
+     available.  */
+  DBusGConnection *peer;
 
   /* woodchuck root proxy.  */
   DBusGProxy *woodchuck_proxy;
@@ -98,6 +122,30 @@ struct _GWoodchuck
 
   /* A hash from stream cookies to struct object *.  */
   GHashTable *stream_hash;
+  /* A hash from the UUIDs of the streams and objects in the above
+     tables to their struct object *.  Used to find the objects that
+     a signal refers to.  */
+  GHashTable *uuid_hash;
+  /* Protects the lookup tables and the struct objects in them, the
+     proxies and REQUESTS.  The public functions may be called from
+     any thread; signal_filter runs in the main thread.  The lock is
+     only held while accessing the tables and sending messages, never
+     while waiting for a reply or calling a callback.  */
+  GStaticMutex lock;
+  /* Whether the GWOODCHUCK_PREFETCH flag was passed.  */
+  gboolean prefetch;
+  /* Whether STREAM_HASH contains all of the manager's streams.  */
+  gboolean streams_complete;
+
+  /* The queued asynchronous requests (struct request *).  */
+  GQueue requests;
+  /* The number of asynchronous requests that have been started but
+     not completed.  */
+  int in_flight;
+  /* Whether requests_pump is running.  */
+  gboolean pumping;
+  /* The idle source that runs requests_pump, if any.  */
+  guint requests_pump_source;
 
   struct gwoodchuck_vtable *vtable;
   gpointer user_data;
@@ -105,6 +153,114 @@ struct _GWoodchuck
 
 G_DEFINE_TYPE (GWoodchuck, gwoodchuck, G_TYPE_OBJECT);
 
+static DBusHandlerResult signal_filter (DBusConnection *connection,
+					DBusMessage *message,
+					void *user_data);
+
+/* The signals that signal_filter processes.  */
+static const char *signal_match_rules[] =
+  {
+    "type='signal',sender='org.woodchuck',member='Removed'",
+    "type='signal',sender='org.woodchuck',"
+    "interface='org.freedesktop.DBus.Properties',member='PropertiesChanged'",
+    NULL
+  };
+
+/* The signals that signal_filter additionally processes if we
+   prefetched the manager's streams and objects.  */
+static const char *prefetch_match_rules[] =
+  {
+    "type='signal',sender='org.woodchuck',"
+    "interface='org.woodchuck.manager',member='StreamAdded'",
+    "type='signal',sender='org.woodchuck',"
+    "interface='org.woodchuck.stream',member='ObjectAdded'",
+    NULL
+  };
+
+/* Return a proxy for PROXY's object that talks to murmeltier via the
+   session bus.  Drops the reference to PROXY.  */
+static DBusGProxy *
+proxy_rebind (GWoodchuck *wc, DBusGProxy *proxy)
+{
+  DBusGProxy *new_proxy
+    = dbus_g_proxy_new_for_name (wc->session_bus,
+				 "org.woodchuck",
+				 dbus_g_proxy_get_path (proxy),
+				 dbus_g_proxy_get_interface (proxy));
+  g_object_unref (proxy);
+  return new_proxy;
+}
+
+/* If murmeltier exits, the peer connection is closed.  Fall back to
+   the session bus, which restarts murmeltier on demand.  */
+static DBusHandlerResult
+peer_filter (DBusConnection *connection, DBusMessage *message,
+	     void *user_data)
+{
+  GWoodchuck *wc = user_data;
+
+  if (! dbus_message_is_signal (message, DBUS_INTERFACE_LOCAL,
+				"Disconnected"))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  g_static_mutex_lock (&wc->lock);
+
+  wc->woodchuck_proxy = proxy_rebind (wc, wc->woodchuck_proxy);
+  if (wc->manager_proxy)
+    wc->manager_proxy = proxy_rebind (wc, wc->manager_proxy);
+  if (wc->uuid_hash)
+    {
+      GList *objects = g_hash_table_get_values (wc->uuid_hash);
+      GList *l;
+      for (l = objects; l; l = l->next)
+	{
+	  struct object *o = l->data;
+	  o->proxy = proxy_rebind (wc, o->proxy);
+	}
+      g_list_free (objects);
+    }
+
+  DBusGConnection *peer = wc->peer;
+  wc->peer = NULL;
+
+  g_static_mutex_unlock (&wc->lock);
+
+  dbus_connection_remove_filter (connection, peer_filter, wc);
+  dbus_g_connection_unref (peer);
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+gwoodchuck_finalize (GObject *object)
+{
+  GWoodchuck *wc = GWOODCHUCK (object);
+
+  if (wc->peer)
+    {
+      dbus_connection_remove_filter
+	(dbus_g_connection_get_connection (wc->peer), peer_filter, wc);
+      dbus_g_connection_unref (wc->peer);
+    }
+
+  if (wc->uuid_hash)
+    /* gwoodchuck_new installed the signal filter.  */
+    {
+      DBusConnection *connection
+	= dbus_g_connection_get_connection (wc->session_bus);
+      dbus_connection_remove_filter (connection, signal_filter, wc);
+
+      int i;
+      for (i = 0; signal_match_rules[i]; i ++)
+	dbus_bus_remove_match (connection, signal_match_rules[i], NULL);
+      if (wc->prefetch)
+	for (i = 0; prefetch_match_rules[i]; i ++)
+	  dbus_bus_remove_match (connection, prefetch_match_rules[i], NULL);
+    }
+
+  G_OBJECT_CLASS (gwoodchuck_parent_class)->finalize (object);
+}
+
 static void
 gwoodchuck_class_init (GWoodchuckClass *klass)
 {
@@ -113,6 +269,7 @@ gwoodchuck_class_init (GWoodchuckClass *klass)
   GObjectClass *object_class;
 
   object_class = G_OBJECT_CLASS (klass);
+  object_class->finalize = gwoodchuck_finalize;
 
   dbus_g_object_type_install_info
     (GWOODCHUCK_TYPE, &dbus_glib_org_woodchuck_upcall_object_info);
@@ -121,6 +278,14 @@ gwoodchuck_class_init (GWoodchuckClass *klass)
 static void
 gwoodchuck_init (GWoodchuck *wc)
 {
+  /* Worker threads may call us.  The application must have
+     initialized thread support before making any D-Bus call; by now
+     it is too late.  */
+  if (! g_thread_supported ())
+    g_critical ("%s: g_thread_init and dbus_g_thread_init must be called "
+		"before the first D-Bus call.", __FUNCTION__);
+  g_static_mutex_init (&wc->lock);
+
   GError *error = NULL;
   wc->session_bus = dbus_g_bus_get (DBUS_BUS_SESSION, &error);
   if (error)
@@ -135,14 +300,49 @@ gwoodchuck_init (GWoodchuck *wc)
      "org.woodchuck",
      "/org/woodchuck",
      "org.woodchuck");
+
+  /* Bypass the bus daemon if murmeltier offers a direct connection.
+     The other proxies are derived from wc->woodchuck_proxy and thus
+     also use it.  */
+  char *address = NULL;
+  if (! org_woodchuck_peer_address (wc->woodchuck_proxy, &address, &error))
+    {
+      /* An old murmeltier.  Use the bus.  */
+      g_error_free (error);
+      return;
+    }
+
+  if (*address)
+    {
+      wc->peer = dbus_g_connection_open (address, &error);
+      if (error)
+	{
+	  g_warning ("%s: Connecting to %s: %s",
+		     __FUNCTION__, address, error->message);
+	  g_error_free (error);
+	}
+      else
+	{
+	  g_object_unref (wc->woodchuck_proxy);
+	  wc->woodchuck_proxy = dbus_g_proxy_new_for_peer
+	    (wc->peer, "/org/woodchuck", "org.woodchuck");
+	  dbus_connection_add_filter
+	    (dbus_g_connection_get_connection (wc->peer),
+	     peer_filter, wc, NULL);
+	}
+    }
+  g_free (address);
 }
 
+static gboolean registry_prefetch (GWoodchuck *wc, GError **caller_error);
+
 GWoodchuck *
-gwoodchuck_new (const char *human_readable_name,
-		const char *dbus_service_name,
-		struct gwoodchuck_vtable *vtable,
-		gpointer user_data,
-		GError **caller_error)
+gwoodchuck_new_full (const char *human_readable_name,
+		     const char *dbus_service_name,
+		     struct gwoodchuck_vtable *vtable,
+		     gpointer user_data,
+		     uint32_t flags,
+		     GError **caller_error)
 {
   GWoodchuck *wc = GWOODCHUCK (g_object_new (GWOODCHUCK_TYPE, NULL));
   char *uuid = NULL;
@@ -280,7 +480,33 @@ gwoodchuck_new (const char *human_readable_name,
   free (path);
 
   wc->stream_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  wc->uuid_hash = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* Keep the local lookup tables up to date when another process
+     changes or removes our streams and objects.  Passing a NULL
+     error means that we don't wait for the replies.  */
+  DBusConnection *connection
+    = dbus_g_connection_get_connection (wc->session_bus);
+  int i;
+  for (i = 0; signal_match_rules[i]; i ++)
+    dbus_bus_add_match (connection, signal_match_rules[i], NULL);
+  if ((flags & GWOODCHUCK_PREFETCH))
+    /* Add the rules before listing so that we don't miss any
+       additions.  */
+    {
+      wc->prefetch = TRUE;
+      for (i = 0; prefetch_match_rules[i]; i ++)
+	dbus_bus_add_match (connection, prefetch_match_rules[i], NULL);
+    }
+  dbus_connection_add_filter (connection, signal_filter, wc, NULL);
 
+  if (wc->prefetch && ! registry_prefetch (wc, &error))
+    /* Not fatal: we fall back to looking up objects on demand.  */
+    {
+      g_warning ("%s: Prefetching streams and objects: %s",
+		 __FUNCTION__, error->message);
+      g_clear_error (&error);
+    }
 
   /* Prepare to listen for feedback.  */
 
@@ -308,101 +534,112 @@ gwoodchuck_new (const char *human_readable_name,
   return wc;
 }
 
-/* Register a stream in the local lookup table.  */
+GWoodchuck *
+gwoodchuck_new (const char *human_readable_name,
+		const char *dbus_service_name,
+		struct gwoodchuck_vtable *vtable,
+		gpointer user_data,
+		GError **error)
+{
+  return gwoodchuck_new_full (human_readable_name, dbus_service_name,
+			      vtable, user_data, 0, error);
+}
+
+/* Register a stream in the local lookup table.  PARENT must be
+   NULL.  */
 static struct object *
-stream_register_local (DBusGProxy *proxy, GHashTable *hash, const char *uuid,
+stream_register_local (GWoodchuck *wc, struct object *parent,
+		       const char *uuid,
 		       const char *cookie, const char *human_readable_name)
 {
+  assert (! parent);
+
   char *path = NULL;
   asprintf (&path, "/org/woodchuck/stream/%s", uuid);
 
+  int uuid_len = strlen (uuid);
   int human_readable_name_len = strlen (human_readable_name);
   int cookie_len = strlen (cookie);
   struct object *stream = g_malloc0 (sizeof (*stream)
+				     + uuid_len + 1
 				     + human_readable_name_len + 1
 				     + cookie_len + 1);
 
   char *p = stream->data;
+  stream->uuid = p;
+  p = mempcpy (p, uuid, uuid_len + 1);
   stream->human_readable_name = p;
   p = mempcpy (p, human_readable_name, human_readable_name_len + 1);
   stream->cookie = p;
   p = mempcpy (p, cookie, cookie_len + 1);
 
-  stream->proxy = dbus_g_proxy_new_from_proxy (proxy,
+  stream->proxy = dbus_g_proxy_new_from_proxy (wc->manager_proxy,
 					       "org.woodchuck.stream",
 					       path);
   free (path);
 
-  g_hash_table_insert (hash, stream->cookie, stream);
+  g_hash_table_insert (wc->stream_hash, stream->cookie, stream);
+  g_hash_table_insert (wc->uuid_hash, stream->uuid, stream);
 
   stream->hash = g_hash_table_new (g_str_hash, g_str_equal);
 
   return stream;
 }
 
-/* Register an object in the local lookup table.  */
+/* Register an object belonging to the stream PARENT in the local
+   lookup table.  */
 static struct object *
-object_register_local (DBusGProxy *proxy, GHashTable *hash, const char *uuid,
+object_register_local (GWoodchuck *wc, struct object *parent,
+		       const char *uuid,
 		       const char *cookie, const char *human_readable_name)
 {
+  assert (parent->hash);
+
   char *path = NULL;
   asprintf (&path, "/org/woodchuck/object/%s", uuid);
 
+  int uuid_len = strlen (uuid);
   int human_readable_name_len = strlen (human_readable_name);
   int cookie_len = strlen (cookie);
   struct object *object = g_malloc0 (sizeof (*object)
+				     + uuid_len + 1
 				     + human_readable_name_len + 1
 				     + cookie_len + 1);
 
   char *p = object->data;
+  object->uuid = p;
+  p = mempcpy (p, uuid, uuid_len + 1);
   object->human_readable_name = p;
   p = mempcpy (p, human_readable_name, human_readable_name_len + 1);
   object->cookie = p;
   p = mempcpy (p, cookie, cookie_len + 1);
 
-  object->proxy = dbus_g_proxy_new_from_proxy (proxy,
+  object->proxy = dbus_g_proxy_new_from_proxy (parent->proxy,
 					       "org.woodchuck.object",
 					       path);
   free (path);
 
-  g_hash_table_insert (hash, object->cookie, object);
+  object->parent = parent;
+  g_hash_table_insert (parent->hash, object->cookie, object);
+  g_hash_table_insert (wc->uuid_hash, object->uuid, object);
 
   return object;
 }
 
-/* Return the UUID of the object with the cookie COOKIE, or NULL if it
-   does not exist.  If an error occurs, *CALLER_ERROR will be set
-   (i.e., you probably don't want to pass NULL).  */
+/* Process the reply to a LookupStreamByCookie call (if PARENT is
+   NULL) or a LookupObjectByCookie call on PARENT for COOKIE.  OBJECTS
+   is the returned array of <UUID, HumanReadableName>.  Add the object
+   to the local lookup table and return it.  Return NULL if it does
+   not exist.  */
 static struct object *
-ll_object_lookup (DBusGProxy *proxy, GHashTable *hash,
-		  const char *cookie,
-		  gboolean (*lookup_by_cookie) (DBusGProxy *, const char *,
-						GPtrArray **, GError **),
-		  struct object * (*register_local) (DBusGProxy *,
-						     GHashTable *,
-						     const char *,
-						     const char *,
-						     const char *),
-		  GError **caller_error)
+lookup_reply (GWoodchuck *wc, struct object *parent, const char *cookie,
+	      GPtrArray *objects, GError **error)
 {
+  GHashTable *hash = parent ? parent->hash : wc->stream_hash;
   struct object *object = g_hash_table_lookup (hash, cookie);
   if (object)
-    /* We already know about the object.  Return it.  */
-    {
-      assert (strcmp (object->cookie, cookie) == 0);
-      return object;
-    }
-
-  /* Lookup the object.  */
-  GPtrArray *objects = NULL;
-  GError *error = NULL;
-  if (! lookup_by_cookie (proxy, cookie, &objects, &error))
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return NULL;
-    }
+    /* Another request already looked it up.  */
+    return object;
 
   if (objects->len > 1)
     /* There are multiple objects with the same cookie.  This is
@@ -428,21 +665,19 @@ ll_object_lookup (DBusGProxy *proxy, GHashTable *hash,
 				  a_human_readable_name);
 	}
 
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_OBJECT_EXISTS,
-		   "%s: Multiple objects with cookie '%s' exist (%s)."
+      g_set_error (error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_OBJECT_EXISTS,
+		   "Multiple objects with cookie '%s' exist (%s).  "
 		   "Aborting to avoid corruption.",
-		   __FUNCTION__, cookie, s->str);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+		   cookie, s->str);
 
       g_string_free (s, TRUE);
 
-      goto out;
+      return NULL;
     }
 
   if (objects->len == 0)
     /* A object with this cookie does not exist.  */
-    goto out;
+    return NULL;
 
   GValueArray *strct = g_ptr_array_index (objects, 0);
 
@@ -452,76 +687,12 @@ ll_object_lookup (DBusGProxy *proxy, GHashTable *hash,
   const char *human_readable_name
     = g_value_get_string (human_readable_name_value);
 
-  object = register_local (proxy, hash, uuid, cookie, human_readable_name);
-
- out:
-  if (objects)
-    {
-      int i;
-      for (i = 0; i < objects->len; i ++)
-	g_value_array_free (g_ptr_array_index (objects, i));
-      g_ptr_array_free (objects, TRUE);
-    }
-
-  return object;
-}
-	       
-static struct object *
-stream_lookup (GWoodchuck *wc, const char *cookie, GError **caller_error)
-{
-  struct object *stream = ll_object_lookup
-    (wc->manager_proxy, wc->stream_hash, cookie,
-     org_woodchuck_manager_lookup_stream_by_cookie, stream_register_local,
-     caller_error);
-
-  if (stream)
-    assert (stream->hash);
-
-  return stream;
-}
-
-static struct object *
-object_lookup (GWoodchuck *wc, struct object *stream,
-	       const char *cookie, GError **caller_error)
-{
-  /* Better be a stream.  */
-  assert (stream->hash);
-
-  struct object *object = ll_object_lookup
-    (stream->proxy, stream->hash, cookie,
-     org_woodchuck_stream_lookup_object_by_cookie, object_register_local,
-     caller_error);
-
-  if (object)
-    assert (! object->hash);
-
-  return object;
-}
-
-static struct object *
-object_find (GWoodchuck *wc, const char *stream_identifier,
-	     const char *cookie, GError **caller_error)
-{
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, stream_identifier, &error);
-  if (error)
-    {
-      g_critical ("%s: %s", __FUNCTION__, error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
-
-  if (! stream)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: No stream with identifier '%s' exists.",
-		   __FUNCTION__, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return NULL;
-    }
-
-  return object_lookup (wc, stream, cookie, caller_error);
+  if (parent)
+    return object_register_local (wc, parent, uuid, cookie,
+				  human_readable_name);
+  else
+    return stream_register_local (wc, NULL, uuid, cookie,
+				  human_readable_name);
 }
 
 static void
@@ -537,7 +708,9 @@ object_deregister_local (GWoodchuck *wc,
 	       object->cookie, stream->cookie);
       assert (0 == 1);
     }
+  g_hash_table_remove (wc->uuid_hash, object->uuid);
 
+  g_object_unref (object->proxy);
   g_free (object);
 }
 
@@ -553,264 +726,549 @@ stream_deregister_local (GWoodchuck *wc, struct object *stream)
       assert (0 == 1);
     }
 
+  g_hash_table_remove (wc->uuid_hash, stream->uuid);
+
+  /* We can't use object_deregister_local: it removes the object from
+     STREAM->HASH, which we are iterating over.  */
   void iter (gpointer key, gpointer value, gpointer user_data)
   {
     struct object *object = value;
     assert (! object->hash);
-    object_deregister_local (wc, stream, object);
+    g_hash_table_remove (wc->uuid_hash, object->uuid);
+    g_object_unref (object->proxy);
+    g_free (object);
   }
   g_hash_table_foreach (stream->hash, iter, NULL);
+  g_hash_table_destroy (stream->hash);
 
+  g_object_unref (stream->proxy);
   g_free (stream);
 
   return;
 }
 
-gboolean
-gwoodchuck_stream_register (GWoodchuck *wc,
-			    const char *identifier,
-			    const char *human_readable_name, uint32_t freshness,
-			    GError **caller_error)
+/* Call LIST_FROM on PROXY until all pages have been returned and call
+   CALLBACK with each row's UUID, cookie and human readable name.  If
+   murmeltier does not support LIST_FROM, fall back to LIST.  */
+static gboolean
+list_all (DBusGProxy *proxy,
+	  gboolean (*list_from) (DBusGProxy *, const char *, guint,
+				 GPtrArray **, char **, GError **),
+	  gboolean (*list) (DBusGProxy *, GPtrArray **, GError **),
+	  void (*callback) (const char *uuid, const char *cookie,
+			    const char *human_readable_name),
+	  GError **caller_error)
 {
-  /* We require that the identifier be unique.  */
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, identifier, &error);
-  if (error)
+  char *cursor = g_strdup ("");
+  gboolean ret = TRUE;
+  do
     {
-      g_critical ("%s: %s", __FUNCTION__, error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+      GPtrArray *rows = NULL;
+      char *next_cursor = NULL;
+      GError *error = NULL;
+      if (! list_from (proxy, cursor, 0, &rows, &next_cursor, &error))
+	{
+	  if (! *cursor
+	      && g_error_matches (error,
+				  DBUS_GERROR, DBUS_GERROR_UNKNOWN_METHOD))
+	    /* An old murmeltier.  Get everything at once.  */
+	    {
+	      g_clear_error (&error);
+	      next_cursor = g_strdup ("");
+	      list (proxy, &rows, &error);
+	    }
 
-  if (stream)
-    {
-      assert (strcmp (stream->cookie, identifier) == 0);
+	  if (error)
+	    {
+	      g_propagate_error (caller_error, error);
+	      g_free (next_cursor);
+	      ret = FALSE;
+	      break;
+	    }
+	}
 
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_OBJECT_EXISTS,
-		   "%s: Register stream '%s': A stream ('%s') with "
-		   "identifier '%s' already exists.",
-		   __FUNCTION__,
-		   human_readable_name, stream->human_readable_name,
-		   identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      int i;
+      for (i = 0; i < rows->len; i ++)
+	{
+	  GValueArray *strct = g_ptr_array_index (rows, i);
+	  callback (g_value_get_string (g_value_array_get_nth (strct, 0)),
+		    g_value_get_string (g_value_array_get_nth (strct, 1)),
+		    g_value_get_string (g_value_array_get_nth (strct, 2)));
+	  g_value_array_free (strct);
+	}
+      g_ptr_array_free (rows, TRUE);
 
-      return FALSE;
+      g_free (cursor);
+      cursor = next_cursor;
     }
+  while (*cursor);
 
-  /* The stream does not appear to exist.  Register it.  */
+  g_free (cursor);
+  return ret;
+}
 
-  GHashTable *properties = g_hash_table_new (g_str_hash, g_str_equal);
+/* Load all of the manager's streams and their objects into the local
+   lookup tables and mark the tables as complete.  signal_filter keeps
+   them up to date.
 
-  void adds (char *key, const char *value, GValue *gvalue)
+   If multiple streams (or objects in a stream) have the same cookie,
+   we don't cache any of them and leave the table incomplete: the
+   lookup then reports the conflict as usual.  */
+static gboolean
+registry_prefetch (GWoodchuck *wc, GError **caller_error)
+{
+  GHashTable *duplicates = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, NULL);
+
+  struct object *parent = NULL;
+  void add (const char *uuid, const char *cookie,
+	    const char *human_readable_name)
   {
-    memset (gvalue, 0, sizeof (*gvalue));
-    g_value_init (gvalue, G_TYPE_STRING);
-    g_value_set_static_string (gvalue, value);
-    g_hash_table_insert (properties, key, gvalue);
+    GHashTable *hash = parent ? parent->hash : wc->stream_hash;
+    if (g_hash_table_lookup (hash, cookie))
+      g_hash_table_insert (duplicates, g_strdup (cookie), NULL);
+    else if (parent)
+      object_register_local (wc, parent, uuid, cookie, human_readable_name);
+    else
+      stream_register_local (wc, NULL, uuid, cookie, human_readable_name);
   }
-  void addu (char *key, uint32_t value, GValue *gvalue)
+
+  /* Drop the duplicates from PARENT's table (or the stream table) and
+     return whether there were none.  */
+  gboolean drop_duplicates (void)
   {
-    memset (gvalue, 0, sizeof (*gvalue));
-    g_value_init (gvalue, G_TYPE_UINT);
-    g_value_set_uint (gvalue, value);
-    g_hash_table_insert (properties, key, gvalue);
+    GHashTable *hash = parent ? parent->hash : wc->stream_hash;
+    gboolean unique = g_hash_table_size (duplicates) == 0;
+
+    GList *cookies = g_hash_table_get_keys (duplicates);
+    GList *l;
+    for (l = cookies; l; l = l->next)
+      {
+	struct object *object = g_hash_table_lookup (hash, l->data);
+	if (parent)
+	  object_deregister_local (wc, parent, object);
+	else
+	  stream_deregister_local (wc, object);
+      }
+    g_list_free (cookies);
+    g_hash_table_remove_all (duplicates);
+
+    return unique;
   }
 
-  GValue human_readable_name_value;
-  adds ("HumanReadableName", human_readable_name, &human_readable_name_value);
-  GValue cookie_value;
-  adds ("Cookie", identifier, &cookie_value);
-  GValue freshness_value;
-  addu ("Freshness", freshness, &freshness_value);
+  gboolean ret = list_all (wc->manager_proxy,
+			   org_woodchuck_manager_list_streams_from,
+			   org_woodchuck_manager_list_streams,
+			   add, caller_error);
+  wc->streams_complete = drop_duplicates () && ret;
 
-  char *uuid = NULL;
-  gboolean ret = org_woodchuck_manager_stream_register (wc->manager_proxy,
-							properties, TRUE,
-							&uuid, &error);
-  g_hash_table_unref (properties);
-  if (! ret)
+  GList *streams = g_hash_table_get_values (wc->stream_hash);
+  GList *l;
+  for (l = streams; ret && l; l = l->next)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      parent = l->data;
+      ret = list_all (parent->proxy,
+		      org_woodchuck_stream_list_objects_from,
+		      org_woodchuck_stream_list_objects,
+		      add, caller_error);
+      parent->complete = drop_duplicates () && ret;
     }
+  g_list_free (streams);
 
-  stream = stream_register_local (wc->manager_proxy, wc->stream_hash,
-				  uuid, identifier, human_readable_name);
+  g_hash_table_destroy (duplicates);
 
-  g_free (uuid);
-
-  return stream != NULL;
+  return ret;
 }
 
-gboolean
-gwoodchuck_stream_updated_full (GWoodchuck *wc,
-				const char *stream_identifier,
-				uint32_t indicator_mask,
-				uint64_t transferred_up,
-				uint64_t transferred_down,
-				uint64_t start,
-				uint32_t duration,
-				uint32_t new_objects,
-				uint32_t updated_objects,
-				uint32_t objects_inline,
-				GError **caller_error)
+/* Process the signals that murmeltier sends when an object is
+   changed or removed.  We only cache the UUID, cookie and human
+   readable name of our streams and objects.  If an object is removed
+   or its cookie or human readable name changes, we drop it from the
+   local lookup tables; the next lookup will query murmeltier.
+
+   If we prefetched the streams and objects, we also process the
+   signals that murmeltier sends when a stream or an object is added.
+   If another process added it, we don't know its cookie and so the
+   table is no longer complete.  */
+static DBusHandlerResult
+signal_process (DBusConnection *connection, DBusMessage *message,
+		void *user_data)
 {
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, stream_identifier, &error);
-  if (error)
+  GWoodchuck *wc = user_data;
+
+  if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_SIGNAL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  const char *path = dbus_message_get_path (message);
+  if (! path)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (dbus_message_is_signal (message, "org.woodchuck.manager", "Removed")
+      && strcmp (path, dbus_g_proxy_get_path (wc->manager_proxy)) == 0)
+    /* Our manager was removed and with it all of our streams.  */
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      GList *streams = g_hash_table_get_values (wc->stream_hash);
+      GList *l;
+      for (l = streams; l; l = l->next)
+	stream_deregister_local (wc, l->data);
+      g_list_free (streams);
+
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
-  if (! stream)
+  /* Whether the stream or object that the StreamAdded or ObjectAdded
+     signal MESSAGE announces is in the local lookup tables.  */
+  gboolean added_known (void)
+  {
+    const char *added = NULL;
+    if (! dbus_message_get_args (message, NULL,
+				 DBUS_TYPE_STRING, &added,
+				 DBUS_TYPE_INVALID))
+      return TRUE;
+    return g_hash_table_lookup (wc->uuid_hash, added) != NULL;
+  }
+
+  if (dbus_message_is_signal (message, "org.woodchuck.manager", "StreamAdded"))
     {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Stream '%s' is not registered.",
-		   __FUNCTION__, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      if (strcmp (path, dbus_g_proxy_get_path (wc->manager_proxy)) == 0
+	  && ! added_known ())
+	wc->streams_complete = FALSE;
 
-      return FALSE;
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
-  gboolean ret = org_woodchuck_stream_update_status
-      (stream->proxy, 0, indicator_mask, transferred_up, transferred_down,
-       start, duration, new_objects, updated_objects,
-       objects_inline, &error);
+  const char *uuid = strrchr (path, '/');
+  if (! uuid)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  uuid ++;
+
+  struct object *object = g_hash_table_lookup (wc->uuid_hash, uuid);
+  if (! object)
+    /* Not one of ours or not cached.  */
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-  if (! ret)
+  if (dbus_message_is_signal (message, "org.woodchuck.stream", "ObjectAdded"))
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      if (object->hash && ! added_known ())
+	object->complete = FALSE;
+
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
-  return TRUE;
-}
+  gboolean drop = FALSE;
+  gboolean removed = FALSE;
+  if (dbus_message_is_signal (message, "org.woodchuck.stream", "Removed")
+      || dbus_message_is_signal (message, "org.woodchuck.object", "Removed"))
+    drop = removed = TRUE;
+  else if (dbus_message_is_signal (message, DBUS_INTERFACE_PROPERTIES,
+				   "PropertiesChanged"))
+    {
+      gboolean interesting (const char *property)
+      {
+	return (strcmp (property, "Cookie") == 0
+		|| strcmp (property, "HumanReadableName") == 0);
+      }
 
-gboolean
-gwoodchuck_stream_updated (GWoodchuck *wc,
-			   const char *stream_identifier,
-			   uint64_t transferred,
-			   uint32_t duration,
-			   uint32_t new_objects,
-			   uint32_t updated_objects,
-			   uint32_t objects_inline,
-			   GError **error)
-{
-  return gwoodchuck_stream_updated_full (wc, stream_identifier, 0,
-					 0, transferred,
-					 time (NULL) - duration, duration,
-					 new_objects, updated_objects,
-					 objects_inline, error);
-}
+      DBusMessageIter iter;
+      if (! dbus_message_iter_init (message, &iter)
+	  || strcmp (dbus_message_get_signature (message), "sa{sv}as") != 0)
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-gboolean
-gwoodchuck_stream_update_failed (GWoodchuck *wc,
-				 const char *stream_identifier,
-				 uint32_t reason,
-				 uint32_t transferred,
-				 GError **caller_error)
-{
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, stream_identifier, &error);
-  if (error)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+      /* Skip the interface.  */
+      dbus_message_iter_next (&iter);
 
-  if (! stream)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Stream '%s' is not registered.",
-		   __FUNCTION__, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      /* The changed properties.  */
+      DBusMessageIter array_iter;
+      dbus_message_iter_recurse (&iter, &array_iter);
+      while (! drop
+	     && dbus_message_iter_get_arg_type (&array_iter)
+	     == DBUS_TYPE_DICT_ENTRY)
+	{
+	  DBusMessageIter entry_iter;
+	  dbus_message_iter_recurse (&array_iter, &entry_iter);
+	  const char *property;
+	  dbus_message_iter_get_basic (&entry_iter, &property);
+	  drop = interesting (property);
 
-      return FALSE;
+	  dbus_message_iter_next (&array_iter);
+	}
+      dbus_message_iter_next (&iter);
+
+      /* The invalidated properties.  */
+      dbus_message_iter_recurse (&iter, &array_iter);
+      while (! drop
+	     && dbus_message_iter_get_arg_type (&array_iter)
+	     == DBUS_TYPE_STRING)
+	{
+	  const char *property;
+	  dbus_message_iter_get_basic (&array_iter, &property);
+	  drop = interesting (property);
+
+	  dbus_message_iter_next (&array_iter);
+	}
     }
 
-  gboolean ret = org_woodchuck_stream_update_status
-      (stream->proxy, reason, 0, 0, transferred,
-       time (NULL), 0, 0, 0, 0, &error);
-  if (! ret)
+  if (drop)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      if (! removed)
+	/* The object still exists, but we no longer know its
+	   cookie.  */
+	{
+	  if (object->hash)
+	    wc->streams_complete = FALSE;
+	  else
+	    object->parent->complete = FALSE;
+	}
+
+      if (object->hash)
+	stream_deregister_local (wc, object);
+      else
+	object_deregister_local (wc, object->parent, object);
     }
 
-  return TRUE;
+  /* Other GWoodchucks may also be interested.  */
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
-gboolean
-gwoodchuck_stream_unregister (GWoodchuck *wc, const char *identifier,
-			      GError **caller_error)
+static DBusHandlerResult
+signal_filter (DBusConnection *connection, DBusMessage *message,
+	       void *user_data)
 {
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, identifier, &error);
-  if (error)
+  GWoodchuck *wc = user_data;
+
+  g_static_mutex_lock (&wc->lock);
+  DBusHandlerResult ret = signal_process (connection, message, user_data);
+  g_static_mutex_unlock (&wc->lock);
+
+  return ret;
+}
+
+/* The number of asynchronous requests that we keep in flight.  The
+   asynchronous requests are started and completed in the main
+   thread.  */
+#define REQUESTS_IN_FLIGHT 8
+
+enum request_kind
+  {
+    REQUEST_STREAM_REGISTER,
+    REQUEST_STREAM_UPDATE_STATUS,
+    REQUEST_STREAM_UNREGISTER,
+    REQUEST_OBJECT_REGISTER,
+    REQUEST_OBJECT_UNREGISTER,
+    REQUEST_OBJECT_TRANSFER_STATUS,
+    REQUEST_OBJECT_USED,
+    REQUEST_OBJECT_FILES_DELETED,
+  };
+
+/* A call to one of the public functions.  A request first looks up
+   the stream and, if it concerns an object, the object, and then
+   makes the call.  The synchronous functions run a request to
+   completion using blocking calls.  The asynchronous functions queue
+   it; the queued requests are run from the main loop.  */
+struct request
+{
+  GWoodchuck *wc;
+  enum request_kind kind;
+  /* The public function, for error messages.  */
+  const char *function;
+
+  char *stream_identifier;
+  /* NULL if the request concerns a stream.  */
+  char *object_identifier;
+
+  enum
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+      REQUEST_QUEUED,
+      /* We asked murmeltier for the stream.  */
+      REQUEST_STREAM_LOOKUP,
+      /* We asked murmeltier for the object.  */
+      REQUEST_OBJECT_LOOKUP,
+      /* We made the call.  */
+      REQUEST_CALL,
+    } state;
+
+  /* The outstanding call, if any.  We hold a reference to PROXY: if
+     the proxy were destroyed, the call would be cancelled.  */
+  DBusGProxy *proxy;
+  DBusGProxyCall *call;
+
+  /* Whether the request is run synchronously.  */
+  gboolean sync;
+  /* If synchronous, whether the request completed and the error, if
+     any.  */
+  gboolean done;
+  GError *error;
 
-  if (! org_woodchuck_stream_unregister (stream->proxy, FALSE, &error))
+  gwoodchuck_ready_callback callback;
+  gpointer user_data;
+
+  union
+  {
+    struct
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      char *human_readable_name;
+      uint32_t freshness;
+    } stream_register;
+    struct
+    {
+      uint32_t status;
+      uint32_t indicator_mask;
+      uint64_t transferred_up;
+      uint64_t transferred_down;
+      uint64_t start;
+      uint32_t duration;
+      uint32_t new_objects;
+      uint32_t updated_objects;
+      uint32_t objects_inline;
+    } update_status;
+    struct
+    {
+      char *human_readable_name;
+      int64_t expected_size;
+      uint64_t expected_transfer_up;
+      uint64_t expected_transfer_down;
+      uint32_t transfer_frequency;
+    } object_register;
+    struct
+    {
+      uint32_t status;
+      uint32_t indicator_mask;
+      uint64_t transferred_up;
+      uint64_t transferred_down;
+      uint64_t transfer_time;
+      uint32_t transfer_duration;
+      uint64_t object_size;
+      struct gwoodchuck_object_transferred_file *files;
+      int files_count;
+    } transfer_status;
+    struct
+    {
+      uint64_t start;
+      uint64_t duration;
+      uint64_t use_mask;
+    } used;
+    struct
+    {
+      uint32_t response;
+      uint64_t arg;
+    } files_deleted;
+  };
+};
+
+static struct request *
+request_new (GWoodchuck *wc, enum request_kind kind, const char *function,
+	     const char *stream_identifier, const char *object_identifier)
+{
+  struct request *r = g_new0 (struct request, 1);
+  r->wc = wc;
+  r->kind = kind;
+  r->function = function;
+  r->stream_identifier = g_strdup (stream_identifier);
+  r->object_identifier = g_strdup (object_identifier);
+  return r;
+}
+
+static void
+request_free (struct request *r)
+{
+  switch (r->kind)
+    {
+    case REQUEST_STREAM_REGISTER:
+      g_free (r->stream_register.human_readable_name);
+      break;
+    case REQUEST_OBJECT_REGISTER:
+      g_free (r->object_register.human_readable_name);
+      break;
+    case REQUEST_OBJECT_TRANSFER_STATUS:
+      {
+	int i;
+	for (i = 0; i < r->transfer_status.files_count; i ++)
+	  g_free ((char *) r->transfer_status.files[i].filename);
+	g_free (r->transfer_status.files);
+	break;
+      }
+    default:
+      break;
     }
 
-  stream_deregister_local (wc, stream);
+  g_free (r->stream_identifier);
+  g_free (r->object_identifier);
+  g_free (r);
+}
 
-  return TRUE;
+static GType
+lookup_reply_type (void)
+{
+  static GType ass;
+  if (! ass)
+    ass = dbus_g_type_get_collection
+      ("GPtrArray",
+       dbus_g_type_get_struct ("GValueArray",
+			       G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID));
+  return ass;
 }
 
-gboolean
-gwoodchuck_object_register (GWoodchuck *wc,
-			    const char *stream_identifier,
-			    const char *object_identifier,
-			    const char *human_readable_name,
-			    int64_t expected_size,
-			    uint64_t expected_transfer_up,
-			    uint64_t expected_transfer_down,
-			    uint32_t transfer_frequency,
-			    GError **caller_error)
+static GType
+properties_type (void)
 {
-  GError *error = NULL;
-  struct object *stream = stream_lookup (wc, stream_identifier, &error);
+  static GType asv;
+  if (! asv)
+    asv = dbus_g_type_get_map ("GHashTable", G_TYPE_STRING, G_TYPE_VALUE);
+  return asv;
+}
+
+static void requests_pump (GWoodchuck *wc);
+static void request_reply (struct request *r);
+
+static void
+request_notify (DBusGProxy *proxy, DBusGProxyCall *call, gpointer user_data)
+{
+  request_reply (user_data);
+}
+
+/* The function to pass to dbus_g_proxy_begin_call.  A synchronous
+   request collects the reply itself.  */
+static DBusGProxyCallNotify
+request_notify_for (struct request *r)
+{
+  return r->sync ? NULL : request_notify;
+}
+
+/* R completed.  If ERROR is not NULL, R failed; we consume ERROR.  */
+static void
+request_finish (struct request *r, GError *error)
+{
+  GWoodchuck *wc = r->wc;
+
   if (error)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
+      g_prefix_error (&error, "%s: ", r->function);
       g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
     }
 
-  if (! stream)
+  if (r->sync)
     {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Stream '%s' is not registered.",
-		   __FUNCTION__, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      r->error = error;
+      r->done = TRUE;
+      return;
     }
 
+  if (r->callback)
+    r->callback (wc, error, r->user_data);
+  if (error)
+    g_error_free (error);
+  request_free (r);
+
+  wc->in_flight --;
+  requests_pump (wc);
+  g_object_unref (wc);
+}
+
+/* Make R's call.  STREAM is R's stream (NULL if R registers it).
+   OBJECT is R's object, if any.  */
+static void
+request_call (struct request *r, struct object *stream, struct object *object)
+{
   GHashTable *properties = g_hash_table_new (g_str_hash, g_str_equal);
 
   void adds (char *key, const char *value, GValue *gvalue)
@@ -828,139 +1286,838 @@ gwoodchuck_object_register (GWoodchuck *wc,
     g_hash_table_insert (properties, key, gvalue);
   }
 
-  GValue human_readable_name_value;
-  adds ("HumanReadableName", human_readable_name, &human_readable_name_value);
-  GValue cookie_value;
-  adds ("Cookie", object_identifier, &cookie_value);
-  GValue wakeup_value;
-  addu ("Wakeup", TRUE, &wakeup_value);
-
-  GValueArray *strct = g_value_array_new (4);
-
-  GValue url_value = { 0 };
-  g_value_init (&url_value, G_TYPE_STRING);
-  g_value_set_static_string (&url_value, "");
-  g_value_array_append (strct, &url_value);
-
-  GValue expected_size_value = { 0 };
-  g_value_init (&expected_size_value, G_TYPE_INT64);
-  g_value_set_int64 (&expected_size_value, expected_size);
-  g_value_array_append (strct, &expected_size_value);
-
-  GValue expected_transfer_up_value = { 0 };
-  g_value_init (&expected_transfer_up_value, G_TYPE_UINT64);
-  g_value_set_uint64 (&expected_transfer_up_value, expected_transfer_up);
-  g_value_array_append (strct, &expected_transfer_up_value);
-
-  GValue expected_transfer_down_value = { 0 };
-  g_value_init (&expected_transfer_down_value, G_TYPE_UINT64);
-  g_value_set_uint64 (&expected_transfer_down_value, expected_transfer_down);
-  g_value_array_append (strct, &expected_transfer_down_value);
-
-  GValue utility_value = { 0 };
-  g_value_init (&utility_value, G_TYPE_UINT);
-  g_value_set_uint (&utility_value, 1);
-  g_value_array_append (strct, &utility_value);
-
-  GValue use_simple_transferer_value = { 0 };
-  g_value_init (&use_simple_transferer_value, G_TYPE_BOOLEAN);
-  g_value_set_boolean (&use_simple_transferer_value, FALSE);
-  g_value_array_append (strct, &use_simple_transferer_value);
-
-  GPtrArray *versions = g_ptr_array_new ();
-  g_ptr_array_add (versions, strct);
-
-  static GType asxttub;
-  if (! asxttub)
-    asxttub = dbus_g_type_get_collection
-      ("GPtrArray",
-       dbus_g_type_get_struct ("GValueArray",
-			       G_TYPE_STRING, G_TYPE_INT64,
-			       G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT,
-			       G_TYPE_BOOLEAN, G_TYPE_INVALID));
+  r->state = REQUEST_CALL;
+
+  switch (r->kind)
+    {
+    case REQUEST_STREAM_REGISTER:
+      {
+	GValue human_readable_name_value;
+	adds ("HumanReadableName", r->stream_register.human_readable_name,
+	      &human_readable_name_value);
+	GValue cookie_value;
+	adds ("Cookie", r->stream_identifier, &cookie_value);
+	GValue freshness_value;
+	addu ("Freshness", r->stream_register.freshness, &freshness_value);
+
+	r->proxy = g_object_ref (r->wc->manager_proxy);
+	r->call = dbus_g_proxy_begin_call
+	  (r->proxy, "StreamRegister", request_notify_for (r), r, NULL,
+	   properties_type (), properties, G_TYPE_BOOLEAN, TRUE,
+	   G_TYPE_INVALID);
+	break;
+      }
 
-  GValue versions_value = { 0 };
-  g_value_init (&versions_value, asxttub);
-  g_value_set_boxed (&versions_value, versions);
+    case REQUEST_STREAM_UPDATE_STATUS:
+      r->proxy = g_object_ref (stream->proxy);
+      r->call = dbus_g_proxy_begin_call
+	(r->proxy, "UpdateStatus", request_notify_for (r), r, NULL,
+	 G_TYPE_UINT, r->update_status.status,
+	 G_TYPE_UINT, r->update_status.indicator_mask,
+	 G_TYPE_UINT64, r->update_status.transferred_up,
+	 G_TYPE_UINT64, r->update_status.transferred_down,
+	 G_TYPE_UINT64, r->update_status.start,
+	 G_TYPE_UINT, r->update_status.duration,
+	 G_TYPE_UINT, r->update_status.new_objects,
+	 G_TYPE_UINT, r->update_status.updated_objects,
+	 G_TYPE_UINT, r->update_status.objects_inline,
+	 G_TYPE_INVALID);
+      break;
+
+    case REQUEST_STREAM_UNREGISTER:
+      r->proxy = g_object_ref (stream->proxy);
+      r->call = dbus_g_proxy_begin_call
+	(r->proxy, "Unregister", request_notify_for (r), r, NULL,
+	 G_TYPE_BOOLEAN, FALSE, G_TYPE_INVALID);
+      break;
+
+    case REQUEST_OBJECT_REGISTER:
+      {
+	GValue human_readable_name_value;
+	adds ("HumanReadableName", r->object_register.human_readable_name,
+	      &human_readable_name_value);
+	GValue cookie_value;
+	adds ("Cookie", r->object_identifier, &cookie_value);
+	GValue wakeup_value;
+	addu ("Wakeup", TRUE, &wakeup_value);
+
+	GValueArray *strct = g_value_array_new (4);
+
+	GValue url_value = { 0 };
+	g_value_init (&url_value, G_TYPE_STRING);
+	g_value_set_static_string (&url_value, "");
+	g_value_array_append (strct, &url_value);
+
+	GValue expected_size_value = { 0 };
+	g_value_init (&expected_size_value, G_TYPE_INT64);
+	g_value_set_int64 (&expected_size_value,
+			   r->object_register.expected_size);
+	g_value_array_append (strct, &expected_size_value);
+
+	GValue expected_transfer_up_value = { 0 };
+	g_value_init (&expected_transfer_up_value, G_TYPE_UINT64);
+	g_value_set_uint64 (&expected_transfer_up_value,
+			    r->object_register.expected_transfer_up);
+	g_value_array_append (strct, &expected_transfer_up_value);
+
+	GValue expected_transfer_down_value = { 0 };
+	g_value_init (&expected_transfer_down_value, G_TYPE_UINT64);
+	g_value_set_uint64 (&expected_transfer_down_value,
+			    r->object_register.expected_transfer_down);
+	g_value_array_append (strct, &expected_transfer_down_value);
+
+	GValue utility_value = { 0 };
+	g_value_init (&utility_value, G_TYPE_UINT);
+	g_value_set_uint (&utility_value, 1);
+	g_value_array_append (strct, &utility_value);
+
+	GValue use_simple_transferer_value = { 0 };
+	g_value_init (&use_simple_transferer_value, G_TYPE_BOOLEAN);
+	g_value_set_boolean (&use_simple_transferer_value, FALSE);
+	g_value_array_append (strct, &use_simple_transferer_value);
+
+	GPtrArray *versions = g_ptr_array_new ();
+	g_ptr_array_add (versions, strct);
+
+	static GType asxttub;
+	if (! asxttub)
+	  asxttub = dbus_g_type_get_collection
+	    ("GPtrArray",
+	     dbus_g_type_get_struct ("GValueArray",
+				     G_TYPE_STRING, G_TYPE_INT64,
+				     G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT,
+				     G_TYPE_BOOLEAN, G_TYPE_INVALID));
+
+	GValue versions_value = { 0 };
+	g_value_init (&versions_value, asxttub);
+	g_value_set_static_boxed (&versions_value, versions);
+
+	g_hash_table_insert (properties, "Versions", &versions_value);
+
+	/* The arguments are marshalled immediately.  */
+	r->proxy = g_object_ref (stream->proxy);
+	r->call = dbus_g_proxy_begin_call
+	  (r->proxy, "ObjectRegister", request_notify_for (r), r, NULL,
+	   properties_type (), properties, G_TYPE_BOOLEAN, TRUE,
+	   G_TYPE_INVALID);
+
+	g_value_array_free (strct);
+	g_ptr_array_free (versions, TRUE);
+	break;
+      }
 
-  g_hash_table_insert (properties, "Versions", &versions_value);
+    case REQUEST_OBJECT_UNREGISTER:
+      r->proxy = g_object_ref (object->proxy);
+      r->call = dbus_g_proxy_begin_call
+	(r->proxy, "Unregister", request_notify_for (r), r, NULL,
+	 G_TYPE_INVALID);
+      break;
 
-  char *uuid = NULL;
-  gboolean ret = org_woodchuck_stream_object_register (stream->proxy,
-						       properties, TRUE,
-						       &uuid, &error);
+    case REQUEST_OBJECT_TRANSFER_STATUS:
+      {
+	static GType asbu;
+	if (! asbu)
+	  asbu = dbus_g_type_get_collection
+	    ("GPtrArray",
+	     dbus_g_type_get_struct ("GValueArray",
+				     G_TYPE_STRING, G_TYPE_BOOLEAN,
+				     G_TYPE_UINT, G_TYPE_INVALID));
+
+	struct gwoodchuck_object_transferred_file *files
+	  = r->transfer_status.files;
+	int files_count = r->transfer_status.files_count;
+
+	GPtrArray *files_ptr_array = g_ptr_array_new ();
+	int i;
+	for (i = 0; i < files_count; i ++)
+	  {
+	    GValueArray *strct = g_value_array_new (3);
+
+	    GValue *filename_value = alloca (sizeof (GValue));
+	    memset (filename_value, 0, sizeof (GValue));
+	    g_value_init (filename_value, G_TYPE_STRING);
+	    g_value_set_static_string (filename_value, files[i].filename);
+	    g_value_array_append (strct, filename_value);
+
+	    GValue *dedicated_value = alloca (sizeof (GValue));
+	    memset (dedicated_value, 0, sizeof (GValue));
+	    g_value_init (dedicated_value, G_TYPE_BOOLEAN);
+	    g_value_set_boolean (dedicated_value, files[i].dedicated);
+	    g_value_array_append (strct, dedicated_value);
+
+	    GValue *deletion_policy_value = alloca (sizeof (GValue));
+	    memset (deletion_policy_value, 0, sizeof (GValue));
+	    g_value_init (deletion_policy_value, G_TYPE_UINT);
+	    g_value_set_uint (deletion_policy_value,
+			      files[i].deletion_policy);
+	    g_value_array_append (strct, deletion_policy_value);
+
+	    g_ptr_array_add (files_ptr_array, strct);
+	  }
+
+	r->proxy = g_object_ref (object->proxy);
+	r->call = dbus_g_proxy_begin_call
+	  (r->proxy, "TransferStatus", request_notify_for (r), r, NULL,
+	   G_TYPE_UINT, r->transfer_status.status,
+	   G_TYPE_UINT, r->transfer_status.indicator_mask,
+	   G_TYPE_UINT64, r->transfer_status.transferred_up,
+	   G_TYPE_UINT64, r->transfer_status.transferred_down,
+	   G_TYPE_UINT64, r->transfer_status.transfer_time,
+	   G_TYPE_UINT, r->transfer_status.transfer_duration,
+	   G_TYPE_UINT64, r->transfer_status.object_size,
+	   asbu, files_ptr_array,
+	   G_TYPE_INVALID);
+
+	for (i = 0; i < files_count; i ++)
+	  g_value_array_free (g_ptr_array_index (files_ptr_array, i));
+	g_ptr_array_free (files_ptr_array, TRUE);
+	break;
+      }
+
+    case REQUEST_OBJECT_USED:
+      r->proxy = g_object_ref (object->proxy);
+      r->call = dbus_g_proxy_begin_call
+	(r->proxy, "Used", request_notify_for (r), r, NULL,
+	 G_TYPE_UINT64, r->used.start,
+	 G_TYPE_UINT64, r->used.duration,
+	 G_TYPE_UINT64, r->used.use_mask,
+	 G_TYPE_INVALID);
+      break;
+
+    case REQUEST_OBJECT_FILES_DELETED:
+      r->proxy = g_object_ref (object->proxy);
+      r->call = dbus_g_proxy_begin_call
+	(r->proxy, "FilesDeleted", request_notify_for (r), r, NULL,
+	 G_TYPE_UINT, r->files_deleted.response,
+	 G_TYPE_UINT64, r->files_deleted.arg,
+	 G_TYPE_INVALID);
+      break;
+    }
 
   g_hash_table_unref (properties);
-  g_value_array_free (strct);
-  g_ptr_array_free (versions, TRUE);
+}
 
-  if (! ret)
+/* Collect the reply to R's call, which was made on PROXY, and update
+   the local lookup tables.  */
+static gboolean
+request_end (struct request *r, DBusGProxy *proxy, DBusGProxyCall *call,
+	     GError **error)
+{
+  GWoodchuck *wc = r->wc;
+  struct object *stream;
+  struct object *object;
+
+  switch (r->kind)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+    case REQUEST_STREAM_REGISTER:
+    case REQUEST_OBJECT_REGISTER:
+      {
+	char *uuid = NULL;
+	if (! dbus_g_proxy_end_call (proxy, call, error,
+				     G_TYPE_STRING, &uuid, G_TYPE_INVALID))
+	  return FALSE;
+
+	g_static_mutex_lock (&wc->lock);
+	stream = g_hash_table_lookup (wc->stream_hash, r->stream_identifier);
+	if (r->kind == REQUEST_STREAM_REGISTER)
+	  {
+	    if (! stream)
+	      {
+		stream = stream_register_local
+		  (wc, NULL, uuid, r->stream_identifier,
+		   r->stream_register.human_readable_name);
+		/* The new stream is empty.  */
+		stream->complete = wc->prefetch;
+	      }
+	  }
+	else if (stream
+		 && ! g_hash_table_lookup (stream->hash, r->object_identifier))
+	  /* We'll likely soon report the object's status.  */
+	  object_register_local (wc, stream, uuid, r->object_identifier,
+				 r->object_register.human_readable_name);
+	g_static_mutex_unlock (&wc->lock);
+
+	g_free (uuid);
+	return TRUE;
+      }
 
-  return TRUE;
+    case REQUEST_STREAM_UNREGISTER:
+      if (! dbus_g_proxy_end_call (proxy, call, error, G_TYPE_INVALID))
+	return FALSE;
+
+      g_static_mutex_lock (&wc->lock);
+      stream = g_hash_table_lookup (wc->stream_hash, r->stream_identifier);
+      if (stream)
+	stream_deregister_local (wc, stream);
+      g_static_mutex_unlock (&wc->lock);
+      return TRUE;
+
+    case REQUEST_OBJECT_UNREGISTER:
+      if (! dbus_g_proxy_end_call (proxy, call, error, G_TYPE_INVALID))
+	return FALSE;
+
+      g_static_mutex_lock (&wc->lock);
+      stream = g_hash_table_lookup (wc->stream_hash, r->stream_identifier);
+      object = stream
+	? g_hash_table_lookup (stream->hash, r->object_identifier) : NULL;
+      if (object)
+	object_deregister_local (wc, stream, object);
+      g_static_mutex_unlock (&wc->lock);
+      return TRUE;
+
+    default:
+      return dbus_g_proxy_end_call (proxy, call, error, G_TYPE_INVALID);
+    }
 }
 
-gboolean
-gwoodchuck_object_unregister (GWoodchuck *wc,
-			      const char *stream_identifier,
-			      const char *object_identifier,
-			      GError **caller_error)
+/* Look up R's stream and object, querying murmeltier if they are not
+   in the local lookup tables, and then make R's call.  Either starts a
+   call or finishes R.  */
+static void
+request_step (struct request *r)
 {
+  GWoodchuck *wc = r->wc;
   GError *error = NULL;
-  struct object *stream = stream_lookup (wc, stream_identifier, &error);
-  if (error)
+
+  /* STREAM and OBJECT are only valid while we hold the lock.  */
+  g_static_mutex_lock (&wc->lock);
+
+  struct object *stream
+    = g_hash_table_lookup (wc->stream_hash, r->stream_identifier);
+  if (! stream)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      if (r->state < REQUEST_STREAM_LOOKUP && ! wc->streams_complete)
+	{
+	  r->state = REQUEST_STREAM_LOOKUP;
+	  r->proxy = g_object_ref (wc->manager_proxy);
+	  r->call = dbus_g_proxy_begin_call
+	    (r->proxy, "LookupStreamByCookie", request_notify_for (r), r, NULL,
+	     G_TYPE_STRING, r->stream_identifier, G_TYPE_INVALID);
+	  g_static_mutex_unlock (&wc->lock);
+	  return;
+	}
+
+      if (r->kind != REQUEST_STREAM_REGISTER)
+	{
+	  g_set_error (&error,
+		       G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
+		       "Stream '%s' is not registered.",
+		       r->stream_identifier);
+	  g_static_mutex_unlock (&wc->lock);
+	  request_finish (r, error);
+	  return;
+	}
+    }
+  else if (r->kind == REQUEST_STREAM_REGISTER)
+    /* We require that the identifier be unique.  */
+    {
+      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_OBJECT_EXISTS,
+		   "Register stream '%s': A stream ('%s') with "
+		   "identifier '%s' already exists.",
+		   r->stream_register.human_readable_name,
+		   stream->human_readable_name, r->stream_identifier);
+      g_static_mutex_unlock (&wc->lock);
+      request_finish (r, error);
+      return;
     }
 
-  if (! stream)
+  struct object *object = NULL;
+  if (r->object_identifier && r->kind != REQUEST_OBJECT_REGISTER)
     {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Stream '%s' is not registered.",
-		   __FUNCTION__, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      object = g_hash_table_lookup (stream->hash, r->object_identifier);
+      if (! object)
+	{
+	  if (r->state < REQUEST_OBJECT_LOOKUP && ! stream->complete)
+	    {
+	      r->state = REQUEST_OBJECT_LOOKUP;
+	      r->proxy = g_object_ref (stream->proxy);
+	      r->call = dbus_g_proxy_begin_call
+		(r->proxy, "LookupObjectByCookie", request_notify_for (r), r,
+		 NULL, G_TYPE_STRING, r->object_identifier, G_TYPE_INVALID);
+	      g_static_mutex_unlock (&wc->lock);
+	      return;
+	    }
+
+	  g_set_error (&error,
+		       G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
+		       "Object '%s' is not registered in stream '%s'.",
+		       r->object_identifier, r->stream_identifier);
+	  g_static_mutex_unlock (&wc->lock);
+	  request_finish (r, error);
+	  return;
+	}
     }
 
-  struct object *object = object_lookup (wc, stream, object_identifier, &error);
-  if (error)
+  request_call (r, stream, object);
+  g_static_mutex_unlock (&wc->lock);
+}
+
+/* Process the reply to R's outstanding call.  */
+static void
+request_reply (struct request *r)
+{
+  DBusGProxy *proxy = r->proxy;
+  DBusGProxyCall *call = r->call;
+  r->proxy = NULL;
+  r->call = NULL;
+
+  GError *error = NULL;
+  if (r->state == REQUEST_CALL)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      request_end (r, proxy, call, &error);
+      g_object_unref (proxy);
+      request_finish (r, error);
+      return;
     }
 
-  if (! object)
+  GPtrArray *objects = NULL;
+  if (dbus_g_proxy_end_call (proxy, call, &error,
+			     lookup_reply_type (), &objects, G_TYPE_INVALID))
     {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Object '%s' is not registered in stream '%s'.",
-		   __FUNCTION__, object_identifier, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
+      g_static_mutex_lock (&r->wc->lock);
+      if (r->state == REQUEST_STREAM_LOOKUP)
+	lookup_reply (r->wc, NULL, r->stream_identifier, objects, &error);
+      else
+	{
+	  /* The stream may have been dropped in the mean time.  If
+	     so, request_step reports that it does not exist.  */
+	  struct object *stream
+	    = g_hash_table_lookup (r->wc->stream_hash, r->stream_identifier);
+	  if (stream)
+	    lookup_reply (r->wc, stream, r->object_identifier, objects,
+			  &error);
+	}
+      g_static_mutex_unlock (&r->wc->lock);
 
-      return FALSE;
+      int i;
+      for (i = 0; i < objects->len; i ++)
+	g_value_array_free (g_ptr_array_index (objects, i));
+      g_ptr_array_free (objects, TRUE);
     }
+  g_object_unref (proxy);
+
+  if (error)
+    request_finish (r, error);
+  else
+    request_step (r);
+}
+
+/* Run R to completion using blocking calls and free it.  */
+static gboolean
+request_run (struct request *r, GError **error)
+{
+  r->sync = TRUE;
+
+  request_step (r);
+  while (! r->done)
+    request_reply (r);
+
+  gboolean ret = ! r->error;
+  if (r->error)
+    g_propagate_error (error, r->error);
+  request_free (r);
+
+  return ret;
+}
+
+/* Whether R's stream or object is not in the local lookup tables.
+   Then, starting R requires asking murmeltier or, if the tables are
+   complete, fails, unless a request before R registers it.  The
+   caller must hold the lock.  */
+static gboolean
+request_needs_lookup (struct request *r)
+{
+  GWoodchuck *wc = r->wc;
+
+  struct object *stream
+    = g_hash_table_lookup (wc->stream_hash, r->stream_identifier);
+  if (! stream)
+    return TRUE;
+
+  if (! r->object_identifier || r->kind == REQUEST_OBJECT_REGISTER)
+    return FALSE;
 
-  if (! org_woodchuck_object_unregister (object->proxy, &error))
+  return ! g_hash_table_lookup (stream->hash, r->object_identifier);
+}
+
+/* Start queued requests, in order, until REQUESTS_IN_FLIGHT are in
+   flight.  Requests are sent on the same connection and thus arrive
+   in order.  A request that has to look up its stream or object,
+   however, waits until the requests before it have completed: it
+   might refer to an object that one of them registers.  */
+static void
+requests_pump (GWoodchuck *wc)
+{
+  if (wc->pumping)
+    /* request_step finished a request, which called us.  */
+    return;
+
+  g_object_ref (wc);
+  wc->pumping = TRUE;
+
+  while (wc->in_flight < REQUESTS_IN_FLIGHT)
     {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
+      g_static_mutex_lock (&wc->lock);
+      struct request *r = g_queue_peek_head (&wc->requests);
+      if (r && wc->in_flight > 0 && request_needs_lookup (r))
+	r = NULL;
+      if (r)
+	g_queue_pop_head (&wc->requests);
+      g_static_mutex_unlock (&wc->lock);
+
+      if (! r)
+	break;
+
+      wc->in_flight ++;
+      request_step (r);
+    }
+
+  wc->pumping = FALSE;
+  g_object_unref (wc);
+}
+
+static gboolean
+requests_pump_idle (gpointer user_data)
+{
+  GWoodchuck *wc = user_data;
+
+  g_static_mutex_lock (&wc->lock);
+  wc->requests_pump_source = 0;
+  g_static_mutex_unlock (&wc->lock);
+
+  requests_pump (wc);
+  return FALSE;
+}
+
+/* Queue R.  When it completes, CALLBACK is called with USER_DATA.  */
+static void
+request_queue (struct request *r,
+	       gwoodchuck_ready_callback callback, gpointer user_data)
+{
+  GWoodchuck *wc = r->wc;
+
+  r->callback = callback;
+  r->user_data = user_data;
+
+  /* Each request holds a reference.  */
+  g_object_ref (wc);
+
+  g_static_mutex_lock (&wc->lock);
+  g_queue_push_tail (&wc->requests, r);
+
+  /* Start the requests from the main loop.  This way, CALLBACK is
+     never called before the function that queued R returns and
+     requests that are queued together are sent together.  */
+  if (! wc->requests_pump_source)
+    wc->requests_pump_source
+      = g_idle_add_full (G_PRIORITY_DEFAULT, requests_pump_idle,
+			 g_object_ref (wc), g_object_unref);
+  g_static_mutex_unlock (&wc->lock);
+}
+
+static struct request *
+stream_register_request (GWoodchuck *wc, const char *function,
+			 const char *identifier,
+			 const char *human_readable_name, uint32_t freshness)
+{
+  struct request *r = request_new (wc, REQUEST_STREAM_REGISTER, function,
+				   identifier, NULL);
+  r->stream_register.human_readable_name = g_strdup (human_readable_name);
+  r->stream_register.freshness = freshness;
+  return r;
+}
+
+gboolean
+gwoodchuck_stream_register (GWoodchuck *wc,
+			    const char *identifier,
+			    const char *human_readable_name, uint32_t freshness,
+			    GError **error)
+{
+  return request_run (stream_register_request (wc, __FUNCTION__, identifier,
+					       human_readable_name,
+					       freshness),
+		      error);
+}
+
+void
+gwoodchuck_stream_register_async (GWoodchuck *wc,
+				  const char *identifier,
+				  const char *human_readable_name,
+				  uint32_t freshness,
+				  gwoodchuck_ready_callback callback,
+				  gpointer user_data)
+{
+  request_queue (stream_register_request (wc, __FUNCTION__, identifier,
+					  human_readable_name, freshness),
+		 callback, user_data);
+}
+
+static struct request *
+stream_update_status_request (GWoodchuck *wc, const char *function,
+			      const char *stream_identifier,
+			      uint32_t status,
+			      uint32_t indicator_mask,
+			      uint64_t transferred_up,
+			      uint64_t transferred_down,
+			      uint64_t start,
+			      uint32_t duration,
+			      uint32_t new_objects,
+			      uint32_t updated_objects,
+			      uint32_t objects_inline)
+{
+  struct request *r = request_new (wc, REQUEST_STREAM_UPDATE_STATUS,
+				   function, stream_identifier, NULL);
+  r->update_status.status = status;
+  r->update_status.indicator_mask = indicator_mask;
+  r->update_status.transferred_up = transferred_up;
+  r->update_status.transferred_down = transferred_down;
+  r->update_status.start = start;
+  r->update_status.duration = duration;
+  r->update_status.new_objects = new_objects;
+  r->update_status.updated_objects = updated_objects;
+  r->update_status.objects_inline = objects_inline;
+  return r;
+}
+
+gboolean
+gwoodchuck_stream_updated_full (GWoodchuck *wc,
+				const char *stream_identifier,
+				uint32_t indicator_mask,
+				uint64_t transferred_up,
+				uint64_t transferred_down,
+				uint64_t start,
+				uint32_t duration,
+				uint32_t new_objects,
+				uint32_t updated_objects,
+				uint32_t objects_inline,
+				GError **error)
+{
+  return request_run (stream_update_status_request
+		      (wc, __FUNCTION__, stream_identifier, 0,
+		       indicator_mask, transferred_up, transferred_down,
+		       start, duration, new_objects, updated_objects,
+		       objects_inline),
+		      error);
+}
+
+void
+gwoodchuck_stream_updated_full_async (GWoodchuck *wc,
+				      const char *stream_identifier,
+				      uint32_t indicator_mask,
+				      uint64_t transferred_up,
+				      uint64_t transferred_down,
+				      uint64_t start,
+				      uint32_t duration,
+				      uint32_t new_objects,
+				      uint32_t updated_objects,
+				      uint32_t objects_inline,
+				      gwoodchuck_ready_callback callback,
+				      gpointer user_data)
+{
+  request_queue (stream_update_status_request
+		 (wc, __FUNCTION__, stream_identifier, 0,
+		  indicator_mask, transferred_up, transferred_down,
+		  start, duration, new_objects, updated_objects,
+		  objects_inline),
+		 callback, user_data);
+}
+
+gboolean
+gwoodchuck_stream_updated (GWoodchuck *wc,
+			   const char *stream_identifier,
+			   uint64_t transferred,
+			   uint32_t duration,
+			   uint32_t new_objects,
+			   uint32_t updated_objects,
+			   uint32_t objects_inline,
+			   GError **error)
+{
+  return gwoodchuck_stream_updated_full (wc, stream_identifier, 0,
+					 0, transferred,
+					 time (NULL) - duration, duration,
+					 new_objects, updated_objects,
+					 objects_inline, error);
+}
+
+void
+gwoodchuck_stream_updated_async (GWoodchuck *wc,
+				 const char *stream_identifier,
+				 uint64_t transferred,
+				 uint32_t duration,
+				 uint32_t new_objects,
+				 uint32_t updated_objects,
+				 uint32_t objects_inline,
+				 gwoodchuck_ready_callback callback,
+				 gpointer user_data)
+{
+  gwoodchuck_stream_updated_full_async (wc, stream_identifier, 0,
+					0, transferred,
+					time (NULL) - duration, duration,
+					new_objects, updated_objects,
+					objects_inline, callback, user_data);
+}
+
+gboolean
+gwoodchuck_stream_update_failed (GWoodchuck *wc,
+				 const char *stream_identifier,
+				 uint32_t reason,
+				 uint32_t transferred,
+				 GError **error)
+{
+  return request_run (stream_update_status_request
+		      (wc, __FUNCTION__, stream_identifier, reason,
+		       0, 0, transferred, time (NULL), 0, 0, 0, 0),
+		      error);
+}
+
+void
+gwoodchuck_stream_update_failed_async (GWoodchuck *wc,
+				       const char *stream_identifier,
+				       uint32_t reason,
+				       uint32_t transferred,
+				       gwoodchuck_ready_callback callback,
+				       gpointer user_data)
+{
+  request_queue (stream_update_status_request
+		 (wc, __FUNCTION__, stream_identifier, reason,
+		  0, 0, transferred, time (NULL), 0, 0, 0, 0),
+		 callback, user_data);
+}
+
+gboolean
+gwoodchuck_stream_unregister (GWoodchuck *wc, const char *identifier,
+			      GError **error)
+{
+  return request_run (request_new (wc, REQUEST_STREAM_UNREGISTER,
+				   __FUNCTION__, identifier, NULL),
+		      error);
+}
+
+void
+gwoodchuck_stream_unregister_async (GWoodchuck *wc, const char *identifier,
+				    gwoodchuck_ready_callback callback,
+				    gpointer user_data)
+{
+  request_queue (request_new (wc, REQUEST_STREAM_UNREGISTER,
+			      __FUNCTION__, identifier, NULL),
+		 callback, user_data);
+}
+
+static struct request *
+object_register_request (GWoodchuck *wc, const char *function,
+			 const char *stream_identifier,
+			 const char *object_identifier,
+			 const char *human_readable_name,
+			 int64_t expected_size,
+			 uint64_t expected_transfer_up,
+			 uint64_t expected_transfer_down,
+			 uint32_t transfer_frequency)
+{
+  struct request *r = request_new (wc, REQUEST_OBJECT_REGISTER, function,
+				   stream_identifier, object_identifier);
+  r->object_register.human_readable_name = g_strdup (human_readable_name);
+  r->object_register.expected_size = expected_size;
+  r->object_register.expected_transfer_up = expected_transfer_up;
+  r->object_register.expected_transfer_down = expected_transfer_down;
+  r->object_register.transfer_frequency = transfer_frequency;
+  return r;
+}
+
+gboolean
+gwoodchuck_object_register (GWoodchuck *wc,
+			    const char *stream_identifier,
+			    const char *object_identifier,
+			    const char *human_readable_name,
+			    int64_t expected_size,
+			    uint64_t expected_transfer_up,
+			    uint64_t expected_transfer_down,
+			    uint32_t transfer_frequency,
+			    GError **error)
+{
+  return request_run (object_register_request
+		      (wc, __FUNCTION__, stream_identifier, object_identifier,
+		       human_readable_name, expected_size,
+		       expected_transfer_up, expected_transfer_down,
+		       transfer_frequency),
+		      error);
+}
+
+void
+gwoodchuck_object_register_async (GWoodchuck *wc,
+				  const char *stream_identifier,
+				  const char *object_identifier,
+				  const char *human_readable_name,
+				  int64_t expected_size,
+				  uint64_t expected_transfer_up,
+				  uint64_t expected_transfer_down,
+				  uint32_t transfer_frequency,
+				  gwoodchuck_ready_callback callback,
+				  gpointer user_data)
+{
+  request_queue (object_register_request
+		 (wc, __FUNCTION__, stream_identifier, object_identifier,
+		  human_readable_name, expected_size,
+		  expected_transfer_up, expected_transfer_down,
+		  transfer_frequency),
+		 callback, user_data);
+}
+
+gboolean
+gwoodchuck_object_unregister (GWoodchuck *wc,
+			      const char *stream_identifier,
+			      const char *object_identifier,
+			      GError **error)
+{
+  return request_run (request_new (wc, REQUEST_OBJECT_UNREGISTER,
+				   __FUNCTION__,
+				   stream_identifier, object_identifier),
+		      error);
+}
+
+void
+gwoodchuck_object_unregister_async (GWoodchuck *wc,
+				    const char *stream_identifier,
+				    const char *object_identifier,
+				    gwoodchuck_ready_callback callback,
+				    gpointer user_data)
+{
+  request_queue (request_new (wc, REQUEST_OBJECT_UNREGISTER,
+			      __FUNCTION__,
+			      stream_identifier, object_identifier),
+		 callback, user_data);
+}
+
+static struct request *
+object_transfer_status_request
+  (GWoodchuck *wc, const char *function,
+   const char *stream_identifier, const char *object_identifier,
+   uint32_t status, uint32_t indicator_mask,
+   uint64_t transferred_up, uint64_t transferred_down,
+   uint64_t transfer_time, uint32_t transfer_duration, uint64_t object_size,
+   struct gwoodchuck_object_transferred_file *files, int files_count)
+{
+  struct request *r = request_new (wc, REQUEST_OBJECT_TRANSFER_STATUS,
+				   function,
+				   stream_identifier, object_identifier);
+  r->transfer_status.status = status;
+  r->transfer_status.indicator_mask = indicator_mask;
+  r->transfer_status.transferred_up = transferred_up;
+  r->transfer_status.transferred_down = transferred_down;
+  r->transfer_status.transfer_time = transfer_time;
+  r->transfer_status.transfer_duration = transfer_duration;
+  r->transfer_status.object_size = object_size;
+
+  r->transfer_status.files
+    = g_new (struct gwoodchuck_object_transferred_file, files_count);
+  r->transfer_status.files_count = files_count;
+  int i;
+  for (i = 0; i < files_count; i ++)
+    {
+      r->transfer_status.files[i] = files[i];
+      r->transfer_status.files[i].filename = g_strdup (files[i].filename);
     }
 
-  object_deregister_local (wc, stream, object);
-
-  return TRUE;
+  return r;
 }
 
 gboolean
@@ -969,75 +2126,30 @@ gwoodchuck_object_transferred_full
    uint32_t indicator_mask, uint64_t transferred_up, uint64_t transferred_down,
    uint64_t transfer_time, uint32_t transfer_duration, uint64_t object_size,
    struct gwoodchuck_object_transferred_file *files, int files_count,
-   GError **caller_error)
+   GError **error)
 {
-  GError *error = NULL;
-  struct object *object = object_find (wc, stream_identifier,
-				       object_identifier, &error);
-  if (error)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
-
-  if (! object)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Object '%s' is not registered in stream '%s'.",
-		   __FUNCTION__, object_identifier, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-
-      return FALSE;
-    }
-
-  GPtrArray *files_ptr_array = g_ptr_array_new ();
-  int i;
-  for (i = 0; i < files_count; i ++)
-    {
-      GValueArray *strct = g_value_array_new (3);
-
-      GValue *filename_value = alloca (sizeof (GValue));
-      memset (filename_value, 0, sizeof (GValue));
-      g_value_init (filename_value, G_TYPE_STRING);
-      g_value_set_static_string (filename_value, files[i].filename);
-      g_value_array_append (strct, filename_value);
-
-      GValue *dedicated_value = alloca (sizeof (GValue));
-      memset (dedicated_value, 0, sizeof (GValue));
-      g_value_init (dedicated_value, G_TYPE_BOOLEAN);
-      g_value_set_boolean (dedicated_value, files[i].dedicated);
-      g_value_array_append (strct, dedicated_value);
-
-      GValue *deletion_policy_value = alloca (sizeof (GValue));
-      memset (deletion_policy_value, 0, sizeof (GValue));
-      g_value_init (deletion_policy_value, G_TYPE_UINT);
-      g_value_set_uint (deletion_policy_value, files[i].deletion_policy);
-      g_value_array_append (strct, deletion_policy_value);
-
-      g_ptr_array_add (files_ptr_array, strct);
-    }
-
-  gboolean ret = org_woodchuck_object_transfer_status
-      (object->proxy, 0, indicator_mask, transferred_up, transferred_down,
-       transfer_time, transfer_duration, object_size, files_ptr_array,
-       &error);
-
-  for (i = 0; i < files_count; i ++)
-    g_value_array_free (g_ptr_array_index (files_ptr_array, i));
-  g_ptr_array_free (files_ptr_array, TRUE);
-
-  if (! ret)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+  return request_run (object_transfer_status_request
+		      (wc, __FUNCTION__, stream_identifier, object_identifier,
+		       0, indicator_mask, transferred_up, transferred_down,
+		       transfer_time, transfer_duration, object_size,
+		       files, files_count),
+		      error);
+}
 
-  return TRUE;
+void
+gwoodchuck_object_transferred_full_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint32_t indicator_mask, uint64_t transferred_up, uint64_t transferred_down,
+   uint64_t transfer_time, uint32_t transfer_duration, uint64_t object_size,
+   struct gwoodchuck_object_transferred_file *files, int files_count,
+   gwoodchuck_ready_callback callback, gpointer user_data)
+{
+  request_queue (object_transfer_status_request
+		 (wc, __FUNCTION__, stream_identifier, object_identifier,
+		  0, indicator_mask, transferred_up, transferred_down,
+		  transfer_time, transfer_duration, object_size,
+		  files, files_count),
+		 callback, user_data);
 }
 
 gboolean
@@ -1059,51 +2171,67 @@ gwoodchuck_object_transferred
      &file, 1, error);
 }
 
+void
+gwoodchuck_object_transferred_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   uint32_t indicator_mask, uint64_t object_size,
+   uint32_t transfer_duration, const char *filename,
+   uint32_t deletion_policy,
+   gwoodchuck_ready_callback callback, gpointer user_data)
+{
+  struct gwoodchuck_object_transferred_file file =
+    {
+      filename, TRUE, deletion_policy
+    };
+
+  gwoodchuck_object_transferred_full_async
+    (wc, stream_identifier, object_identifier,
+     indicator_mask, 0, object_size,
+     time (NULL) - transfer_duration, transfer_duration, object_size,
+     &file, 1, callback, user_data);
+}
+
 gboolean
 gwoodchuck_object_transfer_failed (GWoodchuck *wc,
 				   const char *stream_identifier,
 				   const char *object_identifier,
 				   uint32_t reason,
 				   uint32_t transferred,
-				   GError **caller_error)
+				   GError **error)
 {
-  GError *error = NULL;
-  struct object *object = object_find (wc,stream_identifier, object_identifier,
-				       &error);
-  if (error)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
-
-  if (! object)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Object '%s' is not registered in stream '%s'.",
-		   __FUNCTION__, object_identifier, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-
-      return FALSE;
-    }
-
-  GPtrArray *files_ptr_array = g_ptr_array_new ();
+  return request_run (object_transfer_status_request
+		      (wc, __FUNCTION__, stream_identifier, object_identifier,
+		       reason, 0, 0, transferred, time (NULL), 0, 0, NULL, 0),
+		      error);
+}
 
-  gboolean ret = org_woodchuck_object_transfer_status
-      (object->proxy, reason, 0, 0, transferred,
-       time (NULL), 0, 0, files_ptr_array, &error);
-  g_ptr_array_free (files_ptr_array, TRUE);
-  if (! ret)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+void
+gwoodchuck_object_transfer_failed_async (GWoodchuck *wc,
+					 const char *stream_identifier,
+					 const char *object_identifier,
+					 uint32_t reason,
+					 uint32_t transferred,
+					 gwoodchuck_ready_callback callback,
+					 gpointer user_data)
+{
+  request_queue (object_transfer_status_request
+		 (wc, __FUNCTION__, stream_identifier, object_identifier,
+		  reason, 0, 0, transferred, time (NULL), 0, 0, NULL, 0),
+		 callback, user_data);
+}
 
-  return TRUE;
+static struct request *
+object_used_request (GWoodchuck *wc, const char *function,
+		     const char *stream_identifier,
+		     const char *object_identifier,
+		     uint64_t start, uint64_t duration, uint64_t use_mask)
+{
+  struct request *r = request_new (wc, REQUEST_OBJECT_USED, function,
+				   stream_identifier, object_identifier);
+  r->used.start = start;
+  r->used.duration = duration;
+  r->used.use_mask = use_mask;
+  return r;
 }
 
 gboolean
@@ -1112,40 +2240,28 @@ gwoodchuck_object_used_full (GWoodchuck *wc,
 			     const char *object_identifier,
 			     uint64_t start, uint64_t duration,
 			     uint64_t use_mask,
-			     GError **caller_error)
+			     GError **error)
 {
-  GError *error = NULL;
-  struct object *object = object_find (wc, stream_identifier, object_identifier,
-				       &error);
-  if (error)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
-
-  if (! object)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Object '%s' is not registered in stream '%s'.",
-		   __FUNCTION__, object_identifier, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-
-      return FALSE;
-    }
-
-  if (! org_woodchuck_object_used (object->proxy, start, duration, use_mask,
-				   &error))
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+  return request_run (object_used_request (wc, __FUNCTION__,
+					   stream_identifier,
+					   object_identifier,
+					   start, duration, use_mask),
+		      error);
+}
 
-  return TRUE;
+void
+gwoodchuck_object_used_full_async (GWoodchuck *wc,
+				   const char *stream_identifier,
+				   const char *object_identifier,
+				   uint64_t start, uint64_t duration,
+				   uint64_t use_mask,
+				   gwoodchuck_ready_callback callback,
+				   gpointer user_data)
+{
+  request_queue (object_used_request (wc, __FUNCTION__,
+				      stream_identifier, object_identifier,
+				      start, duration, use_mask),
+		 callback, user_data);
 }
 
 gboolean
@@ -1159,48 +2275,60 @@ gwoodchuck_object_used (GWoodchuck *wc,
 				      now, now, -1, error);
 }
 
+void
+gwoodchuck_object_used_async (GWoodchuck *wc,
+			      const char *stream_identifier,
+			      const char *object_identifier,
+			      gwoodchuck_ready_callback callback,
+			      gpointer user_data)
+{
+  time_t now = time (NULL);
+  gwoodchuck_object_used_full_async (wc, stream_identifier,
+				     object_identifier, now, now, -1,
+				     callback, user_data);
+}
+
+static struct request *
+object_files_deleted_request (GWoodchuck *wc, const char *function,
+			      const char *stream_identifier,
+			      const char *object_identifier,
+			      enum woodchuck_deletion_response response,
+			      uint64_t arg)
+{
+  struct request *r = request_new (wc, REQUEST_OBJECT_FILES_DELETED,
+				   function,
+				   stream_identifier, object_identifier);
+  r->files_deleted.response = response;
+  r->files_deleted.arg = arg;
+  return r;
+}
+
 gboolean
 gwoodchuck_object_files_deleted (GWoodchuck *wc,
 				 const char *stream_identifier,
 				 const char *object_identifier,
 				 enum woodchuck_deletion_response response,
 				 uint64_t arg,
-				 GError **caller_error)
+				 GError **error)
 {
-  GError *error = NULL;
-  struct object *object = object_find (wc, stream_identifier, object_identifier,
-				       &error);
-  if (error)
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
-
-  if (! object)
-    {
-      g_set_error (&error, G_WOODCHUCK_ERROR, WOODCHUCK_ERROR_NO_SUCH_OBJECT,
-		   "%s: Object '%s' is not registered in stream '%s'.",
-		   __FUNCTION__, object_identifier, stream_identifier);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-
-      return FALSE;
-    }
-
-  if (! org_woodchuck_object_files_deleted
-      (object->proxy, response, arg, &error))
-    {
-      g_prefix_error (&error, "%s: ", __FUNCTION__);
-      g_critical ("%s", error->message);
-      g_propagate_error (caller_error, error);
-      return FALSE;
-    }
+  return request_run (object_files_deleted_request
+		      (wc, __FUNCTION__, stream_identifier, object_identifier,
+		       response, arg),
+		      error);
+}
 
-  return TRUE;
+void
+gwoodchuck_object_files_deleted_async
+  (GWoodchuck *wc, const char *stream_identifier, const char *object_identifier,
+   enum woodchuck_deletion_response response, uint64_t arg,
+   gwoodchuck_ready_callback callback, gpointer user_data)
+{
+  request_queue (object_files_deleted_request
+		 (wc, __FUNCTION__, stream_identifier, object_identifier,
+		  response, arg),
+		 callback, user_data);
 }
-
+
 /* Process upcalls.  */
 static gboolean
 org_woodchuck_upcall_object_transferred (GWoodchuck *wc,
@@ -1293,6 +2421,33 @@ org_woodchuck_upcall_object_transfer (GWoodchuck *wc,
   return FALSE;
 }
 
+static gboolean
+org_woodchuck_upcall_object_transfer_local_copy (GWoodchuck *wc,
+						 const char *manager_uuid,
+						 const char *manager_cookie,
+						 const char *stream_uuid,
+						 const char *stream_cookie,
+						 const char *object_uuid,
+						 const char *object_cookie,
+						 GValueArray *version_strct,
+						 const char *filename,
+						 uint32_t quality,
+						 const char *local_copy,
+						 GError **error)
+{
+  if (wc->vtable && wc->vtable->object_transfer_local_copy)
+    {
+      wc->vtable->object_transfer_local_copy (stream_cookie, object_cookie,
+					      quality, local_copy,
+					      wc->user_data);
+      return TRUE;
+    }
+
+  return org_woodchuck_upcall_object_transfer
+    (wc, manager_uuid, manager_cookie, stream_uuid, stream_cookie,
+     object_uuid, object_cookie, version_strct, filename, quality, error);
+}
+
 static gboolean
 org_woodchuck_upcall_object_delete_files (GWoodchuck *wc,
 					  const char *manager_uuid,
@@ -1318,27 +2473,328 @@ org_woodchuck_upcall_object_delete_files (GWoodchuck *wc,
 
       int64_t ret = wc->vtable->object_delete (stream_cookie, object_cookie,
 					       filenames, wc->user_data);
+      /* Don't block murmeltier's upcall on the reply.  */
       if (ret == 0)
-	gwoodchuck_object_files_deleted (wc, stream_cookie, object_cookie,
-					 WOODCHUCK_DELETE_DELETED, 0, error);
+	gwoodchuck_object_files_deleted_async
+	  (wc, stream_cookie, object_cookie,
+	   WOODCHUCK_DELETE_DELETED, 0, NULL, NULL);
       else if (ret > 0)
-	gwoodchuck_object_files_deleted (wc, stream_cookie, object_cookie,
-					 WOODCHUCK_DELETE_REFUSED, ret, error);
+	gwoodchuck_object_files_deleted_async
+	  (wc, stream_cookie, object_cookie,
+	   WOODCHUCK_DELETE_REFUSED, ret, NULL, NULL);
       else
-	gwoodchuck_object_files_deleted (wc, stream_cookie, object_cookie,
-					 WOODCHUCK_DELETE_COMPRESSED, -1 * ret,
-					 error);
+	gwoodchuck_object_files_deleted_async
+	  (wc, stream_cookie, object_cookie,
+	   WOODCHUCK_DELETE_COMPRESSED, -1 * ret, NULL, NULL);
 
       return TRUE;
     }
 
   return FALSE;
 }
+
+static gboolean
+org_woodchuck_upcall_object_files_compressed (GWoodchuck *wc,
+					      const char *manager_uuid,
+					      const char *manager_cookie,
+					      const char *stream_uuid,
+					      const char *stream_cookie,
+					      const char *object_uuid,
+					      const char *object_cookie,
+					      GPtrArray *files,
+					      uint64_t object_size,
+					      GError **error)
+{
+  if (wc->vtable && wc->vtable->object_files_compressed)
+    {
+      const char *filenames[files->len + 1];
+      const char *new_filenames[files->len + 1];
+      int i;
+      for (i = 0; i < files->len; i ++)
+	{
+	  GValueArray *strct = g_ptr_array_index (files, i);
+	  filenames[i] = g_value_get_string (g_value_array_get_nth (strct, 0));
+	  new_filenames[i]
+	    = g_value_get_string (g_value_array_get_nth (strct, 1));
+	}
+      filenames[i] = NULL;
+      new_filenames[i] = NULL;
+
+      wc->vtable->object_files_compressed (stream_cookie, object_cookie,
+					   filenames, new_filenames,
+					   object_size, wc->user_data);
+    }
+
+  /* The files were renamed whether or not the application cares.  */
+  return TRUE;
+}
 
 #ifdef GWOODCHUCK_TEST
+/* Have several threads register objects and report their status
+   concurrently while the main thread processes signals.  Return 0 on
+   success.  */
+static int
+concurrency_test (GWoodchuck *wc)
+{
+#define THREADS 4
+#define OBJECTS_PER_THREAD 8
+#define ITERATIONS 20
+
+  const char *stream_identifier = "http://example.org/concurrency.xml";
+
+  GError *error = NULL;
+  if (! gwoodchuck_stream_register (wc, stream_identifier, "Concurrency",
+				    0, &error))
+    {
+      if (error->code != WOODCHUCK_ERROR_OBJECT_EXISTS)
+	{
+	  fprintf (stderr, "gwoodchuck_stream_register(%s): %s\n",
+		   stream_identifier, error->message);
+	  g_error_free (error);
+	  return 1;
+	}
+      g_error_free (error);
+      error = NULL;
+    }
+
+  gint running = THREADS;
+  gint failed = 0;
+
+  gpointer worker (gpointer data)
+  {
+    int t = GPOINTER_TO_INT (data);
+    GError *error = NULL;
+
+    gboolean check (gboolean ret, const char *what, const char *object,
+		    int tolerate)
+    {
+      if (ret)
+	return TRUE;
+
+      if (error->code != tolerate)
+	{
+	  fprintf (stderr, "Thread %d: %s(%s): %s\n",
+		   t, what, object, error->message);
+	  g_atomic_int_set (&failed, 1);
+	}
+      g_error_free (error);
+      error = NULL;
+      return FALSE;
+    }
+
+    char objects[OBJECTS_PER_THREAD][32];
+    int i;
+    for (i = 0; i < OBJECTS_PER_THREAD; i ++)
+      {
+	snprintf (objects[i], sizeof (objects[i]), "%d-%d", t, i);
+	check (gwoodchuck_object_register (wc, stream_identifier, objects[i],
+					   objects[i], 1000, 0, 1000, 0,
+					   &error),
+	       "gwoodchuck_object_register", objects[i],
+	       WOODCHUCK_ERROR_OBJECT_EXISTS);
+      }
+
+    struct gwoodchuck_object_transferred_file file =
+      {
+	"/tmp/foo",
+	TRUE,
+	WOODCHUCK_DELETION_POLICY_DELETE_WITH_CONSULTATION
+      };
+
+    int k;
+    for (k = 0; k < ITERATIONS; k ++)
+      for (i = 0; i < OBJECTS_PER_THREAD; i ++)
+	{
+	  time_t now = time (NULL);
+	  check (gwoodchuck_object_transferred_full
+		 (wc, stream_identifier, objects[i], 0, 0, 1000, now, 1, 1000,
+		  &file, 1, &error),
+		 "gwoodchuck_object_transferred_full", objects[i], -1);
+	  check (gwoodchuck_object_used_full
+		 (wc, stream_identifier, objects[i], now, 1, -1, &error),
+		 "gwoodchuck_object_used_full", objects[i], -1);
+
+	  /* Also use an object of the next thread, which that thread
+	     may not have registered yet.  */
+	  char other[32];
+	  snprintf (other, sizeof (other), "%d-%d", (t + 1) % THREADS, i);
+	  check (gwoodchuck_object_used_full
+		 (wc, stream_identifier, other, now, 1, -1, &error),
+		 "gwoodchuck_object_used_full", other,
+		 WOODCHUCK_ERROR_NO_SUCH_OBJECT);
+	}
+
+    g_atomic_int_add (&running, -1);
+    return NULL;
+  }
+
+  GThread *threads[THREADS];
+  int t;
+  for (t = 0; t < THREADS; t ++)
+    threads[t] = g_thread_create (worker, GINT_TO_POINTER (t), TRUE, NULL);
+
+  while (g_atomic_int_get (&running) > 0)
+    if (! g_main_context_iteration (NULL, FALSE))
+      g_usleep (1000);
+
+  for (t = 0; t < THREADS; t ++)
+    g_thread_join (threads[t]);
+
+  if (! gwoodchuck_stream_unregister (wc, stream_identifier, &error))
+    {
+      fprintf (stderr, "gwoodchuck_stream_unregister(%s): %s\n",
+	       stream_identifier, error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  return g_atomic_int_get (&failed);
+}
+
+/* Queue more than REQUESTS_IN_FLIGHT asynchronous requests and check
+   that each callback is called exactly once, in the order in which
+   the requests were queued, and with the expected error.  Return 0 on
+   success.  */
+static int
+async_test (GWoodchuck *wc)
+{
+#define ASYNC_OBJECTS (2 * REQUESTS_IN_FLIGHT)
+
+  const char *stream_identifier = "http://example.org/async.xml";
+  /* Registered by the queued requests.  */
+  const char *new_stream_identifier = "http://example.org/async-new.xml";
+  const char *missing_stream_identifier
+    = "http://example.org/async-missing.xml";
+
+  /* Start from a clean slate.  */
+  GError *error = NULL;
+  const char *stale[] = { stream_identifier, new_stream_identifier };
+  int i;
+  for (i = 0; i < sizeof (stale) / sizeof (stale[0]); i ++)
+    if (! gwoodchuck_stream_unregister (wc, stale[i], &error))
+      {
+	if (error->code != WOODCHUCK_ERROR_NO_SUCH_OBJECT)
+	  {
+	    fprintf (stderr, "gwoodchuck_stream_unregister(%s): %s\n",
+		     stale[i], error->message);
+	    g_error_free (error);
+	    return 1;
+	  }
+	g_error_free (error);
+	error = NULL;
+      }
+
+  /* The expected error code of each request, 0 for success.  */
+  int expected[3 * ASYNC_OBJECTS + 16];
+  int queued = 0;
+  int completed = 0;
+  int failed = 0;
+
+  /* Returns the user data for the next request, which is expected to
+     complete with error code CODE.  */
+  gpointer expect (int code)
+  {
+    g_assert (queued < sizeof (expected) / sizeof (expected[0]));
+    expected[queued] = code;
+    return GINT_TO_POINTER (queued ++);
+  }
+
+  void ready (GWoodchuck *wc, const GError *error, gpointer user_data)
+  {
+    int i = GPOINTER_TO_INT (user_data);
+
+    if (i != completed)
+      {
+	fprintf (stderr, "async_test: Request %d completed, "
+		 "expected request %d to complete next.\n", i, completed);
+	failed = 1;
+      }
+    else if ((error ? error->code : 0) != expected[i])
+      {
+	fprintf (stderr, "async_test: Request %d: expected error %d, "
+		 "got %d (%s).\n",
+		 i, expected[i], error ? error->code : 0,
+		 error ? error->message : "success");
+	failed = 1;
+      }
+
+    completed ++;
+  }
+
+  gwoodchuck_stream_register_async (wc, stream_identifier, "Async", 0,
+				    ready, expect (0));
+  for (i = 0; i < ASYNC_OBJECTS; i ++)
+    {
+      char object[32];
+      snprintf (object, sizeof (object), "async-%d", i);
+
+      gwoodchuck_object_register_async (wc, stream_identifier, object,
+					object, 1000, 0, 1000, 0,
+					ready, expect (0));
+      gwoodchuck_object_transferred_async
+	(wc, stream_identifier, object, 0, 1000, 1, "/tmp/foo",
+	 WOODCHUCK_DELETION_POLICY_DELETE_WITH_CONSULTATION,
+	 ready, expect (0));
+      gwoodchuck_object_used_async (wc, stream_identifier, object,
+				    ready, expect (0));
+    }
+
+  /* The object register has to look up the stream, which the request
+     before it registers.  */
+  gwoodchuck_stream_register_async (wc, new_stream_identifier, "Async New",
+				    0, ready, expect (0));
+  gwoodchuck_object_register_async (wc, new_stream_identifier, "new",
+				    "new", 1000, 0, 1000, 0,
+				    ready, expect (0));
+  gwoodchuck_object_used_async (wc, new_stream_identifier, "new",
+				ready, expect (0));
+
+  /* Requests that fail.  */
+  gwoodchuck_object_used_async (wc, stream_identifier, "missing",
+				ready,
+				expect (WOODCHUCK_ERROR_NO_SUCH_OBJECT));
+  gwoodchuck_object_used_async (wc, missing_stream_identifier, "missing",
+				ready,
+				expect (WOODCHUCK_ERROR_NO_SUCH_OBJECT));
+  gwoodchuck_stream_register_async (wc, stream_identifier, "Async", 0,
+				    ready,
+				    expect (WOODCHUCK_ERROR_OBJECT_EXISTS));
+
+  gwoodchuck_stream_unregister_async (wc, new_stream_identifier,
+				      ready, expect (0));
+  gwoodchuck_stream_unregister_async (wc, stream_identifier,
+				      ready, expect (0));
+
+  if (completed)
+    {
+      fprintf (stderr, "async_test: A callback was called before the "
+	       "main loop ran.\n");
+      failed = 1;
+    }
+
+  time_t deadline = time (NULL) + 60;
+  while (completed < queued && time (NULL) < deadline)
+    if (! g_main_context_iteration (NULL, FALSE))
+      g_usleep (1000);
+  /* Catch callbacks that are called more than once.  */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  if (completed != queued)
+    {
+      fprintf (stderr, "async_test: %d requests queued, "
+	       "%d callbacks called.\n", queued, completed);
+      failed = 1;
+    }
+
+  return failed;
+}
+
 int
 main (int argc, char *argv[])
 {
+  g_thread_init (NULL);
+  dbus_g_thread_init ();
   g_type_init ();
 
   GError *error = NULL;
@@ -1549,6 +3005,9 @@ main (int argc, char *argv[])
 	}
     }
 
-  return 0;
+  if (concurrency_test (wc))
+    return 1;
+
+  return async_test (wc);
 }
 #endif
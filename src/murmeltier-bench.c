@@ -0,0 +1,1338 @@
+/* murmeltier-bench.c - Benchmarks for murmeltier's database queries.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <error.h>
+#include <sqlite3.h>
+
+#include "util.h"
+#include "debug.h"
+#include "murmeltier-schema.h"
+#include "murmeltier-queries.h"
+#include "murmeltier-dispatch.h"
+
+/* Return the current time in microseconds.  */
+static uint64_t
+now_us (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* Open an in-memory database with murmeltier's schema.  */
+static sqlite3 *
+db_open (void)
+{
+  sqlite3 *db = NULL;
+  if (sqlite3_open (":memory:", &db))
+    error (1, 0, "sqlite3_open: %s", sqlite3_errmsg (db));
+  if (murmeltier_schema_migrate (db))
+    error (1, 0, "Failed to create schema.");
+  return db;
+}
+
+static void
+db_exec (sqlite3 *db, const char *sql,
+	 int (*callback)(void*,int,char**,char**), void *cookie)
+{
+  char *errmsg = NULL;
+  sqlite3_exec (db, sql, callback, cookie, &errmsg);
+  if (errmsg)
+    error (1, 0, "%s: %s", sql, errmsg);
+}
+
+static int
+count_callback (void *cookie, int argc, char **argv, char **names)
+{
+  int *count = cookie;
+  ++ *count;
+  return 0;
+}
+
+/* Manager hierarchy: compare listing all descendents of the root
+   manager by walking the tree one query per manager to a single
+   recursive query.  */
+
+static void
+manager_tree_populate (sqlite3 *db, int depth, int fanout)
+{
+  db_exec (db,
+	   "begin transaction;"
+	   "insert into managers (uuid, parent_uuid, HumanReadableName, Cookie)"
+	   " values ('root', '', 'Root', 'root');",
+	   NULL, NULL);
+
+  int next = 0;
+  void add (const char *parent, int level)
+  {
+    if (level == depth)
+      return;
+
+    int i;
+    for (i = 0; i < fanout; i ++)
+      {
+	char *uuid = sqlite3_mprintf ("m%d", next ++);
+	char *sql = sqlite3_mprintf
+	  ("insert into managers (uuid, parent_uuid, HumanReadableName, Cookie)"
+	   " values (%Q, %Q, %Q, %Q);", uuid, parent, uuid, uuid);
+	db_exec (db, sql, NULL, NULL);
+	sqlite3_free (sql);
+
+	add (uuid, level + 1);
+	sqlite3_free (uuid);
+      }
+  }
+  add ("root", 0);
+
+  db_exec (db, "end transaction;", NULL, NULL);
+}
+
+static int
+manager_tree_walk (sqlite3 *db)
+{
+  /* This is the algorithm woodchuck_manager_list_managers uses when
+     recursive CTEs are not available.  */
+  int count = 0;
+  int size = 16;
+  char **uuids = malloc (sizeof (char *) * size);
+
+  int callback (void *cookie, int argc, char **argv, char **names)
+  {
+    if (count == size)
+      {
+	size *= 2;
+	uuids = realloc (uuids, sizeof (char *) * size);
+      }
+    uuids[count ++] = strdup (argv[0]);
+    return 0;
+  }
+
+  const char *manager = "root";
+  int i = 0;
+  for (;;)
+    {
+      char *sql = sqlite3_mprintf
+	("select uuid, Cookie, HumanReadableName, parent_uuid"
+	 " from managers where parent_uuid = %Q;", manager);
+      db_exec (db, sql, callback, NULL);
+      sqlite3_free (sql);
+
+      if (i >= count)
+	break;
+      manager = uuids[i ++];
+    }
+
+  for (i = 0; i < count; i ++)
+    free (uuids[i]);
+  free (uuids);
+
+  return count;
+}
+
+static int
+manager_tree_cte (sqlite3 *db)
+{
+  int count = 0;
+  db_exec (db,
+	   "with recursive"
+	   " descendents (uuid, Cookie, HumanReadableName, parent_uuid) as"
+	   " (select uuid, Cookie, HumanReadableName, parent_uuid"
+	   "   from managers where parent_uuid = 'root'"
+	   "  union all"
+	   "  select managers.uuid, managers.Cookie, managers.HumanReadableName,"
+	   "   managers.parent_uuid"
+	   "   from managers join descendents"
+	   "   on managers.parent_uuid = descendents.uuid)"
+	   " select uuid, Cookie, HumanReadableName, parent_uuid"
+	   " from descendents;",
+	   count_callback, &count);
+  return count;
+}
+
+static int
+bench_manager_tree (int iterations)
+{
+  struct
+  {
+    const char *name;
+    int depth;
+    int fanout;
+  } shapes[] =
+    {
+      { "deep", 1000, 1 },
+      { "deep", 5000, 1 },
+      { "wide", 1, 1000 },
+      { "wide", 1, 10000 },
+      { "bushy", 4, 10 },
+      { "bushy", 3, 30 },
+    };
+
+  printf ("%-6s %6s %6s %8s %12s %12s %8s\n",
+	  "shape", "depth", "fanout", "managers",
+	  "walk (us)", "cte (us)", "speedup");
+
+  int s;
+  for (s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s ++)
+    {
+      sqlite3 *db = db_open ();
+      manager_tree_populate (db, shapes[s].depth, shapes[s].fanout);
+
+      uint64_t walk = 0;
+      uint64_t cte = 0;
+      int walk_count = 0;
+      int cte_count = 0;
+      int i;
+      for (i = 0; i < iterations; i ++)
+	{
+	  uint64_t start = now_us ();
+	  walk_count = manager_tree_walk (db);
+	  walk += now_us () - start;
+
+	  start = now_us ();
+	  cte_count = manager_tree_cte (db);
+	  cte += now_us () - start;
+	}
+
+      if (walk_count != cte_count)
+	error (1, 0, "Walk found %d managers, but CTE found %d!",
+	       walk_count, cte_count);
+
+      printf ("%-6s %6d %6d %8d %12"PRIu64" %12"PRIu64" %7.1fx\n",
+	      shapes[s].name, shapes[s].depth, shapes[s].fanout, cte_count,
+	      walk / iterations, cte / iterations,
+	      cte ? (double) walk / cte : 0);
+
+      sqlite3_close (db);
+    }
+
+  return 0;
+}
+
+/* Query plans: check that the queries murmeltier issues use an index
+   and time them on databases with 1k, 10k and 100k objects.  The
+   queries are taken from murmeltier-queries.h.  Their arguments are
+   given by name and refer to an existing manager, stream, object,
+   etc.  */
+
+struct query
+{
+  /* Where murmeltier issues the query.  */
+  const char *name;
+  /* Tables that the query may scan in full, separated by spaces, or
+     NULL.  The scheduler's queries consider every enabled manager and
+     so necessarily scan the table that drives the join.  */
+  const char *may_scan;
+  /* A format from murmeltier-queries.h.  */
+  const char *sql;
+  /* The format's arguments, one per conversion.  An argument that
+     starts with a colon names a value (see query_arg); one that
+     starts with a quote and a colon names a value that is passed
+     quoted (for arguments that murmeltier quotes before formatting
+     the query).  Any other argument is used as is.  */
+  const char *args[12];
+};
+
+static const struct query queries[] =
+  {
+    { "do_schedule_worker: streams", "managers streams",
+      QUERY_SCHEDULE_STREAMS, { NULL } },
+    { "do_schedule_worker: stream bytes", NULL,
+      QUERY_SCHEDULE_STREAM_BYTES, { ":stream" } },
+    { "do_schedule_worker: objects", "managers streams objects",
+      QUERY_SCHEDULE_OBJECTS, { NULL } },
+    { "do_schedule_worker: version", NULL,
+      QUERY_SCHEDULE_OBJECT_VERSION, { ":object" } },
+    /* Reads the newest run using energy_runs_time_index.  */
+    { "energy_model_update: last run", "energy_runs",
+      QUERY_ENERGY_LAST_RUN, { NULL } },
+    { "energy_model_update: object bytes", NULL,
+      QUERY_ENERGY_BYTES, { "object_instance_status", ":then", ":now" } },
+    { "energy_model_update: stream bytes", NULL,
+      QUERY_ENERGY_BYTES, { "stream_updates", ":then", ":now" } },
+    { "energy_model_update: add", NULL,
+      QUERY_ENERGY_MODEL_ADD, { ":medium" } },
+    { "energy_model_update: sample", NULL,
+      QUERY_ENERGY_MODEL_SAMPLE,
+      { "1", "1", "1", "1", "1", "1", "1", "1", ":medium" } },
+    { "energy_model_update: model", NULL,
+      QUERY_ENERGY_MODEL, { ":medium" } },
+    { "energy_run_record", NULL,
+      QUERY_ENERGY_RUN_RECORD,
+      { ":now", ":medium", "1", "1000", "1", "NULL", "0" } },
+    { "energy_run_record: expire", NULL,
+      QUERY_ENERGY_RUNS_EXPIRE, { ":then" } },
+    { "feedback_deliver", NULL,
+      QUERY_FEEDBACK_OUTBOX, { ":manager", ":seq", "32" } },
+    { "feedback_subscribers_init", NULL,
+      QUERY_FEEDBACK_SUBSCRIBERS_STALE, { NULL } },
+    { "feedback_subscribers_sync: add", NULL,
+      QUERY_FEEDBACK_SUBSCRIBER_ADD, { ":subscriber", ":manager" } },
+    { "feedback_subscribers_sync: bus name", NULL,
+      QUERY_FEEDBACK_SUBSCRIBER_BUS_NAME,
+      { ":bus_name", ":subscriber", ":manager" } },
+    { "feedback_subscribers_sync: acked", NULL,
+      QUERY_FEEDBACK_SUBSCRIBER_ACKED, { ":subscriber", ":manager" } },
+    { "feedback_subscribers_sync: remove", NULL,
+      QUERY_FEEDBACK_SUBSCRIBER_REMOVE, { ":subscriber", ":manager" } },
+    { "feedback_subscribers_sync: trim", NULL,
+      QUERY_FEEDBACK_OUTBOX_TRIM, { ":manager", ":manager", ":manager" } },
+    { "feedback_queue: expire", NULL,
+      QUERY_FEEDBACK_OUTBOX_EXPIRE,
+      { ":manager", "604800", ":manager", "1000" } },
+    { "feedback_ack", NULL,
+      QUERY_FEEDBACK_ACK,
+      { ":object", ":manager", "1", ":bus_name", ":manager" } },
+    /* content_hash_salt has a single row.  */
+    { "content_hash_worker: salt", "content_hash_salt",
+      QUERY_CONTENT_HASH_SALT, { NULL } },
+    { "content_hash_worker: unhashed", NULL,
+      QUERY_CONTENT_HASH_UNHASHED, { "32" } },
+    { "content_hash_worker: set", NULL,
+      QUERY_CONTENT_HASH_SET,
+      { "h", "1000", "1", ":object", "0", ":filename" } },
+    { "local_copy_lookup", NULL,
+      QUERY_LOCAL_COPY_LOOKUP, { ":url", ":object" } },
+    { "disk_usage_update: objects", NULL,
+      QUERY_DISK_USAGE_OBJECTS, { ":disk_usage_where" } },
+    { "disk_usage_update", NULL,
+      QUERY_DISK_USAGE_UPDATE, { "1000", ":disk_usage_where" } },
+    { "disk_usage_changed", NULL,
+      QUERY_DISK_USAGE_CHANGED, { ":object" } },
+    { "disk_usage_worker: unsized", NULL,
+      QUERY_DISK_USAGE_UNSIZED, { "256" } },
+    { "disk_usage_worker: set size", NULL,
+      QUERY_DISK_USAGE_SET_SIZE, { "1000", ":object", "0", ":filename" } },
+    /* Considers every object.  */
+    { "cold_objects_worker", "streams object_instance_status",
+      QUERY_COLD_OBJECTS,
+      { "65536", ":now", ":then", ":then", ":then", "0", "16" } },
+    { "cold_objects_worker: files", NULL,
+      QUERY_COLD_OBJECT_FILES, { ":object", "0" } },
+    { "object_register: uuid exists", NULL,
+      QUERY_UUID_EXISTS, { "objects", ":object" } },
+    { "object_register: unique cookie", NULL,
+      QUERY_REGISTER_UNIQUE,
+      { "objects", "", "bench-new", ":stream", "", "objects", ":stream",
+	":cookie" } },
+    { "lookup_by: objects", NULL,
+      QUERY_LOOKUP_BY_PARENT,
+      { "uuid, HumanReadableName", "objects", "Cookie", ":cookie",
+	":stream" } },
+    { "lookup_by: objects, global", NULL,
+      QUERY_LOOKUP_BY,
+      { "uuid, HumanReadableName, parent_uuid", "objects", "Cookie",
+	":cookie" } },
+#ifdef HAVE_SQLITE_RECURSIVE_CTE
+    { "lookup_by: managers, recursive", "descendents",
+      QUERY_LOOKUP_BY_MANAGER_RECURSIVE,
+      { ":manager", "uuid, HumanReadableName, parent_uuid", "Cookie",
+	":child_manager" } },
+    { "lookup_by: streams, recursive", "descendents",
+      QUERY_LOOKUP_BY_STREAM_RECURSIVE,
+      { ":manager", "uuid, HumanReadableName, parent_uuid", "streams",
+	"Cookie", ":stream", ":manager" } },
+    { "list_managers: recursive", "descendents",
+      QUERY_LIST_MANAGERS_RECURSIVE, { ":manager" } },
+#endif
+    { "list_managers", NULL,
+      QUERY_LIST_MANAGERS, { ":manager" } },
+    { "list_streams", NULL,
+      QUERY_LIST_STREAMS, { ":manager" } },
+    { "list_objects", NULL,
+      QUERY_LIST_OBJECTS, { ":stream" } },
+    { "list_streams_from", NULL,
+      QUERY_LIST_PAGE, { "streams", ":manager", ":stream_cursor", "1001" } },
+    { "list_objects_from", NULL,
+      QUERY_LIST_PAGE, { "objects", ":stream", ":object_cursor", "1001" } },
+    { "stream_updated: instance", NULL,
+      QUERY_STREAM_INSTANCE, { "':stream" } },
+    { "object_transferred: instance", NULL,
+      QUERY_OBJECT_INSTANCE, { "':object" } },
+    { "object_files_deleted", NULL,
+      QUERY_FILES_DELETED, { "deleted = 1", "':object", "':object" } },
+    { "property_get", NULL,
+      QUERY_PROPERTY_GET, { "HumanReadableName", "objects", ":object" } },
+    { "property_get: stream LastUpdate", NULL,
+      QUERY_PROPERTY_GET,
+      { QUERY_STREAM_LAST_UPDATE_TIME, "streams", ":stream" } },
+    { "property_get: object LastTransfer", NULL,
+      QUERY_PROPERTY_GET,
+      { QUERY_OBJECT_LAST_TRANSFER_TIME, "objects", ":object" } },
+    { "property_get_all: object", NULL,
+      QUERY_PROPERTY_GET,
+      { "HumanReadableName, Cookie, Filename, Wakeup,"
+	" TriggerTarget, TriggerEarliest, TriggerLatest, TransferFrequency,"
+	" DontTransfer, NeedUpdate, Priority, DiscoveryTime, PublicationTime,"
+	" RegistrationTime, parent_uuid, Instance, "
+	QUERY_OBJECT_LAST_TRANSFER_TIME ", "
+	QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_TIME ", "
+	QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_STATUS ", DiskUsage",
+	"objects", ":object" } },
+    { "object_unregister: exists", NULL,
+      QUERY_UNREGISTER_EXISTS, { "objects", "':object" } },
+    { "object_unregister: descendents", NULL,
+      QUERY_UNREGISTER_CHILDREN, { "objects", "':stream" } },
+    /* woodchuck_object_unregister's secondary tables.  */
+    { "object_unregister: versions", NULL,
+      QUERY_UNREGISTER_DELETE, { "object_versions", "':object" } },
+    { "object_unregister: status", NULL,
+      QUERY_UNREGISTER_DELETE, { "object_instance_status", "':object" } },
+    { "object_unregister: files", NULL,
+      QUERY_UNREGISTER_DELETE, { "object_instance_files", "':object" } },
+    { "object_unregister: use", NULL,
+      QUERY_UNREGISTER_DELETE, { "object_use", "':object" } },
+    { "object_unregister: feedback", NULL,
+      QUERY_UNREGISTER_DELETE, { "feedback_outbox", "':object" } },
+    /* woodchuck_stream_unregister's secondary and child tables.  */
+    { "object_unregister: stream updates", NULL,
+      QUERY_UNREGISTER_DELETE, { "stream_updates", "':stream" } },
+    { "object_unregister: child objects", NULL,
+      QUERY_UNREGISTER_DELETE_CHILDREN, { "objects", "':stream" } },
+    { "object_unregister: child versions", NULL,
+      QUERY_UNREGISTER_DELETE_CHILDREN, { "object_versions", "':stream" } },
+    { "object_unregister: child status", NULL,
+      QUERY_UNREGISTER_DELETE_CHILDREN,
+      { "object_instance_status", "':stream" } },
+    { "object_unregister: child files", NULL,
+      QUERY_UNREGISTER_DELETE_CHILDREN,
+      { "object_instance_files", "':stream" } },
+    { "object_unregister: child use", NULL,
+      QUERY_UNREGISTER_DELETE_CHILDREN, { "object_use", "':stream" } },
+    /* unregister_reap_tables.  */
+#define REAP(table, parent, may_scan)				\
+    { "unregister_reap: " table, may_scan,				\
+      QUERY_UNREGISTER_REAP, { table, table, "'" parent, "200" } }
+    /* There are few managers and subscribers; SQLite prefers scanning
+       them to looking up each row.  */
+    REAP ("managers", ":manager", "managers"),
+    REAP ("streams", ":manager", NULL),
+    REAP ("stream_updates", ":manager", NULL),
+    REAP ("objects", ":stream", NULL),
+    REAP ("object_versions", ":stream", NULL),
+    REAP ("object_instance_status", ":stream", NULL),
+    REAP ("object_instance_files", ":stream", NULL),
+    REAP ("object_use", ":stream", NULL),
+    REAP ("feedback_outbox", ":manager", NULL),
+    REAP ("feedback_subscribers", ":manager", "feedback_subscribers"),
+    REAP ("space_reclaimed", ":manager", NULL),
+#undef REAP
+  };
+
+/* Populate DB with OBJECTS objects spread over 100 streams, which
+   belong to 30 managers (10 top-level managers with two children
+   each).  Each object has a version, a status, a file, a use record
+   and an entry in the feedback outbox.  Each stream has 10 updates.
+   Each manager has two feedback subscribers.  There are 1000 energy
+   runs.  */
+static void
+query_plans_populate (sqlite3 *db, int objects)
+{
+  db_exec (db, "begin transaction;", NULL, NULL);
+
+  int i;
+  for (i = 0; i < 30; i ++)
+    {
+      char parent[16] = "";
+      if (i >= 10)
+	snprintf (parent, sizeof (parent), "m%d", i % 10);
+
+      char *sql = sqlite3_mprintf
+	("insert into managers (uuid, parent_uuid, HumanReadableName, Cookie)"
+	 " values ('m%d', '%s', 'Manager %d', 'm%d');"
+	 "insert into feedback_subscribers"
+	 " (subscriber, parent_uuid, bus_name, acked)"
+	 " values ('org.example.app%d', 'm%d', ':1.%d', 0),"
+	 "  (':1.%d', 'm%d', ':1.%d', 0);",
+	 i, parent, i, i, i, i, i, 100 + i, i, 100 + i);
+      db_exec (db, sql, NULL, NULL);
+      sqlite3_free (sql);
+    }
+
+  const int streams = 100;
+  for (i = 0; i < streams; i ++)
+    {
+      char *sql = sqlite3_mprintf
+	("insert into streams"
+	 " (uuid, parent_uuid, HumanReadableName, Cookie, instance, Freshness)"
+	 " values ('s%d', 'm%d', 'Stream %d', 's%d', 10, 3600);",
+	 i, i % 30, i, i);
+      db_exec (db, sql, NULL, NULL);
+      sqlite3_free (sql);
+
+      int j;
+      for (j = 0; j < 10; j ++)
+	{
+	  sql = sqlite3_mprintf
+	    ("insert into stream_updates"
+	     " (uuid, instance, parent_uuid, status, transfer_time)"
+	     " values ('s%d', %d, 'm%d', 0, %d);",
+	     i, j, i % 30, j);
+	  db_exec (db, sql, NULL, NULL);
+	  sqlite3_free (sql);
+	}
+    }
+
+  for (i = 0; i < 1000; i ++)
+    {
+      char *sql = sqlite3_mprintf
+	("insert into energy_runs"
+	 " (time, medium, transfers, expected_bytes, estimated_joules,"
+	 "  battery_mj, deferred)"
+	 " values (%d, '%s', 1, 1000, 1, 1000000, 0);",
+	 i * 600, i % 2 ? "wifi" : "cellular");
+      db_exec (db, sql, NULL, NULL);
+      sqlite3_free (sql);
+    }
+  db_exec (db,
+	   "insert into energy_model (medium) values ('wifi');"
+	   "insert into energy_model (medium) values ('cellular');",
+	   NULL, NULL);
+
+  sqlite3_stmt *stmts[6];
+  const char *inserts[] =
+    {
+      "insert into objects"
+      " (uuid, parent_uuid, HumanReadableName, Cookie, Instance,"
+      "  TransferFrequency)"
+      " values (?1, ?2, ?1, ?1, 1, 86400);",
+      "insert into object_versions"
+      " (uuid, version, parent_uuid, url, expected_size, utility)"
+      " values (?1, 0, ?2, 'http://example.org/' || ?1, 1000, 1);",
+      "insert into object_instance_status"
+      " (uuid, instance, parent_uuid, status, transfer_time, object_size)"
+      " values (?1, 0, ?2, 0, 1, ?4);",
+      "insert into object_instance_files"
+      " (uuid, instance, parent_uuid, filename, dedicated, deletion_policy,"
+      "  content_hash, hashed_size, hashed_mtime, size)"
+      " values (?1, 0, ?2, '/tmp/' || ?1, 1, 0, 'h' || ?1, ?4, 1, ?4);",
+      "insert into object_use"
+      " (uuid, instance, parent_uuid, reported, start, duration, use_mask)"
+      " values (?1, 0, ?2, 1, 1, 1, 1);",
+      "insert into feedback_outbox"
+      " (uuid, instance, parent_uuid, stream_uuid, status)"
+      " values (?1, 0, ?3, ?2, 0);",
+    };
+  int j;
+  for (j = 0; j < sizeof (inserts) / sizeof (inserts[0]); j ++)
+    if (sqlite3_prepare_v2 (db, inserts[j], -1, &stmts[j], NULL))
+      error (1, 0, "%s: %s", inserts[j], sqlite3_errmsg (db));
+
+  for (i = 0; i < objects; i ++)
+    {
+      char uuid[16];
+      char stream[16];
+      char manager[16];
+      snprintf (uuid, sizeof (uuid), "o%d", i);
+      snprintf (stream, sizeof (stream), "s%d", i % streams);
+      snprintf (manager, sizeof (manager), "m%d", i % streams % 30);
+
+      for (j = 0; j < sizeof (inserts) / sizeof (inserts[0]); j ++)
+	{
+	  sqlite3_bind_text (stmts[j], 1, uuid, -1, SQLITE_TRANSIENT);
+	  sqlite3_bind_text (stmts[j], 2, stream, -1, SQLITE_TRANSIENT);
+	  if (sqlite3_bind_parameter_count (stmts[j]) >= 3)
+	    sqlite3_bind_text (stmts[j], 3, manager, -1, SQLITE_TRANSIENT);
+	  if (sqlite3_bind_parameter_count (stmts[j]) >= 4)
+	    sqlite3_bind_int (stmts[j], 4, 1000 + i);
+	  if (sqlite3_step (stmts[j]) != SQLITE_DONE)
+	    error (1, 0, "%s: %s", inserts[j], sqlite3_errmsg (db));
+	  sqlite3_reset (stmts[j]);
+	}
+    }
+
+  for (j = 0; j < sizeof (inserts) / sizeof (inserts[0]); j ++)
+    sqlite3_finalize (stmts[j]);
+
+  db_exec (db, "end transaction; analyze;", NULL, NULL);
+}
+
+/* Return the value of the query argument ARG (see struct query) for a
+   database with OBJECTS objects.  The caller must free it using
+   sqlite3_free.  */
+static char *
+query_arg (const char *arg, int objects)
+{
+  if (arg[0] != ':')
+    return sqlite3_mprintf ("%s", arg);
+  arg ++;
+
+  /* OBJECT is in the middle of the collection.  */
+  char object[16];
+  snprintf (object, sizeof (object), "o%d", objects / 2);
+
+  if (strcmp (arg, "disk_usage_where") == 0)
+    {
+      char *filename = sqlite3_mprintf ("/tmp/%s", object);
+      char *where = sqlite3_mprintf (QUERY_DISK_USAGE_WHERE,
+				     filename, (int64_t) 1000, filename);
+      sqlite3_free (filename);
+      return where;
+    }
+
+  struct
+  {
+    const char *name;
+    const char *value;
+  } values[] =
+    {
+      { "manager", "m1" },
+      /* A child of MANAGER.  */
+      { "child_manager", "m11" },
+      /* The stream of OBJECT.  */
+      { "stream", "s0" },
+      { "object", object },
+      { "cookie", object },
+      /* Continue listing MANAGER's streams (s1, s31, s61 and s91)
+	 and STREAM's objects from the middle.  */
+      { "stream_cursor", "s31" },
+      { "object_cursor", object },
+      { "subscriber", "org.example.app1" },
+      { "bus_name", ":1.1" },
+      { "seq", "0" },
+      { "medium", "cellular" },
+      { "now", "600000" },
+      { "then", "300000" },
+    };
+
+  int i;
+  for (i = 0; i < sizeof (values) / sizeof (values[0]); i ++)
+    if (strcmp (arg, values[i].name) == 0)
+      return sqlite3_mprintf ("%s", values[i].value);
+
+  if (strcmp (arg, "url") == 0)
+    return sqlite3_mprintf ("http://example.org/%s", object);
+  if (strcmp (arg, "filename") == 0)
+    return sqlite3_mprintf ("/tmp/%s", object);
+
+  error (1, 0, "Unknown query argument: %s", arg);
+  return NULL;
+}
+
+/* Return QUERY's SQL for a database with OBJECTS objects.  Each
+   conversion in the format is replaced by the corresponding argument:
+   quoted for %Q, escaped for %q and as is otherwise.  The caller must
+   free the result using sqlite3_free.  */
+static char *
+query_sql (const struct query *query, int objects)
+{
+  char *sql = NULL;
+  size_t sql_len = 0;
+  FILE *f = open_memstream (&sql, &sql_len);
+
+  int arg = 0;
+  const char *p;
+  for (p = query->sql; *p; p ++)
+    {
+      if (*p != '%')
+	{
+	  fputc (*p, f);
+	  continue;
+	}
+
+      p ++;
+      if (*p == '%')
+	{
+	  fputc ('%', f);
+	  continue;
+	}
+
+      /* Skip the flags, the width, the precision and the length.  */
+      p += strspn (p, "-+ #0123456789.hljztL");
+
+      if (arg >= sizeof (query->args) / sizeof (query->args[0])
+	  || ! query->args[arg])
+	error (1, 0, "%s: Too few arguments", query->name);
+
+      const char *a = query->args[arg ++];
+      bool quote = *a == '\'';
+      char *value = query_arg (quote ? a + 1 : a, objects);
+
+      char *s;
+      if (*p == 'Q' || quote)
+	s = sqlite3_mprintf ("%Q", value);
+      else if (*p == 'q')
+	s = sqlite3_mprintf ("%q", value);
+      else
+	s = sqlite3_mprintf ("%s", value);
+      fputs (s, f);
+      sqlite3_free (s);
+      sqlite3_free (value);
+    }
+
+  if (arg < sizeof (query->args) / sizeof (query->args[0])
+      && query->args[arg])
+    error (1, 0, "%s: Too many arguments", query->name);
+
+  fclose (f);
+
+  char *result = sqlite3_mprintf ("%s", sql);
+  free (sql);
+  return result;
+}
+
+/* Return whether TABLE is one of the space separated words in
+   LIST.  */
+static bool
+word_in (const char *list, const char *table, int table_len)
+{
+  while (list && *list)
+    {
+      const char *end = strchrnul (list, ' ');
+      if (end - list == table_len && strncmp (list, table, table_len) == 0)
+	return true;
+      list = *end ? end + 1 : end;
+    }
+  return false;
+}
+
+/* Print the plan for QUERY.  Return the number of full table scans
+   that QUERY may not do.  */
+static int
+query_plan_check (sqlite3 *db, const struct query *query, int objects)
+{
+  char *query_text = query_sql (query, objects);
+  char *sql = sqlite3_mprintf ("explain query plan %s", query_text);
+  sqlite3_free (query_text);
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL))
+    error (1, 0, "%s: %s", sql, sqlite3_errmsg (db));
+  sqlite3_free (sql);
+
+  int bad = 0;
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      /* The detail is the last column.  */
+      const char *detail = (const char *) sqlite3_column_text
+	(stmt, sqlite3_column_count (stmt) - 1);
+
+      /* Older versions of SQLite say "SCAN TABLE foo", newer versions
+	 "SCAN foo".  "SCAN CONSTANT ROW" is not a table scan and
+	 neither is a scan of a subquery's result, "SCAN (subquery-1)".  */
+      bool scan = false;
+      if (strncmp (detail, "SCAN ", 5) == 0
+	  && strncmp (detail, "SCAN CONSTANT ROW", 17) != 0)
+	{
+	  const char *table = detail + 5;
+	  if (strncmp (table, "TABLE ", 6) == 0)
+	    table += 6;
+	  int len = strcspn (table, " ");
+	  if (*table != '(' && ! word_in (query->may_scan, table, len))
+	    scan = true;
+	}
+
+      printf ("    %s%s\n", detail, scan ? "  <-- FULL SCAN" : "");
+      bad += scan;
+    }
+  sqlite3_finalize (stmt);
+
+  return bad;
+}
+
+/* Return the average time to execute QUERY in microseconds.  Any
+   changes are rolled back.  */
+static uint64_t
+query_time (sqlite3 *db, const struct query *query, int objects,
+	    int iterations)
+{
+  char *sql = query_sql (query, objects);
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL))
+    error (1, 0, "%s: %s", sql, sqlite3_errmsg (db));
+
+  db_exec (db, "begin transaction;", NULL, NULL);
+
+  uint64_t start = now_us ();
+  int i;
+  for (i = 0; i < iterations; i ++)
+    {
+      int err;
+      while ((err = sqlite3_step (stmt)) == SQLITE_ROW)
+	;
+      if (err != SQLITE_DONE)
+	error (1, 0, "%s: %s", sql, sqlite3_errmsg (db));
+      sqlite3_reset (stmt);
+    }
+  uint64_t elapsed = now_us () - start;
+
+  db_exec (db, "rollback transaction;", NULL, NULL);
+  sqlite3_finalize (stmt);
+  sqlite3_free (sql);
+
+  return elapsed / iterations;
+}
+
+static int
+bench_query_plans (int iterations)
+{
+  int sizes[] = { 1000, 10000, 100000 };
+  int query_count = sizeof (queries) / sizeof (queries[0]);
+  uint64_t times[sizeof (sizes) / sizeof (sizes[0])][query_count];
+
+  int bad = 0;
+  int s;
+  for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s ++)
+    {
+      sqlite3 *db = db_open ();
+      query_plans_populate (db, sizes[s]);
+
+      int q;
+      for (q = 0; q < query_count; q ++)
+	{
+	  if (s == sizeof (sizes) / sizeof (sizes[0]) - 1)
+	    /* Only show the plans for the largest database.  */
+	    {
+	      printf ("  %s\n", queries[q].name);
+	      bad += query_plan_check (db, &queries[q], sizes[s]);
+	    }
+
+	  times[s][q] = query_time (db, &queries[q], sizes[s], iterations);
+	}
+
+      sqlite3_close (db);
+    }
+
+  printf ("\n%-40s", "query (us)");
+  for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s ++)
+    printf (" %9d", sizes[s]);
+  printf ("\n");
+
+  int q;
+  for (q = 0; q < query_count; q ++)
+    {
+      printf ("%-40s", queries[q].name);
+      for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s ++)
+	printf (" %9"PRIu64, times[s][q]);
+      printf ("\n");
+    }
+
+  if (bad)
+    printf ("\n%d unexpected full table scans.\n", bad);
+
+  return bad;
+}
+
+/* Feedback outbox: check that the outbox is trimmed, in particular
+   when the manager has no subscribers, and that it is bounded.  */
+
+/* Add COUNT entries to manager M's outbox.  QUEUED is the time at
+   which they were queued relative to now, in seconds.  */
+static void
+feedback_outbox_add (sqlite3 *db, const char *m, int count, int queued)
+{
+  int i;
+  for (i = 0; i < count; i ++)
+    {
+      char *sql = sqlite3_mprintf
+	("insert into feedback_outbox (uuid, instance, parent_uuid, queued)"
+	 " values ('o%d', 0, %Q, strftime ('%%s', 'now') + %d);",
+	 i, m, queued);
+      db_exec (db, sql, NULL, NULL);
+      sqlite3_free (sql);
+    }
+}
+
+/* Return the number of entries in manager M's outbox.  */
+static int
+feedback_outbox_count (sqlite3 *db, const char *m)
+{
+  int count = 0;
+  char *sql = sqlite3_mprintf
+    ("select seq from feedback_outbox where parent_uuid = %Q;", m);
+  db_exec (db, sql, count_callback, &count);
+  sqlite3_free (sql);
+  return count;
+}
+
+/* Execute the format FMT from murmeltier-queries.h.  */
+static void
+feedback_outbox_exec (sqlite3 *db, const char *fmt, ...)
+{
+  va_list ap;
+  va_start (ap, fmt);
+  char *sql = sqlite3_vmprintf (fmt, ap);
+  va_end (ap);
+
+  db_exec (db, sql, NULL, NULL);
+  sqlite3_free (sql);
+}
+
+static int
+bench_feedback_outbox (int iterations)
+{
+  sqlite3 *db = db_open ();
+  int bad = 0;
+
+  void expect (const char *what, const char *m, int expected)
+  {
+    int count = feedback_outbox_count (db, m);
+    printf ("  %-50s %4d %s\n", what, count,
+	    count == expected ? "ok" : "FAILED");
+    if (count != expected)
+      bad ++;
+  }
+
+  /* A manager without subscribers.  Acknowledging anything or the
+     last subscriber departing empties the outbox.  */
+  feedback_outbox_add (db, "m0", 10, 0);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_TRIM, "m0", "m0", "m0");
+  expect ("no subscribers: trim", "m0", 0);
+
+  feedback_outbox_exec (db, QUERY_FEEDBACK_SUBSCRIBER_ADD, "a", "m0");
+  feedback_outbox_add (db, "m0", 10, 0);
+  feedback_outbox_exec (db,
+			QUERY_FEEDBACK_SUBSCRIBER_REMOVE
+			QUERY_FEEDBACK_OUTBOX_TRIM,
+			"a", "m0", "m0", "m0", "m0");
+  expect ("last subscriber departed: trim", "m0", 0);
+
+  /* A manager with two subscribers.  Entries are only deleted once
+     both acknowledged them.  */
+  feedback_outbox_exec (db, QUERY_FEEDBACK_SUBSCRIBER_ADD, "a", "m1");
+  feedback_outbox_exec (db, QUERY_FEEDBACK_SUBSCRIBER_ADD, "b", "m1");
+  feedback_outbox_add (db, "m1", 10, 0);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_TRIM, "m1", "m1", "m1");
+  expect ("subscribers, nothing acknowledged: trim", "m1", 10);
+
+  db_exec (db,
+	   "update feedback_subscribers set acked ="
+	   " (select min (seq) + 4 from feedback_outbox"
+	   "  where parent_uuid = 'm1')"
+	   " where parent_uuid = 'm1' and subscriber = 'a';",
+	   NULL, NULL);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_TRIM, "m1", "m1", "m1");
+  expect ("one subscriber acknowledged: trim", "m1", 10);
+
+  db_exec (db,
+	   "update feedback_subscribers set acked ="
+	   " (select max (seq) from feedback_outbox"
+	   "  where parent_uuid = 'm1')"
+	   " where parent_uuid = 'm1' and subscriber = 'b';",
+	   NULL, NULL);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_TRIM, "m1", "m1", "m1");
+  expect ("both subscribers acknowledged: trim", "m1", 5);
+
+  /* A manager whose subscriber never acknowledges anything.  */
+  feedback_outbox_exec (db, QUERY_FEEDBACK_SUBSCRIBER_ADD, "a", "m2");
+  feedback_outbox_add (db, "m2", 5, -2 * 24 * 60 * 60);
+  feedback_outbox_add (db, "m2", 30, 0);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_EXPIRE,
+			"m2", 24 * 60 * 60, "m2", 100);
+  expect ("unacknowledged: expire by age", "m2", 30);
+  feedback_outbox_exec (db, QUERY_FEEDBACK_OUTBOX_EXPIRE,
+			"m2", 24 * 60 * 60, "m2", 20);
+  expect ("unacknowledged: expire by count", "m2", 20);
+
+  /* Other managers' entries are untouched.  */
+  expect ("other managers", "m1", 5);
+
+  sqlite3_close (db);
+  return bad;
+}
+
+/* Dispatch: compare process_message's old demultiplexer, which
+   compared the interface against each known interface and then the
+   method against each method in turn, with the generated perfect
+   hash table.  */
+
+static const struct
+{
+  const char *interface;
+  const char *member;
+} dispatch_messages[] =
+  {
+    /* In the order that the old demultiplexer tested them.  */
+    { "org.freedesktop.DBus.Introspectable", "Introspect" },
+    { "org.freedesktop.DBus.Properties", "Get" },
+    { "org.freedesktop.DBus.Properties", "Set" },
+    { "org.woodchuck", "ManagerRegister" },
+    { "org.woodchuck.manager", "ManagerRegister" },
+    { "org.woodchuck.manager", "StreamRegister" },
+    { "org.woodchuck.stream", "ObjectRegister" },
+    { "org.woodchuck", "ListManagers" },
+    { "org.woodchuck", "LookupManagerByCookie" },
+    { "org.woodchuck.manager", "ListManagers" },
+    { "org.woodchuck.manager", "LookupManagerByCookie" },
+    { "org.woodchuck.manager", "ListStreams" },
+    { "org.woodchuck.manager", "LookupStreamByCookie" },
+    { "org.woodchuck.stream", "ListObjects" },
+    { "org.woodchuck.stream", "LookupObjectByCookie" },
+    { "org.woodchuck.manager", "Unregister" },
+    { "org.woodchuck.stream", "Unregister" },
+    { "org.woodchuck", "TransferDesirability" },
+    { "org.woodchuck.manager", "FeedbackSubscribe" },
+    { "org.woodchuck.manager", "FeedbackUnsubscribe" },
+    { "org.woodchuck.manager", "FeedbackAck" },
+    { "org.woodchuck.object", "Unregister" },
+    { "org.woodchuck.object", "Transfer" },
+    { "org.woodchuck.object", "TransferStatus" },
+    { "org.woodchuck.stream", "UpdateStatus" },
+    { "org.woodchuck.object", "Used" },
+    { "org.woodchuck.object", "FilesDeleted" },
+  };
+#define DISPATCH_MESSAGES \
+  (sizeof (dispatch_messages) / sizeof (dispatch_messages[0]))
+
+/* Return the index of the method in DISPATCH_MESSAGES the way the old
+   demultiplexer found it or -1.  */
+static int
+dispatch_ladder (const char *interface_str, const char *method)
+{
+  static const char *interfaces[] =
+    {
+      "org.woodchuck",
+      "org.woodchuck.manager",
+      "org.woodchuck.stream",
+      "org.woodchuck.object",
+      "org.freedesktop.DBus.Introspectable",
+      "org.freedesktop.DBus.Properties",
+    };
+
+  int interface = -1;
+  int i;
+  for (i = 0; i < sizeof (interfaces) / sizeof (interfaces[0]); i ++)
+    if (strcmp (interface_str, interfaces[i]) == 0)
+      interface = i;
+  if (interface == -1)
+    return -1;
+
+  for (i = 0; i < DISPATCH_MESSAGES; i ++)
+    if (strcmp (interfaces[interface], dispatch_messages[i].interface) == 0
+	&& strcmp (method, dispatch_messages[i].member) == 0)
+      return i;
+  return -1;
+}
+
+static int
+bench_dispatch (int iterations)
+{
+  const int rounds = 100000;
+
+  /* Check that the table and the ladder agree.  */
+  int i;
+  for (i = 0; i < DISPATCH_MESSAGES; i ++)
+    {
+      const struct dispatch_entry *entry
+	= dispatch_lookup (dispatch_messages[i].interface,
+			   dispatch_messages[i].member);
+      if (! entry || dispatch_ladder (dispatch_messages[i].interface,
+				      dispatch_messages[i].member) != i)
+	{
+	  printf ("%s.%s: lookup failed!\n",
+		  dispatch_messages[i].interface, dispatch_messages[i].member);
+	  return 1;
+	}
+    }
+  if (dispatch_lookup ("org.woodchuck.object", "ListObjects"))
+    {
+      printf ("org.woodchuck.object.ListObjects unexpectedly found!\n");
+      return 1;
+    }
+
+  /* Prevent the compiler from optimizing the lookups away.  */
+  volatile intptr_t sink = 0;
+  uint64_t ladder = 0;
+  uint64_t table = 0;
+  int iteration;
+  for (iteration = 0; iteration < iterations; iteration ++)
+    {
+      int r;
+      uint64_t start = now_us ();
+      for (r = 0; r < rounds; r ++)
+	for (i = 0; i < DISPATCH_MESSAGES; i ++)
+	  sink += dispatch_ladder (dispatch_messages[i].interface,
+				   dispatch_messages[i].member);
+      ladder += now_us () - start;
+
+      start = now_us ();
+      for (r = 0; r < rounds; r ++)
+	for (i = 0; i < DISPATCH_MESSAGES; i ++)
+	  sink += (intptr_t) dispatch_lookup (dispatch_messages[i].interface,
+					      dispatch_messages[i].member);
+      table += now_us () - start;
+    }
+
+  double messages = (double) iterations * rounds * DISPATCH_MESSAGES;
+  printf ("%-8s %12s\n", "", "ns/message");
+  printf ("%-8s %12.1f\n", "ladder", ladder * 1000 / messages);
+  printf ("%-8s %12.1f\n", "table", table * 1000 / messages);
+
+  return 0;
+}
+
+/* List replies: compare building ListObjects' reply by first copying
+   each row into an array of strings, as list_callback did, with
+   appending the columns directly to the reply while stepping the
+   statement.  The reply is modeled as a growing buffer, which is what
+   libdbus appends to.  We count the allocations that each approach
+   makes in addition to SQLite's.  */
+
+static int list_allocations;
+
+static void *
+list_malloc (size_t size)
+{
+  list_allocations ++;
+  return malloc (size);
+}
+
+static void *
+list_realloc (void *p, size_t size)
+{
+  list_allocations ++;
+  return realloc (p, size);
+}
+
+struct reply
+{
+  char *data;
+  size_t len;
+  size_t size;
+};
+
+static void
+reply_append (struct reply *reply, const char *s)
+{
+  size_t len = strlen (s) + 1;
+  if (reply->len + len > reply->size)
+    {
+      reply->size = MAX (reply->size * 2, reply->len + len);
+      reply->data = list_realloc (reply->data, reply->size);
+    }
+  memcpy (reply->data + reply->len, s, len);
+  reply->len += len;
+}
+
+static const char *list_sql
+  = "select uuid, Cookie, HumanReadableName from objects"
+    " where parent_uuid = 's0';";
+
+static int
+list_copy (sqlite3 *db, struct reply *reply)
+{
+  struct
+  {
+    char **rows;
+    int count;
+    int size;
+  } list = { NULL, 0, 0 };
+
+  int callback (void *cookie, int argc, char **argv, char **names)
+  {
+    char **strct = list_malloc (sizeof (char *) * (argc + 1));
+    int i;
+    for (i = 0; i < argc; i ++)
+      {
+	strct[i] = list_malloc (strlen (argv[i]) + 1);
+	strcpy (strct[i], argv[i]);
+      }
+    strct[argc] = NULL;
+
+    if (list.count == list.size)
+      {
+	list.size = MAX (16, list.size * 2);
+	list.rows = list_realloc (list.rows, sizeof (char **) * list.size);
+      }
+    list.rows[list.count ++] = (char *) strct;
+    return 0;
+  }
+  db_exec (db, list_sql, callback, NULL);
+
+  int i;
+  for (i = 0; i < list.count; i ++)
+    {
+      char **strct = (char **) list.rows[i];
+      int j;
+      for (j = 0; strct[j]; j ++)
+	{
+	  reply_append (reply, strct[j]);
+	  free (strct[j]);
+	}
+      free (strct);
+    }
+  free (list.rows);
+
+  return list.count;
+}
+
+static int
+list_direct (sqlite3 *db, struct reply *reply)
+{
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2 (db, list_sql, -1, &stmt, NULL))
+    error (1, 0, "%s: %s", list_sql, sqlite3_errmsg (db));
+
+  int rows = 0;
+  int argc = sqlite3_column_count (stmt);
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      int i;
+      for (i = 0; i < argc; i ++)
+	reply_append (reply, (const char *) sqlite3_column_text (stmt, i));
+      rows ++;
+    }
+  sqlite3_finalize (stmt);
+
+  return rows;
+}
+
+static int
+bench_list_replies (int iterations)
+{
+  /* All of the objects are in s0.  */
+  const int objects = 10000;
+
+  sqlite3 *db = db_open ();
+  db_exec (db, "begin transaction;", NULL, NULL);
+  int i;
+  for (i = 0; i < objects; i ++)
+    {
+      char *sql = sqlite3_mprintf
+	("insert into objects (uuid, parent_uuid, HumanReadableName, Cookie)"
+	 " values ('%032x', 's0', 'Object number %d', 'http://example.org/%d');",
+	 i, i, i);
+      db_exec (db, sql, NULL, NULL);
+      sqlite3_free (sql);
+    }
+  db_exec (db, "end transaction;", NULL, NULL);
+
+  struct
+  {
+    const char *name;
+    int (*list) (sqlite3 *db, struct reply *reply);
+    uint64_t time;
+    int allocations;
+    size_t len;
+  } methods[] =
+    {
+      { "copy", list_copy, 0, 0, 0 },
+      { "direct", list_direct, 0, 0, 0 },
+    };
+  int method_count = sizeof (methods) / sizeof (methods[0]);
+
+  int m;
+  for (i = 0; i < iterations; i ++)
+    for (m = 0; m < method_count; m ++)
+      {
+	struct reply reply = { NULL, 0, 0 };
+
+	list_allocations = 0;
+	uint64_t start = now_us ();
+	int rows = methods[m].list (db, &reply);
+	methods[m].time += now_us () - start;
+	methods[m].allocations = list_allocations;
+
+	if (rows != objects)
+	  {
+	    printf ("%s: Got %d rows, expected %d!\n",
+		    methods[m].name, rows, objects);
+	    return 1;
+	  }
+	if (m > 0 && reply.len != methods[0].len)
+	  {
+	    printf ("%s: Reply has %zd bytes, expected %zd!\n",
+		    methods[m].name, reply.len, methods[0].len);
+	    return 1;
+	  }
+	methods[m].len = reply.len;
+	free (reply.data);
+      }
+
+  sqlite3_close (db);
+
+  printf ("%-8s %12s %12s\n", "", "us/list", "allocations");
+  for (m = 0; m < method_count; m ++)
+    printf ("%-8s %12"PRIu64" %12d\n", methods[m].name,
+	    methods[m].time / iterations, methods[m].allocations);
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct
+  {
+    const char *name;
+    /* Returns 0 on success.  */
+    int (*func) (int iterations);
+    /* Whether "make check" runs it.  */
+    bool check;
+  } benchmarks[] =
+    {
+      { "manager-tree", bench_manager_tree, false },
+      { "query-plans", bench_query_plans, true },
+      { "feedback-outbox", bench_feedback_outbox, true },
+      { "dispatch", bench_dispatch, false },
+      { "list-replies", bench_list_replies, false },
+    };
+  int benchmark_count = sizeof (benchmarks) / sizeof (benchmarks[0]);
+
+  /* Don't clutter the output with murmeltier_schema_migrate's
+     progress reports.  */
+  output_debug_global = output_debug = -1;
+
+  int iterations = 5;
+  const char *only = NULL;
+#ifdef MURMELTIER_CHECK
+  /* Built as murmeltier-check for "make check": only run the checks,
+     once.  */
+  iterations = 1;
+#endif
+
+  int i;
+  for (i = 1; i < argc; i ++)
+    {
+      if (strncmp (argv[i], "--iterations=", 13) == 0)
+	iterations = MAX (1, atoi (&argv[i][13]));
+      else if (argv[i][0] != '-' && ! only)
+	only = argv[i];
+      else
+	{
+	  fprintf (stderr, "Usage: %s [--iterations=N] [BENCHMARK]\n"
+		   "Benchmarks:", argv[0]);
+	  int j;
+	  for (j = 0; j < benchmark_count; j ++)
+	    fprintf (stderr, " %s", benchmarks[j].name);
+	  fprintf (stderr, "\n");
+	  return 1;
+	}
+    }
+
+  int failed = 0;
+  for (i = 0; i < benchmark_count; i ++)
+    if ((! only || strcmp (only, benchmarks[i].name) == 0)
+#ifdef MURMELTIER_CHECK
+	&& benchmarks[i].check
+#endif
+	)
+      {
+	printf ("%s (%d iterations)\n", benchmarks[i].name, iterations);
+	if (benchmarks[i].func (iterations))
+	  {
+	    printf ("%s FAILED\n", benchmarks[i].name);
+	    failed = 1;
+	  }
+	printf ("\n");
+      }
+
+  return failed;
+}
@@ -18,13 +18,18 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <error.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
 #include <glib.h>
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-bindings.h>
+#include <dbus/dbus-glib-lowlevel.h>
 
 #include "debug.h"
 #include "util.h"
@@ -38,9 +43,259 @@
 #include "org.freedesktop.DBus.Introspectable.xml.h"
 #include "org.freedesktop.DBus.Properties.xml.h"
 
-static DBusHandlerResult
-process_message (DBusConnection *connection, DBusMessage *message,
-		 gpointer user_data)
+#include "murmeltier-dispatch.h"
+
+/* The types of objects.  */
+enum
+  {
+    root = 1, manager, stream, object
+  };
+
+#define PATH_ROOT "/org/woodchuck"
+static const struct
+{
+  /* The object's path or, for managers, streams and objects, the
+     path's prefix (without a trailing /).  */
+  const char *path;
+  int path_len;
+  /* The interface that the object implements (in addition to
+     org.freedesktop.DBus.Introspectable and
+     org.freedesktop.DBus.Properties).  */
+  enum dispatch_interface interface;
+  const char *interface_name;
+} object_types[] =
+  {
+#define T(path_, interface_, interface_name_) \
+    { path_, sizeof (path_) - 1, interface_, interface_name_ }
+    [root] = T (PATH_ROOT, org_woodchuck, "org.woodchuck"),
+    [manager] = T (PATH_ROOT "/manager", org_woodchuck_manager,
+		   "org.woodchuck.manager"),
+    [stream] = T (PATH_ROOT "/stream", org_woodchuck_stream,
+		  "org.woodchuck.stream"),
+    [object] = T (PATH_ROOT "/object", org_woodchuck_object,
+		  "org.woodchuck.object"),
+#undef T
+  };
+
+/* The address of the private server that clients may connect to
+   directly (see org.woodchuck.PeerAddress) or NULL if it could not
+   be created.  */
+static char *peer_address;
+
+/* Per-method statistics.  See org.woodchuck.MethodStatistics.  When
+   tracing is disabled, the only cost is testing method_tracing.  */
+static volatile int method_tracing;
+
+#define TRACE_BUCKETS 24
+
+struct method_stats
+{
+  const struct dispatch_entry *entry;
+  uint32_t calls;
+  uint32_t errors;
+  uint64_t sql_time;
+  uint64_t marshal_time;
+  uint64_t wait_time;
+  uint64_t sql_histogram[TRACE_BUCKETS];
+  uint64_t marshal_histogram[TRACE_BUCKETS];
+  uint64_t wait_histogram[TRACE_BUCKETS];
+};
+
+/* Indexed by enum dispatch_method.  Protected by method_stats_lock.  */
+static struct method_stats method_stats[DISPATCH_METHODS + 1];
+static GStaticMutex method_stats_lock = G_STATIC_MUTEX_INIT;
+
+/* The time spent in the database layer by the current thread's
+   method call.  */
+static __thread uint64_t trace_sql_time;
+
+/* Return the time in microseconds.  */
+static inline uint64_t
+trace_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Evaluate EXPR, a call into the database layer, and, if tracing is
+   enabled, charge the time it takes to the current method call.  */
+#define TRACE_SQL(expr)						\
+  ({								\
+    uint64_t trace_start_ = method_tracing ? trace_now () : 0;	\
+    typeof (expr) trace_ret_ = (expr);				\
+    if (trace_start_)						\
+      trace_sql_time += trace_now () - trace_start_;		\
+    trace_ret_;							\
+  })
+
+static inline int
+trace_bucket (uint64_t us)
+{
+  if (us == 0)
+    return 0;
+  return MIN (64 - __builtin_clzll (us), TRACE_BUCKETS - 1);
+}
+
+static void
+trace_record (const struct dispatch_entry *entry, bool error,
+	      uint64_t wait_time, uint64_t sql_time, uint64_t marshal_time)
+{
+  g_static_mutex_lock (&method_stats_lock);
+
+  struct method_stats *stats = &method_stats[entry->method];
+  stats->entry = entry;
+  stats->calls ++;
+  if (error)
+    stats->errors ++;
+  stats->sql_time += sql_time;
+  stats->marshal_time += marshal_time;
+  stats->wait_time += wait_time;
+  stats->sql_histogram[trace_bucket (sql_time)] ++;
+  stats->marshal_histogram[trace_bucket (marshal_time)] ++;
+  stats->wait_histogram[trace_bucket (wait_time)] ++;
+
+  g_static_mutex_unlock (&method_stats_lock);
+}
+
+/* Write the statistics to the debug log.  */
+static void
+method_stats_dump (void)
+{
+  g_static_mutex_lock (&method_stats_lock);
+
+  int i;
+  for (i = 1; i <= DISPATCH_METHODS; i ++)
+    {
+      struct method_stats *stats = &method_stats[i];
+      if (! stats->calls)
+	continue;
+
+      GString *histograms = g_string_new ("");
+      void histogram (const char *name, uint64_t *buckets)
+      {
+	g_string_append_printf (histograms, " %s:", name);
+	int b;
+	for (b = 0; b < TRACE_BUCKETS; b ++)
+	  g_string_append_printf (histograms, " %"PRIu64, buckets[b]);
+      }
+      histogram ("sql", stats->sql_histogram);
+      histogram ("marshal", stats->marshal_histogram);
+      histogram ("wait", stats->wait_histogram);
+
+      debug (0, "%s.%s: %"PRIu32" calls, %"PRIu32" errors, "
+	     "sql: %"PRIu64" us, marshal: %"PRIu64" us, wait: %"PRIu64" us;"
+	     "%s",
+	     stats->entry->interface_name, stats->entry->member,
+	     stats->calls, stats->errors,
+	     stats->sql_time, stats->marshal_time, stats->wait_time,
+	     histograms->str);
+
+      g_string_free (histograms, TRUE);
+    }
+
+  g_static_mutex_unlock (&method_stats_lock);
+}
+
+/* Append VALUE to ITER as a variant.  Returns false if VALUE's type
+   is not supported.  */
+static bool
+append_variant (DBusMessageIter *iter, const GValue *value)
+{
+  void add (char dtype, void *value)
+  {
+    char dtypestr[2] = { dtype, '\0' };
+
+    DBusMessageIter variant_iter;
+    dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT, dtypestr,
+				      &variant_iter);
+
+    dbus_message_iter_append_basic (&variant_iter, dtype, value);
+
+    dbus_message_iter_close_container (iter, &variant_iter);
+  }
+
+  switch (G_VALUE_TYPE (value))
+    {
+    case G_TYPE_INT:
+      {
+	dbus_int32_t v = g_value_get_int (value);
+	add (DBUS_TYPE_INT32, &v);
+	return true;
+      }
+    case G_TYPE_UINT:
+      {
+	dbus_uint32_t v = g_value_get_uint (value);
+	add (DBUS_TYPE_UINT32, &v);
+	return true;
+      }
+    case G_TYPE_INT64:
+      {
+	dbus_int64_t v = g_value_get_int64 (value);
+	add (DBUS_TYPE_INT64, &v);
+	return true;
+      }
+    case G_TYPE_UINT64:
+      {
+	dbus_uint64_t v = g_value_get_uint64 (value);
+	add (DBUS_TYPE_UINT64, &v);
+	return true;
+      }
+    case G_TYPE_BOOLEAN:
+      {
+	dbus_bool_t v = g_value_get_boolean (value);
+	add (DBUS_TYPE_BOOLEAN, &v);
+	return true;
+      }
+    case G_TYPE_STRING:
+      {
+	const char *v = g_value_get_string (value);
+	add (DBUS_TYPE_STRING, &v);
+	return true;
+      }
+    default:
+      return false;
+    }
+}
+
+/* Append VALUES, a hash table mapping property names to GValues, to
+   ITER as an a{sv}.  The values must have types that append_variant
+   supports.  */
+static void
+append_properties (DBusMessageIter *iter, GHashTable *values)
+{
+  DBusMessageIter array_iter;
+  dbus_message_iter_open_container (iter, DBUS_TYPE_ARRAY,
+				    DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_TYPE_VARIANT_AS_STRING
+				    DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+				    &array_iter);
+
+  GHashTableIter hash_iter;
+  gpointer key;
+  gpointer value;
+  g_hash_table_iter_init (&hash_iter, values);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      DBusMessageIter entry_iter;
+      dbus_message_iter_open_container (&array_iter, DBUS_TYPE_DICT_ENTRY,
+					NULL, &entry_iter);
+      dbus_message_iter_append_basic (&entry_iter, DBUS_TYPE_STRING, &key);
+      bool supported = append_variant (&entry_iter, value);
+      assert (supported);
+      dbus_message_iter_close_container (&array_iter, &entry_iter);
+    }
+
+  dbus_message_iter_close_container (iter, &array_iter);
+}
+
+/* Execute the method call MESSAGE on an object of type TYPE and
+   return the reply.  ENTRY is the method's entry in the dispatch table
+   or NULL if the method is unknown.  */
+static DBusMessage *
+method_call (DBusMessage *message, int type,
+	     const struct dispatch_entry *entry)
 {
   DBusMessage *reply = dbus_message_new_method_return (message);
   const char *error_name = NULL;
@@ -48,7 +303,7 @@ process_message (DBusConnection *connection, DBusMessage *message,
   GError *error = NULL;
   char *error_message = NULL;
   enum woodchuck_error ret = WOODCHUCK_ERROR_GENERIC;
-  char *expected_sig = NULL;
+  const char *expected_sig = NULL;
   const char *actual_sig = dbus_message_get_signature (message);
 
   const char *path = dbus_message_get_path (message);
@@ -65,116 +320,56 @@ process_message (DBusConnection *connection, DBusMessage *message,
 
   debug (5, "Invocation of %s.%s on %s", interface_str, method, path);
 
-  enum
-  {
-    org_woodchuck = 1,
-    org_woodchuck_manager,
-    org_woodchuck_stream,
-    org_woodchuck_object,
-    org_freedesktop_dbus_introspectable,
-    org_freedesktop_dbus_properties
-  };
-  int interface = 0;
-  if (strcmp (interface_str, "org.woodchuck") == 0)
-    interface = org_woodchuck;
-  if (strcmp (interface_str, "org.woodchuck.manager") == 0)
-    interface = org_woodchuck_manager;
-  if (strcmp (interface_str, "org.woodchuck.stream") == 0)
-    interface = org_woodchuck_stream;
-  if (strcmp (interface_str, "org.woodchuck.object") == 0)
-    interface = org_woodchuck_object;
-  if (strcmp (interface_str, "org.freedesktop.DBus.Introspectable") == 0)
-    interface = org_freedesktop_dbus_introspectable;
-  if (strcmp (interface_str, "org.freedesktop.DBus.Properties") == 0)
-    interface = org_freedesktop_dbus_properties;
-
-
-#define PATH_ROOT "/org/woodchuck"
-  if (strncmp (path, PATH_ROOT, sizeof (PATH_ROOT) - 1) != 0)
-    /* Not for us.  */
-    return DBUS_HANDLER_RESULT_HANDLED;
-
-  path = &path[sizeof (PATH_ROOT) - 1];
-
-  debug (5, "Path -> '%s'", path);
-
-#define PATH_MANAGER "manager/"
-#define PATH_STREAM "stream/"
-#define PATH_OBJECT "object/"
-  enum
-  {
-    root = 1, manager, stream, object
-  };
-  int type = 0;
-
-  if (*path == '\0')
-    {
-      debug (5, "Object type: root");
-      type = root;
-      if (! (interface == org_freedesktop_dbus_introspectable
-	     || interface == org_freedesktop_dbus_properties
-	     || interface == org_woodchuck))
-	interface = 0;
-    }
-  else if (*path == '/')
-    {
-      path ++;
-      if (strncmp (path, PATH_MANAGER, sizeof (PATH_MANAGER) - 1) == 0)
-	{
-	  debug (5, "Object type: manager");
-	  path += sizeof (PATH_MANAGER) - 1;
-	  type = manager;
-	  if (! (interface == org_freedesktop_dbus_introspectable
-		 || interface == org_freedesktop_dbus_properties
-		 || interface == org_woodchuck_manager))
-	    interface = 0;
-	}
-      else if (strncmp (path, PATH_STREAM, sizeof (PATH_STREAM) - 1) == 0)
-	{
-	  debug (5, "Object type: stream");
-	  path += sizeof (PATH_STREAM) - 1;
-	  type = stream;
-	  if (! (interface == org_freedesktop_dbus_introspectable
-		 || interface == org_freedesktop_dbus_properties
-		 || interface == org_woodchuck_stream))
-	    interface = 0;
-	}
-      if (strncmp (path, PATH_OBJECT, sizeof (PATH_OBJECT) - 1) == 0)
-	{
-	  debug (5, "Object type: object");
-	  path += sizeof (PATH_OBJECT) - 1;
-	  type = object;
-	  if (! (interface == org_freedesktop_dbus_introspectable
-		 || interface == org_freedesktop_dbus_properties
-		 || interface == org_woodchuck_object))
-	    interface = 0;
-	}
-    }
+  /* Strip the prefix.  For managers, streams and objects, what
+     remains is the UUID.  For the root, nothing should remain.  */
+  path = &path[object_types[type].path_len];
+  if (type != root && *path == '/')
+    path ++;
 
   int hexdigits = strspn (path, "0123456789abcdef");
-  if (! type || path[hexdigits] != '\0')
+  if (path[hexdigits] != '\0' || (type != root && hexdigits == 0))
     /* Bad object name.  */
     {
-      debug (3, "Bad object name: %s.", path);
+      debug (3, "Bad object name: %s.", dbus_message_get_path (message));
       error = g_error_new (DBUS_GERROR, 0, "%s: No such object.",
 			   dbus_message_get_path (message));
       error_name = DBUS_ERROR_UNKNOWN_OBJECT;
       goto out;
     }
 
-  if (! interface)
+  if (! entry)
+    goto bad_method;
+
+  if (! (entry->interface == object_types[type].interface
+	 || entry->interface == org_freedesktop_dbus_introspectable
+	 || entry->interface == org_freedesktop_dbus_properties))
     {
       error_name = DBUS_ERROR_UNKNOWN_INTERFACE;
       goto bad_method;
     }
 
+  expected_sig = entry->signature;
+
+  if (! dbus_message_get_sender (message)
+      && (entry->method == org_woodchuck_manager_FeedbackSubscribe
+	  || entry->method == org_woodchuck_manager_FeedbackUnsubscribe
+	  || entry->method == org_woodchuck_manager_FeedbackAck))
+    /* The message arrived on a peer connection.  Upcalls are sent to
+       the subscriber's bus name, which a peer doesn't have.  */
+    {
+      error = g_error_new (DBUS_GERROR, DBUS_GERROR_NOT_SUPPORTED,
+			   "%s: %s.%s must be called via the bus.",
+			   dbus_message_get_path (message),
+			   interface_str, method);
+      error_name = DBUS_ERROR_NOT_SUPPORTED;
+      goto out;
+    }
+
   debug (5, "Object is '%s'", path);
 
   /* Demux and demarshal.  */
-  if (interface == org_freedesktop_dbus_introspectable
-      && strcmp (method, "Introspect") == 0)
+  if (entry->method == org_freedesktop_dbus_introspectable_Introspect)
     {
-      expected_sig = "";
       if (strcmp (expected_sig, actual_sig) != 0)
 	goto bad_signature;
 
@@ -219,13 +414,11 @@ process_message (DBusConnection *connection, DBusMessage *message,
 				DBUS_TYPE_INVALID);
       ret = 0;
     }
-  else if (interface == org_freedesktop_dbus_properties
-	   && strcmp (method, "Get") == 0)
+  else if (entry->method == org_freedesktop_dbus_properties_Get)
     {
       const char *interface_name = NULL;
       const char *property_name = NULL;
 
-      expected_sig = "ss";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -240,77 +433,30 @@ process_message (DBusConnection *connection, DBusMessage *message,
 
       GValue value = { 0 };
       if (type == root)
-	ret = woodchuck_property_get (path, interface_name,
-				      property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_property_get (path, interface_name, property_name, &value,
+				   &error));
       if (type == manager)
-	ret = woodchuck_manager_property_get (path, interface_name,
-					      property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_manager_property_get (path, interface_name, property_name,
+					   &value, &error));
       if (type == stream)
-	ret = woodchuck_stream_property_get (path, interface_name,
-					     property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_stream_property_get (path, interface_name, property_name,
+					  &value, &error));
       if (type == object)
-	ret = woodchuck_object_property_get (path, interface_name,
-					     property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_object_property_get (path, interface_name, property_name,
+					  &value, &error));
 
       if (ret == 0)
 	{
 	  DBusMessageIter outer_iter;
 	  dbus_message_iter_init_append (reply, &outer_iter);
 
-	  void add (char dtype, void *value)
-	  {
-	    char dtypestr[2] = { dtype, '\0' };
-
-	    DBusMessageIter variant_iter;
-	    dbus_message_iter_open_container (&outer_iter,
-					      DBUS_TYPE_VARIANT,
-					      dtypestr,
-					      &variant_iter);
-
-	    dbus_message_iter_append_basic (&variant_iter, dtype, value);
-
-	    dbus_message_iter_close_container (&outer_iter, &variant_iter);
-	  }
-
-	  switch (G_VALUE_TYPE (&value))
+	  if (! append_variant (&outer_iter, &value))
 	    {
-	    case G_TYPE_INT:
-	      {
-		dbus_int32_t v = g_value_get_int (&value);
-		add (DBUS_TYPE_INT32, &v);
-		break;
-	      }
-	    case G_TYPE_UINT:
-	      {
-		dbus_uint32_t v = g_value_get_uint (&value);
-		add (DBUS_TYPE_UINT32, &v);
-		break;
-	      }
-	    case G_TYPE_INT64:
-	      {
-		dbus_int64_t v = g_value_get_int64 (&value);
-		add (DBUS_TYPE_INT64, &v);
-		break;
-	      }
-	    case G_TYPE_UINT64:
-	      {
-		dbus_uint64_t v = g_value_get_uint64 (&value);
-		add (DBUS_TYPE_UINT64, &v);
-		break;
-	      }
-	    case G_TYPE_BOOLEAN:
-	      {
-		dbus_bool_t v = g_value_get_boolean (&value);
-		add (DBUS_TYPE_BOOLEAN, &v);
-		break;
-	      }
-	    case G_TYPE_STRING:
-	      {
-		const char *v = g_value_get_string (&value);
-		add (DBUS_TYPE_STRING, &v);
-		break;
-	      }
-	    default:
+	      g_value_unset (&value);
 	      error_message = g_strdup_printf
 		("Cannot return property: unsupported type.");
 	      goto bad_signature;
@@ -320,13 +466,53 @@ process_message (DBusConnection *connection, DBusMessage *message,
       if (G_IS_VALUE (&value))
 	g_value_unset (&value);
     }
-  else if (interface == org_freedesktop_dbus_properties
-	   && strcmp (method, "Set") == 0)
+  else if (entry->method == org_freedesktop_dbus_properties_GetAll)
+    {
+      const char *interface_name = NULL;
+
+      DBusError dbus_error;
+      dbus_error_init (&dbus_error);
+      if (strcmp (expected_sig, actual_sig) != 0
+	  || ! dbus_message_get_args (message, &dbus_error,
+				      DBUS_TYPE_STRING, &interface_name,
+				      DBUS_TYPE_INVALID))
+	{
+	  dbus_error_free (&dbus_error);
+	  goto bad_signature;
+	}
+
+      GHashTable *values = NULL;
+      if (type == root)
+	ret = TRACE_SQL
+	  (woodchuck_property_get_all (path, interface_name, &values, &error));
+      if (type == manager)
+	ret = TRACE_SQL
+	  (woodchuck_manager_property_get_all (path, interface_name, &values,
+					       &error));
+      if (type == stream)
+	ret = TRACE_SQL
+	  (woodchuck_stream_property_get_all (path, interface_name, &values,
+					      &error));
+      if (type == object)
+	ret = TRACE_SQL
+	  (woodchuck_object_property_get_all (path, interface_name, &values,
+					      &error));
+
+      if (ret == 0)
+	{
+	  DBusMessageIter iter;
+	  dbus_message_iter_init_append (reply, &iter);
+	  append_properties (&iter, values);
+	}
+
+      if (values)
+	g_hash_table_unref (values);
+    }
+  else if (entry->method == org_freedesktop_dbus_properties_Set)
     {
       const char *interface_name = NULL;
       const char *property_name = NULL;
 
-      expected_sig = "ssv";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if ((strcmp (expected_sig, actual_sig) != 0
@@ -417,31 +603,34 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	}
 
       if (type == root)
-	ret = woodchuck_property_set (path, interface_name,
-				      property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_property_set (path, interface_name, property_name, &value,
+				   &error));
       if (type == manager)
-	ret = woodchuck_manager_property_set (path, interface_name,
-					      property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_manager_property_set (path, interface_name, property_name,
+					   &value, &error));
       if (type == stream)
-	ret = woodchuck_stream_property_set (path, interface_name,
-					     property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_stream_property_set (path, interface_name, property_name,
+					  &value, &error));
       if (type == object)
-	ret = woodchuck_object_property_set (path, interface_name,
-					     property_name, &value, &error);
+	ret = TRACE_SQL
+	  (woodchuck_object_property_set (path, interface_name, property_name,
+					  &value, &error));
 
       if (G_IS_VALUE (&value))
 	g_value_unset (&value);
     }
-  else if ((type == root && strcmp (method, "ManagerRegister") == 0)
-	   || (type == manager && strcmp (method, "ManagerRegister") == 0)
-	   || (type == manager && strcmp (method, "StreamRegister") == 0)
-	   || (type == stream && strcmp (method, "ObjectRegister") == 0))
+  else if (entry->method == org_woodchuck_ManagerRegister
+	   || entry->method == org_woodchuck_manager_ManagerRegister
+	   || entry->method == org_woodchuck_manager_StreamRegister
+	   || entry->method == org_woodchuck_stream_ObjectRegister)
     /* Single argument: a property dictionary.  */
     {
-      /* In reality, we accept either a{sv}b or a{ss}b.  The main reason
-	 is that dbus-send cannot send messages with a variant
-	 type.  */
-      expected_sig = "a{sv}b";
+      /* The signature is a{sv}b.  In reality, we accept either a{sv}b
+	 or a{ss}b.  The main reason is that dbus-send cannot send
+	 messages with a variant type.  */
 
       GHashTable *properties = g_hash_table_new (g_str_hash, g_str_equal);
       GValue *values = NULL;
@@ -726,21 +915,22 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	goto register_bad_type;
 
       char *uuid = NULL;
-      if (type == root && strcmp (method, "ManagerRegister") == 0)
-	ret = woodchuck_manager_register (properties, only_if_unique,
-					  &uuid, &error);
-      else if (type == manager && strcmp (method, "ManagerRegister") == 0)
-	ret = woodchuck_manager_manager_register (path,
-						  properties, only_if_unique,
-						  &uuid, &error);
-      else if (type == manager && strcmp (method, "StreamRegister") == 0)
-	ret = woodchuck_manager_stream_register (path,
-						 properties, only_if_unique,
-						 &uuid, &error);
-      else if (type == stream && strcmp (method, "ObjectRegister") == 0)
-	ret = woodchuck_stream_object_register (path,
-						properties, only_if_unique,
-						&uuid, &error);
+      if (entry->method == org_woodchuck_ManagerRegister)
+	ret = TRACE_SQL
+	  (woodchuck_manager_register (properties, only_if_unique, &uuid,
+				       &error));
+      else if (entry->method == org_woodchuck_manager_ManagerRegister)
+	ret = TRACE_SQL
+	  (woodchuck_manager_manager_register (path, properties,
+					       only_if_unique, &uuid, &error));
+      else if (entry->method == org_woodchuck_manager_StreamRegister)
+	ret = TRACE_SQL
+	  (woodchuck_manager_stream_register (path, properties, only_if_unique,
+					      &uuid, &error));
+      else if (entry->method == org_woodchuck_stream_ObjectRegister)
+	ret = TRACE_SQL
+	  (woodchuck_stream_object_register (path, properties, only_if_unique,
+					     &uuid, &error));
 
       if (ret == 0)
 	dbus_message_append_args (reply, DBUS_TYPE_STRING, &uuid,
@@ -760,21 +950,25 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	}
     }
   else if (/* In: boolean.  */
-	   (type == root && strcmp (method, "ListManagers") == 0)
+	   entry->method == org_woodchuck_ListManagers
 	   /* In: string, boolean.  */
-	   || (type == root && strcmp (method, "LookupManagerByCookie") == 0)
+	   || entry->method == org_woodchuck_LookupManagerByCookie
 	   /* In: boolean.  */
-	   || (type == manager && strcmp (method, "ListManagers") == 0)
+	   || entry->method == org_woodchuck_manager_ListManagers
 	   /* In: string, boolean.  */
-	   || (type == manager && strcmp (method, "LookupManagerByCookie") == 0)
+	   || entry->method == org_woodchuck_manager_LookupManagerByCookie
 	   /* In: none.  */
-	   || (type == manager && strcmp (method, "ListStreams") == 0)
+	   || entry->method == org_woodchuck_manager_ListStreams
+	   /* In: string, uint32.  */
+	   || entry->method == org_woodchuck_manager_ListStreamsFrom
 	   /* In: string.  */
-	   || (type == manager && strcmp (method, "LookupStreamByCookie") == 0)
+	   || entry->method == org_woodchuck_manager_LookupStreamByCookie
 	   /* In: none.  */
-	   || (type == stream && strcmp (method, "ListObjects") == 0)
+	   || entry->method == org_woodchuck_stream_ListObjects
+	   /* In: string, uint32.  */
+	   || entry->method == org_woodchuck_stream_ListObjectsFrom
 	   /* In: string.  */
-	   || (type == stream && strcmp (method, "LookupObjectByCookie") == 0))
+	   || entry->method == org_woodchuck_stream_LookupObjectByCookie)
     {
       DBusMessageIter iter;
       dbus_message_iter_init (message, &iter);
@@ -782,11 +976,13 @@ process_message (DBusConnection *connection, DBusMessage *message,
 
       char *cookie = NULL;
       bool recurse = true;
+      char *cursor = NULL;
+      uint32_t limit = 0;
 
-      if (strcmp (method, "LookupManagerByCookie") == 0)
+      if (entry->method == org_woodchuck_LookupManagerByCookie
+	  || entry->method == org_woodchuck_manager_LookupManagerByCookie)
 	/* In: string, boolean.  */
 	{
-	  expected_sig = "sb";
 	  if (arg_type != DBUS_TYPE_STRING)
 	    goto bad_signature;
 
@@ -803,10 +999,10 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  dbus_message_iter_next (&iter);
 	  arg_type = dbus_message_iter_get_arg_type (&iter);
 	}
-      else if (strncmp (method, "Lookup", 6) == 0)
+      else if (entry->method == org_woodchuck_manager_LookupStreamByCookie
+	       || entry->method == org_woodchuck_stream_LookupObjectByCookie)
 	/* In: string.  */
 	{
-	  expected_sig = "s";
 	  if (arg_type != DBUS_TYPE_STRING)
 	    goto bad_signature;
 
@@ -815,127 +1011,134 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  dbus_message_iter_next (&iter);
 	  arg_type = dbus_message_iter_get_arg_type (&iter);
 	}
-      else if (strcmp (method, "ListManagers") == 0)
+      else if (entry->method == org_woodchuck_manager_ListStreamsFrom
+	       || entry->method == org_woodchuck_stream_ListObjectsFrom)
+	/* In: string, uint32.  */
 	{
-	  expected_sig = "b";
+	  if (arg_type != DBUS_TYPE_STRING)
+	    goto bad_signature;
 
-	  if (arg_type == DBUS_TYPE_BOOLEAN)
-	    /* Optional.  */
-	    {
-	      dbus_message_iter_get_basic (&iter, &recurse);
+	  dbus_message_iter_get_basic (&iter, &cursor);
 
-	      dbus_message_iter_next (&iter);
-	      arg_type = dbus_message_iter_get_arg_type (&iter);
-	    }
-	}
-      else
-	expected_sig = "";
+	  dbus_message_iter_next (&iter);
+	  arg_type = dbus_message_iter_get_arg_type (&iter);
 
-      if (arg_type != DBUS_TYPE_INVALID)
-	goto bad_signature;
+	  if (arg_type != DBUS_TYPE_UINT32)
+	    goto bad_signature;
 
-      GPtrArray *list = NULL;
-      char *array_signature = NULL;
-      if (type == root && strcmp (method, "ListManagers") == 0)
-	{
-	  ret = woodchuck_list_managers (recurse, &list, &error);
-	  array_signature = "(ssss)";
-	}
-      else if (type == root && strcmp (method, "LookupManagerByCookie") == 0)
-	{
-	  ret = woodchuck_lookup_manager_by_cookie
-	    (cookie, recurse, &list, &error);
-	  array_signature = "(sss)";
-	}
-      else if (type == manager && strcmp (method, "LookupManagerByCookie") == 0)
-	{
-	  ret = woodchuck_manager_lookup_manager_by_cookie
-	    (path, cookie, recurse, &list, &error);
-	  array_signature = "(sss)";
-	}
-      else if (type == manager && strcmp (method, "ListManagers") == 0)
-	{
-	  ret = woodchuck_manager_list_managers (path, recurse,
-						 &list, &error);
-	  array_signature = "(ssss)";
-	}
-      else if (type == manager && strcmp (method, "ListStreams") == 0)
-	{
-	  ret = woodchuck_manager_list_streams (path, &list, &error);
-	  array_signature = "(sss)";
-	}
-      else if (type == manager && strcmp (method, "LookupStreamByCookie") == 0)
-	{
-	  ret = woodchuck_manager_lookup_stream_by_cookie
-	    (path, cookie, &list, &error);
-	  array_signature = "(ss)";
-	}
-      else if (type == stream && strcmp (method, "ListObjects") == 0)
-	{
-	  ret = woodchuck_stream_list_objects (path, &list, &error);
-	  array_signature = "(sss)";
-	}
-      else if (type == stream && strcmp (method, "LookupObjectByCookie") == 0)
-	{
-	  ret = woodchuck_stream_lookup_object_by_cookie
-	    (path, cookie, &list, &error);
-	  array_signature = "(ss)";
-	}
-      assert (array_signature);
+	  dbus_message_iter_get_basic (&iter, &limit);
 
-      if (list)
+	  dbus_message_iter_next (&iter);
+	  arg_type = dbus_message_iter_get_arg_type (&iter);
+	}
+      else if ((entry->method == org_woodchuck_ListManagers
+		|| entry->method == org_woodchuck_manager_ListManagers)
+	       && arg_type == DBUS_TYPE_BOOLEAN)
+	/* In: boolean (optional).  */
 	{
-	  DBusMessageIter outer_iter;
-	  dbus_message_iter_init_append (reply, &outer_iter);
-
-	  DBusMessageIter array_iter;
-	  dbus_message_iter_open_container (&outer_iter,
-					    DBUS_TYPE_ARRAY,
-					    array_signature,
-					    &array_iter);
-
-	  int i;
-	  for (i = 0; i < list->len; i ++)
-	    {
-	      GPtrArray *strct = g_ptr_array_index (list, i);
+	  dbus_message_iter_get_basic (&iter, &recurse);
 
-	      DBusMessageIter struct_iter;
-	      dbus_message_iter_open_container (&array_iter,
-						DBUS_TYPE_STRUCT, NULL,
-						&struct_iter);
+	  dbus_message_iter_next (&iter);
+	  arg_type = dbus_message_iter_get_arg_type (&iter);
+	}
 
-	      int i;
-	      for (i = 0; i < strct->len; i ++)
-		{
-		  char *value = g_ptr_array_index (strct, i);
-		  if (! value)
-		    value = "";
-
-		  if (ret == 0)
-		    dbus_message_iter_append_basic
-		      (&struct_iter, DBUS_TYPE_STRING, &value);
-		  g_free (g_ptr_array_index (strct, i));
-		}
+      if (arg_type != DBUS_TYPE_INVALID)
+	goto bad_signature;
 
-	      g_ptr_array_free (strct, TRUE);
+      const char *array_signature;
+      if (entry->method == org_woodchuck_ListManagers
+	  || entry->method == org_woodchuck_manager_ListManagers)
+	array_signature = "(ssss)";
+      else if (entry->method == org_woodchuck_manager_LookupStreamByCookie
+	       || entry->method == org_woodchuck_stream_LookupObjectByCookie)
+	array_signature = "(ss)";
+      else
+	array_signature = "(sss)";
 
-	      dbus_message_iter_close_container (&array_iter, &struct_iter);
-	    }
+      /* Append the rows to the reply as they are read from the
+	 database.  If an error occurs, the reply is replaced by an
+	 error.  */
+      DBusMessageIter outer_iter;
+      dbus_message_iter_init_append (reply, &outer_iter);
 
-	  g_ptr_array_free (list, TRUE);
+      DBusMessageIter array_iter;
+      dbus_message_iter_open_container (&outer_iter,
+					DBUS_TYPE_ARRAY,
+					array_signature,
+					&array_iter);
+
+      void row (void *user_data, int argc, const char *argv[])
+      {
+	DBusMessageIter struct_iter;
+	dbus_message_iter_open_container (&array_iter,
+					  DBUS_TYPE_STRUCT, NULL,
+					  &struct_iter);
+
+	int i;
+	for (i = 0; i < argc; i ++)
+	  {
+	    const char *value = argv[i] ?: "";
+	    dbus_message_iter_append_basic (&struct_iter,
+					    DBUS_TYPE_STRING, &value);
+	  }
 
-	  dbus_message_iter_close_container (&outer_iter, &array_iter);
+	dbus_message_iter_close_container (&array_iter, &struct_iter);
+      }
+
+      /* Set by the paged methods.  */
+      char *next_cursor = NULL;
+
+      if (entry->method == org_woodchuck_ListManagers)
+	ret = TRACE_SQL (woodchuck_list_managers (recurse, row, NULL, &error));
+      else if (entry->method == org_woodchuck_LookupManagerByCookie)
+	ret = TRACE_SQL
+	  (woodchuck_lookup_manager_by_cookie (cookie, recurse, row, NULL,
+					       &error));
+      else if (entry->method == org_woodchuck_manager_LookupManagerByCookie)
+	ret = TRACE_SQL
+	  (woodchuck_manager_lookup_manager_by_cookie (path, cookie, recurse,
+						       row, NULL, &error));
+      else if (entry->method == org_woodchuck_manager_ListManagers)
+	ret = TRACE_SQL
+	  (woodchuck_manager_list_managers (path, recurse, row, NULL, &error));
+      else if (entry->method == org_woodchuck_manager_ListStreams)
+	ret = TRACE_SQL
+	  (woodchuck_manager_list_streams (path, row, NULL, &error));
+      else if (entry->method == org_woodchuck_manager_ListStreamsFrom)
+	ret = TRACE_SQL
+	  (woodchuck_manager_list_streams_from (path, cursor, limit, row, NULL,
+						&next_cursor, &error));
+      else if (entry->method == org_woodchuck_manager_LookupStreamByCookie)
+	ret = TRACE_SQL
+	  (woodchuck_manager_lookup_stream_by_cookie (path, cookie, row, NULL,
+						      &error));
+      else if (entry->method == org_woodchuck_stream_ListObjects)
+	ret = TRACE_SQL
+	  (woodchuck_stream_list_objects (path, row, NULL, &error));
+      else if (entry->method == org_woodchuck_stream_ListObjectsFrom)
+	ret = TRACE_SQL
+	  (woodchuck_stream_list_objects_from (path, cursor, limit, row, NULL,
+					       &next_cursor, &error));
+      else if (entry->method == org_woodchuck_stream_LookupObjectByCookie)
+	ret = TRACE_SQL
+	  (woodchuck_stream_lookup_object_by_cookie (path, cookie, row, NULL,
+						     &error));
+
+      dbus_message_iter_close_container (&outer_iter, &array_iter);
+
+      if (next_cursor)
+	{
+	  dbus_message_iter_append_basic (&outer_iter, DBUS_TYPE_STRING,
+					  &next_cursor);
+	  g_free (next_cursor);
 	}
-      else
-	assert (ret != 0);
     }
-  else if ((type == manager && strcmp (method, "Unregister") == 0)
-	   || (type == stream && strcmp (method, "Unregister") == 0))
+  else if (entry->method == org_woodchuck_manager_Unregister
+	   || entry->method == org_woodchuck_stream_Unregister)
     {
       /* In.  */
       bool predicate = false;
 
-      expected_sig = "b";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -948,14 +1151,128 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	}
 
       if (type == manager)
-	ret = woodchuck_manager_unregister (path, predicate, &error);
+	ret = TRACE_SQL
+	  (woodchuck_manager_unregister (path, predicate, &error));
       else
 	{
 	  assert (type == stream);
-	  ret = woodchuck_stream_unregister (path, predicate, &error);
+	  ret = TRACE_SQL
+	    (woodchuck_stream_unregister (path, predicate, &error));
+	}
+    }
+  else if (entry->method == org_woodchuck_PeerAddress)
+    {
+      if (strcmp (expected_sig, actual_sig) != 0)
+	goto bad_signature;
+
+      const char *address = peer_address ?: "";
+      dbus_message_append_args (reply, DBUS_TYPE_STRING, &address,
+				DBUS_TYPE_INVALID);
+      ret = 0;
+    }
+  else if (entry->method == org_woodchuck_SetMethodTracing)
+    {
+      /* In.  */
+      dbus_bool_t enable = false;
+
+      DBusError dbus_error;
+      dbus_error_init (&dbus_error);
+      if (strcmp (expected_sig, actual_sig) != 0
+	  || ! dbus_message_get_args (message, &dbus_error,
+				      DBUS_TYPE_BOOLEAN, &enable,
+				      DBUS_TYPE_INVALID))
+	{
+	  dbus_error_free (&dbus_error);
+	  goto bad_signature;
+	}
+
+      debug (0, "Method tracing %s.", enable ? "enabled" : "disabled");
+      method_tracing = enable;
+      ret = 0;
+    }
+  else if (entry->method == org_woodchuck_MethodStatistics)
+    {
+      /* In.  */
+      dbus_bool_t reset = false;
+
+      DBusError dbus_error;
+      dbus_error_init (&dbus_error);
+      if (strcmp (expected_sig, actual_sig) != 0
+	  || ! dbus_message_get_args (message, &dbus_error,
+				      DBUS_TYPE_BOOLEAN, &reset,
+				      DBUS_TYPE_INVALID))
+	{
+	  dbus_error_free (&dbus_error);
+	  goto bad_signature;
+	}
+
+      DBusMessageIter outer_iter;
+      dbus_message_iter_init_append (reply, &outer_iter);
+
+      DBusMessageIter array_iter;
+      dbus_message_iter_open_container (&outer_iter, DBUS_TYPE_ARRAY,
+					"(ssuutttatatat)", &array_iter);
+
+      void histogram (DBusMessageIter *struct_iter, uint64_t *buckets)
+      {
+	DBusMessageIter iter;
+	dbus_message_iter_open_container (struct_iter, DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_UINT64_AS_STRING, &iter);
+	dbus_message_iter_append_fixed_array (&iter, DBUS_TYPE_UINT64,
+					      &buckets, TRACE_BUCKETS);
+	dbus_message_iter_close_container (struct_iter, &iter);
+      }
+
+      g_static_mutex_lock (&method_stats_lock);
+
+      int i;
+      for (i = 1; i <= DISPATCH_METHODS; i ++)
+	{
+	  struct method_stats *stats = &method_stats[i];
+	  if (! stats->calls)
+	    continue;
+
+	  DBusMessageIter struct_iter;
+	  dbus_message_iter_open_container (&array_iter, DBUS_TYPE_STRUCT,
+					    NULL, &struct_iter);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+					  &stats->entry->interface_name);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+					  &stats->entry->member);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT32,
+					  &stats->calls);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT32,
+					  &stats->errors);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+					  &stats->sql_time);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+					  &stats->marshal_time);
+	  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+					  &stats->wait_time);
+	  histogram (&struct_iter, stats->sql_histogram);
+	  histogram (&struct_iter, stats->marshal_histogram);
+	  histogram (&struct_iter, stats->wait_histogram);
+	  dbus_message_iter_close_container (&array_iter, &struct_iter);
 	}
+
+      if (reset)
+	memset (method_stats, 0, sizeof (method_stats));
+
+      g_static_mutex_unlock (&method_stats_lock);
+
+      dbus_message_iter_close_container (&outer_iter, &array_iter);
+
+      ret = 0;
+    }
+  else if (entry->method == org_woodchuck_DumpMethodStatistics)
+    {
+      if (strcmp (expected_sig, actual_sig) != 0)
+	goto bad_signature;
+
+      method_stats_dump ();
+      ret = 0;
     }
-  else if (type == root && strcmp (method, "TransferDesirability") == 0)
+  else if (entry->method == org_woodchuck_TransferDesirability)
     {
       /* In.  */
       uint32_t request_type;
@@ -965,7 +1282,6 @@ process_message (DBusConnection *connection, DBusMessage *message,
       uint32_t desirability = 0;
       uint32_t version = 0;
 
-      expected_sig = "ua(xttu)";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1014,23 +1330,23 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  i ++;
 	}
 
-      ret = woodchuck_transfer_desirability
-	(request_type, versions, version_count,
-	 &desirability, &version, &error);
+      ret = TRACE_SQL
+	(woodchuck_transfer_desirability (request_type, versions,
+					  version_count, &desirability,
+					  &version, &error));
 
       if (ret == 0)
 	dbus_message_append_args (reply, DBUS_TYPE_UINT32, &desirability,
 				  DBUS_TYPE_UINT32, &version,
 				  DBUS_TYPE_INVALID);
     }
-  else if (type == manager && strcmp (method, "FeedbackSubscribe") == 0)
+  else if (entry->method == org_woodchuck_manager_FeedbackSubscribe)
     {
       /* In.  */
       bool descendents_too;
       /* Out.  */
       char *handle = NULL;
 
-      expected_sig = "b";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1042,9 +1358,10 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_manager_feedback_subscribe
-	(dbus_message_get_sender (message),
-	 path, descendents_too, &handle, &error);
+      ret = TRACE_SQL
+	(woodchuck_manager_feedback_subscribe
+	 (dbus_message_get_sender (message), path, descendents_too, &handle,
+	  &error));
 
       if (ret == 0)
 	dbus_message_append_args (reply, DBUS_TYPE_STRING, &handle,
@@ -1052,12 +1369,11 @@ process_message (DBusConnection *connection, DBusMessage *message,
 
       g_free (handle);
     }
-  else if (type == manager && strcmp (method, "FeedbackUnsubscribe") == 0)
+  else if (entry->method == org_woodchuck_manager_FeedbackUnsubscribe)
     {
       /* In.  */
       const char *handle = NULL;
 
-      expected_sig = "s";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1069,16 +1385,16 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_manager_feedback_unsubscribe
-	(dbus_message_get_sender (message), path, handle, &error);
+      ret = TRACE_SQL
+	(woodchuck_manager_feedback_unsubscribe
+	 (dbus_message_get_sender (message), path, handle, &error));
     }
-  else if (type == manager && strcmp (method, "FeedbackAck") == 0)
+  else if (entry->method == org_woodchuck_manager_FeedbackAck)
     {
       /* In.  */
       const char *object_uuid = NULL;
       unsigned int object_instance = 0;
 
-      expected_sig = "su";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1091,24 +1407,23 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_manager_feedback_ack
-	(dbus_message_get_sender (message), path, object_uuid, object_instance,
-	 &error);
+      ret = TRACE_SQL
+	(woodchuck_manager_feedback_ack (dbus_message_get_sender (message),
+					 path, object_uuid, object_instance,
+					 &error));
     }
-  else if (type == object && strcmp (method, "Unregister") == 0)
+  else if (entry->method == org_woodchuck_object_Unregister)
     {
-      expected_sig = "";
       if (strcmp (expected_sig, actual_sig) != 0)
 	goto bad_signature;
 
-      ret = woodchuck_object_unregister (path, &error);
+      ret = TRACE_SQL (woodchuck_object_unregister (path, &error));
     }
-  else if (type == object && strcmp (method, "Transfer") == 0)
+  else if (entry->method == org_woodchuck_object_Transfer)
     {
       /* In.  */
       uint32_t request_type = 0;
 
-      expected_sig = "u";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1120,10 +1435,10 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_object_transfer (path, request_type, &error);
+      ret = TRACE_SQL (woodchuck_object_transfer (path, request_type, &error));
     }
-  else if ((type == object && strcmp (method, "TransferStatus") == 0)
-	   || (type == stream && strcmp (method, "UpdateStatus") == 0))
+  else if (entry->method == org_woodchuck_object_TransferStatus
+	   || entry->method == org_woodchuck_stream_UpdateStatus)
     {
       /* In.  */
       uint32_t status;
@@ -1143,11 +1458,6 @@ process_message (DBusConnection *connection, DBusMessage *message,
       uint32_t updated_objects;
       uint32_t objects_inline;
 
-      if (strcmp (method, "TransferStatus") == 0)
-	expected_sig = "uutttuta(sbu)";
-      else
-	expected_sig = "uutttuuuu";
-
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1171,7 +1481,7 @@ process_message (DBusConnection *connection, DBusMessage *message,
       for (i = 0; i < 6; i ++)
 	dbus_message_iter_next (&outer_iter);
 
-      if (strcmp (method, "TransferStatus") == 0)
+      if (entry->method == org_woodchuck_object_TransferStatus)
 	{
 	  dbus_message_iter_get_basic (&outer_iter, &object_size);
 	  dbus_message_iter_next (&outer_iter);
@@ -1208,10 +1518,12 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	      i ++;
 	    }
 
-	  ret = woodchuck_object_transfer_status
-	    (path, status, indicator, transferred_up, transferred_down,
-	     transfer_time, transfer_duration, object_size,
-	     files, files_count, &error);
+	  ret = TRACE_SQL
+	    (woodchuck_object_transfer_status (path, status, indicator,
+					       transferred_up,
+					       transferred_down, transfer_time,
+					       transfer_duration, object_size,
+					       files, files_count, &error));
 	}
       else
 	{
@@ -1224,20 +1536,21 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  dbus_message_iter_get_basic (&outer_iter, &objects_inline);
 	  dbus_message_iter_next (&outer_iter);
 
-	  ret = woodchuck_stream_update_status
-	    (path, status, indicator, transferred_up, transferred_down,
-	     transfer_time, transfer_duration, new_objects,
-	     updated_objects, objects_inline, &error);
+	  ret = TRACE_SQL
+	    (woodchuck_stream_update_status (path, status, indicator,
+					     transferred_up, transferred_down,
+					     transfer_time, transfer_duration,
+					     new_objects, updated_objects,
+					     objects_inline, &error));
 	}
     }
-  else if (type == object && strcmp (method, "Used") == 0)
+  else if (entry->method == org_woodchuck_object_Used)
     {
       /* In.  */
       uint64_t start = 0;
       uint64_t duration = 0;
       uint64_t use_mask = 0;
 
-      expected_sig = "ttt";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1251,15 +1564,15 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_object_use (path, start, duration, use_mask, &error);
+      ret = TRACE_SQL
+	(woodchuck_object_use (path, start, duration, use_mask, &error));
     }
-  else if (type == object && strcmp (method, "FilesDeleted") == 0)
+  else if (entry->method == org_woodchuck_object_FilesDeleted)
     {
       /* In.  */
       uint32_t update = 0;
       uint64_t arg = 0;
 
-      expected_sig = "ut";
       DBusError dbus_error;
       dbus_error_init (&dbus_error);
       if (strcmp (expected_sig, actual_sig) != 0
@@ -1272,7 +1585,8 @@ process_message (DBusConnection *connection, DBusMessage *message,
 	  goto bad_signature;
 	}
 
-      ret = woodchuck_object_files_deleted (path, update, arg, &error);
+      ret = TRACE_SQL
+	(woodchuck_object_files_deleted (path, update, arg, &error));
     }
   else
     {
@@ -1346,15 +1660,626 @@ process_message (DBusConnection *connection, DBusMessage *message,
 
   g_free (error_message);
 
-  dbus_connection_send (connection, reply, NULL);
-  dbus_message_unref (reply);
+  return reply;
+}
+
+/* Most methods are executed on a worker thread so that a slow method
+   call does not delay other clients or the main loop.  Methods that
+   only read the database are executed in parallel on the reader
+   threads.  Methods that modify it are executed one at a time, in the
+   order that they arrived, on the writer thread.
+
+   A client may pipeline several method calls and expects them to be
+   executed in order: a read must see the effect of a write sent
+   before it, and must not see the effect of a write sent after it.
+   Thus, each connection has a queue of jobs.  The job at the head of
+   the queue is started if it does not conflict with the connection's
+   running jobs: a read may run concurrently with other reads, a write
+   with other writes (the writer thread executes them in order), and
+   a method executed on the main thread only when nothing else is
+   running.  The queue is only manipulated by the main thread.  */
+static GThreadPool *reader_pool;
+static GThreadPool *writer_pool;
+#define READER_THREADS 4
+
+struct job
+{
+  DBusConnection *connection;
+  DBusMessage *message;
+  int type;
+  const struct dispatch_entry *entry;
+  /* The pool that executes the job or NULL for the main thread.  */
+  GThreadPool *pool;
+  DBusMessage *reply;
+  /* When the message was received, if tracing is enabled.  */
+  uint64_t received;
+};
+
+/* A connection's jobs.  Attached to the connection using
+   CONNECTION_JOBS_SLOT.  */
+struct connection_jobs
+{
+  /* The number of running reads and writes.  */
+  int reads;
+  int writes;
+  /* Jobs that have not yet been started, in the order that they
+     arrived.  */
+  GQueue pending;
+};
+static dbus_int32_t connection_jobs_slot = -1;
+
+/* Return the pool that should execute the method ENTRY or NULL if it
+   should be executed on the main thread.  */
+static GThreadPool *
+method_pool (const struct dispatch_entry *entry)
+{
+  if (! entry)
+    /* method_call just returns an error.  */
+    return NULL;
+
+  switch (entry->method)
+    {
+    case org_freedesktop_dbus_introspectable_Introspect:
+    case org_woodchuck_PeerAddress:
+    case org_woodchuck_SetMethodTracing:
+    case org_woodchuck_MethodStatistics:
+    case org_woodchuck_DumpMethodStatistics:
+      /* Don't touch the database.  */
+    case org_woodchuck_manager_FeedbackSubscribe:
+    case org_woodchuck_manager_FeedbackUnsubscribe:
+      /* Manipulate the subscription tables, which belong to the main
+	 thread.  FeedbackAck only trims the feedback outbox and is
+	 executed on the writer thread.  */
+      return NULL;
+
+    case org_freedesktop_dbus_properties_Get:
+    case org_freedesktop_dbus_properties_GetAll:
+    case org_woodchuck_ListManagers:
+    case org_woodchuck_LookupManagerByCookie:
+    case org_woodchuck_TransferDesirability:
+    case org_woodchuck_manager_ListManagers:
+    case org_woodchuck_manager_LookupManagerByCookie:
+    case org_woodchuck_manager_ListStreams:
+    case org_woodchuck_manager_ListStreamsFrom:
+    case org_woodchuck_manager_LookupStreamByCookie:
+    case org_woodchuck_stream_ListObjects:
+    case org_woodchuck_stream_ListObjectsFrom:
+    case org_woodchuck_stream_LookupObjectByCookie:
+      return reader_pool;
+
+    default:
+      return writer_pool;
+    }
+}
+
+/* Execute the method call MESSAGE.  If tracing is enabled, record
+   its statistics.  RECEIVED is the time at which MESSAGE was received
+   or 0 if tracing was disabled at the time.  */
+static DBusMessage *
+method_call_traced (DBusMessage *message, int type,
+		    const struct dispatch_entry *entry, uint64_t received)
+{
+  if (! method_tracing || ! entry)
+    return method_call (message, type, entry);
+
+  uint64_t start = trace_now ();
+  trace_sql_time = 0;
+
+  DBusMessage *reply = method_call (message, type, entry);
+
+  uint64_t end = trace_now ();
+  uint64_t sql_time = MIN (trace_sql_time, end - start);
+  trace_record (entry,
+		dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR,
+		received ? start - received : 0,
+		sql_time, end - start - sql_time);
+
+  return reply;
+}
+
+static void
+connection_jobs_free (void *data)
+{
+  struct connection_jobs *jobs = data;
+
+  assert (g_queue_is_empty (&jobs->pending));
+  g_free (jobs);
+}
+
+static struct connection_jobs *
+connection_jobs (DBusConnection *connection)
+{
+  struct connection_jobs *jobs
+    = dbus_connection_get_data (connection, connection_jobs_slot);
+  if (! jobs)
+    {
+      jobs = g_new0 (struct connection_jobs, 1);
+      g_queue_init (&jobs->pending);
+      dbus_connection_set_data (connection, connection_jobs_slot,
+				jobs, connection_jobs_free);
+    }
+  return jobs;
+}
+
+static void
+job_free (struct job *job)
+{
+  if (job->reply)
+    dbus_message_unref (job->reply);
+  dbus_message_unref (job->message);
+  dbus_connection_unref (job->connection);
+  g_free (job);
+}
+
+/* Start the jobs at the head of CONNECTION's queue that do not
+   conflict with its running jobs.  Must be called from the main
+   thread.  */
+static void
+connection_jobs_run (DBusConnection *connection)
+{
+  struct connection_jobs *jobs = connection_jobs (connection);
+
+  struct job *job;
+  while ((job = g_queue_peek_head (&jobs->pending)))
+    {
+      if (job->pool == reader_pool)
+	{
+	  if (jobs->writes)
+	    break;
+	  jobs->reads ++;
+	}
+      else if (job->pool == writer_pool)
+	{
+	  if (jobs->reads)
+	    break;
+	  jobs->writes ++;
+	}
+      else if (jobs->reads || jobs->writes)
+	break;
+
+      g_queue_pop_head (&jobs->pending);
+
+      if (job->pool)
+	g_thread_pool_push (job->pool, job, NULL);
+      else
+	{
+	  job->reply = method_call_traced (job->message, job->type,
+					   job->entry, job->received);
+	  dbus_connection_send (job->connection, job->reply, NULL);
+	  job_free (job);
+	}
+    }
+}
+
+/* Send a job's reply and start any jobs that were waiting for it.
+   Runs on the main thread, which dispatches the connection.  */
+static gboolean
+job_reply (gpointer user_data)
+{
+  struct job *job = user_data;
+  DBusConnection *connection = dbus_connection_ref (job->connection);
+
+  dbus_connection_send (job->connection, job->reply, NULL);
+
+  struct connection_jobs *jobs = connection_jobs (connection);
+  if (job->pool == reader_pool)
+    jobs->reads --;
+  else
+    jobs->writes --;
+
+  job_free (job);
+
+  connection_jobs_run (connection);
+  dbus_connection_unref (connection);
+
+  return FALSE;
+}
+
+/* A worker thread's entry point.  USER_DATA is non-zero for the
+   writer thread.  */
+static void
+job_execute (gpointer data, gpointer user_data)
+{
+  struct job *job = data;
+  bool writer = GPOINTER_TO_INT (user_data);
+
+  woodchuck_thread_init ();
+
+  if (writer)
+    woodchuck_write_lock ();
+  job->reply = method_call_traced (job->message, job->type, job->entry,
+				   job->received);
+  if (writer)
+    woodchuck_write_unlock ();
+
+  g_idle_add (job_reply, job);
+}
+
+/* murmeltier_dbus_server_init registers this function as the handler
+   for each of the object types' paths.  USER_DATA is the type.  */
+static DBusHandlerResult
+process_message (DBusConnection *connection, DBusMessage *message,
+		 gpointer user_data)
+{
+  int type = GPOINTER_TO_INT (user_data);
+  assert (root <= type && type <= object);
+
+  const char *interface_str = dbus_message_get_interface (message);
+  const char *method = dbus_message_get_member (message);
+  const struct dispatch_entry *entry = NULL;
+  if (interface_str && method)
+    entry = dispatch_lookup (interface_str, method);
+
+  struct job *job = g_new (struct job, 1);
+  job->connection = dbus_connection_ref (connection);
+  job->message = dbus_message_ref (message);
+  job->type = type;
+  job->entry = entry;
+  job->pool = method_pool (entry);
+  job->reply = NULL;
+  job->received = method_tracing ? trace_now () : 0;
+
+  g_queue_push_tail (&connection_jobs (connection)->pending, job);
+  connection_jobs_run (connection);
 
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/* The object path handler, which is registered on the session bus
+   and on each peer connection.  */
+static DBusObjectPathVTable org_woodchuck_vtable =
+  {
+    .message_function = process_message
+  };
+
+/* Register process_message as the handler for each type of object on
+   CONNECTION.  libdbus dispatches to the handler with the longest
+   matching prefix so that process_message knows the object's type
+   without looking at the path.  */
+static void
+object_paths_register (DBusConnection *connection)
+{
+  int type;
+  for (type = root; type <= object; type ++)
+    dbus_connection_register_fallback (connection,
+				       object_types[type].path,
+				       &org_woodchuck_vtable,
+				       GINT_TO_POINTER (type));
+}
+
+/* Each message sent via the bus daemon is copied twice and costs two
+   context switches.  Clients that make many calls can instead
+   connect to a private server and send their method calls to us
+   directly.  The messages on these peer connections are processed
+   by process_message just like those from the bus.  Only the
+   EXTERNAL authentication mechanism is allowed, which libdbus
+   restricts to processes running as our user.  */
+static DBusServer *peer_server;
+/* The open peer connections.  Only accessed from the main thread.  */
+static GSList *peer_connections;
+
+static DBusHandlerResult
+peer_filter (DBusConnection *connection, DBusMessage *message,
+	     void *user_data)
+{
+  if (dbus_message_is_signal (message, DBUS_INTERFACE_LOCAL,
+			      "Disconnected"))
+    {
+      debug (3, "Peer disconnected.");
+      peer_connections = g_slist_remove (peer_connections, connection);
+      /* Drop peer_new_connection's reference.  The dispatcher holds
+	 a reference until we return.  */
+      dbus_connection_unref (connection);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+peer_new_connection (DBusServer *server, DBusConnection *connection,
+		     void *user_data)
+{
+  debug (3, "New peer connection.");
+
+  dbus_connection_ref (connection);
+  dbus_connection_setup_with_g_main (connection, NULL);
+  dbus_connection_add_filter (connection, peer_filter, NULL, NULL);
+  object_paths_register (connection);
+
+  peer_connections = g_slist_prepend (peer_connections, connection);
+}
+
+static void
+peer_server_init (void)
+{
+  DBusError derror;
+  dbus_error_init (&derror);
+
+  char *address = g_strdup_printf ("unix:tmpdir=%s", g_get_tmp_dir ());
+  peer_server = dbus_server_listen (address, &derror);
+  g_free (address);
+  if (! peer_server)
+    {
+      debug (0, "Failed to create peer server: %s", derror.message);
+      dbus_error_free (&derror);
+      return;
+    }
+
+  const char *mechanisms[] = { "EXTERNAL", NULL };
+  dbus_server_set_auth_mechanisms (peer_server, mechanisms);
+  dbus_server_set_new_connection_function (peer_server, peer_new_connection,
+					   NULL, NULL);
+  dbus_server_setup_with_g_main (peer_server, NULL);
+
+  peer_address = dbus_server_get_address (peer_server);
+  debug (1, "Accepting peer connections on %s", peer_address);
+}
+
+/* Changes to the objects are announced using signals.  The functions
+   that queue them may be called from any thread.  The signals are
+   sent from the main thread by an idle callback so that all of the
+   changes made during a main loop iteration are sent together and
+   repeated changes to a property are coalesced.  They are broadcast
+   on the session bus and sent to each peer connection.  */
+static DBusConnection *signal_connection;
+static GStaticMutex signal_lock = G_STATIC_MUTEX_INIT;
+
+struct pending_signal
+{
+  char *path;
+  const char *interface_name;
+  /* The signal's name or NULL for a PropertiesChanged signal.  */
+  const char *member;
+  /* The argument of an added signal.  */
+  char *uuid;
+
+  /* For PropertiesChanged signals, the changed properties (a map
+     from the property's name to a GValue) and the invalidated
+     properties (a set of names).  */
+  GHashTable *changed;
+  GHashTable *invalidated;
+};
+
+/* The pending signals in the order in which they were queued.  */
+static GQueue pending_signals = G_QUEUE_INIT;
+/* Map from an object path to its pending PropertiesChanged
+   signal.  */
+static GHashTable *pending_properties;
+static guint signals_flush_id;
+
+static void
+pending_signal_free (struct pending_signal *s)
+{
+  g_free (s->path);
+  g_free (s->uuid);
+  if (s->changed)
+    g_hash_table_unref (s->changed);
+  if (s->invalidated)
+    g_hash_table_unref (s->invalidated);
+  g_free (s);
+}
+
+static void
+value_free (gpointer data)
+{
+  GValue *value = data;
+  g_value_unset (value);
+  g_free (value);
+}
+
+static gboolean
+signals_flush (gpointer user_data)
+{
+  g_static_mutex_lock (&signal_lock);
+  GQueue signals = pending_signals;
+  g_queue_init (&pending_signals);
+  g_hash_table_remove_all (pending_properties);
+  signals_flush_id = 0;
+  g_static_mutex_unlock (&signal_lock);
+
+  debug (4, "Sending %d signals.", g_queue_get_length (&signals));
+
+  struct pending_signal *s;
+  while ((s = g_queue_pop_head (&signals)))
+    {
+      DBusMessage *message;
+      if (s->member)
+	{
+	  message = dbus_message_new_signal (s->path, s->interface_name,
+					     s->member);
+	  if (s->uuid)
+	    dbus_message_append_args (message,
+				      DBUS_TYPE_STRING, &s->uuid,
+				      DBUS_TYPE_INVALID);
+	}
+      else
+	{
+	  message = dbus_message_new_signal (s->path,
+					     DBUS_INTERFACE_PROPERTIES,
+					     "PropertiesChanged");
+
+	  DBusMessageIter iter;
+	  dbus_message_iter_init_append (message, &iter);
+	  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING,
+					  &s->interface_name);
+	  append_properties (&iter, s->changed);
+
+	  DBusMessageIter array_iter;
+	  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+					    DBUS_TYPE_STRING_AS_STRING,
+					    &array_iter);
+	  GHashTableIter hash_iter;
+	  gpointer key;
+	  g_hash_table_iter_init (&hash_iter, s->invalidated);
+	  while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+	    dbus_message_iter_append_basic (&array_iter, DBUS_TYPE_STRING,
+					    &key);
+	  dbus_message_iter_close_container (&iter, &array_iter);
+	}
+
+      if (signal_connection)
+	dbus_connection_send (signal_connection, message, NULL);
+      GSList *l;
+      for (l = peer_connections; l; l = l->next)
+	dbus_connection_send (l->data, message, NULL);
+      dbus_message_unref (message);
+      pending_signal_free (s);
+    }
+
+  return FALSE;
+}
+
+/* Return the type of the objects stored in TABLE.  */
+static int
+table_type (const char *table)
+{
+  if (! table)
+    return root;
+  if (strcmp (table, "managers") == 0)
+    return manager;
+  if (strcmp (table, "streams") == 0)
+    return stream;
+  assert (strcmp (table, "objects") == 0);
+  return object;
+}
+
+static char *
+object_path (int type, const char *uuid)
+{
+  if (type == root)
+    return g_strdup (object_types[root].path);
+  return g_strdup_printf ("%s/%s", object_types[type].path, uuid);
+}
+
+/* Queue S.  Must be called with signal_lock held.  */
+static void
+signal_queue (struct pending_signal *s)
+{
+  g_queue_push_tail (&pending_signals, s);
+  if (! signals_flush_id)
+    signals_flush_id = g_idle_add (signals_flush, NULL);
+}
+
+void
+murmeltier_dbus_server_property_changed (const char *table, const char *uuid,
+					 const char *property_name,
+					 const GValue *value)
+{
+  int type = table_type (table);
+  char *path = object_path (type, uuid);
+
+  g_static_mutex_lock (&signal_lock);
+
+  struct pending_signal *s = g_hash_table_lookup (pending_properties, path);
+  if (s)
+    g_free (path);
+  else
+    {
+      s = g_new0 (struct pending_signal, 1);
+      s->path = path;
+      s->interface_name = object_types[type].interface_name;
+      s->changed = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  g_free, value_free);
+      s->invalidated = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      g_free, NULL);
+      g_hash_table_insert (pending_properties, s->path, s);
+      signal_queue (s);
+    }
+
+  if (value)
+    {
+      GValue *copy = g_new0 (GValue, 1);
+      g_value_init (copy, G_VALUE_TYPE (value));
+      g_value_copy (value, copy);
+
+      g_hash_table_remove (s->invalidated, property_name);
+      g_hash_table_insert (s->changed, g_strdup (property_name), copy);
+    }
+  else
+    {
+      g_hash_table_remove (s->changed, property_name);
+      g_hash_table_insert (s->invalidated, g_strdup (property_name), NULL);
+    }
+
+  g_static_mutex_unlock (&signal_lock);
+}
+
+void
+murmeltier_dbus_server_object_added (const char *parent_table,
+				     const char *parent_uuid,
+				     const char *table, const char *uuid)
+{
+  int parent_type = table_type (parent_table);
+  int type = table_type (table);
+
+  struct pending_signal *s = g_new0 (struct pending_signal, 1);
+  s->path = object_path (parent_type, parent_uuid);
+  s->interface_name = object_types[parent_type].interface_name;
+  if (type == manager)
+    s->member = "ManagerAdded";
+  else if (type == stream)
+    s->member = "StreamAdded";
+  else
+    s->member = "ObjectAdded";
+  s->uuid = g_strdup (uuid);
+
+  g_static_mutex_lock (&signal_lock);
+  signal_queue (s);
+  g_static_mutex_unlock (&signal_lock);
+}
+
+void
+murmeltier_dbus_server_object_removed (const char *table, const char *uuid)
+{
+  int type = table_type (table);
+
+  struct pending_signal *s = g_new0 (struct pending_signal, 1);
+  s->path = object_path (type, uuid);
+  s->interface_name = object_types[type].interface_name;
+  s->member = "Removed";
+
+  g_static_mutex_lock (&signal_lock);
+
+  /* There is no point announcing changes to an object that no longer
+     exists.  */
+  struct pending_signal *changed
+    = g_hash_table_lookup (pending_properties, s->path);
+  if (changed)
+    {
+      g_hash_table_remove (pending_properties, s->path);
+      g_queue_remove (&pending_signals, changed);
+      pending_signal_free (changed);
+    }
+
+  signal_queue (s);
+
+  g_static_mutex_unlock (&signal_lock);
+}
+
 void
 murmeltier_dbus_server_init (void)
 {
+  /* The worker threads create reply messages.  This must be called
+     before any other libdbus function.  */
+  dbus_g_thread_init ();
+
+  if (! dbus_connection_allocate_data_slot (&connection_jobs_slot))
+    error (1, 0, "Failed to allocate a connection data slot.");
+
+  /* The methods assume that they are executed on the worker threads
+     (in particular, that the writer thread holds the write lock), so
+     don't try to limp along without them.  */
+  GError *err = NULL;
+  reader_pool = g_thread_pool_new (job_execute, GINT_TO_POINTER (0),
+				   READER_THREADS, FALSE, &err);
+  if (err)
+    error (1, 0, "Failed to create reader thread pool: %s", err->message);
+  writer_pool = g_thread_pool_new (job_execute, GINT_TO_POINTER (1),
+				   1, FALSE, &err);
+  if (err)
+    error (1, 0, "Failed to create writer thread pool: %s", err->message);
+
   DBusError derror;
   dbus_error_init (&derror);
 
@@ -1365,11 +2290,15 @@ murmeltier_dbus_server_init (void)
       dbus_error_free (&derror);
     }
 
-  static DBusObjectPathVTable org_woodchuck_vtable;
-  org_woodchuck_vtable.message_function = process_message;
-  dbus_connection_register_fallback (session_bus,
-				     "/org/woodchuck",
-				     &org_woodchuck_vtable, NULL);
+  pending_properties = g_hash_table_new (g_str_hash, g_str_equal);
+  signal_connection = session_bus;
+
+  if (getenv ("MURMELTIER_TRACE_METHODS"))
+    method_tracing = 1;
+
+  object_paths_register (session_bus);
+
+  peer_server_init ();
 
   GError *error = NULL;
   DBusGConnection *g_session_bus = dbus_g_bus_get (DBUS_BUS_SESSION, &error);
@@ -27,21 +27,63 @@
 /* Initialize module.  */
 extern void murmeltier_dbus_server_init (void);
 
+/* Announce changes to clients.  These may be called from any thread.
+   TABLE and PARENT_TABLE are "managers", "streams" or "objects", or
+   NULL for the root object.  The signals are sent later from the main
+   thread.  */
+
+/* The property PROPERTY_NAME of the object UUID changed to VALUE.  If
+   VALUE is NULL, the property changed but its new value is not
+   sent.  */
+extern void murmeltier_dbus_server_property_changed
+  (const char *table, const char *uuid, const char *property_name,
+   const GValue *value);
+
+/* The object UUID was registered with PARENT_UUID.  */
+extern void murmeltier_dbus_server_object_added
+  (const char *parent_table, const char *parent_uuid,
+   const char *table, const char *uuid);
+
+/* The object UUID (and any descendents) was unregistered.  */
+extern void murmeltier_dbus_server_object_removed
+  (const char *table, const char *uuid);
+
+/* Most of the following callbacks are called from the D-Bus server's
+   worker threads.  A thread must call woodchuck_thread_init before
+   calling any of them.  Callbacks that modify the database must be
+   called with the write lock held.  woodchuck_write_lock blocks and
+   must not be called from the main thread.  */
+extern void woodchuck_thread_init (void);
+extern void woodchuck_write_lock (void);
+extern void woodchuck_write_unlock (void);
+
+/* The list and lookup callbacks pass each row that they find to a
+   function of this type.  ARGV holds the row's ARGC columns.  NULL
+   columns are passed as NULL.  The strings are only valid until the
+   function returns.  */
+typedef void (*woodchuck_row_callback) (void *cookie, int argc,
+				       const char *argv[]);
+
+/* The maximum number of rows that a paged list (e.g.,
+   woodchuck_stream_list_objects_from) returns.  */
+#define WOODCHUCK_LIST_PAGE_MAX 1000
+
 /* org.woochuck callbacks.  */
 extern enum woodchuck_error woodchuck_manager_register
   (GHashTable *properties, gboolean only_if_cookie_unique,
    char **uuid, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing four strings, the
-   uuid, the cookie, the human readable name and the parent manager's
-   UUID.  */
+/* Each row consists of four strings, the uuid, the cookie, the human
+   readable name and the parent manager's UUID.  */
 extern enum woodchuck_error woodchuck_list_managers
-  (gboolean recurse, GPtrArray **list, GError **error);
+  (gboolean recurse, woodchuck_row_callback callback, void *cookie,
+   GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing three strings, the
-   uuid, the human readable name and the parent manager's UUID.  */
+/* Each row consists of three strings, the uuid, the human readable
+   name and the parent manager's UUID.  */
 extern enum woodchuck_error woodchuck_lookup_manager_by_cookie
-  (const char *cookie, gboolean recursive, GPtrArray **list, GError **error);
+  (const char *cookie, gboolean recursive,
+   woodchuck_row_callback callback, void *callback_cookie, GError **error);
 
 struct woodchuck_transfer_desirability_version
 {
@@ -64,31 +106,43 @@ extern enum woodchuck_error woodchuck_manager_manager_register
   (const char *manager, GHashTable *properties, gboolean only_if_cookie_unique,
    char **uuid, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing four strings, the
-   uuid, the cookie, the human readable name and the parent manager's
-   UUID.  */
+/* Each row consists of four strings, the uuid, the cookie, the human
+   readable name and the parent manager's UUID.  */
 extern enum woodchuck_error woodchuck_manager_list_managers
-  (const char *manager, gboolean recurse, GPtrArray **list, GError **error);
+  (const char *manager, gboolean recurse,
+   woodchuck_row_callback callback, void *cookie, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing three strings, the
-   uuid, the human readable name and the parent manager's UUID.  */
+/* Each row consists of three strings, the uuid, the human readable
+   name and the parent manager's UUID.  */
 extern enum woodchuck_error woodchuck_manager_lookup_manager_by_cookie
 (const char *manager, const char *cookie, gboolean recursive,
-   GPtrArray **list, GError **error);
+   woodchuck_row_callback callback, void *callback_cookie, GError **error);
 
 extern enum woodchuck_error woodchuck_manager_stream_register
   (const char *manager, GHashTable *properties, gboolean only_if_cookie_unique,
    char **uuid, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing three strings, the
-   uuid, the cookie, and the human readable name.  */
+/* Each row consists of three strings, the uuid, the cookie, and the
+   human readable name.  */
 extern enum woodchuck_error woodchuck_manager_list_streams
-  (const char *manager, GPtrArray **list, GError **error);
+  (const char *manager, woodchuck_row_callback callback, void *cookie,
+   GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing two strings, the
-   uuid and the human readable name.  */
+/* Like woodchuck_manager_list_streams, but only return the (at most)
+   LIMIT streams whose uuid follows CURSOR, in uuid order.  An empty
+   CURSOR starts at the beginning.  *NEXT_CURSOR is set to the cursor
+   for the next page or, if there are no more streams, to the empty
+   string.  Free it using g_free.  */
+extern enum woodchuck_error woodchuck_manager_list_streams_from
+  (const char *manager, const char *cursor, uint32_t limit,
+   woodchuck_row_callback callback, void *cookie,
+   char **next_cursor, GError **error);
+
+/* Each row consists of two strings, the uuid and the human readable
+   name.  */
 extern enum woodchuck_error woodchuck_manager_lookup_stream_by_cookie
-  (const char *manager, const char *cookie, GPtrArray **list, GError **error);
+  (const char *manager, const char *cookie,
+   woodchuck_row_callback callback, void *callback_cookie, GError **error);
 
 extern enum woodchuck_error woodchuck_manager_feedback_subscribe
   (const char *sender, const char *manager, bool descendents_too, char **handle,
@@ -97,6 +151,9 @@ extern enum woodchuck_error woodchuck_manager_feedback_subscribe
 extern enum woodchuck_error woodchuck_manager_feedback_unsubscribe
   (const char *sender, const char *manager, const char *handle, GError **error);
 
+/* Remove the feedback about OBJECT_UUID's instances up to and
+   including OBJECT_INSTANCE from the outbox so that it is not sent
+   again.  */
 extern enum woodchuck_error woodchuck_manager_feedback_ack
   (const char *sender, const char *manager,
    const char *object_uuid, uint32_t object_instance,
@@ -110,15 +167,24 @@ extern enum woodchuck_error woodchuck_stream_object_register
   (const char *stream, GHashTable *properties, gboolean only_if_cookie_unique,
    char **uuid, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing three strings, the
-   uuid, the cookie and the human readable name.  */
+/* Each row consists of three strings, the uuid, the cookie and the
+   human readable name.  */
 extern enum woodchuck_error woodchuck_stream_list_objects
-  (const char *stream, GPtrArray **list, GError **error);
+  (const char *stream, woodchuck_row_callback callback, void *cookie,
+   GError **error);
+
+/* Like woodchuck_stream_list_objects, but paged.  See
+   woodchuck_manager_list_streams_from.  */
+extern enum woodchuck_error woodchuck_stream_list_objects_from
+  (const char *stream, const char *cursor, uint32_t limit,
+   woodchuck_row_callback callback, void *cookie,
+   char **next_cursor, GError **error);
 
-/* Returns a GPtrArray of GPtrArray each containing two strings, the
-   uuid and the human readable name.  */
+/* Each row consists of two strings, the uuid and the human readable
+   name.  */
 extern enum woodchuck_error woodchuck_stream_lookup_object_by_cookie
-  (const char *stream, const char *cookie, GPtrArray **list, GError **error);
+  (const char *stream, const char *cookie,
+   woodchuck_row_callback callback, void *callback_cookie, GError **error);
 
 extern enum woodchuck_error woodchuck_stream_update_status
   (const char *object, uint32_t status, uint32_t indicator,
@@ -166,6 +232,12 @@ extern enum woodchuck_error woodchuck_property_set
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
 
+/* Returns a hash table mapping each of the object's properties' names
+   to a GValue.  Free it using g_hash_table_unref.  */
+extern enum woodchuck_error woodchuck_property_get_all
+  (const char *object, const char *interface_name,
+   GHashTable **values, GError **error);
+
 extern enum woodchuck_error woodchuck_manager_property_get
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
@@ -174,6 +246,10 @@ extern enum woodchuck_error woodchuck_manager_property_set
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
 
+extern enum woodchuck_error woodchuck_manager_property_get_all
+  (const char *object, const char *interface_name,
+   GHashTable **values, GError **error);
+
 extern enum woodchuck_error woodchuck_stream_property_get
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
@@ -182,6 +258,10 @@ extern enum woodchuck_error woodchuck_stream_property_set
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
 
+extern enum woodchuck_error woodchuck_stream_property_get_all
+  (const char *object, const char *interface_name,
+   GHashTable **values, GError **error);
+
 extern enum woodchuck_error woodchuck_object_property_get
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
@@ -190,4 +270,8 @@ extern enum woodchuck_error woodchuck_object_property_set
   (const char *object, const char *interface_name, const char *property_name,
    GValue *value, GError **error);
 
+extern enum woodchuck_error woodchuck_object_property_get_all
+  (const char *object, const char *interface_name,
+   GHashTable **values, GError **error);
+
 #endif
@@ -0,0 +1,1000 @@
+/* murmeltier-load.c - An end-to-end load generator for murmeltier.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+/* Starts a private dbus-daemon and a murmeltier whose home directory
+   is a temporary directory, and then has several clients concurrently
+   invoke a mix of murmeltier's methods.  Reports the throughput, the
+   latency distribution of each type of operation, murmeltier's
+   resident set size and the size of its database.
+
+   Alternatively, --bus=ADDRESS uses the murmeltier that is already
+   running on the specified bus.  */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <error.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dbus/dbus.h>
+
+#include "util.h"
+
+#define WOODCHUCK_SERVICE "org.woodchuck"
+#define PATH_ROOT "/org/woodchuck"
+
+/* The operations.  */
+enum op
+  {
+    OP_MANAGER_REGISTER,
+    OP_STREAM_REGISTER,
+    OP_OBJECT_REGISTER,
+    OP_PROPERTY_GET,
+    OP_PROPERTY_SET,
+    OP_TRANSFER_STATUS,
+    OP_LIST,
+    OP_COUNT
+  };
+
+static const char *op_names[OP_COUNT] =
+  {
+    [OP_MANAGER_REGISTER] = "manager",
+    [OP_STREAM_REGISTER] = "stream",
+    [OP_OBJECT_REGISTER] = "object",
+    [OP_PROPERTY_GET] = "get",
+    [OP_PROPERTY_SET] = "set",
+    [OP_TRANSFER_STATUS] = "status",
+    [OP_LIST] = "list",
+  };
+
+/* The relative frequency of each operation.  */
+static int weights[OP_COUNT] =
+  {
+    [OP_MANAGER_REGISTER] = 1,
+    [OP_STREAM_REGISTER] = 2,
+    [OP_OBJECT_REGISTER] = 20,
+    [OP_PROPERTY_GET] = 30,
+    [OP_PROPERTY_SET] = 10,
+    [OP_TRANSFER_STATUS] = 20,
+    [OP_LIST] = 5,
+  };
+
+static const char *bus_address;
+static int clients = 4;
+static int seconds = 10;
+/* If not zero, each client performs this many operations instead of
+   running for SECONDS.  */
+static int ops_per_client;
+
+/* Latencies, in microseconds.  */
+struct samples
+{
+  uint32_t *latency;
+  int count;
+  int size;
+  int errors;
+};
+
+/* The maximum number of streams and objects that a client
+   remembers.  */
+#define STREAMS_MAX 64
+#define OBJECTS_MAX 1024
+
+struct client
+{
+  int id;
+  pthread_t tid;
+  DBusConnection *connection;
+  unsigned int seed;
+
+  char *manager;
+  char *streams[STREAMS_MAX];
+  int stream_count;
+  char *objects[OBJECTS_MAX];
+  int object_count;
+  /* The number of objects registered.  Once OBJECTS is full, new
+     objects replace random old ones.  */
+  int objects_registered;
+  /* Used to generate unique cookies.  */
+  int serial;
+
+  struct samples samples[OP_COUNT];
+};
+
+static void
+sample_add (struct samples *s, uint64_t latency)
+{
+  if (s->count == s->size)
+    {
+      s->size = s->size ? 2 * s->size : 1024;
+      s->latency = realloc (s->latency, s->size * sizeof (s->latency[0]));
+      if (! s->latency)
+	error (1, errno, "realloc");
+    }
+  s->latency[s->count ++] = latency > UINT32_MAX ? UINT32_MAX : latency;
+}
+
+static uint64_t
+now_us (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* Send M, wait for the reply and record the latency under OP.
+   Returns the reply or NULL on error.  Consumes M.  */
+static DBusMessage *
+call (struct client *c, enum op op, DBusMessage *m)
+{
+  DBusError err;
+  dbus_error_init (&err);
+
+  uint64_t start = now_us ();
+  DBusMessage *reply = dbus_connection_send_with_reply_and_block
+    (c->connection, m, 60 * 1000, &err);
+  uint64_t latency = now_us () - start;
+
+  dbus_message_unref (m);
+
+  if (! reply)
+    {
+      if (c->samples[op].errors ++ == 0)
+	fprintf (stderr, "client %d: %s: %s: %s\n",
+		 c->id, op_names[op], err.name, err.message);
+      dbus_error_free (&err);
+      return NULL;
+    }
+
+  sample_add (&c->samples[op], latency);
+  return reply;
+}
+
+/* Return a copy of the string returned by REPLY or NULL.  Consumes
+   REPLY.  */
+static char *
+reply_string (DBusMessage *reply)
+{
+  if (! reply)
+    return NULL;
+
+  char *s = NULL;
+  const char *value;
+  if (dbus_message_get_args (reply, NULL,
+			     DBUS_TYPE_STRING, &value, DBUS_TYPE_INVALID))
+    s = strdup (value);
+  dbus_message_unref (reply);
+  return s;
+}
+
+static void
+append_variant (DBusMessageIter *iter, int type, const void *value)
+{
+  char signature[2] = { type, 0 };
+  DBusMessageIter variant;
+  dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT, signature,
+				    &variant);
+  dbus_message_iter_append_basic (&variant, type, value);
+  dbus_message_iter_close_container (iter, &variant);
+}
+
+static void
+append_property (DBusMessageIter *dict, const char *name, const char *value)
+{
+  DBusMessageIter entry;
+  dbus_message_iter_open_container (dict, DBUS_TYPE_DICT_ENTRY, NULL,
+				    &entry);
+  dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &name);
+  append_variant (&entry, DBUS_TYPE_STRING, &value);
+  dbus_message_iter_close_container (dict, &entry);
+}
+
+/* Invoke the register method METHOD of INTERFACE on PATH.  Returns
+   the new object's UUID or NULL.  */
+static char *
+do_register (struct client *c, enum op op, const char *path,
+	     const char *interface, const char *method, const char *what)
+{
+  char name[64];
+  snprintf (name, sizeof (name), "Load %s %d.%d", what, c->id, c->serial);
+  char cookie[64];
+  snprintf (cookie, sizeof (cookie), "load-%s-%d-%d",
+	    what, c->id, c->serial);
+  c->serial ++;
+
+  DBusMessage *m = dbus_message_new_method_call
+    (WOODCHUCK_SERVICE, path, interface, method);
+
+  DBusMessageIter iter;
+  dbus_message_iter_init_append (m, &iter);
+  DBusMessageIter dict;
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+  append_property (&dict, "HumanReadableName", name);
+  append_property (&dict, "Cookie", cookie);
+  dbus_message_iter_close_container (&iter, &dict);
+
+  dbus_bool_t only_if_cookie_unique = FALSE;
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN,
+				  &only_if_cookie_unique);
+
+  return reply_string (call (c, op, m));
+}
+
+static char *
+path_of (const char *type, const char *uuid)
+{
+  char *path = NULL;
+  if (asprintf (&path, "%s/%s/%s", PATH_ROOT, type, uuid) < 0)
+    error (1, errno, "asprintf");
+  return path;
+}
+
+static void
+manager_register (struct client *c)
+{
+  char *uuid = do_register (c, OP_MANAGER_REGISTER, PATH_ROOT,
+			    "org.woodchuck", "ManagerRegister", "manager");
+  if (! c->manager)
+    c->manager = uuid;
+  else
+    free (uuid);
+}
+
+static void
+stream_register (struct client *c)
+{
+  if (! c->manager)
+    return;
+
+  char *path = path_of ("manager", c->manager);
+  char *uuid = do_register (c, OP_STREAM_REGISTER, path,
+			    "org.woodchuck.manager", "StreamRegister",
+			    "stream");
+  free (path);
+
+  if (! uuid)
+    return;
+
+  if (c->stream_count < STREAMS_MAX)
+    c->streams[c->stream_count ++] = uuid;
+  else
+    {
+      int i = rand_r (&c->seed) % STREAMS_MAX;
+      free (c->streams[i]);
+      c->streams[i] = uuid;
+    }
+}
+
+static const char *
+random_stream (struct client *c)
+{
+  if (c->stream_count == 0)
+    return NULL;
+  return c->streams[rand_r (&c->seed) % c->stream_count];
+}
+
+static const char *
+random_object (struct client *c)
+{
+  if (c->object_count == 0)
+    return NULL;
+  return c->objects[rand_r (&c->seed) % c->object_count];
+}
+
+static void
+object_register (struct client *c)
+{
+  const char *stream = random_stream (c);
+  if (! stream)
+    return;
+
+  char *path = path_of ("stream", stream);
+  char *uuid = do_register (c, OP_OBJECT_REGISTER, path,
+			    "org.woodchuck.stream", "ObjectRegister",
+			    "object");
+  free (path);
+
+  if (! uuid)
+    return;
+
+  c->objects_registered ++;
+  if (c->object_count < OBJECTS_MAX)
+    c->objects[c->object_count ++] = uuid;
+  else
+    {
+      int i = rand_r (&c->seed) % OBJECTS_MAX;
+      free (c->objects[i]);
+      c->objects[i] = uuid;
+    }
+}
+
+static void
+property_get (struct client *c)
+{
+  const char *object = random_object (c);
+  if (! object)
+    return;
+
+  static const char *properties[] =
+    { "Cookie", "HumanReadableName", "Priority", "LastTransferTime" };
+  const char *interface = "org.woodchuck.object";
+  const char *property
+    = properties[rand_r (&c->seed)
+		 % (sizeof (properties) / sizeof (properties[0]))];
+
+  char *path = path_of ("object", object);
+  DBusMessage *m = dbus_message_new_method_call
+    (WOODCHUCK_SERVICE, path, DBUS_INTERFACE_PROPERTIES, "Get");
+  free (path);
+  dbus_message_append_args (m,
+			    DBUS_TYPE_STRING, &interface,
+			    DBUS_TYPE_STRING, &property,
+			    DBUS_TYPE_INVALID);
+
+  DBusMessage *reply = call (c, OP_PROPERTY_GET, m);
+  if (reply)
+    dbus_message_unref (reply);
+}
+
+static void
+property_set (struct client *c)
+{
+  const char *object = random_object (c);
+  if (! object)
+    return;
+
+  const char *interface = "org.woodchuck.object";
+  const char *property = "Priority";
+  uint32_t priority = rand_r (&c->seed) % 10;
+
+  char *path = path_of ("object", object);
+  DBusMessage *m = dbus_message_new_method_call
+    (WOODCHUCK_SERVICE, path, DBUS_INTERFACE_PROPERTIES, "Set");
+  free (path);
+
+  DBusMessageIter iter;
+  dbus_message_iter_init_append (m, &iter);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &interface);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &property);
+  append_variant (&iter, DBUS_TYPE_UINT32, &priority);
+
+  DBusMessage *reply = call (c, OP_PROPERTY_SET, m);
+  if (reply)
+    dbus_message_unref (reply);
+}
+
+static void
+transfer_status (struct client *c)
+{
+  const char *object = random_object (c);
+  if (! object)
+    return;
+
+  char *path = path_of ("object", object);
+  DBusMessage *m = dbus_message_new_method_call
+    (WOODCHUCK_SERVICE, path, "org.woodchuck.object", "TransferStatus");
+  free (path);
+
+  uint32_t status = rand_r (&c->seed) % 8 == 0 ? 0x101 : 0;
+  uint32_t indicator = 0;
+  uint64_t transferred_up = 1024;
+  uint64_t transferred_down = 64 * 1024;
+  uint64_t transfer_time = time (NULL);
+  uint32_t transfer_duration = 2;
+  uint64_t object_size = 64 * 1024;
+
+  DBusMessageIter iter;
+  dbus_message_iter_init_append (m, &iter);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &status);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &indicator);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64, &transferred_up);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64,
+				  &transferred_down);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64, &transfer_time);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32,
+				  &transfer_duration);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64, &object_size);
+
+  DBusMessageIter files;
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(sbu)", &files);
+  dbus_message_iter_close_container (&iter, &files);
+
+  DBusMessage *reply = call (c, OP_TRANSFER_STATUS, m);
+  if (reply)
+    dbus_message_unref (reply);
+}
+
+/* Invoke ListManagers, ListStreams or ListObjects.  */
+static void
+list (struct client *c)
+{
+  DBusMessage *m;
+  int which = rand_r (&c->seed) % 3;
+  if (which == 0 || ! c->manager)
+    {
+      m = dbus_message_new_method_call
+	(WOODCHUCK_SERVICE, PATH_ROOT, "org.woodchuck", "ListManagers");
+      dbus_bool_t recursive = FALSE;
+      dbus_message_append_args (m, DBUS_TYPE_BOOLEAN, &recursive,
+				DBUS_TYPE_INVALID);
+    }
+  else if (which == 1 || ! random_stream (c))
+    {
+      char *path = path_of ("manager", c->manager);
+      m = dbus_message_new_method_call
+	(WOODCHUCK_SERVICE, path, "org.woodchuck.manager", "ListStreams");
+      free (path);
+    }
+  else
+    {
+      char *path = path_of ("stream", random_stream (c));
+      m = dbus_message_new_method_call
+	(WOODCHUCK_SERVICE, path, "org.woodchuck.stream", "ListObjects");
+      free (path);
+    }
+
+  DBusMessage *reply = call (c, OP_LIST, m);
+  if (reply)
+    dbus_message_unref (reply);
+}
+
+static void (*op_funcs[OP_COUNT]) (struct client *) =
+  {
+    [OP_MANAGER_REGISTER] = manager_register,
+    [OP_STREAM_REGISTER] = stream_register,
+    [OP_OBJECT_REGISTER] = object_register,
+    [OP_PROPERTY_GET] = property_get,
+    [OP_PROPERTY_SET] = property_set,
+    [OP_TRANSFER_STATUS] = transfer_status,
+    [OP_LIST] = list,
+  };
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int ready;
+static bool go;
+static uint64_t deadline;
+
+static void *
+client_run (void *arg)
+{
+  struct client *c = arg;
+
+  /* Create a manager, a stream and an object so that every type of
+     operation has a target.  */
+  manager_register (c);
+  stream_register (c);
+  object_register (c);
+  int op;
+  for (op = 0; op < OP_COUNT; op ++)
+    {
+      /* Don't count the set up.  */
+      c->samples[op].count = 0;
+      c->samples[op].errors = 0;
+    }
+
+  pthread_mutex_lock (&start_lock);
+  ready ++;
+  pthread_cond_broadcast (&start_cond);
+  while (! go)
+    pthread_cond_wait (&start_cond, &start_lock);
+  pthread_mutex_unlock (&start_lock);
+
+  int total_weight = 0;
+  for (op = 0; op < OP_COUNT; op ++)
+    total_weight += weights[op];
+
+  int n;
+  for (n = 0;
+       ops_per_client ? n < ops_per_client : now () < deadline;
+       n ++)
+    {
+      int r = rand_r (&c->seed) % total_weight;
+      for (op = 0; r >= weights[op]; op ++)
+	r -= weights[op];
+
+      op_funcs[op] (c);
+    }
+
+  return NULL;
+}
+
+static int
+compare_uint32 (const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Return the Pth percentile of the sorted array SAMPLES, in
+   milliseconds.  */
+static double
+percentile (const struct samples *s, int p)
+{
+  if (s->count == 0)
+    return 0;
+  int i = (int64_t) (s->count - 1) * p / 100;
+  return s->latency[i] / 1000.0;
+}
+
+/* Return the value of the field FIELD (e.g., "VmRSS") of
+   /proc/PID/status in kilobytes, or -1 if unknown.  */
+static long
+proc_status_kb (pid_t pid, const char *field)
+{
+  char filename[64];
+  snprintf (filename, sizeof (filename), "/proc/%d/status", (int) pid);
+  FILE *f = fopen (filename, "r");
+  if (! f)
+    return -1;
+
+  long kb = -1;
+  char line[256];
+  int len = strlen (field);
+  while (fgets (line, sizeof (line), f))
+    if (strncmp (line, field, len) == 0 && line[len] == ':')
+      {
+	kb = atol (line + len + 1);
+	break;
+      }
+  fclose (f);
+  return kb;
+}
+
+/* Return the size of the database DB, including its journal, or -1
+   if unknown.  */
+static int64_t
+db_size (const char *db)
+{
+  int64_t size = -1;
+  const char *suffixes[] = { "", "-journal", "-wal" };
+  int i;
+  for (i = 0; i < sizeof (suffixes) / sizeof (suffixes[0]); i ++)
+    {
+      char *filename = NULL;
+      if (asprintf (&filename, "%s%s", db, suffixes[i]) < 0)
+	continue;
+      struct stat st;
+      if (stat (filename, &st) == 0)
+	size = (size < 0 ? 0 : size) + st.st_size;
+      free (filename);
+    }
+  return size;
+}
+
+/* Return the process id of the owner of org.woodchuck or -1.  */
+static pid_t
+murmeltier_pid (DBusConnection *connection)
+{
+  const char *name = WOODCHUCK_SERVICE;
+  DBusMessage *m = dbus_message_new_method_call
+    (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+     "GetConnectionUnixProcessID");
+  dbus_message_append_args (m, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+
+  DBusMessage *reply = dbus_connection_send_with_reply_and_block
+    (connection, m, 5000, NULL);
+  dbus_message_unref (m);
+  if (! reply)
+    return -1;
+
+  uint32_t pid = 0;
+  if (! dbus_message_get_args (reply, NULL,
+			       DBUS_TYPE_UINT32, &pid, DBUS_TYPE_INVALID))
+    pid = 0;
+  dbus_message_unref (reply);
+  return pid ? (pid_t) pid : -1;
+}
+
+static DBusConnection *
+connect_bus (void)
+{
+  DBusError err;
+  dbus_error_init (&err);
+
+  DBusConnection *connection
+    = dbus_connection_open_private (bus_address, &err);
+  if (! connection || ! dbus_bus_register (connection, &err))
+    error (1, 0, "Connecting to %s: %s", bus_address, err.message);
+
+  return connection;
+}
+
+static pid_t dbus_daemon_pid = -1;
+static pid_t murmeltier_started_pid = -1;
+static char *tmpdir;
+static bool keep;
+
+/* Wait up to TIMEOUT seconds for org.woodchuck to appear on the bus.
+   If we started murmeltier and it exits, give up immediately.  */
+static bool
+wait_for_murmeltier (DBusConnection *connection, int timeout)
+{
+  uint64_t end = now () + timeout * 1000;
+  do
+    {
+      if (dbus_bus_name_has_owner (connection, WOODCHUCK_SERVICE, NULL))
+	return true;
+
+      int status;
+      if (murmeltier_started_pid > 0
+	  && waitpid (murmeltier_started_pid, &status, WNOHANG)
+	     == murmeltier_started_pid)
+	{
+	  murmeltier_started_pid = -1;
+	  fprintf (stderr, "murmeltier exited (status %d); "
+		   "see %s/murmeltier.out.\n",
+		   WIFEXITED (status) ? WEXITSTATUS (status) : -1, tmpdir);
+	  keep = true;
+	  return false;
+	}
+
+      usleep (100 * 1000);
+    }
+  while (now () < end);
+  return false;
+}
+
+static void
+cleanup (void)
+{
+  if (murmeltier_started_pid > 0)
+    {
+      kill (murmeltier_started_pid, SIGTERM);
+      waitpid (murmeltier_started_pid, NULL, 0);
+      murmeltier_started_pid = -1;
+    }
+  if (dbus_daemon_pid > 0)
+    {
+      kill (dbus_daemon_pid, SIGTERM);
+      waitpid (dbus_daemon_pid, NULL, 0);
+      dbus_daemon_pid = -1;
+    }
+  if (tmpdir && ! keep)
+    {
+      char *command = NULL;
+      if (asprintf (&command, "rm -rf '%s'", tmpdir) >= 0)
+	{
+	  if (system (command) != 0)
+	    fprintf (stderr, "Failed to remove %s\n", tmpdir);
+	  free (command);
+	}
+    }
+  else if (tmpdir)
+    printf ("State kept in %s\n", tmpdir);
+}
+
+/* Start a dbus-daemon that only serves us and set BUS_ADDRESS.  */
+static void
+start_dbus_daemon (void)
+{
+  char *config = NULL;
+  if (asprintf (&config, "%s/bus.conf", tmpdir) < 0)
+    error (1, errno, "asprintf");
+
+  FILE *f = fopen (config, "w");
+  if (! f)
+    error (1, errno, "Creating %s", config);
+  fprintf (f,
+	   "<!DOCTYPE busconfig PUBLIC"
+	   " \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+	   " \"http://www.freedesktop.org/standards/dbus/1.0/"
+	   "busconfig.dtd\">\n"
+	   "<busconfig>\n"
+	   "  <type>session</type>\n"
+	   "  <listen>unix:tmpdir=%s</listen>\n"
+	   "  <policy context=\"default\">\n"
+	   "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+	   "    <allow eavesdrop=\"true\"/>\n"
+	   "    <allow own=\"*\"/>\n"
+	   "  </policy>\n"
+	   "</busconfig>\n",
+	   tmpdir);
+  fclose (f);
+
+  int fds[2];
+  if (pipe (fds) < 0)
+    error (1, errno, "pipe");
+
+  dbus_daemon_pid = fork ();
+  if (dbus_daemon_pid < 0)
+    error (1, errno, "fork");
+  if (dbus_daemon_pid == 0)
+    {
+      close (fds[0]);
+      char *config_arg = NULL;
+      char *print_address = NULL;
+      if (asprintf (&config_arg, "--config-file=%s", config) < 0
+	  || asprintf (&print_address, "--print-address=%d", fds[1]) < 0)
+	_exit (1);
+      execlp ("dbus-daemon", "dbus-daemon", "--nofork",
+	      config_arg, print_address, NULL);
+      fprintf (stderr, "Executing dbus-daemon: %m\n");
+      _exit (1);
+    }
+  close (fds[1]);
+  free (config);
+
+  char address[1024];
+  int have = 0;
+  ssize_t l;
+  while (have < sizeof (address) - 1
+	 && (l = read (fds[0], address + have,
+		       sizeof (address) - 1 - have)) > 0)
+    {
+      have += l;
+      if (memchr (address, '\n', have))
+	break;
+    }
+  close (fds[0]);
+  address[have] = 0;
+  address[strcspn (address, "\n")] = 0;
+  if (! *address)
+    error (1, 0, "dbus-daemon did not report its address.");
+
+  bus_address = strdup (address);
+}
+
+static void
+start_murmeltier (const char *murmeltier)
+{
+  murmeltier_started_pid = fork ();
+  if (murmeltier_started_pid < 0)
+    error (1, errno, "fork");
+  if (murmeltier_started_pid == 0)
+    {
+      setenv ("HOME", tmpdir, 1);
+      setenv ("DBUS_SESSION_BUS_ADDRESS", bus_address, 1);
+
+      /* Use dup2 rather than freopen: a reopened stderr is buffered
+	 and the exec failure message would be lost on _exit.  */
+      char *log = NULL;
+      if (asprintf (&log, "%s/murmeltier.out", tmpdir) >= 0)
+	{
+	  int fd = open (log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	  if (fd < 0 || dup2 (fd, 1) < 0 || dup2 (fd, 2) < 0)
+	    _exit (1);
+	  close (fd);
+	}
+
+      execl (murmeltier, murmeltier, NULL);
+      fprintf (stderr, "Executing %s: %m\n", murmeltier);
+      _exit (1);
+    }
+}
+
+/* Parse a mix of the form OP:WEIGHT,OP:WEIGHT,...  Operations that
+   are not mentioned get a weight of 0.  */
+static bool
+parse_mix (const char *mix)
+{
+  int op;
+  for (op = 0; op < OP_COUNT; op ++)
+    weights[op] = 0;
+
+  char *copy = strdup (mix);
+  char *saveptr = NULL;
+  char *token;
+  int total = 0;
+  for (token = strtok_r (copy, ",", &saveptr);
+       token;
+       token = strtok_r (NULL, ",", &saveptr))
+    {
+      char *colon = strchr (token, ':');
+      if (colon)
+	*colon = 0;
+      for (op = 0; op < OP_COUNT; op ++)
+	if (strcmp (token, op_names[op]) == 0)
+	  break;
+      if (op == OP_COUNT)
+	{
+	  fprintf (stderr, "Unknown operation: %s\n", token);
+	  free (copy);
+	  return false;
+	}
+      weights[op] = colon ? MAX (0, atoi (colon + 1)) : 1;
+      total += weights[op];
+    }
+  free (copy);
+
+  if (total == 0)
+    {
+      fprintf (stderr, "The mix has no operations.\n");
+      return false;
+    }
+  return true;
+}
+
+static void
+usage (const char *program)
+{
+  int op;
+  fprintf (stderr,
+	   "Usage: %s [--clients=N] [--seconds=N | --ops=N] [--mix=MIX]\n"
+	   "       [--murmeltier=PATH | --bus=ADDRESS [--db=PATH]] [--keep]\n"
+	   "MIX is a comma separated list of OP:WEIGHT.  Default:",
+	   program);
+  for (op = 0; op < OP_COUNT; op ++)
+    fprintf (stderr, "%s%s:%d", op ? "," : " ", op_names[op], weights[op]);
+  fprintf (stderr, "\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *murmeltier = "./murmeltier";
+  const char *db = NULL;
+
+  int i;
+  for (i = 1; i < argc; i ++)
+    {
+      if (strncmp (argv[i], "--clients=", 10) == 0)
+	clients = MAX (1, atoi (&argv[i][10]));
+      else if (strncmp (argv[i], "--seconds=", 10) == 0)
+	seconds = MAX (1, atoi (&argv[i][10]));
+      else if (strncmp (argv[i], "--ops=", 6) == 0)
+	ops_per_client = MAX (1, atoi (&argv[i][6]));
+      else if (strncmp (argv[i], "--mix=", 6) == 0)
+	{
+	  if (! parse_mix (&argv[i][6]))
+	    return 1;
+	}
+      else if (strncmp (argv[i], "--murmeltier=", 13) == 0)
+	murmeltier = &argv[i][13];
+      else if (strncmp (argv[i], "--bus=", 6) == 0)
+	bus_address = &argv[i][6];
+      else if (strncmp (argv[i], "--db=", 5) == 0)
+	db = &argv[i][5];
+      else if (strcmp (argv[i], "--keep") == 0)
+	keep = true;
+      else
+	{
+	  usage (argv[0]);
+	  return 1;
+	}
+    }
+
+  dbus_threads_init_default ();
+
+  if (! bus_address)
+    {
+      char template[] = "/tmp/murmeltier-load-XXXXXX";
+      if (! mkdtemp (template))
+	error (1, errno, "mkdtemp");
+      tmpdir = strdup (template);
+      atexit (cleanup);
+
+      start_dbus_daemon ();
+      start_murmeltier (murmeltier);
+
+      if (! db && asprintf ((char **) &db, "%s/.murmeltier/config.db",
+			    tmpdir) < 0)
+	db = NULL;
+    }
+
+  DBusConnection *connection = connect_bus ();
+  if (! wait_for_murmeltier (connection, 30))
+    error (1, 0, "murmeltier did not appear on %s.", bus_address);
+  pid_t pid = murmeltier_pid (connection);
+
+  printf ("%d clients, %d %s, bus: %s\n",
+	  clients, ops_per_client ? ops_per_client : seconds,
+	  ops_per_client ? "operations per client" : "seconds",
+	  bus_address);
+  printf ("Mix:");
+  int op;
+  for (op = 0; op < OP_COUNT; op ++)
+    printf (" %s:%d", op_names[op], weights[op]);
+  printf ("\n");
+  fflush (stdout);
+
+  long rss_before = pid > 0 ? proc_status_kb (pid, "VmRSS") : -1;
+  int64_t db_before = db ? db_size (db) : -1;
+
+  struct client *c = calloc (clients, sizeof (*c));
+  for (i = 0; i < clients; i ++)
+    {
+      c[i].id = i;
+      c[i].seed = i + 1;
+      c[i].connection = connect_bus ();
+      pthread_create (&c[i].tid, NULL, client_run, &c[i]);
+    }
+
+  /* Start all clients at once.  */
+  pthread_mutex_lock (&start_lock);
+  while (ready < clients)
+    pthread_cond_wait (&start_cond, &start_lock);
+  uint64_t start = now ();
+  deadline = start + seconds * 1000;
+  go = true;
+  pthread_cond_broadcast (&start_cond);
+  pthread_mutex_unlock (&start_lock);
+
+  for (i = 0; i < clients; i ++)
+    pthread_join (c[i].tid, NULL);
+  uint64_t elapsed = MAX (now () - start, (uint64_t) 1);
+
+  /* Merge the clients' samples.  */
+  struct samples all[OP_COUNT];
+  memset (all, 0, sizeof (all));
+  int objects_registered = 0;
+  for (i = 0; i < clients; i ++)
+    {
+      objects_registered += c[i].objects_registered;
+      for (op = 0; op < OP_COUNT; op ++)
+	{
+	  int j;
+	  for (j = 0; j < c[i].samples[op].count; j ++)
+	    sample_add (&all[op], c[i].samples[op].latency[j]);
+	  all[op].errors += c[i].samples[op].errors;
+	}
+    }
+
+  printf ("\n%-8s %8s %6s %9s %9s %9s %9s %9s\n",
+	  "op", "count", "errors", "ops/s",
+	  "p50 ms", "p90 ms", "p99 ms", "max ms");
+  int total = 0;
+  int errors = 0;
+  for (op = 0; op < OP_COUNT; op ++)
+    {
+      struct samples *s = &all[op];
+      qsort (s->latency, s->count, sizeof (s->latency[0]), compare_uint32);
+      total += s->count;
+      errors += s->errors;
+
+      if (s->count == 0 && s->errors == 0)
+	continue;
+      printf ("%-8s %8d %6d %9.1f %9.2f %9.2f %9.2f %9.2f\n",
+	      op_names[op], s->count, s->errors,
+	      s->count * 1000.0 / elapsed,
+	      percentile (s, 50), percentile (s, 90), percentile (s, 99),
+	      percentile (s, 100));
+    }
+  printf ("%-8s %8d %6d %9.1f\n",
+	  "total", total, errors, total * 1000.0 / elapsed);
+  printf ("\nElapsed: %.2f s; objects registered: %d\n",
+	  elapsed / 1000.0, objects_registered);
+
+  if (pid > 0)
+    printf ("murmeltier (pid %d): RSS: %ld kB (before: %ld kB); "
+	    "peak RSS: %ld kB\n",
+	    (int) pid, proc_status_kb (pid, "VmRSS"), rss_before,
+	    proc_status_kb (pid, "VmHWM"));
+  if (db && db_size (db) >= 0)
+    printf ("Database %s: %"PRId64" bytes (before: %"PRId64" bytes)\n",
+	    db, db_size (db), db_before);
+
+  for (i = 0; i < clients; i ++)
+    {
+      dbus_connection_close (c[i].connection);
+      dbus_connection_unref (c[i].connection);
+    }
+  dbus_connection_close (connection);
+  dbus_connection_unref (connection);
+
+  return errors ? 1 : 0;
+}
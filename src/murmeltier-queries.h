@@ -0,0 +1,490 @@
+/* murmeltier-queries.h - Murmeltier's database queries.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef MURMELTIER_QUERIES_H
+#define MURMELTIER_QUERIES_H
+
+#include <inttypes.h>
+#include <sqlite3.h>
+
+/* The queries that murmeltier issues frequently or on large tables.
+   They are shared with murmeltier-bench, which checks that they use
+   an index ("make check") and times them.  Each is a format for
+   sqlite3_mprintf; the comment lists its arguments in order.  An
+   argument described as quoted has already been passed through
+   %Q.  */
+
+/* The scheduler (do_schedule_worker).  */
+
+/* No arguments.  */
+#define QUERY_SCHEDULE_STREAMS						\
+  "select streams.uuid, streams.cookie,"				\
+  "  streams.parent_uuid, managers.cookie, managers.DBusServiceName,"	\
+  "  streams.Freshness, stream_updates.transfer_time, stream_updates.status" \
+  " from streams left join stream_updates"				\
+  " on (streams.uuid == stream_updates.uuid"				\
+  /* MAX(STREAMS_UPDATES.INSTANCE) == STREAMS.INSTANCE + 1 */		\
+  "     and streams.instance == stream_updates.instance + 1)"		\
+  " join managers on streams.parent_uuid == managers.uuid"		\
+  /* A value of -1 means never update.  */				\
+  " where streams.Freshness != (1 << 32)-1 and managers.Enabled == 1;"
+
+/* The stream (%Q).  */
+#define QUERY_SCHEDULE_STREAM_BYTES					\
+  "select avg (coalesce (transferred_up, 0)"				\
+  "            + coalesce (transferred_down, 0))"			\
+  " from (select transferred_up, transferred_down from stream_updates"	\
+  "       where uuid = %Q order by instance desc limit 8);"
+
+/* No arguments.  */
+#define QUERY_SCHEDULE_OBJECTS						\
+  "select objects.uuid, objects.cookie,"				\
+  "  streams.uuid, streams.cookie,"					\
+  "  streams.parent_uuid, managers.cookie, managers.DBusServiceName,"	\
+  "  objects.TransferFrequency, object_instance_status.transfer_time,"	\
+  "  object_instance_status.status,"					\
+  "  objects.TriggerTarget, objects.TriggerEarliest, objects.TriggerLatest," \
+  "  objects.NeedUpdate, objects.instance,"				\
+  "  objects.Filename, objects.Wakeup"					\
+  " from objects left join object_instance_status"			\
+  " on (objects.uuid == object_instance_status.uuid"			\
+  /* MAX(OBJECT_INSTANCE_STATUS.INSTANCE) == OBJECTS.INSTANCE + 1 */	\
+  "     and objects.Instance == object_instance_status.instance + 1)"	\
+  " join streams on objects.parent_uuid == streams.uuid"		\
+  " join managers on managers.uuid == streams.parent_uuid"		\
+  " where managers.Enabled == 1 and objects.DontTransfer == 0"		\
+  "  and (coalesce (object_instance_status.transfer_time, 0) == 0"	\
+  "       or objects.NeedUpdate == 1"					\
+  "       or objects.TransferFrequency > 0);"
+
+/* The object (%Q).  */
+#define QUERY_SCHEDULE_OBJECT_VERSION					\
+  "select version, url, expected_size, expected_transfer_up,"		\
+  "  expected_transfer_down, utility, use_simple_transferer"		\
+  " from object_versions where uuid = %Q"				\
+  " order by utility desc, version limit 1;"
+
+/* The energy model (energy_model_update and energy_run_record).  */
+
+/* No arguments.  */
+#define QUERY_ENERGY_LAST_RUN						\
+  "select time, medium, battery_mj from energy_runs"			\
+  " order by time desc limit 1;"
+
+/* The table (object_instance_status or stream_updates, %s), the
+   start (%"PRId64") and the end (%"PRId64") of the interval.  */
+#define QUERY_ENERGY_BYTES						\
+  "select sum (coalesce (transferred_up, 0)"				\
+  "            + coalesce (transferred_down, 0))"			\
+  " from %s where transfer_time >= %"PRId64				\
+  "  and transfer_time < %"PRId64";"
+
+/* The medium (%Q).  */
+#define QUERY_ENERGY_MODEL_ADD						\
+  "insert or ignore into energy_model (medium) values (%Q);"
+
+/* The interval (%f), the bytes (%f), the energy (%f), their products
+   (t * t, t * b, b * b, t * e and b * e, %f each) and the medium
+   (%Q).  */
+#define QUERY_ENERGY_MODEL_SAMPLE					\
+  "update energy_model set n = n + 1,"					\
+  "  s_t = s_t + %f, s_b = s_b + %f, s_e = s_e + %f,"			\
+  "  s_tt = s_tt + %f, s_tb = s_tb + %f, s_bb = s_bb + %f,"		\
+  "  s_te = s_te + %f, s_be = s_be + %f"				\
+  " where medium = %Q;"
+
+/* The medium (%Q).  */
+#define QUERY_ENERGY_MODEL						\
+  "select n, s_t, s_b, s_e, s_tt, s_tb, s_bb, s_te, s_be"		\
+  " from energy_model where medium = %Q;"
+
+/* The time (%"PRId64"), the medium (%Q), the number of transfers
+   (%d), the expected bytes (%"PRId64"), the estimated joules (%f),
+   the battery level or NULL (%s) and whether the run was deferred
+   (%d).  */
+#define QUERY_ENERGY_RUN_RECORD						\
+  "insert into energy_runs"						\
+  " (time, medium, transfers, expected_bytes, estimated_joules,"	\
+  "  battery_mj, deferred)"						\
+  " values (%"PRId64", %Q, %d, %"PRId64", %f, %s, %d);"
+
+/* The oldest time to keep (%"PRId64").  */
+#define QUERY_ENERGY_RUNS_EXPIRE					\
+  "delete from energy_runs where time < %"PRId64";"
+
+/* Feedback (feedback_deliver, feedback_subscribers_sync and
+   woodchuck_manager_feedback_ack).  */
+
+/* The manager (%Q), the subscriber's cursor (%"PRId64") and the
+   maximum number of entries (%d).  */
+#define QUERY_FEEDBACK_OUTBOX						\
+  "select seq, manager_cookie, stream_uuid, stream_cookie,"		\
+  "  uuid, object_cookie, status, instance,"				\
+  "  version, url, expected_size, expected_transfer_up,"		\
+  "  expected_transfer_down, utility, use_simple_transferer,"		\
+  "  filename, object_size, trigger_target, trigger_fired"		\
+  " from feedback_outbox"						\
+  " where parent_uuid = %Q and seq > %"PRId64				\
+  " order by seq limit %d;"
+
+/* No arguments.  Removes the subscribers that were identified by
+   their unique bus name, which do not survive a restart.  */
+#define QUERY_FEEDBACK_SUBSCRIBERS_STALE				\
+  "delete from feedback_subscribers"					\
+  " where subscriber >= ':' and subscriber < ';';"
+
+/* The subscriber (%Q) and the manager (%Q).  */
+#define QUERY_FEEDBACK_SUBSCRIBER_ADD					\
+  "insert or ignore into feedback_subscribers"				\
+  " (subscriber, parent_uuid) values (%Q, %Q);"
+
+/* The bus name (%Q), the subscriber (%Q) and the manager (%Q).  */
+#define QUERY_FEEDBACK_SUBSCRIBER_BUS_NAME				\
+  "update feedback_subscribers set bus_name = %Q"			\
+  " where subscriber = %Q and parent_uuid = %Q;"
+
+/* The subscriber (%Q) and the manager (%Q).  */
+#define QUERY_FEEDBACK_SUBSCRIBER_ACKED					\
+  "select acked from feedback_subscribers"				\
+  " where subscriber = %Q and parent_uuid = %Q;"
+
+/* The subscriber (%Q) and the manager (%Q).  */
+#define QUERY_FEEDBACK_SUBSCRIBER_REMOVE				\
+  "delete from feedback_subscribers"					\
+  " where subscriber = %Q and parent_uuid = %Q;"
+
+/* The manager (%Q, three times).  Deletes the entries that all of
+   the manager's subscribers acknowledged or, if the manager has no
+   subscribers, all of its entries.  */
+#define QUERY_FEEDBACK_OUTBOX_TRIM					\
+  "delete from feedback_outbox"						\
+  " where parent_uuid = %Q"						\
+  "  and seq <= coalesce ((select min (acked) from feedback_subscribers" \
+  "                        where parent_uuid = %Q),"			\
+  "                       (select max (seq) from feedback_outbox"	\
+  "                        where parent_uuid = %Q));"
+
+/* The manager (%Q), the maximum age of an entry in seconds (%d), the
+   manager (%Q) and the maximum number of entries (%d).  Deletes the
+   manager's entries that are too old or beyond the newest entries,
+   whether or not they were acknowledged.  */
+#define QUERY_FEEDBACK_OUTBOX_EXPIRE					\
+  "delete from feedback_outbox"						\
+  " where parent_uuid = %Q"						\
+  "  and (queued < strftime ('%%s', 'now') - %d"			\
+  "       or seq <= (select seq from feedback_outbox"			\
+  "                  where parent_uuid = %Q"				\
+  "                  order by seq desc limit 1 offset %d));"
+
+/* The object (%Q), the manager (%Q), the instance (%"PRId32"), the
+   sender's bus name (%Q) and the manager (%Q).  */
+#define QUERY_FEEDBACK_ACK						\
+  "update feedback_subscribers"						\
+  " set acked = max (acked,"						\
+  "  coalesce ((select max (seq) from feedback_outbox"			\
+  "             where uuid = %Q and parent_uuid = %Q"			\
+  "              and instance <= %"PRId32"), 0))"			\
+  " where bus_name = %Q and parent_uuid = %Q;"
+
+/* The content index (content_hash_worker and local_copy_lookup).  */
+
+/* No arguments.  */
+#define QUERY_CONTENT_HASH_SALT						\
+  "select salt from content_hash_salt;"
+
+/* The maximum number of files (%d).  */
+#define QUERY_CONTENT_HASH_UNHASHED					\
+  "select uuid, instance, filename from object_instance_files"		\
+  " where content_hash is null limit %d;"
+
+/* The hash (%Q), the file's size (%"PRId64") and mtime (%"PRId64"),
+   the object (%Q), the instance (%d) and the filename (%Q).  */
+#define QUERY_CONTENT_HASH_SET						\
+  "update object_instance_files"					\
+  " set content_hash = %Q, hashed_size = %"PRId64","			\
+  "  hashed_mtime = %"PRId64						\
+  " where uuid = %Q and instance = %d and filename = %Q;"
+
+/* The URL (%Q) and the object (%Q).  */
+#define QUERY_LOCAL_COPY_LOOKUP						\
+  "select c.filename, c.hashed_size, c.hashed_mtime"			\
+  " from object_versions as v"						\
+  " join objects as o on o.uuid = v.uuid"				\
+  " join object_instance_files as f"					\
+  "  on f.uuid = o.uuid and f.instance = o.instance - 1"		\
+  " join object_instance_files as c on c.content_hash = f.content_hash"	\
+  " join object_instance_status as s"					\
+  "  on s.uuid = c.uuid and s.instance = c.instance"			\
+  " where v.url = %Q and v.uuid != %Q and o.TransferFrequency = 0"	\
+  "  and f.content_hash != ''"						\
+  "  and (select count (*) from object_versions"			\
+  "       where uuid = o.uuid) = 1"					\
+  "  and (select count (*) from object_instance_files"			\
+  "       where uuid = f.uuid and instance = f.instance) = 1"		\
+  "  and s.status = 0 and coalesce (s.deleted, 0) = 0"			\
+  "  and s.compressed_size is null"					\
+  " limit 8;"
+
+/* The disk usage index (disk_usage_update, disk_usage_changed and
+   disk_usage_worker).  */
+
+/* The filename (%Q), its size (%"PRId64") and the filename again
+   (%Q).  The resulting WHERE clause is passed to
+   QUERY_DISK_USAGE_OBJECTS and QUERY_DISK_USAGE_UPDATE.  */
+#define QUERY_DISK_USAGE_WHERE						\
+  " where filename = %Q and coalesce (size, -1) != %"PRId64		\
+  "  and instance = (select max (instance) from object_instance_files"	\
+  "                  as g where g.uuid = object_instance_files.uuid"	\
+  "                   and g.filename = %Q)"
+
+/* The WHERE clause (%s).  */
+#define QUERY_DISK_USAGE_OBJECTS					\
+  "select uuid from object_instance_files%s;"
+
+/* The size (%"PRId64") and the WHERE clause (%s).  */
+#define QUERY_DISK_USAGE_UPDATE						\
+  "update object_instance_files set size = %"PRId64"%s;"
+
+/* The object (%Q).  */
+#define QUERY_DISK_USAGE_CHANGED					\
+  "select objects.uuid, streams.uuid, streams.parent_uuid"		\
+  " from objects left join streams on streams.uuid = objects.parent_uuid" \
+  " where objects.uuid = %Q;"
+
+/* The maximum number of files (%d).  */
+#define QUERY_DISK_USAGE_UNSIZED					\
+  "select uuid, instance, filename,"					\
+  "  exists (select 1 from object_instance_files as g"			\
+  "          where g.uuid = f.uuid and g.filename = f.filename"		\
+  "           and g.instance > f.instance)"				\
+  " from object_instance_files as f where size is null limit %d;"
+
+/* The size (%"PRId64"), the object (%Q), the instance (%d) and the
+   filename (%Q).  */
+#define QUERY_DISK_USAGE_SET_SIZE					\
+  "update object_instance_files set size = %"PRId64			\
+  " where uuid = %Q and instance = %d and filename = %Q;"
+
+/* Cold objects (cold_objects_worker).  */
+
+/* The minimum size (%d), the current time (%"PRId64"), the time
+   before which a deletion request may be repeated (%"PRId64"), the
+   time before which an object must have been last transferred and
+   used (%"PRId64", twice), the precious deletion policy (%d) and the
+   maximum number of objects (%d).  */
+#define QUERY_COLD_OBJECTS						\
+  "select s.uuid, s.instance, objects.Cookie,"				\
+  "  streams.uuid, streams.Cookie,"					\
+  "  managers.uuid, managers.Cookie, managers.DBusServiceName"		\
+  " from object_instance_status as s"					\
+  " join objects on objects.uuid = s.uuid"				\
+  " join streams on streams.uuid = objects.parent_uuid"			\
+  " join managers on managers.uuid = streams.parent_uuid"		\
+  " where coalesce (s.deleted, 0) = 0"					\
+  "  and s.compressed_size is null"					\
+  "  and s.object_size >= %d"						\
+  "  and coalesce (s.preserve_until, 0) < %"PRId64			\
+  "  and coalesce (s.delete_requested, 0) < %"PRId64			\
+  "  and coalesce (s.transfer_time, 0) < %"PRId64			\
+  "  and s.instance = (select max (instance) from object_instance_status" \
+  "                    where uuid = s.uuid)"				\
+  "  and not exists (select 1 from object_use"				\
+  "                  where object_use.uuid = s.uuid"			\
+  "                   and object_use.start + max (object_use.duration, 0)" \
+  "                       >= %"PRId64")"				\
+  /* It has files, none of which are precious.  */			\
+  "  and exists (select 1 from object_instance_files as f"		\
+  "              where f.uuid = s.uuid and f.instance = s.instance)"	\
+  "  and not exists (select 1 from object_instance_files as f"		\
+  "                  where f.uuid = s.uuid and f.instance = s.instance"	\
+  "                   and f.deletion_policy = %d)"			\
+  " order by s.object_size desc"					\
+  " limit %d;"
+
+/* The object (%Q) and the instance (%d).  */
+#define QUERY_COLD_OBJECT_FILES						\
+  "select filename, dedicated, deletion_policy"				\
+  " from object_instance_files where uuid = %Q and instance = %d;"
+
+/* Registration, lookups and listings (object_register, lookup_by,
+   list_page and the woodchuck_*_list_* functions).  */
+
+/* The table (%s) and the UUID (%Q).  */
+#define QUERY_UUID_EXISTS						\
+  "select 1 from %s where uuid = %Q;"
+
+/* The table (%s), the additional columns (%s), the new uuid (%Q),
+   the parent (%Q), the additional values (%s), the table again (%s),
+   the parent again (%Q) and the cookie (%Q).  Inserts the row only if
+   no sibling has the same cookie.  */
+#define QUERY_REGISTER_UNIQUE						\
+  "insert or abort into %s"						\
+  " (uuid, parent_uuid%s) select %Q, %Q%s"				\
+  " where not exists"							\
+  "  (select 1 from %s where parent_uuid = %Q and cookie = %Q);"
+
+/* The columns (%s), the table (%s), the column to match (%s), its
+   value (%Q) and the parent (%Q).  */
+#define QUERY_LOOKUP_BY_PARENT						\
+  "select %s from %s where %s = %Q and parent_uuid = %Q;"
+
+/* The columns (%s), the table (%s), the column to match (%s) and its
+   value (%Q).  */
+#define QUERY_LOOKUP_BY							\
+  "select %s from %s where %s = %Q;"
+
+/* Recursive common table expressions were introduced in SQLite
+   3.8.3.  Without them, we fall back to walking the manager hierarchy
+   one query at a time.  */
+#if SQLITE_VERSION_NUMBER >= 3008003
+# define HAVE_SQLITE_RECURSIVE_CTE 1
+
+/* A common table expression, DESCENDENTS, which contains the uuid,
+   cookie, human readable name and parent of every manager descended
+   from the manager whose UUID is passed as an argument (using %Q).
+   Rows are produced breadth first.  */
+# define MANAGER_DESCENDENTS_CTE					\
+  "with recursive"							\
+  " descendents (uuid, Cookie, HumanReadableName, parent_uuid) as"	\
+  " (select uuid, Cookie, HumanReadableName, parent_uuid"		\
+  "   from managers where parent_uuid = %Q"				\
+  "  union all"								\
+  "  select managers.uuid, managers.Cookie, managers.HumanReadableName," \
+  "   managers.parent_uuid"						\
+  "   from managers join descendents"					\
+  "   on managers.parent_uuid = descendents.uuid)"
+
+/* The ancestor (%Q), the columns (%s), the column to match (%s) and
+   its value (%Q).  */
+# define QUERY_LOOKUP_BY_MANAGER_RECURSIVE				\
+  MANAGER_DESCENDENTS_CTE						\
+  " select %s from managers where %s = %Q"				\
+  "  and uuid in (select uuid from descendents);"
+
+/* The ancestor (%Q), the columns (%s), the table (%s), the column to
+   match (%s), its value (%Q) and the ancestor again (%Q).  */
+# define QUERY_LOOKUP_BY_STREAM_RECURSIVE				\
+  MANAGER_DESCENDENTS_CTE						\
+  " select %s from %s where %s = %Q"					\
+  "  and (parent_uuid = %Q"						\
+  "       or parent_uuid in (select uuid from descendents));"
+
+/* The ancestor (%Q).  */
+# define QUERY_LIST_MANAGERS_RECURSIVE					\
+  MANAGER_DESCENDENTS_CTE						\
+  " select uuid, Cookie, HumanReadableName, parent_uuid"		\
+  " from descendents;"
+#endif
+
+/* The parent (%Q).  */
+#define QUERY_LIST_MANAGERS						\
+  "select uuid, Cookie, HumanReadableName, parent_uuid"			\
+  " from managers where parent_uuid = %Q;"
+
+/* The manager (%Q).  */
+#define QUERY_LIST_STREAMS						\
+  "select uuid, Cookie, HumanReadablename from streams"			\
+  " where parent_uuid=%Q;"
+
+/* The stream (%Q).  */
+#define QUERY_LIST_OBJECTS						\
+  "select uuid, Cookie, HumanReadableName from objects"			\
+  " where parent_uuid=%Q;"
+
+/* The table (%s), the parent (%Q), the cursor (%Q) and the maximum
+   number of rows (%d).  */
+#define QUERY_LIST_PAGE							\
+  "select uuid, Cookie, HumanReadableName from %s"			\
+  " where parent_uuid = %Q and uuid > %Q"				\
+  " order by uuid limit %d;"
+
+/* Status reports (woodchuck_stream_update_status,
+   woodchuck_object_transfer_status and
+   woodchuck_object_files_deleted).  */
+
+/* The quoted stream (%s).  */
+#define QUERY_STREAM_INSTANCE						\
+  "select instance, parent_uuid from streams where uuid = %s;"
+
+/* The quoted object (%s).  */
+#define QUERY_OBJECT_INSTANCE						\
+  "select instance, parent_uuid from objects where uuid = %s;"
+
+/* The assignments (%s) and the quoted object (%s, twice).  */
+#define QUERY_FILES_DELETED						\
+  "update object_instance_status set %s"				\
+  " where uuid = %s"							\
+  " and instance"							\
+  "  = (select max (instance) from object_instance_status where uuid = %s);"
+
+/* Properties (property_get and property_get_all).  */
+
+/* The columns (%s), the table (%s) and the object (%Q).  */
+#define QUERY_PROPERTY_GET						\
+  "select %s from %s where uuid = %Q;"
+
+/* The expressions of the computed properties.  */
+#define QUERY_STREAM_LAST_UPDATE_TIME					\
+  "(select transfer_time from stream_updates"				\
+  " where stream_updates.uuid = streams.uuid and status = 0"		\
+  " order by instance desc limit 1)"
+#define QUERY_STREAM_LAST_UPDATE_ATTEMPT_TIME				\
+  "(select transfer_time from stream_updates"				\
+  " where stream_updates.uuid = streams.uuid"				\
+  " order by instance desc limit 1)"
+#define QUERY_STREAM_LAST_UPDATE_ATTEMPT_STATUS				\
+  "(select status from stream_updates"					\
+  " where stream_updates.uuid = streams.uuid"				\
+  " order by instance desc limit 1)"
+#define QUERY_OBJECT_LAST_TRANSFER_TIME					\
+  "(select transfer_time from object_instance_status"			\
+  " where object_instance_status.uuid = objects.uuid and status = 0"	\
+  " order by instance desc limit 1)"
+#define QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_TIME				\
+  "(select transfer_time from object_instance_status"			\
+  " where object_instance_status.uuid = objects.uuid"			\
+  " order by instance desc limit 1)"
+#define QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_STATUS			\
+  "(select status from object_instance_status"				\
+  " where object_instance_status.uuid = objects.uuid"			\
+  " order by instance desc limit 1)"
+
+/* Unregistration (object_unregister and unregister_reap).  */
+
+/* The table (%s) and the quoted uuid (%s).  */
+#define QUERY_UNREGISTER_EXISTS						\
+  "select uuid from %s where uuid = %s;"
+
+/* The child table (%s) and the quoted parent (%s).  */
+#define QUERY_UNREGISTER_CHILDREN					\
+  "select uuid from %s where parent_uuid = %s;"
+
+/* The table (%s) and the quoted uuid (%s).  */
+#define QUERY_UNREGISTER_DELETE						\
+  "delete from %s where uuid = %s;"
+
+/* The child table (%s) and the quoted parent (%s).  */
+#define QUERY_UNREGISTER_DELETE_CHILDREN				\
+  "delete from %s where parent_uuid = %s;"
+
+/* The table (%s, twice), the quoted parent (%s) and the maximum
+   number of rows (%d).  */
+#define QUERY_UNREGISTER_REAP						\
+  "delete from %s where rowid in"					\
+  " (select rowid from %s where parent_uuid = %s limit %d);"
+
+#endif
@@ -0,0 +1,400 @@
+/* murmeltier-schema.c - Murmeltier's database schema.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sqlite3.h>
+
+#include "murmeltier-schema.h"
+#include "debug.h"
+#include "util.h"
+
+/* The database schema is versioned using SQLite's user_version
+   pragma.  The version is the number of entries in SCHEMA_MIGRATIONS
+   that have been applied.  Databases created before the schema was
+   versioned have version 0; the first migration is idempotent so that
+   it can be applied to them.
+
+   To change the schema, append a migration; never modify one that has
+   been released.  SQLite's ALTER TABLE can only rename tables and add
+   columns.  Other layout changes (e.g., changing a table's key) are
+   done by creating the new table, copying the rows, dropping the old
+   table and renaming the new one, and then recreating its indexes.
+   Each migration is applied in its own transaction together with the
+   version update.  */
+struct schema_migration
+{
+  /* A short description, for the log.  */
+  const char *description;
+  /* SQL to execute.  May be NULL.  */
+  const char *sql;
+  /* A function to call after executing SQL, for changes that can't be
+     expressed in SQL alone.  May be NULL.  Returns an SQLite error
+     code and sets *ERRMSG on failure.  */
+  int (*func) (sqlite3 *db, char **errmsg);
+};
+
+/* Add the managers.Enabled column unless the table already has it.
+   The column was added to the managers table's definition after
+   its first release.  */
+static int
+schema_add_managers_enabled (sqlite3 *db, char **errmsg)
+{
+  bool have_enabled = false;
+  int callback (void *cookie, int argc, char **argv, char **names)
+  {
+    int i;
+    for (i = 0; i < argc; i ++)
+      if (strcmp (names[i], "name") == 0 && argv[i]
+	  && strcasecmp (argv[i], "Enabled") == 0)
+	have_enabled = true;
+    return 0;
+  }
+
+  int err = sqlite3_exec (db, "pragma table_info (managers);",
+			  callback, NULL, errmsg);
+  if (err || have_enabled)
+    return err;
+
+  return sqlite3_exec (db,
+		       "alter table managers add column Enabled default 1;",
+		       NULL, NULL, errmsg);
+}
+
+static const struct schema_migration schema_migrations[] =
+  {
+    { "Initial schema",
+      "create table if not exists managers"
+      " (uuid PRIMARY KEY, parent_uuid NOT NULL, HumanReadableName,"
+      "  DBusServiceName, DBusObject, Cookie, Priority, Enabled default 1,"
+      "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
+      "create index if not exists managers_cookie_index on managers (cookie);"
+      "create index if not exists managers_parent_uuid_index on managers"
+      " (parent_uuid);"
+
+      "create table if not exists streams"
+      " (uuid PRIMARY KEY, parent_uuid NOT NULL, instance,"
+      "  HumanReadableName, Cookie, Priority, Freshness, ObjectsMostlyInline,"
+      "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
+      "create index if not exists streams_cookie_index on streams (cookie);"
+      "create index if not exists streams_parent_uuid_index"
+      " on streams (parent_uuid);"
+
+      "create table if not exists stream_updates"
+      " (uuid NOT NULL, instance, parent_uuid NOT NULL,"
+      "  status, indicator, transferred_up, transferred_down,"
+      "  transfer_time, transfer_duration,"
+      "  new_objects, updated_objects, objects_inline,"
+      "  UNIQUE (uuid, instance));"
+      "create index if not exists stream_updates_parent_uuid_index"
+      " on stream_updates (parent_uuid);"
+
+      "create table if not exists objects"
+      " (uuid PRIMARY KEY, parent_uuid NOT NULL,"
+      "  Instance DEFAULT 0, HumanReadableName, Cookie, Filename, Wakeup,"
+      "  TriggerTarget, TriggerEarliest, TriggerLatest,"
+      "  TransferFrequency,"
+      "  DontTransfer DEFAULT 0, NeedUpdate, Priority,"
+      "  DiscoveryTime, PublicationTime,"
+      "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
+      "create index if not exists objects_cookie_index on objects (cookie);"
+      "create index if not exists objects_parent_uuid_index"
+      " on objects (parent_uuid);"
+
+      /* The available versions of an object.  Columns are as per the
+	 org.woodchuck.Object.Versions property.  */
+      "create table if not exists object_versions"
+      " (uuid NOT NULL, version NOT NULL, parent_uuid NOT NULL,"
+      "  url, expected_size, expected_transfer_up, expected_transfer_down,"
+      "  utility, use_simple_transferer,"
+      "  UNIQUE (uuid, version, url));"
+      "create index if not exists object_versions_parent_uuid_index"
+      " on object_versions (parent_uuid);"
+
+      /* An object instance's status.  Columns are as per
+	 org.woodchuck.object.TransferStatus.  */
+      "create table if not exists object_instance_status"
+      " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
+      "  status, transferred_up, transferred_down,"
+      "  transfer_time, transfer_duration, object_size, indicator,"
+      "  deleted, preserve_until, compressed_size,"
+      "  UNIQUE (uuid, instance));"
+      "create index if not exists object_status_parent_uuid_index"
+      " on object_instance_status (parent_uuid);"
+
+      "create table if not exists object_instance_files"
+      " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
+      "  filename, dedicated, deletion_policy,"
+      "  UNIQUE (uuid, instance, filename));"
+      "create index if not exists object_instance_files_parent_uuid_index"
+      " on object_instance_files (parent_uuid);"
+
+      "create table if not exists object_use"
+      " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
+      "  reported, start, duration, use_mask);"
+      "create index if not exists object_use_parent_uuid_index"
+      " on object_use (parent_uuid);",
+      NULL },
+    { "Add managers.Enabled", NULL, schema_add_managers_enabled },
+    /* Used by the cookie uniqueness check in object_register.  */
+    { "Index cookies by parent",
+      "create index if not exists managers_parent_uuid_cookie_index"
+      " on managers (parent_uuid, cookie);"
+      "create index if not exists streams_parent_uuid_cookie_index"
+      " on streams (parent_uuid, cookie);"
+      "create index if not exists objects_parent_uuid_cookie_index"
+      " on objects (parent_uuid, cookie);",
+      NULL },
+    /* Managers and streams that have been unregistered, but whose
+       descendents have not yet been deleted.  See unregister_reap.  */
+    { "Add pending_unregistrations",
+      "create table pending_unregistrations (uuid PRIMARY KEY);",
+      NULL },
+    /* Used when unregistering an object.  Found by murmeltier-bench
+       query-plans.  */
+    { "Index object_use by uuid",
+      "create index object_use_uuid_index on object_use (uuid, instance);",
+      NULL },
+    /* ListStreamsFrom and ListObjectsFrom return a parent's children
+       ordered by uuid.  These indexes make that order free and
+       subsume the indexes on parent_uuid alone.  */
+    { "Index streams and objects by parent and uuid",
+      "create index streams_parent_uuid_uuid_index"
+      " on streams (parent_uuid, uuid);"
+      "drop index if exists streams_parent_uuid_index;"
+      "create index objects_parent_uuid_uuid_index"
+      " on objects (parent_uuid, uuid);"
+      "drop index if exists objects_parent_uuid_index;",
+      NULL },
+    /* Feedback (ObjectTransferred upcalls) that has not yet been
+       acknowledged.  UUID is the object's UUID and PARENT_UUID its
+       manager's.  SEQ orders the entries; AUTOINCREMENT ensures that
+       it is never reused, even after the outbox empties, as
+       subscribers' cursors refer to it.  The remaining columns are
+       the upcall's arguments; VERSION through USE_SIMPLE_TRANSFERER
+       are the fields of the Version structure.  */
+    { "Add feedback_outbox",
+      "create table feedback_outbox"
+      " (seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "  uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
+      "  manager_cookie, stream_uuid, stream_cookie, object_cookie,"
+      "  status, version, url, expected_size, expected_transfer_up,"
+      "  expected_transfer_down, utility, use_simple_transferer,"
+      "  filename, object_size, trigger_target, trigger_fired,"
+      "  queued DEFAULT (strftime ('%s', 'now')));"
+      "create index feedback_outbox_parent_uuid_index"
+      " on feedback_outbox (parent_uuid);"
+      "create index feedback_outbox_uuid_index"
+      " on feedback_outbox (uuid, instance);",
+      NULL },
+    /* The space that has been reclaimed from cold objects, per
+       manager (PARENT_UUID), in bytes.  DELETED counts the size of
+       deleted objects and COMPRESSED the bytes saved by compressing
+       objects.  DELETE_REQUESTED is when murmeltier last asked the
+       application to delete an object instance.  See
+       cold_objects_worker.  */
+    { "Add space_reclaimed",
+      "create table space_reclaimed"
+      " (parent_uuid PRIMARY KEY, deleted DEFAULT 0, compressed DEFAULT 0);"
+      "alter table object_instance_status add column delete_requested;",
+      NULL },
+    /* The content index.  CONTENT_HASH is the keyed hash of a file's
+       content (or the empty string if it couldn't be read),
+       HASHED_SIZE and HASHED_MTIME the file's size and modification
+       time when it was hashed.  The key is in CONTENT_HASH_SALT.  See
+       content_hash_worker and local_copy_lookup.  */
+    { "Add the content index",
+      "alter table object_instance_files add column content_hash;"
+      "alter table object_instance_files add column hashed_size;"
+      "alter table object_instance_files add column hashed_mtime;"
+      "create index object_instance_files_content_hash_index"
+      " on object_instance_files (content_hash);"
+      "create index object_versions_url_index on object_versions (url);"
+      "create table content_hash_salt (salt);"
+      "insert into content_hash_salt (salt) values (hex (randomblob (16)));",
+      NULL },
+    /* The disk usage index.  SIZE is the number of bytes a file
+       occupies (NULL if not yet known, 0 if it no longer exists or
+       was superseded by a newer instance's file with the same name).
+       DISKUSAGE is the sum of the sizes of an object's files, of a
+       stream's objects and of a manager's streams; the triggers keep
+       it up to date.  See disk_usage_refresh and disk_usage_worker.  */
+    { "Add the disk usage index",
+      "alter table object_instance_files add column size;"
+      "alter table objects add column DiskUsage DEFAULT 0;"
+      "alter table streams add column DiskUsage DEFAULT 0;"
+      "alter table managers add column DiskUsage DEFAULT 0;"
+      "create index object_instance_files_filename_index"
+      " on object_instance_files (filename);"
+      "create index object_instance_files_size_index"
+      " on object_instance_files (size);"
+      "create trigger object_instance_files_insert_disk_usage"
+      " after insert on object_instance_files"
+      " begin"
+      "  update objects set DiskUsage = DiskUsage + coalesce (new.size, 0)"
+      "   where uuid = new.uuid;"
+      " end;"
+      "create trigger object_instance_files_update_disk_usage"
+      " after update of size on object_instance_files"
+      " begin"
+      "  update objects set DiskUsage = DiskUsage"
+      "    - coalesce (old.size, 0) + coalesce (new.size, 0)"
+      "   where uuid = new.uuid;"
+      " end;"
+      "create trigger object_instance_files_delete_disk_usage"
+      " after delete on object_instance_files"
+      " begin"
+      "  update objects set DiskUsage = DiskUsage - coalesce (old.size, 0)"
+      "   where uuid = old.uuid;"
+      " end;"
+      "create trigger objects_update_disk_usage"
+      " after update of DiskUsage on objects"
+      " begin"
+      "  update streams set DiskUsage = DiskUsage"
+      "    - old.DiskUsage + new.DiskUsage"
+      "   where uuid = new.parent_uuid;"
+      " end;"
+      "create trigger objects_delete_disk_usage"
+      " after delete on objects"
+      " begin"
+      "  update streams set DiskUsage = DiskUsage - old.DiskUsage"
+      "   where uuid = old.parent_uuid;"
+      " end;"
+      "create trigger streams_update_disk_usage"
+      " after update of DiskUsage on streams"
+      " begin"
+      "  update managers set DiskUsage = DiskUsage"
+      "    - old.DiskUsage + new.DiskUsage"
+      "   where uuid = new.parent_uuid;"
+      " end;"
+      "create trigger streams_delete_disk_usage"
+      " after delete on streams"
+      " begin"
+      "  update managers set DiskUsage = DiskUsage - old.DiskUsage"
+      "   where uuid = old.parent_uuid;"
+      " end;",
+      NULL },
+    /* The energy model.  ENERGY_RUNS records each scheduler run: the
+       connection's MEDIUM, the number of TRANSFERS it started (or, if
+       DEFERRED, would have started), their EXPECTED_BYTES and
+       ESTIMATED_JOULES, and the energy remaining in the battery when
+       it started (BATTERY_MJ, in millijoules, NULL if charging).
+       ENERGY_MODEL holds, per medium, the sums needed to fit a linear
+       model to the energy consumed between runs.  See
+       energy_model_update.  */
+    { "Add the energy model",
+      "create table energy_runs"
+      " (time, medium, transfers, expected_bytes, estimated_joules,"
+      "  battery_mj, deferred);"
+      "create index energy_runs_time_index on energy_runs (time);"
+      "create table energy_model"
+      " (medium PRIMARY KEY, n DEFAULT 0,"
+      "  s_t DEFAULT 0, s_b DEFAULT 0, s_e DEFAULT 0,"
+      "  s_tt DEFAULT 0, s_tb DEFAULT 0, s_bb DEFAULT 0,"
+      "  s_te DEFAULT 0, s_be DEFAULT 0);"
+      "create index object_instance_status_transfer_time_index"
+      " on object_instance_status (transfer_time);"
+      "create index stream_updates_transfer_time_index"
+      " on stream_updates (transfer_time);",
+      NULL },
+    /* Feedback subscribers.  SUBSCRIBER is the manager's
+       DBusServiceName if the subscriber owns it and otherwise the
+       subscriber's unique bus name; BUS_NAME is the bus name from
+       which it last subscribed to the manager PARENT_UUID.  ACKED is
+       the seq of the last feedback_outbox entry that it acknowledged.
+       An entry is deleted once every subscriber to its manager
+       acknowledged it.  See feedback_subscribers_sync.  */
+    { "Add feedback_subscribers",
+      "create table feedback_subscribers"
+      " (subscriber NOT NULL, parent_uuid NOT NULL, bus_name,"
+      "  acked DEFAULT 0, PRIMARY KEY (subscriber, parent_uuid));"
+      "create index feedback_subscribers_bus_name_index"
+      " on feedback_subscribers (bus_name, parent_uuid);",
+      NULL },
+    /* Reaping an unregistered manager's subscribers looks them up by
+       manager, which the primary key does not cover.  Found by
+       murmeltier-bench query-plans.  */
+    { "Index feedback_subscribers by manager",
+      "create index feedback_subscribers_parent_uuid_index"
+      " on feedback_subscribers (parent_uuid);",
+      NULL },
+  };
+
+int
+murmeltier_schema_migrate (sqlite3 *db)
+{
+  uint64_t start = now ();
+
+  int version = -1;
+  int version_callback (void *cookie, int argc, char **argv, char **names)
+  {
+    version = atoi (argv[0]);
+    return 0;
+  }
+
+  char *errmsg = NULL;
+  sqlite3_exec (db, "pragma user_version;", version_callback, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "Reading schema version: %s", errmsg);
+      sqlite3_free (errmsg);
+      return 1;
+    }
+
+  int latest = sizeof (schema_migrations) / sizeof (schema_migrations[0]);
+  if (version > latest)
+    {
+      debug (0, "Database schema version %d is newer than this version "
+	     "of murmeltier supports (%d).  Please upgrade.",
+	     version, latest);
+      return 1;
+    }
+
+  int initial_version = version;
+  for (; version < latest; version ++)
+    {
+      const struct schema_migration *m = &schema_migrations[version];
+
+      debug (0, "Migrating schema from version %d to %d: %s",
+	     version, version + 1, m->description);
+
+      sqlite3_exec (db, "begin immediate transaction;", NULL, NULL, &errmsg);
+      if (! errmsg && m->sql)
+	sqlite3_exec (db, m->sql, NULL, NULL, &errmsg);
+      if (! errmsg && m->func)
+	m->func (db, &errmsg);
+      if (! errmsg)
+	sqlite3_exec_printf (db, "pragma user_version = %d;",
+			     NULL, NULL, &errmsg, version + 1);
+      if (! errmsg)
+	sqlite3_exec (db, "end transaction;", NULL, NULL, &errmsg);
+      if (errmsg)
+	{
+	  debug (0, "Migrating schema to version %d (%s): %s",
+		 version + 1, m->description, errmsg);
+	  sqlite3_free (errmsg);
+	  sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+	  return 1;
+	}
+    }
+
+  debug (0, "Schema version %d (was %d), checked in "TIME_FMT".",
+	 version, initial_version, TIME_PRINTF (now () - start));
+
+  return 0;
+}
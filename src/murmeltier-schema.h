@@ -0,0 +1,28 @@
+/* murmeltier-schema.h - Murmeltier's database schema.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef MURMELTIER_SCHEMA_H
+#define MURMELTIER_SCHEMA_H
+
+#include <sqlite3.h>
+
+/* Create the tables and indexes that murmeltier uses in DB or, if DB
+   was created by an older version of murmeltier, bring them up to
+   date.  Returns 0 on success.  */
+extern int murmeltier_schema_migrate (sqlite3 *db);
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <error.h>
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -31,6 +32,10 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
 
 #include "murmeltier-dbus-server.h"
 
@@ -39,6 +44,11 @@
 #include "debug.h"
 #include "util.h"
 #include "dotdir.h"
+#include "murmeltier-schema.h"
+#include "murmeltier-queries.h"
+#include "simple-transferer.h"
+#include "md5.h"
+#include "timers.h"
 
 #define G_MURMELTIER_ERROR murmeltier_error_quark ()
 static GQuark
@@ -54,6 +64,22 @@ struct subscription
   char *dbus_name;
   DBusGProxy *proxy;
   char *handle;
+  /* The name under which the subscriber's acknowledgements are
+     recorded in feedback_subscribers or NULL if not yet known.  See
+     feedback_subscriber_cb.  */
+  char *subscriber;
+  /* Whether the subscriber's row in feedback_subscribers exists and
+     CURSOR was initialized from it.  */
+  bool registered;
+  /* The sequence number of the last feedback_outbox entry that the
+     subscriber received.  */
+  int64_t cursor;
+  /* The number of upcalls to the subscriber whose replies are
+     outstanding.  */
+  int in_flight;
+  /* If not zero, delivering feedback to the subscriber failed.  Don't
+     try again until this time (in ms since the epoch).  */
+  uint64_t stalled_until;
   char data[];
 };
 
@@ -104,7 +130,45 @@ struct _Murmeltier
 static Murmeltier *mt;
 
 static char *db_filename;
-static sqlite3 *db;
+/* Every thread must have its own sqlite3 instance.  The main thread's
+   and the D-Bus server's worker threads' are opened by
+   woodchuck_thread_init.  */
+static __thread sqlite3 *db;
+
+/* Held while a D-Bus worker thread executes a method that modifies the
+   database and while unregister_reap runs.  The main thread never
+   blocks on it: it only tries to take it and, if that fails, tries
+   again later.  */
+static GStaticMutex db_write_lock = G_STATIC_MUTEX_INIT;
+
+static GThread *main_thread;
+
+/* Configure DB, a connection that the calling thread just opened.  */
+static void
+db_setup (sqlite3 *db)
+{
+  /* Wait a while before timing out.  */
+  sqlite3_busy_timeout (db, 5 * 60 * 1000);
+
+  /* With a write-ahead log, readers don't wait for a writer to commit
+     and a writer doesn't wait for readers to finish.  Otherwise, a
+     query on the main thread could wait up to the busy timeout for a
+     worker thread's transaction.  */
+  char *errmsg = NULL;
+  sqlite3_exec (db, "pragma journal_mode=wal;", NULL, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "Enabling write-ahead logging: %s", errmsg);
+      sqlite3_free (errmsg);
+    }
+}
+
+/* The maximum number of objects that the simple transferer transfers
+   at once.  */
+#define SIMPLE_TRANSFERER_TRANSFERS 2
+/* The maximum rate at which the simple transferer transfers an
+   object, in bytes per second.  */
+#define SIMPLE_TRANSFERER_BYTES_PER_SECOND (256 * 1024)
 
 extern GType murmeltier_get_type (void);
 
@@ -113,55 +177,77 @@ struct property
   char *name;
   GType type;
   bool readwrite;
+  /* An SQL expression that evaluates to the property's value in the
+     context of the object's row, or NULL if the value is stored in
+     the column named after the property.  Such properties can't be
+     set when the object is registered.  */
+  const char *sql;
 };
 
 static struct property manager_properties[]
-  = { { "HumanReadableName", G_TYPE_STRING, true },
-      { "DBusServiceName", G_TYPE_STRING, true },
-      { "DBusObject", G_TYPE_STRING, true },
-      { "Cookie", G_TYPE_STRING, true },
-      { "Priority", G_TYPE_UINT, true },
-      { "PublicationTime", G_TYPE_UINT64, true },
-      { "Enabled", G_TYPE_BOOLEAN, true },
+  = { { "HumanReadableName", G_TYPE_STRING, true, NULL },
+      { "DBusServiceName", G_TYPE_STRING, true, NULL },
+      { "DBusObject", G_TYPE_STRING, true, NULL },
+      { "Cookie", G_TYPE_STRING, true, NULL },
+      { "Priority", G_TYPE_UINT, true, NULL },
+      /* Not stored.  */
+      { "PublicationTime", G_TYPE_UINT64, true, "NULL" },
+      { "Enabled", G_TYPE_BOOLEAN, true, NULL },
       /* Readonly.  */
-      { "RegistrationTime", G_TYPE_UINT64, false },
-      { "ParentUUID", G_TYPE_STRING, false },
-      { NULL, G_TYPE_INVALID, false }
+      { "RegistrationTime", G_TYPE_UINT64, false, NULL },
+      { "ParentUUID", G_TYPE_STRING, false, "parent_uuid" },
+      /* Maintained by triggers.  See disk_usage_update.  */
+      { "DiskUsage", G_TYPE_UINT64, false, "DiskUsage" },
+      { NULL, G_TYPE_INVALID, false, NULL }
 };
 
 static struct property stream_properties[]
-  = { { "HumanReadableName", G_TYPE_STRING, true },
-      { "Cookie", G_TYPE_STRING, true },
-      { "Priority", G_TYPE_UINT, true },
-      { "Freshness", G_TYPE_UINT, true },
-      { "ObjectsMostlyInline", G_TYPE_BOOLEAN, true },
+  = { { "HumanReadableName", G_TYPE_STRING, true, NULL },
+      { "Cookie", G_TYPE_STRING, true, NULL },
+      { "Priority", G_TYPE_UINT, true, NULL },
+      { "Freshness", G_TYPE_UINT, true, NULL },
+      { "ObjectsMostlyInline", G_TYPE_BOOLEAN, true, NULL },
       /* Readonly.  */
-      { "RegistrationTime", G_TYPE_UINT64, false },
-      { "ParentUUID", G_TYPE_STRING, false },
-      { NULL, G_TYPE_INVALID, false }
+      { "RegistrationTime", G_TYPE_UINT64, false, NULL },
+      { "ParentUUID", G_TYPE_STRING, false, "parent_uuid" },
+      { "LastUpdateTime", G_TYPE_UINT64, false,
+	QUERY_STREAM_LAST_UPDATE_TIME },
+      { "LastUpdateAttemptTime", G_TYPE_UINT64, false,
+	QUERY_STREAM_LAST_UPDATE_ATTEMPT_TIME },
+      { "LastUpdateAttemptStatus", G_TYPE_UINT, false,
+	QUERY_STREAM_LAST_UPDATE_ATTEMPT_STATUS },
+      { "DiskUsage", G_TYPE_UINT64, false, "DiskUsage" },
+      { NULL, G_TYPE_INVALID, false, NULL }
 };
 
 static struct property object_properties[]
-  = { { "HumanReadableName", G_TYPE_STRING, true },
-      { "Cookie", G_TYPE_STRING, true },
+  = { { "HumanReadableName", G_TYPE_STRING, true, NULL },
+      { "Cookie", G_TYPE_STRING, true, NULL },
       /* This is filled in in properties_init.  */
-      { "Versions", G_TYPE_INVALID, true },
-      { "Filename", G_TYPE_STRING, true },
-      { "Wakeup", G_TYPE_BOOLEAN, true },
-      { "TriggerTarget", G_TYPE_UINT64, true },
-      { "TriggerEarliest", G_TYPE_UINT64, true },
-      { "TriggerLatest", G_TYPE_UINT64, true },
-      { "TransferFrequency", G_TYPE_UINT, true },
-      { "DontTransfer", G_TYPE_BOOLEAN, true },
-      { "NeedUpdate", G_TYPE_BOOLEAN, true },
-      { "Priority", G_TYPE_UINT, true },
-      { "DiscoveryTime", G_TYPE_UINT64, true },
-      { "PublicationTime", G_TYPE_UINT64, true },
+      { "Versions", G_TYPE_INVALID, true, NULL },
+      { "Filename", G_TYPE_STRING, true, NULL },
+      { "Wakeup", G_TYPE_BOOLEAN, true, NULL },
+      { "TriggerTarget", G_TYPE_UINT64, true, NULL },
+      { "TriggerEarliest", G_TYPE_UINT64, true, NULL },
+      { "TriggerLatest", G_TYPE_UINT64, true, NULL },
+      { "TransferFrequency", G_TYPE_UINT, true, NULL },
+      { "DontTransfer", G_TYPE_BOOLEAN, true, NULL },
+      { "NeedUpdate", G_TYPE_BOOLEAN, true, NULL },
+      { "Priority", G_TYPE_UINT, true, NULL },
+      { "DiscoveryTime", G_TYPE_UINT64, true, NULL },
+      { "PublicationTime", G_TYPE_UINT64, true, NULL },
       /* Readonly.  */
-      { "RegistrationTime", G_TYPE_UINT64, false },
-      { "ParentUUID", G_TYPE_STRING, false },
-      { "Instance", G_TYPE_UINT, false },
-      { NULL, G_TYPE_INVALID, true },
+      { "RegistrationTime", G_TYPE_UINT64, false, NULL },
+      { "ParentUUID", G_TYPE_STRING, false, "parent_uuid" },
+      { "Instance", G_TYPE_UINT, false, NULL },
+      { "LastTransferTime", G_TYPE_UINT64, false,
+	QUERY_OBJECT_LAST_TRANSFER_TIME },
+      { "LastTransferAttemptTime", G_TYPE_UINT64, false,
+	QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_TIME },
+      { "LastTransferAttemptStatus", G_TYPE_UINT, false,
+	QUERY_OBJECT_LAST_TRANSFER_ATTEMPT_STATUS },
+      { "DiskUsage", G_TYPE_UINT64, false, "DiskUsage" },
+      { NULL, G_TYPE_INVALID, true, NULL },
 };
 
 static void
@@ -199,7 +285,40 @@ struct upcall
       GValueArray *versions;
       char *filename;
       int quality;
+      /* A local file with the object's content or NULL.  */
+      char *local_copy;
     } object_transfer;
+#define UPCALL_OBJECT_TRANSFERRED 3
+    struct
+    {
+      char *stream_uuid;
+      char *stream_cookie;
+      char *object_uuid;
+      char *object_cookie;
+      uint32_t status;
+      uint32_t instance;
+      GValueArray *version;
+      char *filename;
+      uint64_t size;
+      uint64_t trigger_target;
+      uint64_t trigger_fired;
+    } object_transferred;
+#define UPCALL_OBJECT_DELETE_FILES 4
+    /* UPCALL_OBJECT_FILES_COMPRESSED also uses object_delete_files.  */
+#define UPCALL_OBJECT_FILES_COMPRESSED 5
+    struct
+    {
+      char *stream_uuid;
+      char *stream_cookie;
+      char *object_uuid;
+      char *object_cookie;
+      /* A GValueArray * for each file: (filename, dedicated,
+	 deletion policy) or, for UPCALL_OBJECT_FILES_COMPRESSED,
+	 (filename, new filename, new size).  */
+      GPtrArray *files;
+      /* UPCALL_OBJECT_FILES_COMPRESSED: the object's new size.  */
+      uint64_t object_size;
+    } object_delete_files;
   };
 };
 
@@ -258,7 +377,8 @@ upcall_transfer_object (const char *dbus_service_name,
 			const char *object_cookie,
 			GValueArray *versions,
 			const char *filename,
-			int quality)
+			int quality,
+			const char *local_copy)
 {
   int dbus_service_name_len
     = dbus_service_name ? strlen (dbus_service_name) + 1 : 0;
@@ -269,11 +389,13 @@ upcall_transfer_object (const char *dbus_service_name,
   int object_uuid_len = strlen (object_uuid) + 1;
   int object_cookie_len = strlen (object_cookie) + 1;
   int filename_len = strlen (filename) + 1;
+  int local_copy_len = local_copy ? strlen (local_copy) + 1 : 0;
 
   struct upcall *i = g_malloc
     (sizeof (*i) + dbus_service_name_len + manager_uuid_len
      + manager_cookie_len + stream_uuid_len + stream_cookie_len
-     + object_uuid_len + object_cookie_len + filename_len);
+     + object_uuid_len + object_cookie_len + filename_len
+     + local_copy_len);
 
   i->type = UPCALL_OBJECT_TRANSFER;
 
@@ -308,107 +430,517 @@ upcall_transfer_object (const char *dbus_service_name,
   i->object_transfer.filename = p;
   p = mempcpy (p, filename, filename_len);
 
+  if (local_copy)
+    {
+      i->object_transfer.local_copy = p;
+      p = mempcpy (p, local_copy, local_copy_len);
+    }
+  else
+    i->object_transfer.local_copy = NULL;
+
   i->object_transfer.versions = versions;
   i->object_transfer.quality = quality;
 
   return i;
 }
 
+static struct upcall *
+upcall_object_transferred (const char *dbus_service_name,
+			   const char *manager_uuid,
+			   const char *manager_cookie,
+			   const char *stream_uuid,
+			   const char *stream_cookie,
+			   const char *object_uuid,
+			   const char *object_cookie,
+			   uint32_t status,
+			   uint32_t instance,
+			   GValueArray *version,
+			   const char *filename,
+			   uint64_t size,
+			   uint64_t trigger_target,
+			   uint64_t trigger_fired)
+{
+  int dbus_service_name_len
+    = dbus_service_name ? strlen (dbus_service_name) + 1 : 0;
+  int manager_uuid_len = strlen (manager_uuid) + 1;
+  int manager_cookie_len = strlen (manager_cookie) + 1;
+  int stream_uuid_len = strlen (stream_uuid) + 1;
+  int stream_cookie_len = strlen (stream_cookie) + 1;
+  int object_uuid_len = strlen (object_uuid) + 1;
+  int object_cookie_len = strlen (object_cookie) + 1;
+  int filename_len = strlen (filename) + 1;
+
+  struct upcall *i = g_malloc
+    (sizeof (*i) + dbus_service_name_len + manager_uuid_len
+     + manager_cookie_len + stream_uuid_len + stream_cookie_len
+     + object_uuid_len + object_cookie_len + filename_len);
+
+  i->type = UPCALL_OBJECT_TRANSFERRED;
+
+  void *p = (void *) &i[1];
+
+  if (dbus_service_name)
+    {
+      i->dbus_service_name = p;
+      p = mempcpy (p, dbus_service_name, dbus_service_name_len);
+    }
+  else
+    i->dbus_service_name = NULL;
+
+  i->manager_uuid = p;
+  p = mempcpy (p, manager_uuid, manager_uuid_len);
+
+  i->manager_cookie = p;
+  p = mempcpy (p, manager_cookie, manager_cookie_len);
+
+  i->object_transferred.stream_uuid = p;
+  p = mempcpy (p, stream_uuid, stream_uuid_len);
+
+  i->object_transferred.stream_cookie = p;
+  p = mempcpy (p, stream_cookie, stream_cookie_len);
+
+  i->object_transferred.object_uuid = p;
+  p = mempcpy (p, object_uuid, object_uuid_len);
+
+  i->object_transferred.object_cookie = p;
+  p = mempcpy (p, object_cookie, object_cookie_len);
+
+  i->object_transferred.filename = p;
+  p = mempcpy (p, filename, filename_len);
+
+  i->object_transferred.status = status;
+  i->object_transferred.instance = instance;
+  i->object_transferred.version = version;
+  i->object_transferred.size = size;
+  i->object_transferred.trigger_target = trigger_target;
+  i->object_transferred.trigger_fired = trigger_fired;
+
+  return i;
+}
+
+static struct upcall *
+upcall_object_delete_files (const char *dbus_service_name,
+			    const char *manager_uuid,
+			    const char *manager_cookie,
+			    const char *stream_uuid,
+			    const char *stream_cookie,
+			    const char *object_uuid,
+			    const char *object_cookie,
+			    GPtrArray *files)
+{
+  int dbus_service_name_len
+    = dbus_service_name ? strlen (dbus_service_name) + 1 : 0;
+  int manager_uuid_len = strlen (manager_uuid) + 1;
+  int manager_cookie_len = strlen (manager_cookie) + 1;
+  int stream_uuid_len = strlen (stream_uuid) + 1;
+  int stream_cookie_len = strlen (stream_cookie) + 1;
+  int object_uuid_len = strlen (object_uuid) + 1;
+  int object_cookie_len = strlen (object_cookie) + 1;
+
+  struct upcall *i = g_malloc
+    (sizeof (*i) + dbus_service_name_len + manager_uuid_len
+     + manager_cookie_len + stream_uuid_len + stream_cookie_len
+     + object_uuid_len + object_cookie_len);
+
+  i->type = UPCALL_OBJECT_DELETE_FILES;
+
+  void *p = (void *) &i[1];
+
+  if (dbus_service_name)
+    {
+      i->dbus_service_name = p;
+      p = mempcpy (p, dbus_service_name, dbus_service_name_len);
+    }
+  else
+    i->dbus_service_name = NULL;
+
+  i->manager_uuid = p;
+  p = mempcpy (p, manager_uuid, manager_uuid_len);
+
+  i->manager_cookie = p;
+  p = mempcpy (p, manager_cookie, manager_cookie_len);
+
+  i->object_delete_files.stream_uuid = p;
+  p = mempcpy (p, stream_uuid, stream_uuid_len);
+
+  i->object_delete_files.stream_cookie = p;
+  p = mempcpy (p, stream_cookie, stream_cookie_len);
+
+  i->object_delete_files.object_uuid = p;
+  p = mempcpy (p, object_uuid, object_uuid_len);
+
+  i->object_delete_files.object_cookie = p;
+  p = mempcpy (p, object_cookie, object_cookie_len);
+
+  i->object_delete_files.files = files;
+  i->object_delete_files.object_size = 0;
+
+  return i;
+}
+
+/* FILES is an array of (filename, new filename, new size)
+   structures.  */
+static struct upcall *
+upcall_object_files_compressed (const char *dbus_service_name,
+				const char *manager_uuid,
+				const char *manager_cookie,
+				const char *stream_uuid,
+				const char *stream_cookie,
+				const char *object_uuid,
+				const char *object_cookie,
+				GPtrArray *files, uint64_t object_size)
+{
+  struct upcall *i = upcall_object_delete_files
+    (dbus_service_name, manager_uuid, manager_cookie,
+     stream_uuid, stream_cookie, object_uuid, object_cookie, files);
+  i->type = UPCALL_OBJECT_FILES_COMPRESSED;
+  i->object_delete_files.object_size = object_size;
+  return i;
+}
+
+
+static void
+upcall_free (struct upcall *i)
+{
+  if (i->type == UPCALL_OBJECT_TRANSFER)
+    g_value_array_free (i->object_transfer.versions);
+  else if (i->type == UPCALL_OBJECT_TRANSFERRED)
+    g_value_array_free (i->object_transferred.version);
+  else if (i->type == UPCALL_OBJECT_DELETE_FILES
+	   || i->type == UPCALL_OBJECT_FILES_COMPRESSED)
+    {
+      int j;
+      for (j = 0; j < i->object_delete_files.files->len; j ++)
+	g_value_array_free (g_ptr_array_index (i->object_delete_files.files,
+					       j));
+      g_ptr_array_free (i->object_delete_files.files, TRUE);
+    }
+  g_free (i);
+}
+
+/* An upcall to send if an optional upcall is not implemented.  */
+struct upcall_fallback
+{
+  struct upcall *upcall;
+  DBusGProxy *proxy;
+  char *handle;
+};
+
+static void upcall_fallback_cb (DBusGProxy *proxy, GError *error,
+				gpointer user_data);
+
+/* Send the upcall I to PROXY.  HANDLE identifies the recipient in
+   debugging output.  Returns whether the upcall was delivered.  */
+static bool
+upcall_send (struct upcall *i, DBusGProxy *proxy, const char *handle)
+{
+  GError *error = NULL;
+
+  if (i->type == UPCALL_STREAM_UPDATE)
+    {
+      debug (4, "Executing org_woodchuck_upcall_stream_update "
+	     "(%s, %s, %s, %s, %s)",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->stream_update.stream_uuid,
+	     i->stream_update.stream_cookie);
+
+      if (! (org_woodchuck_upcall_stream_update
+	     (proxy,
+	      i->manager_uuid,
+	      i->manager_cookie,
+	      i->stream_update.stream_uuid,
+	      i->stream_update.stream_cookie,
+	      &error)))
+	{
+	  debug (0, "Executing org_woodchuck_upcall_stream_update "
+		 "(%s, %s, %s, %s, %s) upcall failed: %s",
+		 handle,
+		 i->manager_uuid,
+		 i->manager_cookie,
+		 i->stream_update.stream_uuid,
+		 i->stream_update.stream_cookie,
+		 error ? error->message : "<Unknown>");
+
+	  if (error)
+	    g_error_free (error);
+	  return false;
+	}
+    }
+  else if (i->type == UPCALL_OBJECT_TRANSFER && i->object_transfer.local_copy)
+    {
+      debug (4, "Executing org_woodchuck_upcall_object_transfer_local_copy "
+	     "(%s, %s, %s, %s, %s, %s, %s, [versions], %s, %d, %s)",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->object_transfer.stream_uuid,
+	     i->object_transfer.stream_cookie,
+	     i->object_transfer.object_uuid,
+	     i->object_transfer.object_cookie,
+	     i->object_transfer.filename,
+	     i->object_transfer.quality,
+	     i->object_transfer.local_copy);
+
+      /* The upcall is optional.  Wait for the reply (without blocking
+	 the main loop) and if the application doesn't implement it,
+	 send an ObjectTransfer upcall instead.  */
+      struct upcall_fallback *f = g_malloc (sizeof (*f));
+      f->upcall = upcall_transfer_object
+	(i->dbus_service_name, i->manager_uuid, i->manager_cookie,
+	 i->object_transfer.stream_uuid, i->object_transfer.stream_cookie,
+	 i->object_transfer.object_uuid, i->object_transfer.object_cookie,
+	 g_value_array_copy (i->object_transfer.versions),
+	 i->object_transfer.filename, i->object_transfer.quality, NULL);
+      f->proxy = g_object_ref (proxy);
+      f->handle = g_strdup (handle);
+
+      org_woodchuck_upcall_object_transfer_local_copy_async
+	(proxy,
+	 i->manager_uuid,
+	 i->manager_cookie,
+	 i->object_transfer.stream_uuid,
+	 i->object_transfer.stream_cookie,
+	 i->object_transfer.object_uuid,
+	 i->object_transfer.object_cookie,
+	 i->object_transfer.versions,
+	 i->object_transfer.filename,
+	 i->object_transfer.quality,
+	 i->object_transfer.local_copy,
+	 upcall_fallback_cb, f);
+    }
+  else if (i->type == UPCALL_OBJECT_TRANSFER)
+    {
+      debug (4, "Executing org_woodchuck_upcall_object_transfer "
+	     "(%s, %s, %s, %s, %s, %s, %s, [versions], %s, %d)",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->object_transfer.stream_uuid,
+	     i->object_transfer.stream_cookie,
+	     i->object_transfer.object_uuid,
+	     i->object_transfer.object_cookie,
+	     i->object_transfer.filename,
+	     i->object_transfer.quality);
+
+      GValueArray *versions
+	= g_value_array_copy (i->object_transfer.versions);
+
+      if (! (org_woodchuck_upcall_object_transfer
+	     (proxy,
+	      i->manager_uuid,
+	      i->manager_cookie,
+	      i->object_transfer.stream_uuid,
+	      i->object_transfer.stream_cookie,
+	      i->object_transfer.object_uuid,
+	      i->object_transfer.object_cookie,
+	      versions,
+	      i->object_transfer.filename,
+	      i->object_transfer.quality,
+	      &error)))
+	{
+	  debug (0, "Executing org_woodchuck_upcall_object_transfer "
+		 "(%s, %s, %s, %s, %s, %s, %s, [versions], %s, %d) "
+		 "upcall failed: %s",
+		 handle,
+		 i->manager_uuid,
+		 i->manager_cookie,
+		 i->object_transfer.stream_uuid,
+		 i->object_transfer.stream_cookie,
+		 i->object_transfer.object_uuid,
+		 i->object_transfer.object_cookie,
+		 i->object_transfer.filename,
+		 i->object_transfer.quality,
+		 error ? error->message : "<Unknown>");
+
+	  if (error)
+	    g_error_free (error);
+	  return false;
+	}
+    }
+  else if (i->type == UPCALL_OBJECT_TRANSFERRED)
+    {
+      debug (4, "Executing org_woodchuck_upcall_object_transferred "
+	     "(%s, %s, %s, %s, %s, %s, %s, %"PRIx32", %"PRId32", "
+	     "[version], %s, %"PRId64")",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->object_transferred.stream_uuid,
+	     i->object_transferred.stream_cookie,
+	     i->object_transferred.object_uuid,
+	     i->object_transferred.object_cookie,
+	     i->object_transferred.status,
+	     i->object_transferred.instance,
+	     i->object_transferred.filename,
+	     i->object_transferred.size);
+
+      GValueArray *version
+	= g_value_array_copy (i->object_transferred.version);
+
+      if (! (org_woodchuck_upcall_object_transferred
+	     (proxy,
+	      i->manager_uuid,
+	      i->manager_cookie,
+	      i->object_transferred.stream_uuid,
+	      i->object_transferred.stream_cookie,
+	      i->object_transferred.object_uuid,
+	      i->object_transferred.object_cookie,
+	      i->object_transferred.status,
+	      i->object_transferred.instance,
+	      version,
+	      i->object_transferred.filename,
+	      i->object_transferred.size,
+	      i->object_transferred.trigger_target,
+	      i->object_transferred.trigger_fired,
+	      &error)))
+	{
+	  debug (0, "Executing org_woodchuck_upcall_object_transferred "
+		 "(%s, %s, %s, %s, %s, %s, %s, %"PRIx32", %"PRId32", "
+		 "[version], %s, %"PRId64") upcall failed: %s",
+		 handle,
+		 i->manager_uuid,
+		 i->manager_cookie,
+		 i->object_transferred.stream_uuid,
+		 i->object_transferred.stream_cookie,
+		 i->object_transferred.object_uuid,
+		 i->object_transferred.object_cookie,
+		 i->object_transferred.status,
+		 i->object_transferred.instance,
+		 i->object_transferred.filename,
+		 i->object_transferred.size,
+		 error ? error->message : "<Unknown>");
+
+	  if (error)
+	    g_error_free (error);
+	  return false;
+	}
+    }
+  else if (i->type == UPCALL_OBJECT_DELETE_FILES)
+    {
+      debug (4, "Executing org_woodchuck_upcall_object_delete_files "
+	     "(%s, %s, %s, %s, %s, %s, %s, [%d files])",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->object_delete_files.stream_uuid,
+	     i->object_delete_files.stream_cookie,
+	     i->object_delete_files.object_uuid,
+	     i->object_delete_files.object_cookie,
+	     i->object_delete_files.files->len);
+
+      if (! (org_woodchuck_upcall_object_delete_files
+	     (proxy,
+	      i->manager_uuid,
+	      i->manager_cookie,
+	      i->object_delete_files.stream_uuid,
+	      i->object_delete_files.stream_cookie,
+	      i->object_delete_files.object_uuid,
+	      i->object_delete_files.object_cookie,
+	      i->object_delete_files.files,
+	      &error)))
+	{
+	  debug (0, "Executing org_woodchuck_upcall_object_delete_files "
+		 "(%s, %s, %s, %s, %s, %s, %s, [%d files]) "
+		 "upcall failed: %s",
+		 handle,
+		 i->manager_uuid,
+		 i->manager_cookie,
+		 i->object_delete_files.stream_uuid,
+		 i->object_delete_files.stream_cookie,
+		 i->object_delete_files.object_uuid,
+		 i->object_delete_files.object_cookie,
+		 i->object_delete_files.files->len,
+		 error ? error->message : "<Unknown>");
+
+	  if (error)
+	    g_error_free (error);
+	  return false;
+	}
+    }
+  else if (i->type == UPCALL_OBJECT_FILES_COMPRESSED)
+    {
+      debug (4, "Executing org_woodchuck_upcall_object_files_compressed "
+	     "(%s, %s, %s, %s, %s, %s, %s, [%d files], %"PRId64")",
+	     handle,
+	     i->manager_uuid,
+	     i->manager_cookie,
+	     i->object_delete_files.stream_uuid,
+	     i->object_delete_files.stream_cookie,
+	     i->object_delete_files.object_uuid,
+	     i->object_delete_files.object_cookie,
+	     i->object_delete_files.files->len,
+	     i->object_delete_files.object_size);
+
+      if (! (org_woodchuck_upcall_object_files_compressed
+	     (proxy,
+	      i->manager_uuid,
+	      i->manager_cookie,
+	      i->object_delete_files.stream_uuid,
+	      i->object_delete_files.stream_cookie,
+	      i->object_delete_files.object_uuid,
+	      i->object_delete_files.object_cookie,
+	      i->object_delete_files.files,
+	      i->object_delete_files.object_size,
+	      &error)))
+	{
+	  debug (0, "Executing org_woodchuck_upcall_object_files_compressed "
+		 "(%s, %s, %s, %s, %s, %s, %s, [%d files], %"PRId64") "
+		 "upcall failed: %s",
+		 handle,
+		 i->manager_uuid,
+		 i->manager_cookie,
+		 i->object_delete_files.stream_uuid,
+		 i->object_delete_files.stream_cookie,
+		 i->object_delete_files.object_uuid,
+		 i->object_delete_files.object_cookie,
+		 i->object_delete_files.files->len,
+		 i->object_delete_files.object_size,
+		 error ? error->message : "<Unknown>");
+
+	  if (error)
+	    g_error_free (error);
+	  return false;
+	}
+    }
+
+  return true;
+}
+
+/* Called when the application replies to an optional upcall.  */
+static void
+upcall_fallback_cb (DBusGProxy *proxy, GError *error, gpointer user_data)
+{
+  struct upcall_fallback *f = user_data;
+
+  if (error)
+    {
+      if (g_error_matches (error, DBUS_GERROR, DBUS_GERROR_UNKNOWN_METHOD))
+	/* An application that doesn't implement it.  */
+	upcall_send (f->upcall, f->proxy, f->handle);
+      else
+	debug (0, "%s: Optional upcall failed: %s",
+	       f->handle, error->message);
+      g_error_free (error);
+    }
+
+  upcall_free (f->upcall);
+  g_object_unref (f->proxy);
+  g_free (f->handle);
+  g_free (f);
+}
 
 static void
 upcall_execute (struct upcall *i)
 {
   assertx (i->type == UPCALL_STREAM_UPDATE
-	   || i->type == UPCALL_OBJECT_TRANSFER,
+	   || i->type == UPCALL_OBJECT_TRANSFER
+	   || i->type == UPCALL_OBJECT_TRANSFERRED
+	   || i->type == UPCALL_OBJECT_DELETE_FILES
+	   || i->type == UPCALL_OBJECT_FILES_COMPRESSED,
 	   "type: %d", i->type);
 
-  void do_upcall (DBusGProxy *proxy, const char *handle)
-  {
-    GError *error = NULL;
-
-    if (i->type == UPCALL_STREAM_UPDATE)
-      {
-	debug (4, "Executing org_woodchuck_upcall_stream_update "
-	       "(%s, %s, %s, %s, %s)",
-	       handle,
-	       i->manager_uuid,
-	       i->manager_cookie,
-	       i->stream_update.stream_uuid,
-	       i->stream_update.stream_cookie);
-
-	if (! (org_woodchuck_upcall_stream_update
-	       (proxy,
-		i->manager_uuid,
-		i->manager_cookie,
-		i->stream_update.stream_uuid,
-		i->stream_update.stream_cookie,
-		&error)))
-	  {
-	    debug (0, "Executing org_woodchuck_upcall_stream_update "
-		   "(%s, %s, %s, %s, %s) upcall failed: %s",
-		   handle,
-		   i->manager_uuid,
-		   i->manager_cookie,
-		   i->stream_update.stream_uuid,
-		   i->stream_update.stream_cookie,
-		   error ? error->message : "<Unknown>");
-
-	    if (error)
-	      g_error_free (error);
-	    error = NULL;
-	  }
-      }
-    else if (i->type == UPCALL_OBJECT_TRANSFER)
-      {
-	debug (4, "Executing org_woodchuck_upcall_object_transfer "
-	       "(%s, %s, %s, %s, %s, %s, %s, [versions], %s, %d)",
-	       handle,
-	       i->manager_uuid,
-	       i->manager_cookie,
-	       i->object_transfer.stream_uuid,
-	       i->object_transfer.stream_cookie,
-	       i->object_transfer.object_uuid,
-	       i->object_transfer.object_cookie,
-	       i->object_transfer.filename,
-	       i->object_transfer.quality);
-
-	GValueArray *versions
-	  = g_value_array_copy (i->object_transfer.versions);
-
-	if (! (org_woodchuck_upcall_object_transfer
-	       (proxy,
-		i->manager_uuid,
-		i->manager_cookie,
-		i->object_transfer.stream_uuid,
-		i->object_transfer.stream_cookie,
-		i->object_transfer.object_uuid,
-		i->object_transfer.object_cookie,
-		versions,
-		i->object_transfer.filename,
-		i->object_transfer.quality,
-		&error)))
-	  {
-	    debug (0, "Executing org_woodchuck_upcall_object_transfer "
-		   "(%s, %s, %s, %s, %s, %s, %s, [versions], %s, %d) "
-		   "upcall failed: %s",
-		   handle,
-		   i->manager_uuid,
-		   i->manager_cookie,
-		   i->object_transfer.stream_uuid,
-		   i->object_transfer.stream_cookie,
-		   i->object_transfer.object_uuid,
-		   i->object_transfer.object_cookie,
-		   i->object_transfer.filename,
-		   i->object_transfer.quality,
-		   error ? error->message : "<Unknown>");
-
-	    if (error)
-	      g_error_free (error);
-	    error = NULL;
-	  }
-      }
-  }
-
   GSList *list = g_hash_table_lookup (mt->manager_to_subscription_list_hash,
 				      i->manager_uuid);
 
@@ -420,7 +952,7 @@ upcall_execute (struct upcall *i)
       if (proxy)
 	{
 	  debug (3, "Starting %s", i->dbus_service_name);
-	  do_upcall (proxy, "START");
+	  upcall_send (i, proxy, "START");
 	  g_object_unref (proxy);
 	}
       else
@@ -433,12 +965,10 @@ upcall_execute (struct upcall *i)
 	struct subscription *s = list->data;
 	list = list->next;
 
-	do_upcall (s->proxy, s->handle);
+	upcall_send (i, s->proxy, s->handle);
       }
 
-  if (i->type == UPCALL_OBJECT_TRANSFER)
-    g_value_array_free (i->object_transfer.versions);
-  g_free (i);
+  upcall_free (i);
 }
 
 static GSList *upcall_list;
@@ -467,87 +997,1773 @@ upcall_execute_callback (gpointer user_data)
       return FALSE;
     }
 }
-
-static guint schedule_id;
 
-/* The time of the last N schedulings.  N should be a multiple of 8.  */
-static uint64_t schedule_records[8];
-#define schedule_records_count \
-  (sizeof (schedule_records) / sizeof (schedule_records[0]))
-static int schedule_record_oldest;
+/* Execute the upcall USER_DATA.  Used to send upcalls that are
+   generated by other threads from the main thread.  */
+static gboolean
+upcall_execute_idle (gpointer user_data)
+{
+  upcall_execute (user_data);
+  return FALSE;
+}
 
-/* On average, schedule at most every 30 minutes.  */
-#define SCHEDULING_THRESHOLD (schedule_records_count * 30 * 60 * 1000)
-/* But don't allow burts to exceed approximately every 10 minutes.  */
-#define SCHEDULING_NEWEST_QUARTER_THRESHOLD \
-  ((schedule_records_count / 4) * 10 * 60 * 1000)
+/* Return an object version as passed to the ObjectTransfer and
+   ObjectTransferred upcalls, i.e., as a (usxttub) structure.  The
+   D-Bus bindings free an upcall's arguments, so a new array is needed
+   for each recipient.  */
+static GValueArray *
+version_value_array (uint32_t index, const char *url, int64_t expected_size,
+		     uint64_t expected_transfer_up,
+		     uint64_t expected_transfer_down,
+		     uint32_t utility, bool use_simple_transferer)
+{
+  GValueArray *version = g_value_array_new (7);
+
+  GValue index_value = { 0 };
+  g_value_init (&index_value, G_TYPE_UINT);
+  g_value_set_uint (&index_value, index);
+  g_value_array_append (version, &index_value);
+
+  GValue url_value = { 0 };
+  g_value_init (&url_value, G_TYPE_STRING);
+  g_value_set_string (&url_value, url ?: "");
+  g_value_array_append (version, &url_value);
+  g_value_unset (&url_value);
+
+  GValue expected_size_value = { 0 };
+  g_value_init (&expected_size_value, G_TYPE_INT64);
+  g_value_set_int64 (&expected_size_value, expected_size);
+  g_value_array_append (version, &expected_size_value);
+
+  GValue expected_transfer_up_value = { 0 };
+  g_value_init (&expected_transfer_up_value, G_TYPE_UINT64);
+  g_value_set_uint64 (&expected_transfer_up_value, expected_transfer_up);
+  g_value_array_append (version, &expected_transfer_up_value);
+
+  GValue expected_transfer_down_value = { 0 };
+  g_value_init (&expected_transfer_down_value, G_TYPE_UINT64);
+  g_value_set_uint64 (&expected_transfer_down_value,
+		      expected_transfer_down);
+  g_value_array_append (version, &expected_transfer_down_value);
+
+  GValue utility_value = { 0 };
+  g_value_init (&utility_value, G_TYPE_UINT);
+  g_value_set_uint (&utility_value, utility);
+  g_value_array_append (version, &utility_value);
+
+  GValue use_simple_transferer_value = { 0 };
+  g_value_init (&use_simple_transferer_value, G_TYPE_BOOLEAN);
+  g_value_set_boolean (&use_simple_transferer_value,
+		       use_simple_transferer);
+  g_value_array_append (version, &use_simple_transferer_value);
+
+  return version;
+}
 
-/* Remember that a scheduling occured.  */
+/* Feedback (the ObjectTransferred upcall) is not sent directly to
+   subscribers.  Instead, it is first appended to the feedback_outbox
+   table.  The main thread then delivers the entries to each of the
+   manager's subscribers in order, a batch at a time.  Each
+   subscription's cursor is the sequence number of the last entry that
+   it received.  Each subscriber's acknowledgements (FeedbackAck) are
+   recorded in feedback_subscribers; an entry remains in the outbox
+   until every subscriber to the manager has acknowledged it.  A new
+   subscription's cursor starts at the subscriber's last acknowledged
+   entry.  Thus, feedback that a client missed because it was slow or
+   because it restarted is resent when it subscribes again.  Entries
+   of a manager without subscribers are deleted when they are
+   acknowledged or the last subscriber departs.  So that the outbox
+   of a manager whose subscribers never acknowledge anything does not
+   grow without bound, entries older than FEEDBACK_MAX_AGE and all but
+   the newest FEEDBACK_MAX_ENTRIES entries of each manager are deleted
+   whenever an entry is added.  */
+
+/* The maximum number of entries to send to a subscriber at once.  */
+#define FEEDBACK_BATCH 16
+/* After an upcall to a subscriber fails, the time to wait before
+   trying it again, in seconds.  */
+#define FEEDBACK_RETRY_DELAY 60
+/* If feedback_subscribers can't be updated because a D-Bus worker
+   thread holds the write lock, the time to wait before trying again,
+   in milliseconds.  */
+#define FEEDBACK_LOCK_RETRY_DELAY 100
+/* The maximum age of an entry in the outbox, in seconds.  */
+#define FEEDBACK_MAX_AGE (7 * 24 * 60 * 60)
+/* The maximum number of entries in the outbox per manager.  */
+#define FEEDBACK_MAX_ENTRIES 1000
+
+static guint feedback_deliver_id;
+
+static void feedback_deliver_start (void);
+
+static enum woodchuck_error rows_each_printf
+  (woodchuck_row_callback callback, void *cookie, GError **error,
+   const char *fmt, ...);
+
+/* A subscriber that is only known by its unique bus name can't
+   subscribe again once it is gone.  Its row in feedback_subscribers
+   is removed by feedback_subscribers_sync.  */
+struct feedback_departed
+{
+  char *subscriber;
+  char *manager;
+};
+/* A list of struct feedback_departed *.  */
+static GSList *feedback_departed;
+
+/* Note that the subscription S is going away.  */
 static void
-schedule_notice ()
+feedback_subscription_removed (struct subscription *s)
 {
-  schedule_records[schedule_record_oldest] = now ();
+  if (! s->subscriber || s->subscriber[0] != ':')
+    /* The subscriber's acknowledgements are kept for when it
+       subscribes again.  */
+    return;
 
-  schedule_record_oldest ++;
-  if (schedule_record_oldest == schedule_records_count)
-    schedule_record_oldest = 0;
-}
+  GSList *l;
+  for (l = g_hash_table_lookup (mt->bus_name_to_subscription_list_hash,
+				s->dbus_name);
+       l; l = l->next)
+    {
+      struct subscription *o = l->data;
+      if (o != s && strcmp (o->manager, s->manager) == 0)
+	/* Another subscription uses the same row.  */
+	return;
+    }
 
-static uint64_t
-schedule_last_schedule ()
-{
-  int i = schedule_record_oldest - 1;
-  if (i < 0)
-    i += schedule_records_count;
+  struct feedback_departed *d = g_malloc (sizeof (*d));
+  d->subscriber = g_strdup (s->subscriber);
+  d->manager = g_strdup (s->manager);
+  feedback_departed = g_slist_prepend (feedback_departed, d);
 
-  return schedule_records[i];
+  feedback_deliver_start ();
 }
 
-/* Check if scheduling occurs too frequently.  */
+/* Remove the rows of departed subscribers from feedback_subscribers,
+   create the rows of new subscriptions and initialize their cursors.
+   Must be called from the main thread.  Returns false if there is
+   work to do, but a D-Bus worker thread holds the write lock.  */
 static bool
-schedule_frequency_check ()
+feedback_subscribers_sync (void)
 {
-  uint64_t n = now ();
-
-  uint64_t total = 0;
-  uint64_t newest_quarter_total = 0;
-  int newest_quarter_count = schedule_records_count / 4;
+  bool work = feedback_departed != NULL;
 
-  int i;
-  for (i = 0; i < schedule_records_count; i ++)
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init (&iter, mt->handle_to_subscription_hash);
+  while (! work && g_hash_table_iter_next (&iter, NULL, &value))
     {
-      /* Newest to oldest.  */
-      int j = schedule_record_oldest - (i + 1);
-      if (j < 0)
-	j += schedule_records_count;
+      struct subscription *s = value;
+      if (s->subscriber && ! s->registered)
+	work = true;
+    }
 
-      total += n - schedule_records[j];
+  if (! work)
+    return true;
+
+  if (! g_static_mutex_trylock (&db_write_lock))
+    /* Rather than block the main loop, try again a bit later.  */
+    return false;
+
+  char *errmsg = NULL;
+  sqlite3_exec (db, "begin transaction;", NULL, NULL, NULL);
+
+  while (feedback_departed)
+    {
+      struct feedback_departed *d = feedback_departed->data;
+      feedback_departed = g_slist_delete_link (feedback_departed,
+					       feedback_departed);
+
+      /* The entries that the remaining subscribers all acknowledged
+	 can now go.  */
+      sqlite3_exec_printf
+	(db,
+	 QUERY_FEEDBACK_SUBSCRIBER_REMOVE
+	 QUERY_FEEDBACK_OUTBOX_TRIM,
+	 NULL, NULL, &errmsg,
+	 d->subscriber, d->manager, d->manager, d->manager, d->manager);
+      if (errmsg)
+	{
+	  debug (0, "Removing feedback subscriber %s of %s: %s",
+		 d->subscriber, d->manager, errmsg);
+	  sqlite3_free (errmsg);
+	  errmsg = NULL;
+	}
+
+      g_free (d->subscriber);
+      g_free (d->manager);
+      g_free (d);
+    }
+
+  g_hash_table_iter_init (&iter, mt->handle_to_subscription_hash);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      struct subscription *s = value;
+      if (! s->subscriber || s->registered)
+	continue;
+
+      int cursor_callback (void *cookie, int argc, char **argv, char **names)
+      {
+	s->cursor = argv[0] ? atoll (argv[0]) : 0;
+	return 0;
+      }
+
+      sqlite3_exec_printf
+	(db,
+	 QUERY_FEEDBACK_SUBSCRIBER_ADD
+	 QUERY_FEEDBACK_SUBSCRIBER_BUS_NAME
+	 QUERY_FEEDBACK_SUBSCRIBER_ACKED,
+	 cursor_callback, NULL, &errmsg,
+	 s->subscriber, s->manager, s->dbus_name,
+	 s->subscriber, s->manager, s->subscriber, s->manager);
+      if (errmsg)
+	{
+	  debug (0, "Adding feedback subscriber %s of %s: %s",
+		 s->subscriber, s->manager, errmsg);
+	  sqlite3_free (errmsg);
+	  errmsg = NULL;
+	  /* Deliver everything that is in the outbox.  */
+	  s->cursor = 0;
+	}
+
+      s->registered = true;
+    }
+
+  sqlite3_exec (db, "end transaction;", NULL, NULL, NULL);
+  woodchuck_write_unlock ();
+
+  return true;
+}
+
+/* The reply to the GetNameOwner call that
+   woodchuck_manager_feedback_subscribe makes for the manager's
+   DBusServiceName.  USER_DATA is a NULL terminated vector consisting
+   of the subscription's handle and the service name.  */
+static void
+feedback_subscriber_cb (DBusGProxy *proxy, char *owner,
+			GError *error, gpointer user_data)
+{
+  char **names = user_data;
+
+  if (error)
+    /* No one owns the name.  */
+    {
+      debug (4, "GetNameOwner (%s): %s", names[1], error->message);
+      g_error_free (error);
+    }
+
+  struct subscription *s
+    = g_hash_table_lookup (mt->handle_to_subscription_hash, names[0]);
+  if (s)
+    {
+      if (owner && strcmp (owner, s->dbus_name) == 0)
+	s->subscriber = g_strdup (names[1]);
+      else
+	s->subscriber = g_strdup (s->dbus_name);
+
+      feedback_deliver_start ();
+    }
+
+  g_free (owner);
+  g_strfreev (names);
+}
+
+/* An upcall to a subscriber whose reply is outstanding.  */
+struct feedback_call
+{
+  int64_t seq;
+  char handle[];
+};
+
+static void
+feedback_sent (DBusGProxy *proxy, DBusGProxyCall *call, gpointer user_data)
+{
+  struct feedback_call *c = user_data;
+
+  GError *error = NULL;
+  bool ok = dbus_g_proxy_end_call (proxy, call, &error, G_TYPE_INVALID);
+
+  struct subscription *s
+    = g_hash_table_lookup (mt->handle_to_subscription_hash, c->handle);
+  if (! s)
+    /* The subscription was removed in the mean time.  */
+    {
+      if (error)
+	g_error_free (error);
+      return;
+    }
+
+  if (! ok)
+    {
+      if (! s->stalled_until)
+	debug (3, "Delivering feedback %"PRId64" to %s failed (%s), "
+	       "retrying in %d s.",
+	       c->seq, s->handle, error ? error->message : "<Unknown>",
+	       FEEDBACK_RETRY_DELAY);
+      s->stalled_until = now () + FEEDBACK_RETRY_DELAY * 1000;
+    }
+  else if (! s->stalled_until)
+    /* The replies arrive in order.  If an earlier upcall failed, the
+       entries after it are sent again.  */
+    s->cursor = c->seq;
+  if (error)
+    g_error_free (error);
+
+  s->in_flight --;
+  if (s->in_flight == 0)
+    /* Send the next batch or schedule a retry.  */
+    feedback_deliver_start ();
+}
+
+/* Send the next batch of feedback to the subscription S.  Returns the
+   number of upcalls that were started.  */
+static int
+feedback_deliver_to (struct subscription *s)
+{
+  static GType usxttub;
+  if (! usxttub)
+    usxttub = dbus_g_type_get_struct ("GValueArray",
+				      G_TYPE_UINT, G_TYPE_STRING,
+				      G_TYPE_INT64, G_TYPE_UINT64,
+				      G_TYPE_UINT64, G_TYPE_UINT,
+				      G_TYPE_BOOLEAN, G_TYPE_INVALID);
+
+  int handle_len = strlen (s->handle);
+
+  void callback (void *cookie, int argc, const char *argv[])
+  {
+    int i = 0;
+    int64_t seq = atoll (argv[i]); i ++;
+    const char *manager_cookie = argv[i] ?: ""; i ++;
+    const char *stream_uuid = argv[i] ?: ""; i ++;
+    const char *stream_cookie = argv[i] ?: ""; i ++;
+    const char *object_uuid = argv[i]; i ++;
+    const char *object_cookie = argv[i] ?: ""; i ++;
+    uint32_t status = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint32_t instance = atoll (argv[i]); i ++;
+    uint32_t version_index = argv[i] ? atoll (argv[i]) : 0; i ++;
+    const char *url = argv[i]; i ++;
+    int64_t expected_size = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint64_t expected_transfer_up = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint64_t expected_transfer_down = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint32_t utility = argv[i] ? atoll (argv[i]) : 0; i ++;
+    bool use_simple_transferer = argv[i] ? atoi (argv[i]) : false; i ++;
+    const char *filename = argv[i] ?: ""; i ++;
+    uint64_t object_size = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint64_t trigger_target = argv[i] ? atoll (argv[i]) : 0; i ++;
+    uint64_t trigger_fired = argv[i] ? atoll (argv[i]) : 0; i ++;
+
+    GValueArray *version = version_value_array
+      (version_index, url, expected_size, expected_transfer_up,
+       expected_transfer_down, utility, use_simple_transferer);
+
+    struct feedback_call *c = g_malloc (sizeof (*c) + handle_len + 1);
+    c->seq = seq;
+    memcpy (c->handle, s->handle, handle_len + 1);
+
+    debug (4, "Sending feedback %"PRId64" (%s, %"PRId32") to %s",
+	   seq, object_uuid, instance, s->handle);
+
+    /* The arguments are marshalled immediately.  */
+    dbus_g_proxy_begin_call
+      (s->proxy, "ObjectTransferred", feedback_sent, c, g_free,
+       G_TYPE_STRING, s->manager,
+       G_TYPE_STRING, manager_cookie,
+       G_TYPE_STRING, stream_uuid,
+       G_TYPE_STRING, stream_cookie,
+       G_TYPE_STRING, object_uuid,
+       G_TYPE_STRING, object_cookie,
+       G_TYPE_UINT, status,
+       G_TYPE_UINT, instance,
+       usxttub, version,
+       G_TYPE_STRING, filename,
+       G_TYPE_UINT64, object_size,
+       G_TYPE_UINT64, trigger_target,
+       G_TYPE_UINT64, trigger_fired,
+       G_TYPE_INVALID);
+    g_value_array_free (version);
+
+    s->in_flight ++;
+  }
+
+  GError *error = NULL;
+  rows_each_printf
+    (callback, NULL, &error,
+     QUERY_FEEDBACK_OUTBOX,
+     s->manager, s->cursor, FEEDBACK_BATCH);
+  if (error)
+    {
+      debug (0, "Reading feedback for %s: %s", s->handle, error->message);
+      g_error_free (error);
+    }
+
+  return s->in_flight;
+}
+
+static gboolean
+feedback_deliver (gpointer user_data)
+{
+  uint64_t n = now ();
+  bool stalled = false;
+
+  bool locked_out = ! feedback_subscribers_sync ();
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init (&iter, mt->handle_to_subscription_hash);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      struct subscription *s = value;
+
+      if (! s->registered || s->in_flight)
+	/* When the subscriber is registered or the outstanding upcalls
+	   complete, we are called again.  */
+	continue;
+
+      if (s->stalled_until > n)
+	{
+	  stalled = true;
+	  continue;
+	}
+
+      s->stalled_until = 0;
+      feedback_deliver_to (s);
+    }
+
+  if (locked_out)
+    feedback_deliver_id = timer_add_full
+      (G_PRIORITY_LOW, "feedback", FEEDBACK_LOCK_RETRY_DELAY,
+       FEEDBACK_LOCK_RETRY_DELAY, feedback_deliver, NULL, NULL);
+  else if (stalled)
+    feedback_deliver_id = timer_add_full
+      (G_PRIORITY_LOW, "feedback", FEEDBACK_RETRY_DELAY * 1000,
+       FEEDBACK_RETRY_DELAY * 1000 / 2, feedback_deliver, NULL, NULL);
+  else
+    feedback_deliver_id = 0;
+  return FALSE;
+}
+
+/* Start delivering any pending feedback.  Must be called from the main
+   thread.  */
+static void
+feedback_deliver_start (void)
+{
+  if (feedback_deliver_id)
+    /* Don't let a stalled subscriber delay the others.  */
+    g_source_remove (feedback_deliver_id);
+  feedback_deliver_id = g_idle_add_full (G_PRIORITY_LOW, feedback_deliver,
+					 NULL, NULL);
+}
+
+/* Remove the rows of subscribers that were only known by their unique
+   bus names: a previous instance of murmeltier recorded them and
+   those subscriptions are gone.  Called at start up.  */
+static void
+feedback_subscribers_init (void)
+{
+  char *errmsg = NULL;
+  sqlite3_exec (db, QUERY_FEEDBACK_SUBSCRIBERS_STALE, NULL, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "Removing stale feedback subscribers: %s", errmsg);
+      sqlite3_free (errmsg);
+    }
+}
+
+/* Called in the main thread after feedback has been added to the
+   outbox.  USER_DATA is the corresponding upcall.  */
+static gboolean
+feedback_queued (gpointer user_data)
+{
+  struct upcall *upcall = user_data;
+
+  if (g_hash_table_lookup (mt->manager_to_subscription_list_hash,
+			   upcall->manager_uuid))
+    {
+      upcall_free (upcall);
+      feedback_deliver_start ();
+    }
+  else
+    /* No one is subscribed.  If the application wants to be woken,
+       start it.  The entry will be sent again when it subscribes.  */
+    upcall_execute (upcall);
+
+  return FALSE;
+}
+
+/* An object that the simple transferer is transferring.  */
+struct simple_transfer
+{
+  /* NULL if the application should not be started to receive the
+     ObjectTransferred upcall.  */
+  char *dbus_service_name;
+  char *manager_uuid;
+  char *manager_cookie;
+  char *stream_uuid;
+  char *stream_cookie;
+  char *object_uuid;
+  char *object_cookie;
+  /* The version being transferred.  */
+  GValueArray *version;
+  uint32_t instance;
+  uint64_t trigger_target;
+};
+
+static void
+simple_transfer_free (struct simple_transfer *t)
+{
+  g_free (t->dbus_service_name);
+  g_free (t->manager_uuid);
+  g_free (t->manager_cookie);
+  g_free (t->stream_uuid);
+  g_free (t->stream_cookie);
+  g_free (t->object_uuid);
+  g_free (t->object_cookie);
+  if (t->version)
+    g_value_array_free (t->version);
+  g_free (t);
+}
+
+/* Add feedback for the transfer T, whose result is RESULT, to the
+   outbox.  The caller must hold the write lock.  Returns whether the
+   entry was added.  */
+static bool
+feedback_queue (struct simple_transfer *t,
+		const struct simple_transferer_result *result)
+{
+  GValueArray *v = t->version;
+  bool success = result->status == 0;
+
+  char *errmsg = NULL;
+  sqlite3_exec_printf
+    (db,
+     "insert into feedback_outbox"
+     " (uuid, instance, parent_uuid, manager_cookie,"
+     "  stream_uuid, stream_cookie, object_cookie, status,"
+     "  version, url, expected_size, expected_transfer_up,"
+     "  expected_transfer_down, utility, use_simple_transferer,"
+     "  filename, object_size, trigger_target, trigger_fired)"
+     " values (%Q, %"PRId32", %Q, %Q, %Q, %Q, %Q, %"PRId32","
+     "  %"PRId32", %Q, %"PRId64", %"PRId64","
+     "  %"PRId64", %"PRId32", %d,"
+     "  %Q, %"PRId64", %"PRId64", %"PRId64");",
+     NULL, NULL, &errmsg,
+     t->object_uuid, t->instance, t->manager_uuid, t->manager_cookie,
+     t->stream_uuid, t->stream_cookie, t->object_cookie, result->status,
+     g_value_get_uint (g_value_array_get_nth (v, 0)),
+     g_value_get_string (g_value_array_get_nth (v, 1)),
+     g_value_get_int64 (g_value_array_get_nth (v, 2)),
+     g_value_get_uint64 (g_value_array_get_nth (v, 3)),
+     g_value_get_uint64 (g_value_array_get_nth (v, 4)),
+     g_value_get_uint (g_value_array_get_nth (v, 5)),
+     (int) g_value_get_boolean (g_value_array_get_nth (v, 6)),
+     result->filename, success ? result->object_size : 0,
+     t->trigger_target, result->start / 1000);
+  if (errmsg)
+    {
+      debug (0, "Queuing feedback for %s(%s): %s",
+	     t->object_uuid, t->object_cookie, errmsg);
+      sqlite3_free (errmsg);
+      return false;
+    }
+
+  sqlite3_exec_printf
+    (db, QUERY_FEEDBACK_OUTBOX_EXPIRE, NULL, NULL, &errmsg,
+     t->manager_uuid, FEEDBACK_MAX_AGE, t->manager_uuid,
+     FEEDBACK_MAX_ENTRIES);
+  if (errmsg)
+    {
+      debug (0, "Expiring feedback of %s: %s", t->manager_uuid, errmsg);
+      sqlite3_free (errmsg);
+    }
+  else if (sqlite3_changes (db))
+    debug (0, "Dropped %d unacknowledged feedback entries of %s.",
+	   sqlite3_changes (db), t->manager_uuid);
+
+  return true;
+}
+
+/* Called by the simple transferer (from one of its threads) when it
+   finishes transferring an object.  Record the transfer's status and
+   notify the application.  */
+static void
+simple_transfer_done (void *cookie,
+		      const struct simple_transferer_result *result)
+{
+  struct simple_transfer *t = cookie;
+
+  woodchuck_thread_init ();
+
+  struct woodchuck_object_transfer_status_files file =
+    { result->filename, TRUE,
+      WOODCHUCK_DELETION_POLICY_DELETE_WITH_CONSULTATION };
+  bool success = result->status == 0;
+
+  GError *error = NULL;
+  woodchuck_write_lock ();
+  enum woodchuck_error err = woodchuck_object_transfer_status
+    (t->object_uuid, result->status, 0,
+     result->transferred_up, result->transferred_down,
+     result->start / 1000, result->duration / 1000,
+     success ? result->object_size : -1,
+     success ? &file : NULL, success ? 1 : 0, &error);
+  bool queued = false;
+  if (err != WOODCHUCK_ERROR_NO_SUCH_OBJECT)
+    queued = feedback_queue (t, result);
+  woodchuck_write_unlock ();
+  if (err)
+    {
+      debug (0, "Recording the transfer status of %s(%s): %s",
+	     t->object_uuid, t->object_cookie,
+	     error ? error->message : "<Unknown>");
+      if (error)
+	g_error_free (error);
+      error = NULL;
+
+      if (err == WOODCHUCK_ERROR_NO_SUCH_OBJECT)
+	/* The object was unregistered while we were transferring it.  */
+	{
+	  simple_transfer_free (t);
+	  return;
+	}
+    }
+
+  struct upcall *upcall = upcall_object_transferred
+    (t->dbus_service_name, t->manager_uuid, t->manager_cookie,
+     t->stream_uuid, t->stream_cookie, t->object_uuid, t->object_cookie,
+     result->status, t->instance, t->version, result->filename,
+     success ? result->object_size : 0, t->trigger_target,
+     result->start / 1000);
+  /* The upcall now owns the version.  */
+  t->version = NULL;
+
+  /* Subscriptions belong to the main thread.  If the feedback
+     couldn't be added to the outbox, at least try to send it now.  */
+  g_idle_add (queued ? feedback_queued : upcall_execute_idle, upcall);
+
+  simple_transfer_free (t);
+}
+
+/* The content index.
+
+   Different objects, often belonging to different managers, may
+   refer to the same content (e.g., a podcast episode that appears in
+   several feeds).  To avoid transferring and storing it again,
+   content_hash_worker computes a keyed hash of each file recorded in
+   object_instance_files.  Before the scheduler transfers an object, it
+   calls local_copy_lookup to look for a one-shot object that has
+   already been transferred from the same URL.  If that object's file
+   (or any other indexed file with the same hash) is still intact, it
+   is offered as a local copy: the simple transferer links it and
+   applications are passed it in the ObjectTransferLocalCopy upcall.
+
+   The hash is an MD5 sum of the file's content prefixed with a random
+   salt, which is stored in the content_hash_salt table.  A file's size
+   and modification time are recorded when it is hashed; a copy is
+   only offered if they are unchanged.  */
+
+/* Hash at most this many bytes per second so as to not interfere with
+   the user.  */
+#define CONTENT_HASH_BYTES_PER_SECOND (4 * 1024 * 1024)
+/* The number of bytes to read at a time.  */
+#define CONTENT_HASH_CHUNK (64 * 1024)
+/* The maximum number of files to hash per pass.  */
+#define CONTENT_HASH_FILES_PER_PASS 32
+
+/* Whether a pass is running.  Belongs to the main thread.  */
+static bool content_hash_running;
+/* Whether files were added while a pass was running.  */
+static bool content_hash_again;
+
+static void content_hash_start (void);
+
+/* Hash the file FILENAME using the key SALT.  On success, stores the
+   hex encoded hash in HASH and the file's size and modification time
+   in SIZE and MTIME, and returns true.  If the file could not be read,
+   HASH is set to the empty string.  If the file changed while it was
+   being hashed, returns false.  */
+static bool
+content_hash_file (const struct md5_ctx *salt, const char *filename,
+		   char hash[MD5_DIGEST_SIZE * 2 + 1],
+		   int64_t *size, int64_t *mtime)
+{
+  hash[0] = 0;
+  *size = 0;
+  *mtime = 0;
+
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    {
+      debug (3, "open (%s): %m", filename);
+      return true;
+    }
+
+  struct stat before;
+  if (fstat (fd, &before) < 0 || ! S_ISREG (before.st_mode))
+    {
+      close (fd);
+      return true;
+    }
+
+  struct md5_ctx ctx = *salt;
+  char *buffer = g_malloc (CONTENT_HASH_CHUNK);
+  bool ok = true;
+  for (;;)
+    {
+      ssize_t len = read (fd, buffer, CONTENT_HASH_CHUNK);
+      if (len < 0)
+	{
+	  debug (0, "read (%s): %m", filename);
+	  ok = false;
+	  break;
+	}
+      if (len == 0)
+	break;
+
+      md5_process_bytes (buffer, len, &ctx);
+
+      usleep (len * 1000000ULL / CONTENT_HASH_BYTES_PER_SECOND);
+    }
+  g_free (buffer);
+
+  struct stat after;
+  if (fstat (fd, &after) < 0
+      || after.st_size != before.st_size
+      || after.st_mtime != before.st_mtime)
+    {
+      debug (3, "%s changed while hashing it.", filename);
+      close (fd);
+      return false;
+    }
+  close (fd);
+
+  if (! ok)
+    return true;
+
+  unsigned char digest[MD5_DIGEST_SIZE];
+  md5_finish_ctx (&ctx, digest);
+  int i;
+  for (i = 0; i < MD5_DIGEST_SIZE; i ++)
+    sprintf (&hash[i * 2], "%02x", digest[i]);
+
+  *size = before.st_size;
+  *mtime = before.st_mtime;
+  return true;
+}
+
+static gboolean
+content_hash_done (gpointer user_data)
+{
+  bool more = GPOINTER_TO_INT (user_data);
+
+  content_hash_running = false;
+  if (more || content_hash_again)
+    content_hash_start ();
+
+  return FALSE;
+}
+
+static void *
+content_hash_worker (void *arg)
+{
+  uint64_t start = now ();
+  bool more = false;
+
+  /* Every thread must have its own sqlite3 instance.  */
+  int err = sqlite3_open (db_filename, &db);
+  if (err)
+    {
+      debug (0, "sqlite3_open (%s): %s", db_filename, sqlite3_errmsg (db));
+      goto out;
+    }
+  db_setup (db);
+
+  struct md5_ctx salt;
+  md5_init_ctx (&salt);
+  void salt_callback (void *cookie, int argc, const char *argv[])
+  {
+    if (argv[0])
+      md5_process_bytes (argv[0], strlen (argv[0]), &salt);
+  }
+  GError *error = NULL;
+  rows_each_printf (salt_callback, NULL, &error, QUERY_CONTENT_HASH_SALT);
+  if (error)
+    {
+      debug (0, "Reading the content hash salt: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  GPtrArray *uuids = g_ptr_array_new ();
+  GArray *instances = g_array_new (FALSE, FALSE, sizeof (int));
+  GPtrArray *filenames = g_ptr_array_new ();
+  void files_callback (void *cookie, int argc, const char *argv[])
+  {
+    int instance = argv[1] ? atoi (argv[1]) : 0;
+
+    g_ptr_array_add (uuids, g_strdup (argv[0] ?: ""));
+    g_array_append_val (instances, instance);
+    g_ptr_array_add (filenames, g_strdup (argv[2] ?: ""));
+  }
+  rows_each_printf (files_callback, NULL, &error,
+		    QUERY_CONTENT_HASH_UNHASHED, CONTENT_HASH_FILES_PER_PASS);
+  if (error)
+    {
+      debug (0, "Looking for files to hash: %s", error->message);
+      g_error_free (error);
+      error = NULL;
+    }
+  more = filenames->len == CONTENT_HASH_FILES_PER_PASS;
+
+  uint64_t bytes = 0;
+  int i;
+  for (i = 0; i < filenames->len; i ++)
+    {
+      const char *uuid = g_ptr_array_index (uuids, i);
+      int instance = g_array_index (instances, int, i);
+      const char *filename = g_ptr_array_index (filenames, i);
+
+      char hash[MD5_DIGEST_SIZE * 2 + 1];
+      int64_t size;
+      int64_t mtime;
+      if (! content_hash_file (&salt, filename, hash, &size, &mtime))
+	/* Try again on the next pass.  */
+	continue;
+      bytes += size;
+
+      debug (4, "%s(%d): %s: %s", uuid, instance, filename, hash);
+
+      woodchuck_write_lock ();
+      char *errmsg = NULL;
+      sqlite3_exec_printf
+	(db, QUERY_CONTENT_HASH_SET,
+	 NULL, NULL, &errmsg, hash, size, mtime, uuid, instance, filename);
+      woodchuck_write_unlock ();
+      if (errmsg)
+	{
+	  debug (0, "Recording the hash of %s: %s", filename, errmsg);
+	  sqlite3_free (errmsg);
+	  more = false;
+	}
+    }
+
+  debug (3, "Hashed %d files (%"PRId64" bytes) in "TIME_FMT,
+	 filenames->len, bytes, TIME_PRINTF (now () - start));
+
+  for (i = 0; i < filenames->len; i ++)
+    {
+      g_free (g_ptr_array_index (uuids, i));
+      g_free (g_ptr_array_index (filenames, i));
+    }
+  g_ptr_array_free (uuids, TRUE);
+  g_array_free (instances, TRUE);
+  g_ptr_array_free (filenames, TRUE);
+
+ out:
+  sqlite3_close (db);
+  db = NULL;
+
+  g_idle_add (content_hash_done, GINT_TO_POINTER (more));
+
+  return NULL;
+}
+
+static gboolean
+content_hash_start_from_main_thread (gpointer user_data)
+{
+  content_hash_start ();
+  return FALSE;
+}
+
+/* Start hashing any files that have not yet been hashed.  */
+static void
+content_hash_start (void)
+{
+  if (g_thread_self () != main_thread)
+    /* Called from a D-Bus worker thread.  */
+    {
+      g_idle_add (content_hash_start_from_main_thread, NULL);
+      return;
+    }
+
+  if (content_hash_running)
+    {
+      content_hash_again = true;
+      return;
+    }
+
+  content_hash_running = true;
+  content_hash_again = false;
+
+  pthread_t tid;
+  pthread_create (&tid, NULL, content_hash_worker, NULL);
+  pthread_detach (tid);
+}
+
+/* Look for a local copy of the content at URL for the object
+   OBJECT_UUID.  The source must be another one-shot object with a
+   single version, which was transferred from URL and whose latest
+   instance consists of a single file that has been hashed.  Any intact
+   file with the same hash is a copy.  Returns the copy's filename,
+   which the caller must free using g_free, or NULL.  */
+static char *
+local_copy_lookup (sqlite3 *db, const char *object_uuid, const char *url)
+{
+  char *local_copy = NULL;
+  int callback (void *cookie, int argc, char **argv, char **names)
+  {
+    const char *filename = argv[0];
+    int64_t size = argv[1] ? atoll (argv[1]) : -1;
+    int64_t mtime = argv[2] ? atoll (argv[2]) : -1;
+
+    struct stat st;
+    if (! filename || stat (filename, &st) < 0 || ! S_ISREG (st.st_mode)
+	|| st.st_size != size || st.st_mtime != mtime)
+      /* The file was modified or removed since it was hashed.  */
+      return 0;
+
+    local_copy = g_strdup (filename);
+    /* Stop.  */
+    return 1;
+  }
+  char *errmsg = NULL;
+  sqlite3_exec_printf
+    (db, QUERY_LOCAL_COPY_LOOKUP, callback, NULL, &errmsg, url, object_uuid);
+  if (errmsg)
+    {
+      /* SQLITE_ABORT is returned when the callback stops the query.  */
+      if (! local_copy)
+	debug (0, "Looking for a local copy of %s: %s", url, errmsg);
+      sqlite3_free (errmsg);
+    }
+
+  if (local_copy)
+    debug (3, "%s: Found a local copy of %s: %s",
+	   object_uuid, url, local_copy);
+
+  return local_copy;
+}
+
+/* The disk usage index.
+
+   Each row in object_instance_files records the size of the file.
+   Triggers (see murmeltier-schema.c) sum the sizes per object, per
+   stream and per manager in the DiskUsage columns, which are exported
+   as read-only properties.  Sizes are updated when an application
+   reports a transfer (TransferStatus) or deletes or compresses an
+   object's files (FilesDeleted), when we compress files ourselves,
+   and when inotify reports a change to a file in a directory that
+   contains registered files.  disk_usage_worker fills in the sizes of
+   files registered before the index existed.  A file that several
+   objects registered is counted for each of them.  */
+
+/* How long to collect inotify events before updating the index, in
+   milliseconds.  */
+#define DISK_USAGE_DELAY 2000
+/* The number of files to stat per transaction when filling in
+   sizes.  */
+#define DISK_USAGE_BATCH 256
+
+/* The inotify file descriptor or -1.  */
+static int disk_usage_fd = -1;
+/* Maps the watched directories to their watch descriptors and back.
+   These belong to the main thread.  */
+static GHashTable *disk_usage_dirs;
+static GHashTable *disk_usage_wds;
+/* Files that changed and whose size needs to be updated.  */
+static GHashTable *disk_usage_pending;
+static guint disk_usage_flush_id;
+
+/* Returns the size of FILENAME or 0 if it doesn't exist.  */
+static int64_t
+disk_usage_of (const char *filename)
+{
+  struct stat st;
+  if (stat (filename, &st) < 0 || ! S_ISREG (st.st_mode))
+    return 0;
+  return st.st_size;
+}
+
+/* Update the size of FILENAME in the newest record of each object that
+   registered it.  Prepends the UUIDs of the objects whose usage
+   changed to *CHANGED.  The caller must hold the write lock.  */
+static void
+disk_usage_update (const char *filename, GSList **changed)
+{
+  int64_t size = disk_usage_of (filename);
+
+  char *where = sqlite3_mprintf (QUERY_DISK_USAGE_WHERE,
+				 filename, size, filename);
+
+  GSList *objects = NULL;
+  void callback (void *cookie, int argc, const char *argv[])
+  {
+    objects = g_slist_prepend (objects, g_strdup (argv[0]));
+  }
+  GError *error = NULL;
+  rows_each_printf (callback, NULL, &error, QUERY_DISK_USAGE_OBJECTS, where);
+  if (error)
+    {
+      debug (0, "Looking up %s: %s", filename, error->message);
+      g_error_free (error);
+    }
+  else if (objects)
+    {
+      char *errmsg = NULL;
+      sqlite3_exec_printf
+	(db, QUERY_DISK_USAGE_UPDATE, NULL, NULL, &errmsg, size, where);
+      if (errmsg)
+	{
+	  debug (0, "Updating the size of %s: %s", filename, errmsg);
+	  sqlite3_free (errmsg);
+	}
+      else
+	debug (4, "%s: %"PRId64" bytes (%d objects)",
+	       filename, size, g_slist_length (objects));
+    }
+  sqlite3_free (where);
+
+  *changed = g_slist_concat (objects, *changed);
+}
+
+/* Invalidate the DiskUsage property of the objects in CHANGED and of
+   their streams and managers.  Frees CHANGED.  */
+static void
+disk_usage_changed (GSList *changed)
+{
+  void callback (void *cookie, int argc, const char *argv[])
+  {
+    murmeltier_dbus_server_property_changed ("objects", argv[0],
+					     "DiskUsage", NULL);
+    if (argv[1])
+      murmeltier_dbus_server_property_changed ("streams", argv[1],
+					       "DiskUsage", NULL);
+    if (argv[2])
+      murmeltier_dbus_server_property_changed ("managers", argv[2],
+					       "DiskUsage", NULL);
+  }
+
+  while (changed)
+    {
+      char *object = changed->data;
+      changed = g_slist_delete_link (changed, changed);
+
+      GError *error = NULL;
+      rows_each_printf (callback, NULL, &error,
+			QUERY_DISK_USAGE_CHANGED, object);
+      if (error)
+	{
+	  debug (0, "%s", error->message);
+	  g_error_free (error);
+	}
+      g_free (object);
+    }
+}
+
+static gboolean
+disk_usage_flush (gpointer user_data)
+{
+  disk_usage_flush_id = 0;
+
+  if (! g_static_mutex_trylock (&db_write_lock))
+    /* A D-Bus worker thread is modifying the database.  Rather than
+       block the main loop, try again a bit later.  */
+    {
+      disk_usage_flush_id
+	= timer_add ("disk usage", DISK_USAGE_DELAY, DISK_USAGE_DELAY,
+		     disk_usage_flush, NULL);
+      return FALSE;
+    }
+
+  debug (4, "%d files changed", g_hash_table_size (disk_usage_pending));
+
+  GSList *changed = NULL;
+  sqlite3_exec (db, "begin transaction;", NULL, NULL, NULL);
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init (&iter, disk_usage_pending);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    disk_usage_update (key, &changed);
+  sqlite3_exec (db, "end transaction;", NULL, NULL, NULL);
+  g_hash_table_remove_all (disk_usage_pending);
+
+  woodchuck_write_unlock ();
+
+  disk_usage_changed (changed);
+
+  return FALSE;
+}
+
+static gboolean
+disk_usage_inotify (GIOChannel *source, GIOCondition condition,
+		    gpointer user_data)
+{
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+  for (;;)
+    {
+      ssize_t len = read (disk_usage_fd, buffer, sizeof (buffer));
+      if (len <= 0)
+	break;
+
+      char *p = buffer;
+      while (p < buffer + len)
+	{
+	  struct inotify_event *e = (struct inotify_event *) p;
+	  p += sizeof (*e) + e->len;
+
+	  if ((e->mask & IN_Q_OVERFLOW))
+	    {
+	      debug (0, "inotify queue overflowed, disk usage may be stale.");
+	      continue;
+	    }
+
+	  char *dir = g_hash_table_lookup (disk_usage_wds,
+					   GINT_TO_POINTER (e->wd));
+	  if (! dir)
+	    continue;
+
+	  if ((e->mask & IN_IGNORED))
+	    /* The directory was removed (or unmounted).  */
+	    {
+	      debug (4, "No longer watching %s", dir);
+	      g_hash_table_remove (disk_usage_wds, GINT_TO_POINTER (e->wd));
+	      /* This frees DIR.  */
+	      g_hash_table_remove (disk_usage_dirs, dir);
+	      continue;
+	    }
+
+	  if (e->len == 0)
+	    continue;
+
+	  char *filename = g_build_filename (dir, e->name, NULL);
+	  g_hash_table_insert (disk_usage_pending, filename, NULL);
+	}
+    }
+
+  if (g_hash_table_size (disk_usage_pending) > 0 && ! disk_usage_flush_id)
+    disk_usage_flush_id
+      = timer_add ("disk usage", DISK_USAGE_DELAY, DISK_USAGE_DELAY,
+		   disk_usage_flush, NULL);
+
+  return TRUE;
+}
+
+static gboolean
+disk_usage_watch_from_main_thread (gpointer user_data)
+{
+  GSList *dirs = user_data;
+
+  while (dirs)
+    {
+      char *dir = dirs->data;
+      dirs = g_slist_delete_link (dirs, dirs);
+
+      if (disk_usage_fd == -1 || g_hash_table_lookup (disk_usage_dirs, dir))
+	{
+	  g_free (dir);
+	  continue;
+	}
+
+      int wd = inotify_add_watch (disk_usage_fd, dir,
+				  IN_CLOSE_WRITE | IN_DELETE
+				  | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+      if (wd < 0)
+	{
+	  debug (1, "inotify_add_watch (%s): %m", dir);
+	  g_free (dir);
+	  continue;
+	}
+
+      debug (4, "Watching %s", dir);
+      g_hash_table_insert (disk_usage_dirs, dir, GINT_TO_POINTER (wd));
+      g_hash_table_insert (disk_usage_wds, GINT_TO_POINTER (wd), dir);
+    }
+
+  return FALSE;
+}
+
+/* Watch the directories in DIRS (a list of strings, which are
+   consumed) for changes.  */
+static void
+disk_usage_watch (GSList *dirs)
+{
+  if (! dirs)
+    return;
+
+  if (g_thread_self () != main_thread)
+    /* The watch tables belong to the main thread.  */
+    g_idle_add (disk_usage_watch_from_main_thread, dirs);
+  else
+    disk_usage_watch_from_main_thread (dirs);
+}
+
+static void *
+disk_usage_worker (void *arg)
+{
+  uint64_t start = now ();
+  int count = 0;
+
+  /* Every thread must have its own sqlite3 instance.  */
+  int err = sqlite3_open (db_filename, &db);
+  if (err)
+    {
+      debug (0, "sqlite3_open (%s): %s", db_filename, sqlite3_errmsg (db));
+      goto out;
+    }
+  db_setup (db);
+
+  /* Fill in the sizes of files whose size is not known.  A file that a
+     newer instance of the same object registered is not counted.  */
+  GError *error = NULL;
+  for (;;)
+    {
+      GString *sql = g_string_new ("begin transaction;");
+      int rows = 0;
+      void callback (void *cookie, int argc, const char *argv[])
+      {
+	const char *uuid = argv[0];
+	int instance = argv[1] ? atoi (argv[1]) : 0;
+	const char *filename = argv[2] ?: "";
+	bool superseded = argv[3] ? atoi (argv[3]) : false;
+
+	char *s = sqlite3_mprintf
+	  (QUERY_DISK_USAGE_SET_SIZE,
+	   superseded ? 0 : disk_usage_of (filename),
+	   uuid, instance, filename);
+	g_string_append (sql, s);
+	sqlite3_free (s);
+
+	rows ++;
+      }
+      rows_each_printf (callback, NULL, &error,
+			QUERY_DISK_USAGE_UNSIZED, DISK_USAGE_BATCH);
+      g_string_append (sql, "end transaction;");
+
+      if (! error && rows > 0)
+	{
+	  char *errmsg = NULL;
+	  woodchuck_write_lock ();
+	  sqlite3_exec (db, sql->str, NULL, NULL, &errmsg);
+	  if (errmsg)
+	    sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+	  woodchuck_write_unlock ();
+	  if (errmsg)
+	    {
+	      debug (0, "Recording file sizes: %s", errmsg);
+	      sqlite3_free (errmsg);
+	      rows = 0;
+	    }
+	}
+      g_string_free (sql, TRUE);
+
+      if (error)
+	{
+	  debug (0, "Looking for files without a size: %s", error->message);
+	  g_error_free (error);
+	  error = NULL;
+	  break;
+	}
+
+      count += rows;
+      if (rows < DISK_USAGE_BATCH)
+	break;
+    }
+
+  /* Watch the directories that contain files.  */
+  GHashTable *dirs = g_hash_table_new (g_str_hash, g_str_equal);
+  GSList *list = NULL;
+  void dirs_callback (void *cookie, int argc, const char *argv[])
+  {
+    char *dir = g_path_get_dirname (argv[0]);
+    if (g_hash_table_lookup (dirs, dir))
+      g_free (dir);
+    else
+      {
+	g_hash_table_insert (dirs, dir, dir);
+	list = g_slist_prepend (list, dir);
+      }
+  }
+  rows_each_printf
+    (dirs_callback, NULL, &error,
+     "select distinct filename from object_instance_files where size > 0;");
+  if (error)
+    {
+      debug (0, "Listing files: %s", error->message);
+      g_error_free (error);
+      error = NULL;
+    }
+  g_hash_table_destroy (dirs);
+
+  debug (3, "Sized %d files and found %d directories in "TIME_FMT,
+	 count, g_slist_length (list), TIME_PRINTF (now () - start));
+
+  disk_usage_watch (list);
+
+ out:
+  sqlite3_close (db);
+  db = NULL;
+
+  return NULL;
+}
+
+static void
+disk_usage_init (void)
+{
+  disk_usage_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+					   g_free, NULL);
+  disk_usage_wds = g_hash_table_new (g_direct_hash, g_direct_equal);
+  disk_usage_pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      g_free, NULL);
+
+  disk_usage_fd = inotify_init ();
+  if (disk_usage_fd < 0)
+    debug (0, "inotify_init: %m; disk usage will only be updated "
+	   "when files are reported");
+  else
+    {
+      fcntl (disk_usage_fd, F_SETFL, O_NONBLOCK);
+      fcntl (disk_usage_fd, F_SETFD, FD_CLOEXEC);
+
+      GIOChannel *channel = g_io_channel_unix_new (disk_usage_fd);
+      g_io_add_watch (channel, G_IO_IN, disk_usage_inotify, NULL);
+      g_io_channel_unref (channel);
+    }
+
+  pthread_t tid;
+  pthread_create (&tid, NULL, disk_usage_worker, NULL);
+  pthread_detach (tid);
+}
+
+static guint schedule_id;
+
+/* The time of the last N schedulings.  N should be a multiple of 8.  */
+static uint64_t schedule_records[8];
+#define schedule_records_count \
+  (sizeof (schedule_records) / sizeof (schedule_records[0]))
+static int schedule_record_oldest;
+
+/* On average, schedule at most every 30 minutes.  */
+#define SCHEDULING_THRESHOLD (schedule_records_count * 30 * 60 * 1000)
+/* But don't allow burts to exceed approximately every 10 minutes.  */
+#define SCHEDULING_NEWEST_QUARTER_THRESHOLD \
+  ((schedule_records_count / 4) * 10 * 60 * 1000)
+
+/* Remember that a scheduling occured.  */
+static void
+schedule_notice ()
+{
+  schedule_records[schedule_record_oldest] = now ();
+
+  schedule_record_oldest ++;
+  if (schedule_record_oldest == schedule_records_count)
+    schedule_record_oldest = 0;
+}
+
+static uint64_t
+schedule_last_schedule ()
+{
+  int i = schedule_record_oldest - 1;
+  if (i < 0)
+    i += schedule_records_count;
+
+  return schedule_records[i];
+}
+
+/* Check if scheduling occurs too frequently.  */
+static bool
+schedule_frequency_check ()
+{
+  uint64_t n = now ();
+
+  uint64_t total = 0;
+  uint64_t newest_quarter_total = 0;
+  int newest_quarter_count = schedule_records_count / 4;
+
+  int i;
+  for (i = 0; i < schedule_records_count; i ++)
+    {
+      /* Newest to oldest.  */
+      int j = schedule_record_oldest - (i + 1);
+      if (j < 0)
+	j += schedule_records_count;
+
+      total += n - schedule_records[j];
 
       if (i < newest_quarter_count)
 	newest_quarter_total += n - schedule_records[j];
     }
 
-  uint64_t average = total / schedule_records_count;
-  uint64_t newest_quarter_average
-    = newest_quarter_total / newest_quarter_count;
+  uint64_t average = total / schedule_records_count;
+  uint64_t newest_quarter_average
+    = newest_quarter_total / newest_quarter_count;
+
+  debug (3, "Average time since last %d scans: "TIME_FMT"; %d scans: "TIME_FMT,
+	 (int) schedule_records_count, TIME_PRINTF (average),
+	 newest_quarter_count, TIME_PRINTF (newest_quarter_average));
+
+  return (average > SCHEDULING_THRESHOLD
+	  && newest_quarter_average > SCHEDULING_NEWEST_QUARTER_THRESHOLD);
+}
+
+#define IDLE_TIME_BEFORE_SCHEDULE (5 * 60)
+
+static bool scheduler_running;
+
+struct scheduler_args
+{
+  int freshness_factor_numerator;
+  int freshness_factor_denominator;
+  /* The default connection's mediums (NC_CONNECTION_MEDIUM_*).  */
+  uint32_t mediums;
+  /* The energy remaining in the batteries, in millijoules, or -1 if
+     charging or unknown.  */
+  int64_t battery_mj;
+};
+
+/* The energy model.
+
+   A scheduler run's energy is estimated as the cost of waking the
+   radio (the ramp up and the tail during which it stays in a high
+   power state after the last packet) plus a cost per byte
+   transferred.  Both depend on the medium.  We start with values
+   from the literature and refine them using our own measurements:
+   each run records the energy remaining in the battery in
+   energy_runs; the energy consumed until the next run, the bytes
+   transferred in between and the time that elapsed form a sample.
+   The model E = tail + power * time + per_byte * bytes is fit to the
+   samples by least squares (POWER absorbs the device's baseline
+   consumption).
+
+   By default, we only transfer over wifi and ethernet: other media
+   (cellular, bluetooth or a medium we don't know) may be metered.
+   The user can allow them by listing the permitted media in the
+   environment variable MURMELTIER_MEDIUMS (e.g., "wifi ethernet
+   cellular").  See schedule.  The energy model then decides how to
+   batch the transfers over the allowed media: on battery, a run whose
+   wake-up cost would dominate is deferred (at most
+   ENERGY_MAX_DEFERRALS times in a row).  Over media other than wifi
+   and ethernet, a run's estimated energy, including the wake-up cost,
+   is limited to ENERGY_BUDGET; the remaining transfers wait for the
+   next run.  */
+
+/* A run is deferred if the wake-up cost would be more than this
+   percentage of its estimated energy.  */
+#define ENERGY_MAX_TAIL_SHARE 50
+/* The maximum number of consecutive deferred runs.  */
+#define ENERGY_MAX_DEFERRALS 3
+/* The maximum estimated energy of a run over a connection that is
+   neither wifi nor ethernet, in joules.  */
+#define ENERGY_BUDGET 200
+/* The media over which we transfer by default
+   (NC_CONNECTION_MEDIUM_*).  */
+#define ENERGY_DEFAULT_MEDIUMS \
+  (NC_CONNECTION_MEDIUM_ETHERNET | NC_CONNECTION_MEDIUM_WIFI)
+/* The number of samples needed before the fitted model is used.  */
+#define ENERGY_MIN_SAMPLES 8
+/* Intervals between runs longer than this (in seconds) are too noisy
+   to be useful samples.  */
+#define ENERGY_MAX_SAMPLE_INTERVAL (3 * 60 * 60)
+/* How long to keep energy_runs entries, in seconds.  */
+#define ENERGY_RUNS_MAX_AGE (30 * 24 * 60 * 60)
+
+struct energy_cost
+{
+  /* Joules per radio wake up.  */
+  double tail;
+  /* Joules per byte.  */
+  double per_byte;
+};
+
+/* From Balasubramanian et al., "Energy Consumption in Mobile Phones:
+   A Measurement Study and Implications for Network Applications",
+   IMC 2009.  For wifi, we assume that the device is already
+   associated.  */
+static const struct
+{
+  const char *medium;
+  struct energy_cost cost;
+} energy_defaults[] =
+  {
+    { "ethernet", { 0, 0 } },
+    { "wifi", { 0.5, 0.007 / 1024 } },
+    { "cellular", { 12.5, 0.025 / 1024 } },
+    { "bluetooth", { 0.5, 0.01 / 1024 } },
+    /* Assume the worst.  */
+    { "unknown", { 12.5, 0.025 / 1024 } },
+  };
+
+/* The number of consecutive deferred runs.  Belongs to the scheduler
+   worker.  */
+static int energy_deferrals;
+
+/* The media over which we may transfer (NC_CONNECTION_MEDIUM_*).
+   Set by energy_mediums_init.  */
+static uint32_t energy_allowed_mediums = ENERGY_DEFAULT_MEDIUMS;
+
+/* Initialize energy_allowed_mediums from the environment variable
+   MURMELTIER_MEDIUMS, a list of media separated by spaces or
+   commas.  */
+static void
+energy_mediums_init (void)
+{
+  const char *env = getenv ("MURMELTIER_MEDIUMS");
+  if (! env)
+    return;
+
+  static const struct
+  {
+    const char *name;
+    uint32_t medium;
+  } names[] =
+    {
+      { "ethernet", NC_CONNECTION_MEDIUM_ETHERNET },
+      { "wifi", NC_CONNECTION_MEDIUM_WIFI },
+      { "cellular", NC_CONNECTION_MEDIUM_CELLULAR },
+      { "bluetooth", NC_CONNECTION_MEDIUM_BLUETOOTH },
+      { "unknown", NC_CONNECTION_MEDIUM_UNKNOWN },
+    };
+
+  uint32_t mediums = 0;
+  char **words = g_strsplit_set (env, " ,", -1);
+  int i;
+  for (i = 0; words[i]; i ++)
+    {
+      if (! *words[i])
+	continue;
+
+      int j;
+      for (j = 0; j < sizeof (names) / sizeof (names[0]); j ++)
+	if (strcmp (words[i], names[j].name) == 0)
+	  break;
+      if (j == sizeof (names) / sizeof (names[0]))
+	debug (0, "MURMELTIER_MEDIUMS: Unknown medium: %s", words[i]);
+      else
+	mediums |= names[j].medium;
+    }
+  g_strfreev (words);
+
+  energy_allowed_mediums = mediums;
+
+  char *m = nc_connection_medium_to_string (mediums);
+  debug (1, "Transferring over: %s", m ?: "nothing");
+  g_free (m);
+}
+
+/* Returns the medium that dominates MEDIUMS.  */
+static const char *
+energy_medium (uint32_t mediums)
+{
+  if ((mediums & NC_CONNECTION_MEDIUM_CELLULAR))
+    return "cellular";
+  if ((mediums & NC_CONNECTION_MEDIUM_BLUETOOTH))
+    return "bluetooth";
+  if ((mediums & NC_CONNECTION_MEDIUM_UNKNOWN))
+    return "unknown";
+  if ((mediums & NC_CONNECTION_MEDIUM_WIFI))
+    return "wifi";
+  if ((mediums & NC_CONNECTION_MEDIUM_ETHERNET))
+    return "ethernet";
+  return "unknown";
+}
+
+static struct energy_cost
+energy_default (const char *medium)
+{
+  int i;
+  for (i = 0; i < sizeof (energy_defaults) / sizeof (energy_defaults[0]);
+       i ++)
+    if (strcmp (energy_defaults[i].medium, medium) == 0)
+      return energy_defaults[i].cost;
+  return energy_defaults[i - 1].cost;
+}
+
+/* Returns the energy remaining in the batteries, in millijoules, or -1
+   if a battery is charging or the charge is unknown.  */
+static int64_t
+energy_battery (void)
+{
+  if (wc_battery_monitor_charging (mt->bm))
+    return -1;
+
+  int64_t mj = 0;
+  GSList *batteries = wc_battery_monitor_list (mt->bm);
+  if (! batteries)
+    mj = -1;
+  while (batteries)
+    {
+      WCBattery *b = WC_BATTERY (batteries->data);
+
+      int mah = wc_battery_mah (b);
+      int mv = wc_battery_mv (b);
+      if (mah <= 0 || mv <= 0)
+	mj = -1;
+      else if (mj != -1)
+	/* 1 mAh at 1 mV is 3.6 mJ.  */
+	mj += (int64_t) mah * mv * 36 / 10;
+
+      g_object_unref (b);
+      batteries = g_slist_delete_link (batteries, batteries);
+    }
+
+  return mj;
+}
+
+/* Add the interval since the last run, which is now ending, to the
+   model, and return the model for MEDIUM.  BATTERY_MJ is the energy
+   remaining in the battery (or -1) and T the current time, in
+   seconds.  */
+static struct energy_cost
+energy_model_update (sqlite3 *db, const char *medium, int64_t battery_mj,
+		     int64_t t)
+{
+  struct energy_cost cost = energy_default (medium);
+
+  /* The last run.  */
+  int64_t last_time = 0;
+  int64_t last_battery_mj = -1;
+  char *last_medium = NULL;
+  int last_callback (void *cookie, int argc, char **argv, char **names)
+  {
+    last_time = argv[0] ? atoll (argv[0]) : 0;
+    last_medium = g_strdup (argv[1] ?: "unknown");
+    last_battery_mj = argv[2] ? atoll (argv[2]) : -1;
+    return 0;
+  }
+  char *errmsg = NULL;
+  sqlite3_exec (db, QUERY_ENERGY_LAST_RUN, last_callback, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "%s", errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+    }
+
+  if (last_medium && last_battery_mj > 0 && battery_mj > 0
+      && battery_mj <= last_battery_mj
+      && t > last_time && t - last_time <= ENERGY_MAX_SAMPLE_INTERVAL)
+    /* We were discharging for the whole interval.  Add a sample.  */
+    {
+      double e = (last_battery_mj - battery_mj) / 1000.;
+      double s = t - last_time;
+      double b = 0;
+      int bytes_callback (void *cookie, int argc, char **argv,
+			  char **names)
+      {
+	b += argv[0] ? atoll (argv[0]) : 0;
+	return 0;
+      }
+      int i;
+      for (i = 0; i < 2; i ++)
+	{
+	  sqlite3_exec_printf
+	    (db, QUERY_ENERGY_BYTES, bytes_callback, NULL, &errmsg,
+	     i == 0 ? "object_instance_status" : "stream_updates",
+	     last_time, t);
+	  if (errmsg)
+	    {
+	      debug (0, "%s", errmsg);
+	      sqlite3_free (errmsg);
+	      errmsg = NULL;
+	    }
+	}
 
-  debug (3, "Average time since last %d scans: "TIME_FMT"; %d scans: "TIME_FMT,
-	 (int) schedule_records_count, TIME_PRINTF (average),
-	 newest_quarter_count, TIME_PRINTF (newest_quarter_average));
+      debug (3, "Energy sample (%s): %.1f J in %.0f s, %.0f bytes",
+	     last_medium, e, s, b);
 
-  return (average > SCHEDULING_THRESHOLD
-	  && newest_quarter_average > SCHEDULING_NEWEST_QUARTER_THRESHOLD);
-}
+      woodchuck_write_lock ();
+      sqlite3_exec_printf
+	(db, QUERY_ENERGY_MODEL_ADD QUERY_ENERGY_MODEL_SAMPLE,
+	 NULL, NULL, &errmsg, last_medium,
+	 s, b, e, s * s, s * b, b * b, s * e, b * e, last_medium);
+      woodchuck_write_unlock ();
+      if (errmsg)
+	{
+	  debug (0, "%s", errmsg);
+	  sqlite3_free (errmsg);
+	  errmsg = NULL;
+	}
+    }
+  g_free (last_medium);
 
-#define IDLE_TIME_BEFORE_SCHEDULE (5 * 60)
+  /* Fit E = tail + power * t + per_byte * b by solving the normal
+     equations using Cramer's rule.  */
+  int model_callback (void *cookie, int argc, char **argv, char **names)
+  {
+    double v[9];
+    int i;
+    for (i = 0; i < 9; i ++)
+      v[i] = argv[i] ? strtod (argv[i], NULL) : 0;
+    double n = v[0], st = v[1], sb = v[2], se = v[3];
+    double stt = v[4], stb = v[5], sbb = v[6], ste = v[7], sbe = v[8];
 
-static bool scheduler_running;
+    if (n < ENERGY_MIN_SAMPLES)
+      return 0;
 
-struct scheduler_args
+    double det3 (double a, double b, double c,
+		 double d, double e, double f,
+		 double g, double h, double i)
+    {
+      return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+    }
+
+    double d = det3 (n, st, sb, st, stt, stb, sb, stb, sbb);
+    if (d == 0)
+      return 0;
+    double tail = det3 (se, st, sb, ste, stt, stb, sbe, stb, sbb) / d;
+    double power = det3 (n, se, sb, st, ste, stb, sb, sbe, sbb) / d;
+    double per_byte = det3 (n, st, se, st, stt, ste, sb, stb, sbe) / d;
+
+    debug (3, "Energy model (%s, %.0f samples): tail: %.2f J; "
+	   "power: %.3f W; per byte: %.3g J",
+	   medium, n, tail, power, per_byte);
+
+    if (tail < 0 || per_byte < 0 || power < 0)
+      /* The measurements are too noisy.  */
+      return 0;
+
+    cost.tail = tail;
+    cost.per_byte = per_byte;
+    return 0;
+  }
+  sqlite3_exec_printf
+    (db, QUERY_ENERGY_MODEL, model_callback, NULL, &errmsg, medium);
+  if (errmsg)
+    {
+      debug (0, "%s", errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+    }
+
+  return cost;
+}
+
+/* Record a scheduler run.  */
+static void
+energy_run_record (sqlite3 *db, const char *medium, int transfers,
+		   uint64_t bytes, double joules, int64_t battery_mj,
+		   bool deferred, int64_t t)
 {
-  int freshness_factor_numerator;
-  int freshness_factor_denominator;
-};
+  char *errmsg = NULL;
+  char *battery = battery_mj < 0 ? NULL
+    : sqlite3_mprintf ("%"PRId64, battery_mj);
+  woodchuck_write_lock ();
+  sqlite3_exec_printf
+    (db,
+     QUERY_ENERGY_RUN_RECORD
+     QUERY_ENERGY_RUNS_EXPIRE,
+     NULL, NULL, &errmsg,
+     t, medium, transfers, bytes, joules, battery ?: "NULL", deferred,
+     t - ENERGY_RUNS_MAX_AGE);
+  woodchuck_write_unlock ();
+  sqlite3_free (battery);
+  if (errmsg)
+    {
+      debug (0, "%s", errmsg);
+      sqlite3_free (errmsg);
+    }
+}
 
 static void *
 do_schedule_worker (void *arg)
@@ -573,11 +2789,26 @@ do_schedule_worker (void *arg)
       goto out;
     }
 
-  /* Wait a while before timing out.  */
-  sqlite3_busy_timeout (db, 5 * 60 * 1000);
+  db_setup (db);
 
   uint64_t n = now ();
 
+  /* The work this run would do.  It is only started once the energy
+     model has been consulted.  */
+  struct scheduled
+  {
+    /* Either an upcall to send...  */
+    struct upcall *upcall;
+    /* ... or a transfer for the simple transferer.  */
+    struct simple_transfer *simple;
+    char *url;
+    char *local_copy;
+    char *target;
+    /* The expected number of bytes transferred.  */
+    uint64_t bytes;
+  };
+  GSList *scheduled = NULL;
+
   int streams_callback (void *cookie, int argc, char **argv, char **names)
   {
     int i = 0;
@@ -659,28 +2890,35 @@ do_schedule_worker (void *arg)
 	     TIME_PRINTF (1000 * (uint64_t) freshness),
 	     TIME_PRINTF (1000 * (uint64_t) (freshness / 4)));
 
-    struct upcall *upcall = upcall_stream_update
+    struct scheduled *w = g_malloc0 (sizeof (*w));
+    w->upcall = upcall_stream_update
       (dbus_service_name, manager_uuid, manager_cookie,
        stream_uuid, stream_cookie);
 
-    upcall_list = g_slist_prepend (upcall_list, upcall);
+    /* Assume that the update transfers about as much as the last
+       few.  */
+    int bytes_callback (void *cookie, int argc, char **argv, char **names)
+    {
+      w->bytes = argv[0] ? atoll (argv[0]) : 0;
+      return 0;
+    }
+    char *errmsg = NULL;
+    sqlite3_exec_printf
+      (db,
+       QUERY_SCHEDULE_STREAM_BYTES, bytes_callback, NULL, &errmsg, stream_uuid);
+    if (errmsg)
+      {
+	debug (0, "%s", errmsg);
+	sqlite3_free (errmsg);
+      }
+
+    scheduled = g_slist_prepend (scheduled, w);
 
     return 0;
   }
   char *errmsg = NULL;
   sqlite3_exec
-    (db,
-     "select streams.uuid, streams.cookie,"
-     "  streams.parent_uuid, managers.cookie, managers.DBusServiceName,"
-     "  streams.Freshness, stream_updates.transfer_time, stream_updates.status"
-     " from streams left join stream_updates"
-     " on (streams.uuid == stream_updates.uuid"
-     /* MAX(STREAMS_UPDATES.INSTANCE) == STREAMS.INSTANCE + 1 */
-     "     and streams.instance == stream_updates.instance + 1)"
-     " join managers on streams.parent_uuid == managers.uuid"
-     /* A value of -1 means never update.  */
-     " where streams.Freshness != (1 << 32)-1 and managers.Enabled == 1;",
-     streams_callback, NULL, &errmsg);
+    (db, QUERY_SCHEDULE_STREAMS, streams_callback, NULL, &errmsg);
   if (errmsg)
     {
       debug (0, "%s", errmsg);
@@ -706,6 +2944,8 @@ do_schedule_worker (void *arg)
     uint64_t trigger_latest = argv[i] ? atoll (argv[i]) : 0; i ++;
     bool need_update = argv[i] ? atoi (argv[i]) : false; i ++;
     int instance = argv[i] ? atoi (argv[i]) : 0; i ++;
+    const char *filename = argv[i] ?: ""; i ++;
+    bool wakeup = argv[i] ? atoi (argv[i]) : true; i ++;
 
     debug (3, "Considering object %s(%s): transfer_time: "TIME_FMT";"
 	   " last_trys_status: %"PRId32"; transfer_frequency: "TIME_FMT";"
@@ -739,147 +2979,782 @@ do_schedule_worker (void *arg)
     GSList *list = g_hash_table_lookup (mt->manager_to_subscription_list_hash,
 					manager_uuid);
 
-    do_debug (3)
+    do_debug (3)
+      {
+	GString *s = g_string_new ("");
+	g_string_append_printf
+	  (s, "Object: %s, %s; Stream: %s, %s; Manager: %s, %s; "
+	   "transfer frequency: %"PRId32", "
+	   "time: @ %"PRId64"/delta: "TIME_FMT"; "
+	   "last try's status: %"PRId32"; "
+	   "trigger: <%"PRId64", %"PRId64", %"PRId64">; instance: %d; "
+	   "subscriptions: ",
+	   object_uuid, object_cookie,
+	   stream_uuid, stream_cookie, manager_uuid, manager_cookie,
+	   transfer_frequency, transfer_time,
+	   TIME_PRINTF (transfer_time == 0 ? 0 : (transfer_time * 1000 - n)),
+	   last_trys_status, trigger_target, trigger_earliest, trigger_latest,
+	   instance);
+
+	if (! list)
+	  g_string_append_printf (s, " NONE");
+	else
+	  {
+	    GSList *l = list;
+	    while (l)
+	      {
+		g_string_append_printf
+		  (s, " %s", ((struct subscription *) l->data)->dbus_name);
+		l = l->next;
+	      }
+	  }
+	debug (3, "%s", s->str);
+	g_string_free (s, TRUE);
+      }
+
+    /* Select the version with the highest utility.  */
+    uint32_t version_index = 0;
+    char *url = NULL;
+    int64_t expected_size = 0;
+    uint64_t expected_transfer_up = 0;
+    uint64_t expected_transfer_down = 0;
+    uint32_t utility = 1;
+    bool use_simple_transferer = false;
+    int version_callback (void *cookie, int argc, char **argv, char **names)
+    {
+      int i = 0;
+      version_index = argv[i] ? atoi (argv[i]) : 0; i ++;
+      url = g_strdup (argv[i] ?: ""); i ++;
+      expected_size = argv[i] ? atoll (argv[i]) : 0; i ++;
+      expected_transfer_up = argv[i] ? atoll (argv[i]) : 0; i ++;
+      expected_transfer_down = argv[i] ? atoll (argv[i]) : 0; i ++;
+      utility = argv[i] ? atoi (argv[i]) : 0; i ++;
+      use_simple_transferer = argv[i] ? atoi (argv[i]) : false; i ++;
+      return 0;
+    }
+    char *errmsg = NULL;
+    sqlite3_exec_printf
+      (db, QUERY_SCHEDULE_OBJECT_VERSION, version_callback, NULL, &errmsg, object_uuid);
+    if (errmsg)
+      {
+	debug (0, "%s", errmsg);
+	sqlite3_free (errmsg);
+	errmsg = NULL;
+      }
+
+    GValueArray *versions = version_value_array
+      (version_index, url, expected_size, expected_transfer_up,
+       expected_transfer_down, utility, use_simple_transferer);
+
+    /* The content of a one-shot object doesn't change.  If we already
+       have it, offer it.  */
+    char *local_copy = NULL;
+    if (transfer_frequency == 0 && url && *url)
+      local_copy = local_copy_lookup (db, object_uuid, url);
+
+    if (use_simple_transferer && url && *url)
+      /* We transfer the object ourselves.  */
+      {
+	char *target;
+	if (*filename == '/')
+	  target = strdup (filename);
+	else
+	  /* Save relative filenames in a directory dedicated to the
+	     object.  */
+	  {
+	    char *subdir = g_strdup_printf ("transfers/%s", object_uuid);
+	    target = dotdir_filename (subdir, filename);
+	    g_free (subdir);
+	  }
+
+	struct simple_transfer *t = g_malloc0 (sizeof (*t));
+	/* Only start the application if it wants to be woken.
+	   Otherwise, the upcall is only sent to subscribers.  */
+	if (wakeup && *dbus_service_name)
+	  t->dbus_service_name = g_strdup (dbus_service_name);
+	t->manager_uuid = g_strdup (manager_uuid);
+	t->manager_cookie = g_strdup (manager_cookie);
+	t->stream_uuid = g_strdup (stream_uuid);
+	t->stream_cookie = g_strdup (stream_cookie);
+	t->object_uuid = g_strdup (object_uuid);
+	t->object_cookie = g_strdup (object_cookie);
+	t->version = versions;
+	t->instance = instance;
+	t->trigger_target = trigger_target;
+
+	debug (3, "Simple transferer: %s(%s): %s -> %s%s%s",
+	       object_uuid, object_cookie, url, target,
+	       local_copy ? " using " : "", local_copy ?: "");
+
+	struct scheduled *w = g_malloc0 (sizeof (*w));
+	w->simple = t;
+	w->url = url;
+	w->local_copy = local_copy;
+	w->target = g_strdup (target);
+	if (! local_copy)
+	  w->bytes = expected_transfer_up + expected_transfer_down;
+	scheduled = g_slist_prepend (scheduled, w);
+
+	free (target);
+	return 0;
+      }
+    g_free (url);
+
+    if (! (list || (dbus_service_name && *dbus_service_name)))
+      {
+	debug (3, "No one ready to receive updates for "
+	       "object %s(%s) in stream %s(%s) in manager %s(%s)",
+	       object_uuid, object_cookie,
+	       stream_uuid, stream_cookie, manager_uuid, manager_cookie);
+	g_value_array_free (versions);
+	g_free (local_copy);
+	return 0;
+      }
+
+    struct scheduled *w = g_malloc0 (sizeof (*w));
+    w->upcall = upcall_transfer_object
+      (dbus_service_name, manager_uuid, manager_cookie,
+       stream_uuid, stream_cookie, object_uuid, object_cookie,
+       versions, filename, 5, local_copy);
+    if (! local_copy)
+      w->bytes = expected_transfer_up + expected_transfer_down;
+    g_free (local_copy);
+
+    scheduled = g_slist_prepend (scheduled, w);
+
+    return 0;
+  }
+  errmsg = NULL;
+  sqlite3_exec (db, QUERY_SCHEDULE_OBJECTS, objects_callback, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "%s", errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+    }
+
+  scheduled = g_slist_reverse (scheduled);
+
+  /* Consult the energy model.  */
+  const char *medium = energy_medium (args->mediums);
+  struct energy_cost cost
+    = energy_model_update (db, medium, args->battery_mj, n / 1000);
+
+  /* Only wifi and ethernet are not subject to the budget.  Other
+     media are only used if the user allowed them.  */
+  bool budgeted = strcmp (medium, "wifi") != 0
+    && strcmp (medium, "ethernet") != 0;
+
+  int transfers = 0;
+  uint64_t bytes = 0;
+  double joules = cost.tail;
+  bool deferred = false;
+  GSList *l;
+  for (l = scheduled; l; l = l->next)
+    {
+      struct scheduled *w = l->data;
+      double e = w->bytes * cost.per_byte;
+
+      if (budgeted && joules + e > ENERGY_BUDGET)
+	/* Over budget (possibly even for the first transfer).  Leave
+	   the rest for the next run.  */
+	break;
+
+      transfers ++;
+      bytes += w->bytes;
+      joules += e;
+    }
+
+  if (transfers > 0 && args->battery_mj != -1
+      && cost.tail * 100 > joules * ENERGY_MAX_TAIL_SHARE
+      && energy_deferrals < ENERGY_MAX_DEFERRALS)
+    /* Waking the radio costs more than the transfers.  Wait for more
+       work to accumulate.  */
+    {
+      deferred = true;
+      energy_deferrals ++;
+    }
+  else if (transfers > 0)
+    energy_deferrals = 0;
+
+  debug (transfers > 0 ? 1 : 3,
+	 "Run over %s: %d of %d transfers, ~%"PRId64" bytes, "
+	 "~%.1f J (tail: %.1f J, %.3g J/byte)%s",
+	 medium, transfers, g_slist_length (scheduled), bytes,
+	 transfers > 0 ? joules : 0., cost.tail, cost.per_byte,
+	 deferred ? "; deferred" : "");
+
+  energy_run_record (db, medium, transfers, bytes,
+		     transfers > 0 && ! deferred ? joules : 0,
+		     args->battery_mj, deferred, n / 1000);
+
+  while (scheduled)
+    {
+      struct scheduled *w = scheduled->data;
+      scheduled = g_slist_delete_link (scheduled, scheduled);
+
+      bool run = transfers > 0 && ! deferred;
+      if (run)
+	transfers --;
+
+      if (w->upcall)
+	{
+	  if (run)
+	    upcall_list = g_slist_prepend (upcall_list, w->upcall);
+	  else
+	    upcall_free (w->upcall);
+	}
+      else
+	{
+	  if (! (run && simple_transferer_queue (w->simple->object_uuid,
+						 w->url, w->local_copy,
+						 w->target,
+						 simple_transfer_done,
+						 w->simple)))
+	    /* Not now or the object is already being transferred.  */
+	    simple_transfer_free (w->simple);
+	  g_free (w->url);
+	  g_free (w->local_copy);
+	  g_free (w->target);
+	}
+      g_free (w);
+    }
+
+  uint64_t t = now () - n;
+  debug (3, "Scheduling took "TIME_FMT, TIME_PRINTF(t));
+
+  if (upcall_list)
+    {
+      debug (3, "Have %d upcalls to send", g_slist_length (upcall_list));
+      upcall_list = g_slist_reverse (upcall_list);
+      g_idle_add (upcall_execute_callback, NULL);
+    }
+
+ out:
+  schedule_notice ();
+
+  scheduler_running = false;
+
+  sqlite3_close (db);
+
+  free (arg);
+
+  return NULL;
+}
+
+/* Reclaiming space from cold objects.
+
+   An object instance is cold if it has not been used in the last
+   COLD_OBJECT_AGE seconds (or, if it was never used, was transferred
+   before then).  When the device is charging and the user is idle,
+   cold_objects_worker considers the largest cold instances.  If all
+   of an instance's files are dedicated to it and the application
+   allowed woodchuck to compress them (the
+   COMPRESS_WITHOUT_CONSULTATION deletion policy), it compresses them
+   itself and tells the application the new file names using the
+   ObjectFilesCompressed upcall.  Otherwise, it sends the application
+   an ObjectDeleteFiles upcall, to which the application responds by
+   calling FilesDeleted.  Precious files are never touched.  The space reclaimed is tracked per manager in the
+   space_reclaimed table.  */
+
+/* How long an instance must not have been used before it is cold, in
+   seconds.  */
+#define COLD_OBJECT_AGE (14 * 24 * 60 * 60)
+/* Instances smaller than this (in bytes) are not worth the effort.  */
+#define COLD_OBJECT_MIN_SIZE (64 * 1024)
+/* The maximum number of instances to consider per pass.  */
+#define COLD_OBJECTS_PER_PASS 16
+/* The minimum time between passes, in seconds.  */
+#define COLD_OBJECTS_INTERVAL (6 * 60 * 60)
+/* If the application does not respond to an ObjectDeleteFiles upcall,
+   how long to wait before asking it again, in seconds.  */
+#define COLD_OBJECTS_ASK_AGAIN (24 * 60 * 60)
+/* Only keep compressed files if they are at least 1/N smaller.  */
+#define COLD_OBJECTS_MIN_SAVINGS 10
+
+/* Whether a pass is running.  Belongs to the main thread.  */
+static bool cold_objects_running;
+/* When the last pass was started.  */
+static uint64_t cold_objects_last_pass;
+/* Set when the user becomes active to end the current pass early.  */
+static volatile bool cold_objects_stop;
+
+/* Add DELETED and COMPRESSED bytes to the space reclaimed from
+   MANAGER's objects.  The caller must hold the write lock.  */
+static void
+space_reclaimed_add (const char *manager, int64_t deleted,
+		     int64_t compressed)
+{
+  debug (3, "Reclaimed from %s: %"PRId64" bytes deleted, "
+	 "%"PRId64" bytes compressed",
+	 manager, deleted, compressed);
+
+  char *errmsg = NULL;
+  sqlite3_exec_printf
+    (db,
+     "insert or ignore into space_reclaimed (parent_uuid) values (%Q);"
+     "update space_reclaimed"
+     " set deleted = deleted + %"PRId64","
+     "  compressed = compressed + %"PRId64
+     " where parent_uuid = %Q;",
+     NULL, NULL, &errmsg, manager, deleted, compressed, manager);
+  if (errmsg)
+    {
+      debug (0, "Updating the space reclaimed from %s: %s",
+	     manager, errmsg);
+      sqlite3_free (errmsg);
+    }
+}
+
+/* Run gzip on FILENAME.  If DECOMPRESS is true, FILENAME must end in
+   .gz and is decompressed.  Returns whether gzip succeeded.  */
+static bool
+gzip_file (const char *filename, bool decompress)
+{
+  char *argv[] = { "gzip", decompress ? "-d" : "-9", (char *) filename,
+		   NULL };
+  int status = 0;
+  GError *error = NULL;
+  if (! g_spawn_sync (NULL, argv, NULL,
+		      G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL
+		      | G_SPAWN_STDERR_TO_DEV_NULL,
+		      NULL, NULL, NULL, NULL, &status, &error))
+    {
+      debug (0, "Running gzip on %s: %s",
+	     filename, error ? error->message : "<Unknown>");
+      if (error)
+	g_error_free (error);
+      return false;
+    }
+
+  if (! WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      debug (0, "gzip %s %s failed (status: %d)",
+	     argv[1], filename, status);
+      return false;
+    }
+
+  return true;
+}
+
+/* A cold object instance.  */
+struct cold_object
+{
+  char *uuid;
+  int instance;
+  char *cookie;
+  char *stream_uuid;
+  char *stream_cookie;
+  char *manager_uuid;
+  char *manager_cookie;
+  char *dbus_service_name;
+};
+
+static void
+cold_object_free (struct cold_object *o)
+{
+  g_free (o->uuid);
+  g_free (o->cookie);
+  g_free (o->stream_uuid);
+  g_free (o->stream_cookie);
+  g_free (o->manager_uuid);
+  g_free (o->manager_cookie);
+  g_free (o->dbus_service_name);
+  g_free (o);
+}
+
+/* Compress the FILES_COUNT files in FILENAMES, which belong to the
+   cold object O, and tell the application about the new file names.
+   If cold_objects_stop is set, stops before the next file.  */
+static void
+cold_object_compress (struct cold_object *o, char **filenames,
+		      int files_count)
+{
+  int64_t before = 0;
+  int64_t after = 0;
+  bool compressed[files_count];
+  int64_t new_size[files_count];
+  bool stopped = false;
+
+  int i;
+  for (i = 0; i < files_count; i ++)
+    {
+      compressed[i] = false;
+
+      struct stat st;
+      if (stat (filenames[i], &st) < 0)
+	{
+	  debug (0, "stat (%s): %m", filenames[i]);
+	  continue;
+	}
+      before += st.st_size;
+
+      if (cold_objects_stop)
+	stopped = true;
+
+      int len = strlen (filenames[i]);
+      if (stopped
+	  || (len > 3 && strcmp (&filenames[i][len - 3], ".gz") == 0))
+	/* Already compressed or the user is active.  */
+	{
+	  after += st.st_size;
+	  continue;
+	}
+
+      char *gz = g_strdup_printf ("%s.gz", filenames[i]);
+      if (gzip_file (filenames[i], false) && stat (gz, &st) == 0)
+	{
+	  compressed[i] = true;
+	  new_size[i] = st.st_size;
+	}
+      after += st.st_size;
+      g_free (gz);
+    }
+
+  bool keep = before > 0
+    && before - after >= before / COLD_OBJECTS_MIN_SAVINGS;
+  if (! keep)
+    /* Not worth it.  Undo any compression.  */
+    {
+      for (i = 0; i < files_count; i ++)
+	if (compressed[i])
+	  {
+	    char *gz = g_strdup_printf ("%s.gz", filenames[i]);
+	    if (gzip_file (gz, true))
+	      compressed[i] = false;
+	    g_free (gz);
+	  }
+    }
+
+  debug (3, "Compressing %s(%s): %"PRId64" -> %"PRId64" bytes%s%s",
+	 o->uuid, o->cookie, before, after, keep ? "" : ", not keeping",
+	 stopped ? " (stopped early: user active)" : "");
+
+  /* Record the new file names and the compressed size.  If compressing
+     didn't help, we still set the compressed size (to the unchanged
+     size) so that the instance is not considered again.  If we
+     stopped early, we don't set it so that the remaining files are
+     compressed in a later pass.  */
+  GString *sql = g_string_new ("begin transaction;");
+  char *object = sqlite3_mprintf ("%Q", o->uuid);
+  GPtrArray *files = g_ptr_array_new ();
+  for (i = 0; i < files_count; i ++)
+    if (compressed[i])
       {
-	GString *s = g_string_new ("");
+	char *gz = g_strdup_printf ("%s.gz", filenames[i]);
+
+	char *filename = sqlite3_mprintf ("%Q", filenames[i]);
 	g_string_append_printf
-	  (s, "Object: %s, %s; Stream: %s, %s; Manager: %s, %s; "
-	   "transfer frequency: %"PRId32", "
-	   "time: @ %"PRId64"/delta: "TIME_FMT"; "
-	   "last try's status: %"PRId32"; "
-	   "trigger: <%"PRId64", %"PRId64", %"PRId64">; instance: %d; "
-	   "subscriptions: ",
-	   object_uuid, object_cookie,
-	   stream_uuid, stream_cookie, manager_uuid, manager_cookie,
-	   transfer_frequency, transfer_time,
-	   TIME_PRINTF (transfer_time == 0 ? 0 : (transfer_time * 1000 - n)),
-	   last_trys_status, trigger_target, trigger_earliest, trigger_latest,
-	   instance);
+	  (sql,
+	   "update object_instance_files set filename = filename || '.gz'"
+	   " where uuid = %s and instance = %d and filename = %s;",
+	   object, o->instance, filename);
+	sqlite3_free (filename);
+
+	GValueArray *file = g_value_array_new (3);
+
+	GValue filename_value = { 0 };
+	g_value_init (&filename_value, G_TYPE_STRING);
+	g_value_set_string (&filename_value, filenames[i]);
+	g_value_array_append (file, &filename_value);
+	g_value_unset (&filename_value);
+
+	GValue new_filename_value = { 0 };
+	g_value_init (&new_filename_value, G_TYPE_STRING);
+	g_value_take_string (&new_filename_value, gz);
+	g_value_array_append (file, &new_filename_value);
+	g_value_unset (&new_filename_value);
+
+	GValue new_size_value = { 0 };
+	g_value_init (&new_size_value, G_TYPE_UINT64);
+	g_value_set_uint64 (&new_size_value, new_size[i]);
+	g_value_array_append (file, &new_size_value);
+
+	g_ptr_array_add (files, file);
+      }
+  if (! stopped)
+    g_string_append_printf
+      (sql,
+       "update object_instance_status set compressed_size = %"PRId64
+       " where uuid = %s and instance = %d;",
+       keep ? after : before, object, o->instance);
+  g_string_append (sql, "end transaction;");
+  sqlite3_free (object);
 
-	if (! list)
-	  g_string_append_printf (s, " NONE");
-	else
+  woodchuck_write_lock ();
+  char *errmsg = NULL;
+  sqlite3_exec (db, sql->str, NULL, NULL, &errmsg);
+  if (errmsg)
+    {
+      debug (0, "Recording compression of %s(%s): %s",
+	     o->uuid, o->cookie, errmsg);
+      sqlite3_free (errmsg);
+      sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+    }
+  else
+    {
+      if (keep)
+	space_reclaimed_add (o->manager_uuid, 0, before - after);
+
+      GSList *changed = NULL;
+      for (i = 0; i < files_count; i ++)
+	if (compressed[i])
 	  {
-	    GSList *l = list;
-	    while (l)
-	      {
-		g_string_append_printf
-		  (s, " %s", ((struct subscription *) l->data)->dbus_name);
-		l = l->next;
-	      }
+	    char *gz = g_strdup_printf ("%s.gz", filenames[i]);
+	    disk_usage_update (filenames[i], &changed);
+	    disk_usage_update (gz, &changed);
+	    g_free (gz);
 	  }
-	debug (3, "%s", s->str);
-	g_string_free (s, TRUE);
-      }
+      disk_usage_changed (changed);
+    }
+  woodchuck_write_unlock ();
 
-    if (! (list || (dbus_service_name && *dbus_service_name)))
-      {
-	debug (3, "No one ready to receive updates for "
-	       "object %s(%s) in stream %s(%s) in manager %s(%s)",
-	       object_uuid, object_cookie,
-	       stream_uuid, stream_cookie, manager_uuid, manager_cookie);
-	return 0;
-      }
+  g_string_free (sql, TRUE);
 
-    /* We need to build this for each subscriber as the dbus handler
-       frees the arguments.  */
-    GValueArray *versions = g_value_array_new (7);
-
-    GValue index_value = { 0 };
-    g_value_init (&index_value, G_TYPE_UINT);
-    g_value_set_uint (&index_value, 0);
-    g_value_array_append (versions, &index_value);
-
-#warning Get the real values from the object_versions table.
-    GValue url_value = { 0 };
-    g_value_init (&url_value, G_TYPE_STRING);
-    g_value_set_static_string (&url_value, "");
-    g_value_array_append (versions, &url_value);
-
-    GValue expected_size_value = { 0 };
-    g_value_init (&expected_size_value, G_TYPE_INT64);
-    g_value_set_int64 (&expected_size_value, 0);
-    g_value_array_append (versions, &expected_size_value);
-
-    GValue expected_transfer_up_value = { 0 };
-    g_value_init (&expected_transfer_up_value, G_TYPE_UINT64);
-    g_value_set_uint64 (&expected_transfer_up_value, 0);
-    g_value_array_append (versions, &expected_transfer_up_value);
-
-    GValue expected_transfer_down_value = { 0 };
-    g_value_init (&expected_transfer_down_value, G_TYPE_UINT64);
-    g_value_set_uint64 (&expected_transfer_down_value, 0);
-    g_value_array_append (versions, &expected_transfer_down_value);
-
-    GValue utility_value = { 0 };
-    g_value_init (&utility_value, G_TYPE_UINT);
-    g_value_set_uint (&utility_value, 1);
-    g_value_array_append (versions, &utility_value);
-
-    GValue use_simple_transferer_value = { 0 };
-    g_value_init (&use_simple_transferer_value, G_TYPE_BOOLEAN);
-    g_value_set_boolean (&use_simple_transferer_value, FALSE);
-    g_value_array_append (versions, &use_simple_transferer_value);
-
-    struct upcall *upcall = upcall_transfer_object
-      (dbus_service_name, manager_uuid, manager_cookie,
-       stream_uuid, stream_cookie, object_uuid, object_cookie,
-       versions, "", 5);
+  if (files->len > 0)
+    /* The files were renamed: the application needs to know even if
+       we failed to record it.  */
+    {
+      debug (3, "Telling %s that %d files of %s(%s) were compressed",
+	     o->dbus_service_name ?: o->manager_uuid, files->len,
+	     o->uuid, o->cookie);
+
+      struct upcall *upcall = upcall_object_files_compressed
+	(o->dbus_service_name, o->manager_uuid, o->manager_cookie,
+	 o->stream_uuid, o->stream_cookie, o->uuid, o->cookie,
+	 files, after);
+      /* Subscriptions belong to the main thread.  */
+      g_idle_add (upcall_execute_idle, upcall);
+    }
+  else
+    g_ptr_array_free (files, TRUE);
+}
 
-    upcall_list = g_slist_prepend (upcall_list, upcall);
+/* Ask the application to delete the cold object O's FILES_COUNT
+   files, which are described by FILENAMES, DEDICATED and
+   DELETION_POLICIES.  */
+static void
+cold_object_ask (struct cold_object *o, char **filenames, bool *dedicated,
+		 uint32_t *deletion_policies, int files_count)
+{
+  GPtrArray *files = g_ptr_array_sized_new (files_count);
+  int i;
+  for (i = 0; i < files_count; i ++)
+    {
+      GValueArray *file = g_value_array_new (3);
 
-    return 0;
-  }
-  errmsg = NULL;
-  sqlite3_exec
+      GValue filename_value = { 0 };
+      g_value_init (&filename_value, G_TYPE_STRING);
+      g_value_set_string (&filename_value, filenames[i]);
+      g_value_array_append (file, &filename_value);
+      g_value_unset (&filename_value);
+
+      GValue dedicated_value = { 0 };
+      g_value_init (&dedicated_value, G_TYPE_BOOLEAN);
+      g_value_set_boolean (&dedicated_value, dedicated[i]);
+      g_value_array_append (file, &dedicated_value);
+
+      GValue deletion_policy_value = { 0 };
+      g_value_init (&deletion_policy_value, G_TYPE_UINT);
+      g_value_set_uint (&deletion_policy_value, deletion_policies[i]);
+      g_value_array_append (file, &deletion_policy_value);
+
+      g_ptr_array_add (files, file);
+    }
+
+  debug (3, "Asking %s to delete %s(%s) (%d files)",
+	 o->dbus_service_name ?: o->manager_uuid, o->uuid, o->cookie,
+	 files_count);
+
+  struct upcall *upcall = upcall_object_delete_files
+    (o->dbus_service_name, o->manager_uuid, o->manager_cookie,
+     o->stream_uuid, o->stream_cookie, o->uuid, o->cookie, files);
+  /* Subscriptions belong to the main thread.  */
+  g_idle_add (upcall_execute_idle, upcall);
+
+  woodchuck_write_lock ();
+  char *errmsg = NULL;
+  sqlite3_exec_printf
     (db,
-     "select objects.uuid, objects.cookie,"
-     "  streams.uuid, streams.cookie,"
-     "  streams.parent_uuid, managers.cookie, managers.DBusServiceName,"
-     "  objects.TransferFrequency, object_instance_status.transfer_time,"
-     "  object_instance_status.status,"
-     "  objects.TriggerTarget, objects.TriggerEarliest, objects.TriggerLatest,"
-     "  objects.NeedUpdate, objects.instance"
-     " from objects left join object_instance_status"
-     " on (objects.uuid == object_instance_status.uuid"
-     /* MAX(OBJECT_INSTANCE_STATUS.INSTANCE) == OBJECTS.INSTANCE + 1 */
-     "     and objects.Instance == object_instance_status.instance + 1)"
-     " join streams on objects.parent_uuid == streams.uuid"
-     " join managers on managers.uuid == streams.parent_uuid"
-     " where managers.Enabled == 1 and objects.DontTransfer == 0"
-     "  and (coalesce (object_instance_status.transfer_time, 0) == 0"
-     "       or objects.NeedUpdate == 1"
-     "       or objects.TransferFrequency > 0);",
-     objects_callback, NULL, &errmsg);
+     "update object_instance_status set delete_requested = %"PRId64
+     " where uuid = %Q and instance = %d;",
+     NULL, NULL, &errmsg, (int64_t) time (NULL), o->uuid, o->instance);
+  woodchuck_write_unlock ();
   if (errmsg)
     {
-      debug (0, "%s", errmsg);
+      debug (0, "Recording deletion request for %s(%s): %s",
+	     o->uuid, o->cookie, errmsg);
       sqlite3_free (errmsg);
-      errmsg = NULL;
     }
+}
 
-  uint64_t t = now () - n;
-  debug (3, "Scheduling took "TIME_FMT, TIME_PRINTF(t));
+static gboolean
+cold_objects_done (gpointer user_data)
+{
+  cold_objects_running = false;
+  return FALSE;
+}
 
-  if (upcall_list)
+static void *
+cold_objects_worker (void *arg)
+{
+  uint64_t start = now ();
+
+  /* Every thread must have its own sqlite3 instance.  */
+  int err = sqlite3_open (db_filename, &db);
+  if (err)
     {
-      debug (3, "Have %d upcalls to send", g_slist_length (upcall_list));
-      upcall_list = g_slist_reverse (upcall_list);
-      g_idle_add (upcall_execute_callback, NULL);
+      debug (0, "sqlite3_open (%s): %s", db_filename, sqlite3_errmsg (db));
+      goto out;
     }
+  db_setup (db);
 
- out:
-  schedule_notice ();
+  GSList *cold = NULL;
+  void cold_callback (void *cookie, int argc, const char *argv[])
+  {
+    struct cold_object *o = g_malloc0 (sizeof (*o));
+    int i = 0;
+    o->uuid = g_strdup (argv[i]); i ++;
+    o->instance = atoi (argv[i]); i ++;
+    o->cookie = g_strdup (argv[i] ?: ""); i ++;
+    o->stream_uuid = g_strdup (argv[i]); i ++;
+    o->stream_cookie = g_strdup (argv[i] ?: ""); i ++;
+    o->manager_uuid = g_strdup (argv[i]); i ++;
+    o->manager_cookie = g_strdup (argv[i] ?: ""); i ++;
+    if (argv[i] && *argv[i])
+      o->dbus_service_name = g_strdup (argv[i]);
+    i ++;
+
+    cold = g_slist_prepend (cold, o);
+  }
 
-  scheduler_running = false;
+  int64_t t = time (NULL);
+  GError *error = NULL;
+  rows_each_printf
+    (cold_callback, NULL, &error,
+     QUERY_COLD_OBJECTS,
+     COLD_OBJECT_MIN_SIZE, t, t - COLD_OBJECTS_ASK_AGAIN,
+     t - COLD_OBJECT_AGE, t - COLD_OBJECT_AGE,
+     WOODCHUCK_DELETION_POLICY_PRECIOUS,
+     COLD_OBJECTS_PER_PASS);
+  if (error)
+    {
+      debug (0, "Looking for cold objects: %s", error->message);
+      g_error_free (error);
+      error = NULL;
+    }
+
+  cold = g_slist_reverse (cold);
+  debug (3, "%d cold objects (found in "TIME_FMT")",
+	 g_slist_length (cold), TIME_PRINTF (now () - start));
+
+  while (cold)
+    {
+      struct cold_object *o = cold->data;
+      cold = g_slist_delete_link (cold, cold);
+
+      if (cold_objects_stop)
+	{
+	  cold_object_free (o);
+	  continue;
+	}
+
+      GPtrArray *filenames = g_ptr_array_new ();
+      GArray *dedicated = g_array_new (FALSE, FALSE, sizeof (bool));
+      GArray *deletion_policies
+	= g_array_new (FALSE, FALSE, sizeof (uint32_t));
+      bool compress = true;
+      void files_callback (void *cookie, int argc, const char *argv[])
+      {
+	bool d = argv[1] ? atoi (argv[1]) : false;
+	uint32_t p = argv[2] ? atoi (argv[2]) : 0;
+
+	g_ptr_array_add (filenames, g_strdup (argv[0] ?: ""));
+	g_array_append_val (dedicated, d);
+	g_array_append_val (deletion_policies, p);
+
+	/* Only compress the files if the application explicitly
+	   allowed it.  In particular, that the application lets us
+	   delete a file does not mean that it can cope with the file
+	   being renamed.  */
+	if (! d
+	    || p != WOODCHUCK_DELETION_POLICY_COMPRESS_WITHOUT_CONSULTATION)
+	  compress = false;
+      }
+      rows_each_printf
+	(files_callback, NULL, &error,
+	 QUERY_COLD_OBJECT_FILES,
+	 o->uuid, o->instance);
+      if (error)
+	{
+	  debug (0, "Reading the files of %s(%s): %s",
+		 o->uuid, o->cookie, error->message);
+	  g_error_free (error);
+	  error = NULL;
+	}
+      else if (filenames->len > 0)
+	{
+	  if (compress)
+	    cold_object_compress (o, (char **) filenames->pdata,
+				  filenames->len);
+	  else
+	    cold_object_ask (o, (char **) filenames->pdata,
+			     (bool *) dedicated->data,
+			     (uint32_t *) deletion_policies->data,
+			     filenames->len);
+	}
 
+      int i;
+      for (i = 0; i < filenames->len; i ++)
+	g_free (g_ptr_array_index (filenames, i));
+      g_ptr_array_free (filenames, TRUE);
+      g_array_free (dedicated, TRUE);
+      g_array_free (deletion_policies, TRUE);
+      cold_object_free (o);
+    }
+
+  debug (3, "Reclaiming space took "TIME_FMT"%s",
+	 TIME_PRINTF (now () - start),
+	 cold_objects_stop ? " (stopped early: user active)" : "");
+
+ out:
   sqlite3_close (db);
+  db = NULL;
 
-  free (arg);
+  g_idle_add (cold_objects_done, NULL);
 
   return NULL;
 }
 
+/* Start a pass over the cold objects, if the device is charging and
+   the last pass was long enough ago.  The caller should check that
+   the user is idle.  */
+static void
+cold_objects_start (void)
+{
+  if (cold_objects_running)
+    return;
+
+  if (! wc_battery_monitor_charging (mt->bm))
+    {
+      debug (3, "Not reclaiming space: Not charging.");
+      return;
+    }
+
+  uint64_t n = now ();
+  if (cold_objects_last_pass
+      && n - cold_objects_last_pass < COLD_OBJECTS_INTERVAL * 1000ULL)
+    return;
+
+  cold_objects_running = true;
+  cold_objects_stop = false;
+  cold_objects_last_pass = n;
+
+  pthread_t tid;
+  pthread_create (&tid, NULL, cold_objects_worker, NULL);
+  pthread_detach (tid);
+}
+
 static pthread_t do_schedule_worker_tid;
 
 static gboolean
@@ -919,6 +3794,9 @@ do_schedule (gpointer user_data)
       break;
     }
 
+  /* This doesn't require a network connection.  */
+  cold_objects_start ();
+
   if (mt->user_really_idling_timeout_id)
     g_source_remove (mt->user_really_idling_timeout_id);
   mt->user_really_idling_timeout_id = 0;
@@ -941,14 +3819,13 @@ do_schedule (gpointer user_data)
       goto out;
     }
 
-  if ((nc_network_connection_mediums (dc)
-       & ~(NC_CONNECTION_MEDIUM_ETHERNET|NC_CONNECTION_MEDIUM_WIFI)) != 0)
-    /* Only use ethernet and wifi based connections.  */
+  if ((nc_network_connection_mediums (dc) & ~energy_allowed_mediums) != 0)
+    /* Only use the allowed media (by default, ethernet and wifi).  */
     {
-      char *m = 
+      char *m =
 	nc_connection_medium_to_string (nc_network_connection_mediums (dc));
       debug (3, "Not scheduling: Default connection includes components "
-	     "that are neither ethernet nor Wifi (%s).",
+	     "that are not allowed (%s).",
 	     m);
       g_free (m);
       goto out;
@@ -984,6 +3861,11 @@ do_schedule (gpointer user_data)
       args->freshness_factor_denominator = 1;
     }
 
+  /* The scheduler uses the energy model to decide how much to do
+     over the connection.  */
+  args->mediums = nc_network_connection_mediums (dc);
+  args->battery_mj = energy_battery ();
+
   pthread_create (&do_schedule_worker_tid, NULL, do_schedule_worker, args);
   pthread_detach (do_schedule_worker_tid);
 
@@ -992,11 +3874,28 @@ do_schedule (gpointer user_data)
   return FALSE;
 }
 
+static void schedule (void);
+
+static gboolean
+schedule_from_main_thread (gpointer user_data)
+{
+  schedule ();
+  return FALSE;
+}
+
 /* Call this when it appears that an action can be executed, e.g.,
    updating a stream or transferring an object.  */
 static void
 schedule (void)
 {
+  if (g_thread_self () != main_thread)
+    /* Called from a D-Bus worker thread.  SCHEDULE_ID belongs to the
+       main thread.  */
+    {
+      g_idle_add (schedule_from_main_thread, NULL);
+      return;
+    }
+
   if (schedule_id)
     return;
 
@@ -1008,25 +3907,28 @@ schedule (void)
   debug (3, "Running scheduler in %d seconds (last schedule delta: "TIME_FMT")",
 	 delay, TIME_PRINTF(1000 * last_schedule_delta));
 
-  schedule_id = g_timeout_add_seconds (delay, do_schedule, NULL);
+  schedule_id = timer_add_seconds ("scheduler", delay, 5, do_schedule, NULL);
 }
 
 /* When a client exits, clean up any feedback subscriptions it may
-   have.  */
-static void
-dbus_name_owner_changed_cb (DBusGProxy *proxy,
-			    const char *name, const char *old_owner,
-			    const char *new_owner,
-			    gpointer user_data)
+   have.  Rather than listen to every NameOwnerChanged signal, which
+   wakes us whenever any process on the session bus comes or goes, we
+   add a match rule for each subscriber's unique name.  */
+static char *
+subscriber_match_rule (const char *name)
 {
-  if (! name)
-    return;
-  if (name[0] != ':')
-    /* We are only interested in private names.  */
-    return;
+  return g_strdup_printf ("type='signal',sender='" DBUS_SERVICE_DBUS "',"
+			  "interface='" DBUS_INTERFACE_DBUS "',"
+			  "member='NameOwnerChanged',arg0='%s'",
+			  name);
+}
 
+/* The client NAME exited.  Remove its subscriptions.  */
+static void
+subscriber_vanished (const char *name)
+{
   GSList *list = g_hash_table_lookup (mt->bus_name_to_subscription_list_hash,
-				      old_owner);
+				      name);
   while (list)
     /* Be careful how we traverse the list:
        woodchuck_manager_feedback_unsubscribe modifies it!  */
@@ -1044,6 +3946,56 @@ dbus_name_owner_changed_cb (DBusGProxy *proxy,
     }
 }
 
+static DBusHandlerResult
+name_owner_changed_filter (DBusConnection *connection, DBusMessage *message,
+			   void *user_data)
+{
+  if (! dbus_message_is_signal (message, DBUS_INTERFACE_DBUS,
+				"NameOwnerChanged")
+      || ! dbus_message_has_sender (message, DBUS_SERVICE_DBUS))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  const char *name = NULL;
+  const char *old_owner = NULL;
+  const char *new_owner = NULL;
+  if (dbus_message_get_args (message, NULL,
+			     DBUS_TYPE_STRING, &name,
+			     DBUS_TYPE_STRING, &old_owner,
+			     DBUS_TYPE_STRING, &new_owner,
+			     DBUS_TYPE_INVALID)
+      /* We are only interested in private names.  */
+      && name[0] == ':')
+    subscriber_vanished (old_owner);
+
+  /* Others may be interested as well.  */
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* The reply to the NameHasOwner call that
+   woodchuck_manager_feedback_subscribe makes after adding a
+   subscriber's match rule.  If the subscriber exited before the rule
+   was in place, we won't see the signal.  */
+static void
+subscriber_has_owner_cb (DBusGProxy *proxy, gboolean has_owner,
+			 GError *error, gpointer user_data)
+{
+  char *name = user_data;
+
+  if (error)
+    {
+      debug (0, "NameHasOwner (%s): %s", name, error->message);
+      g_error_free (error);
+    }
+  else if (! has_owner)
+    {
+      debug (3, "Subscriber %s exited before we started watching it.",
+	     name);
+      subscriber_vanished (name);
+    }
+
+  g_free (name);
+}
+
 static gboolean
 schedule_periodically (gpointer user_data)
 {
@@ -1097,11 +4049,14 @@ user_idle_active (WCUserActivityMonitor *m,
 	 cancelled.  */
       assert (! mt->user_really_idling_timeout_id);
       mt->user_really_idling_timeout_id
-	= g_timeout_add_seconds (IDLE_TIME_BEFORE_SCHEDULE, do_schedule, NULL);
+	= timer_add_seconds ("scheduler", IDLE_TIME_BEFORE_SCHEDULE, 60,
+			     do_schedule, NULL);
     }
   else
     /* The user is now active.  */
     {
+      cold_objects_stop = true;
+
       if (mt->user_really_idling_timeout_id)
 	{
           g_source_remove (mt->user_really_idling_timeout_id);
@@ -1109,6 +4064,20 @@ user_idle_active (WCUserActivityMonitor *m,
 	}
     }
 }
+
+/* On battery, limit the number of timer wakeups.  */
+static void
+battery_status (WCBatteryMonitor *m, WCBattery *b,
+		int old_is_charging, int is_charging,
+		int old_is_discharging, int is_discharging,
+		int old_mv, int mv,
+		int old_mah, int mah,
+		int old_charger, int charger,
+		gpointer user_data)
+{
+  timers_wakeup_budget (wc_battery_monitor_discharging (m)
+			? TIMERS_BATTERY_WAKEUP_BUDGET : 0);
+}
 
 G_DEFINE_TYPE (Murmeltier, murmeltier, G_TYPE_OBJECT);
 
@@ -1149,17 +4118,15 @@ murmeltier_init (Murmeltier *mt)
     (mt->session_bus, "org.freedesktop.DBus",
      "/org/freedesktop/DBus", "org.freedesktop.DBus");
 
-  dbus_g_proxy_add_signal (mt->dbus_proxy,
-			   "NameOwnerChanged",
-			   G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
-			   G_TYPE_INVALID);
-  dbus_g_proxy_connect_signal (mt->dbus_proxy, "NameOwnerChanged",
-			       G_CALLBACK (dbus_name_owner_changed_cb),
-			       NULL, NULL);
+  /* woodchuck_manager_feedback_subscribe adds the match rules.  */
+  dbus_connection_add_filter
+    (dbus_g_connection_get_connection (mt->session_bus),
+     name_owner_changed_filter, NULL, NULL);
 
   /* Approximately every hour, check to see if there is something that
      needs to be transferred.  */
-  g_timeout_add_seconds (60 * 60, schedule_periodically, mt);
+  timer_add_seconds ("scheduler", 60 * 60, 5 * 60,
+		     schedule_periodically, mt);
 
 
   /* Initialize the network monitor.  */
@@ -1178,6 +4145,11 @@ murmeltier_init (Murmeltier *mt)
 		    G_CALLBACK (user_idle_active), mt);
 
   mt->bm = wc_battery_monitor_new ();
+
+  g_signal_connect (G_OBJECT (mt->bm), "battery-status",
+		    G_CALLBACK (battery_status), mt);
+  timers_wakeup_budget (wc_battery_monitor_discharging (mt->bm)
+			? TIMERS_BATTERY_WAKEUP_BUDGET : 0);
 }
 
 static enum woodchuck_error
@@ -1191,6 +4163,8 @@ object_register (const char *parent, const char *parent_table,
   enum woodchuck_error ret = 0;
   gboolean abort_transaction = FALSE;
 
+  *uuid = NULL;
+
   GString *keys = g_string_new ("");
   GString *values = g_string_new ("");
 
@@ -1221,7 +4195,7 @@ object_register (const char *parent, const char *parent_table,
       if (strcmp (key, acceptable_properties[i].name) == 0)
 	break;
 
-    if (! acceptable_properties[i].name)
+    if (! acceptable_properties[i].name || acceptable_properties[i].sql)
       {
 	unknown_property = key;
 	return;
@@ -1320,59 +4294,18 @@ object_register (const char *parent, const char *parent_table,
       goto out;
     }
 
-  if (only_if_cookie_unique)
+  if (only_if_cookie_unique && ! cookie)
     {
-      if (! cookie)
-	{
-	  g_set_error (error, G_MURMELTIER_ERROR, 0,
-		       "Cookie NULL not unique.");
-	  ret = WOODCHUCK_ERROR_OBJECT_EXISTS;
-	  goto out;
-	}
-
-      GString *uuid_other = NULL;
-      int unique_callback (void *cookie, int argc, char **argv, char **names)
-      {
-	if (! uuid_other)
-	  {
-	    uuid_other = g_string_new ("");
-	    g_string_append_printf (uuid_other, "%s", argv[0]);
-	  }
-	else
-	  g_string_append_printf (uuid_other, ", %s", argv[0]);
-	return 0;
-      }
-
-      char *errmsg = NULL;
-      sqlite3_exec_printf
-	(db,
-	 "select uuid from %s where cookie = '%s' and parent_uuid='%s';",
-	 unique_callback, NULL, &errmsg, object_table, cookie, parent);
-      if (errmsg)
-	{
-	  g_set_error (error, G_MURMELTIER_ERROR, 0,
-		       "Internal error at %s:%d: %s",
-		       __FILE__, __LINE__, errmsg);
-	  sqlite3_free (errmsg);
-	  errmsg = NULL;
-
-	  ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
-	  goto out;
-	}
-
-      if (uuid_other)
-	{
-	  g_set_error (error, G_MURMELTIER_ERROR, 0,
-		       "Cookie '%s' not unique.  Other %s with cookie: %s",
-		       cookie, object_table, uuid_other->str);
-	  g_string_free (uuid_other, TRUE);
-	  ret = WOODCHUCK_ERROR_OBJECT_EXISTS;
-	  goto out;
-	}
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Cookie NULL not unique.");
+      ret = WOODCHUCK_ERROR_OBJECT_EXISTS;
+      goto out;
     }
 
+  /* Take the write lock immediately: the uniqueness check and the
+     insert must not be separated by another writer.  */
   char *errmsg = NULL;
-  sqlite3_exec (db, "begin transaction", NULL, NULL, &errmsg);
+  sqlite3_exec (db, "begin immediate transaction", NULL, NULL, &errmsg);
   if (errmsg)
     {
       g_set_error (error, G_MURMELTIER_ERROR, 0,
@@ -1386,43 +4319,123 @@ object_register (const char *parent, const char *parent_table,
     }
   abort_transaction = TRUE;
 
-  *uuid = NULL;
+  /* We generate the UUID ourselves (rather than using
+     lower(hex(randomblob(16))) in the insert) so that we don't have
+     to select it again after inserting the row.  */
+  unsigned char uuid_bytes[16];
+  char uuid_buffer[2 * sizeof (uuid_bytes) + 1];
+  /* The number of UUID conflicts.  With 128 random bits, even one is
+     suspicious.  */
+  int conflicts = 0;
+
+ retry:;
+  sqlite3_randomness (sizeof (uuid_bytes), uuid_bytes);
+  for (i = 0; i < sizeof (uuid_bytes); i ++)
+    sprintf (&uuid_buffer[2 * i], "%02x", uuid_bytes[i]);
+
+  /* Check for a conflict before inserting rather than interpreting
+     the insert's error: SQLite's error messages vary between
+     versions.  We hold the write lock, so the UUID can't be taken
+     between the check and the insert.  */
+  bool uuid_conflict = false;
   int uuid_callback (void *cookie, int argc, char **argv, char **names)
   {
-    assert (! *uuid);
-    *uuid = g_strdup (argv[0]);
+    uuid_conflict = true;
     return 0;
   }
-
- retry:;
-  int err = sqlite3_exec_printf
-    (db,
-     "insert or abort into %s"
-     " (uuid, parent_uuid%s) values (lower(hex(randomblob(16))), %Q%s);"
-     "select uuid from %s where ROWID = last_insert_rowid ();",
-     uuid_callback, NULL, &errmsg,
-     object_table, keys->str, parent ?: "", values->str, object_table);
+  sqlite3_exec_printf (db, QUERY_UUID_EXISTS, uuid_callback, NULL, &errmsg,
+		       object_table, uuid_buffer);
   if (errmsg)
     {
-      if (err == SQLITE_ABORT)
-	/* UUID already exists.  */
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: %s",
+		   __FILE__, __LINE__, errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+
+      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+      goto out;
+    }
+  if (uuid_conflict)
+    {
+      if (conflicts < 3)
 	{
-	  debug (0, "UUID conflict.  Trying again: %s", errmsg);
-	  sqlite3_free (errmsg);
-	  errmsg = NULL;
+	  conflicts ++;
+	  debug (0, "UUID conflict (%s).  Trying again.", uuid_buffer);
 	  goto retry;
 	}
-
-      g_set_error (error, G_MURMELTIER_ERROR, 0,
-		   "Internal error at %s:%d: %s",
-		   __FILE__, __LINE__, errmsg);
+
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: Failed to generate a unique UUID",
+		   __FILE__, __LINE__);
+      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+      goto out;
+    }
+
+  int err;
+  if (only_if_cookie_unique)
+    /* Check that the cookie is unique and insert the row in a single
+       statement.  */
+    err = sqlite3_exec_printf
+      (db, QUERY_REGISTER_UNIQUE, NULL, NULL, &errmsg,
+       object_table, keys->str, uuid_buffer, parent ?: "", values->str,
+       object_table, parent ?: "", cookie);
+  else
+    err = sqlite3_exec_printf
+      (db,
+       "insert or abort into %s"
+       " (uuid, parent_uuid%s) values (%Q, %Q%s);",
+       NULL, NULL, &errmsg,
+       object_table, keys->str, uuid_buffer, parent ?: "", values->str);
+  if (errmsg)
+    {
+      if (err == SQLITE_CONSTRAINT)
+	/* The UUID is unique, so a constraint violation (e.g., of a
+	   NOT NULL column) is the caller's fault.  */
+	{
+	  g_set_error (error, G_MURMELTIER_ERROR, 0,
+		       "Invalid arguments: %s", errmsg);
+	  ret = WOODCHUCK_ERROR_INVALID_ARGS;
+	}
+      else
+	{
+	  g_set_error (error, G_MURMELTIER_ERROR, 0,
+		       "Internal error at %s:%d: %s",
+		       __FILE__, __LINE__, errmsg);
+	  ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+	}
       sqlite3_free (errmsg);
       errmsg = NULL;
+      goto out;
+    }
 
-      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+  if (only_if_cookie_unique && sqlite3_changes (db) == 0)
+    /* Another object with the same cookie exists.  Find out which
+       for the error message.  */
+    {
+      GString *uuid_other = g_string_new ("");
+      int unique_callback (void *cookie, int argc, char **argv, char **names)
+      {
+	g_string_append_printf (uuid_other, "%s%s",
+				uuid_other->len ? ", " : "", argv[0]);
+	return 0;
+      }
+
+      sqlite3_exec_printf
+	(db,
+	 "select uuid from %s where parent_uuid = %Q and cookie = %Q;",
+	 unique_callback, NULL, NULL, object_table, parent ?: "", cookie);
+
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Cookie '%s' not unique.  Other %s with cookie: %s",
+		   cookie, object_table, uuid_other->str);
+      g_string_free (uuid_other, TRUE);
+      ret = WOODCHUCK_ERROR_OBJECT_EXISTS;
       goto out;
     }
 
+  *uuid = g_strdup (uuid_buffer);
+
   debug (0, "UUID is: %s", *uuid);
 
   if (versions)
@@ -1492,13 +4505,22 @@ object_register (const char *parent, const char *parent_table,
 
       if (! ret)
 	ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+
+      /* The commit failed: roll back whatever remains of the
+	 transaction and don't announce the object.  */
+      goto out;
     }
 
   abort_transaction = false;
 
   assert (*uuid);
 
-  schedule ();
+  if (ret == 0)
+    {
+      murmeltier_dbus_server_object_added (parent ? parent_table : NULL,
+					   parent, object_table, *uuid);
+      schedule ();
+    }
  out:
   if (abort_transaction)
     {
@@ -1517,35 +4539,69 @@ object_register (const char *parent, const char *parent_table,
 	}
     }
 
+  if (ret)
+    /* The object was not registered.  */
+    {
+      g_free (*uuid);
+      *uuid = NULL;
+    }
+
   g_string_free (keys, TRUE);
   g_string_free (values, TRUE);
 
   return ret;
 }
 
-static int
-list_callback (void *cookie, int argc, char **argv, char **names)
+/* Execute the SQL statement formed from FMT and the remaining
+   arguments (as for sqlite3_mprintf) and pass each row to CALLBACK.
+   The columns are passed as returned by sqlite3_column_text: they are
+   not copied.  */
+static enum woodchuck_error
+rows_each_printf (woodchuck_row_callback callback, void *cookie,
+		  GError **error, const char *fmt, ...)
 {
-  GPtrArray *list = cookie;
-
-  GPtrArray *strct = g_ptr_array_new ();
+  va_list ap;
+  va_start (ap, fmt);
+  char *sql = sqlite3_vmprintf (fmt, ap);
+  va_end (ap);
 
-  debug (5, "Object %d: %d args", list->len, argc);
+  sqlite3_stmt *stmt = NULL;
+  int err = sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL);
+  sqlite3_free (sql);
+  if (err)
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: %s",
+		   __FILE__, __LINE__, sqlite3_errmsg (db));
+      return WOODCHUCK_ERROR_INTERNAL_ERROR;
+    }
 
-  int i;
-  for (i = 0; i < argc; i ++)
+  int argc = sqlite3_column_count (stmt);
+  const char *argv[argc];
+  int rows = 0;
+  while ((err = sqlite3_step (stmt)) == SQLITE_ROW)
     {
-      if (strcmp (names[i], "parent_uuid") == 0 && argv[i][0] == 0)
-	g_ptr_array_add (strct, NULL);
-      else
-	g_ptr_array_add (strct, g_strdup (argv[i]));
+      int i;
+      for (i = 0; i < argc; i ++)
+	argv[i] = (const char *) sqlite3_column_text (stmt, i);
+
+      callback (cookie, argc, argv);
+      rows ++;
+    }
 
-      debug (5, "Object %d: index %d: %s", list->len, i, argv[i]);
+  enum woodchuck_error ret = 0;
+  if (err != SQLITE_DONE)
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: %s",
+		   __FILE__, __LINE__, sqlite3_errmsg (db));
+      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
     }
+  sqlite3_finalize (stmt);
 
-  g_ptr_array_add (list, strct);
+  debug (5, "%d rows.", rows);
 
-  return 0;
+  return ret;
 }
 
 static enum woodchuck_error
@@ -1553,41 +4609,241 @@ lookup_by (const char *table,
 	   const char *column, const char *value, const char *parent_uuid,
 	   gboolean recursive,
 	   const char *properties,
-	   GPtrArray **objects, GError **error)
+	   woodchuck_row_callback callback, void *cookie, GError **error)
 {
-  *objects = g_ptr_array_new ();
-
-  char *errmsg = NULL;
-  if (! recursive)
-    sqlite3_exec_printf
-      (db,
-       "select %s from %s where %s = %Q and parent_uuid = %Q;",
-       list_callback, *objects, &errmsg,
+  if (! recursive || (parent_uuid && strcmp (table, "objects") == 0))
+    /* Streams don't nest.  Thus, a recursive lookup of an object is
+       the same as a non-recursive lookup.  */
+    return rows_each_printf
+      (callback, cookie, error,
+       QUERY_LOOKUP_BY_PARENT,
        properties, table, column, value, parent_uuid ?: "");
-  else if (! parent_uuid && recursive)
-    sqlite3_exec_printf
-      (db,
-       "select %s from %s where %s = %Q;",
-       list_callback, *objects, &errmsg,
+  else if (! parent_uuid)
+    return rows_each_printf
+      (callback, cookie, error,
+       QUERY_LOOKUP_BY,
        properties, table, column, value);
+#ifdef HAVE_SQLITE_RECURSIVE_CTE
+  else if (strcmp (table, "managers") == 0)
+    /* Any manager descended from PARENT_UUID.  */
+    return rows_each_printf
+      (callback, cookie, error,
+       QUERY_LOOKUP_BY_MANAGER_RECURSIVE,
+       parent_uuid, properties, column, value);
+  else
+    /* Any stream belonging to PARENT_UUID or one of its
+       descendents.  */
+    return rows_each_printf
+      (callback, cookie, error,
+       QUERY_LOOKUP_BY_STREAM_RECURSIVE,
+       parent_uuid, properties, table, column, value, parent_uuid);
+#else
   else
-#warning Implement lookup_by not recursive.
+# warning Implement lookup_by recursive with a parent.
     return WOODCHUCK_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/* Pass at most LIMIT of PARENT_UUID's children in TABLE whose uuid
+   sorts after CURSOR to CALLBACK, in uuid order.  The (parent_uuid,
+   uuid) indexes mean that this is a range scan: the cost of a page
+   does not depend on how far into the list it is.  If there are more
+   rows, *NEXT_CURSOR is set to the uuid of the last row passed to
+   CALLBACK, otherwise, to the empty string.  The caller must free it
+   using g_free.  */
+static enum woodchuck_error
+list_page (const char *table, const char *parent_uuid,
+	   const char *cursor, uint32_t limit,
+	   woodchuck_row_callback callback, void *cookie,
+	   char **next_cursor, GError **error)
+{
+  if (limit == 0 || limit > WOODCHUCK_LIST_PAGE_MAX)
+    limit = WOODCHUCK_LIST_PAGE_MAX;
+
+  /* We ask for one row more than LIMIT: if we get it, there is
+     another page.  */
+  uint32_t rows = 0;
+  char *last = NULL;
+  void page_row (void *user_data, int argc, const char *argv[])
+  {
+    rows ++;
+    if (rows > limit)
+      return;
 
+    callback (user_data, argc, argv);
+    if (rows == limit)
+      last = g_strdup (argv[0]);
+  }
+
+  enum woodchuck_error ret = rows_each_printf
+    (page_row, cookie, error,
+     QUERY_LIST_PAGE,
+     table, parent_uuid, cursor ?: "", (int) limit + 1);
+
+  if (ret == 0 && rows > limit)
+    *next_cursor = last;
+  else
+    {
+      g_free (last);
+      *next_cursor = ret ? NULL : g_strdup ("");
+    }
+
+  return ret;
+}
+
+/* Unregistering a manager or a stream can orphan a large number of
+   rows: a stream may have tens of thousands of objects, each with
+   versions, status, file and use records.  Deleting them all in one
+   transaction holds the write lock (and blocks the main loop) for a
+   long time.  Instead, object_unregister removes the managers and
+   streams themselves and records their UUIDs in the
+   pending_unregistrations table.  unregister_reap then deletes the
+   rows whose parent_uuid is one of these UUIDs, a few at a time, from
+   a low-priority idle handler.  The table survives restarts so that
+   an interrupted reap is resumed.  */
+
+/* The maximum number of rows to delete from each table per
+   iteration.  */
+#define UNREGISTER_REAP_CHUNK 200
+
+/* The tables that unregister_reap clears.  */
+static const char *unregister_reap_tables[] =
+  {
+    "managers", "streams", "stream_updates",
+    "objects", "object_versions", "object_instance_status",
+    "object_instance_files", "object_use", "feedback_outbox",
+    "feedback_subscribers", "space_reclaimed",
+    NULL
+  };
+
+static guint unregister_reap_id;
+
+static void unregister_reap_start (void);
+
+static gboolean
+unregister_reap_retry (gpointer user_data)
+{
+  unregister_reap_id = 0;
+  unregister_reap_start ();
+  return FALSE;
+}
+
+static gboolean
+unregister_reap_start_from_main_thread (gpointer user_data)
+{
+  unregister_reap_start ();
+  return FALSE;
+}
+
+static gboolean
+unregister_reap (gpointer user_data)
+{
+  if (! g_static_mutex_trylock (&db_write_lock))
+    /* A D-Bus worker thread is modifying the database.  Rather than
+       block the main loop, try again a bit later.  */
+    {
+      unregister_reap_id = timer_add_full (G_PRIORITY_LOW, "unregister",
+					   100, 0, unregister_reap_retry,
+					   NULL, NULL);
+      return FALSE;
+    }
+
+  uint64_t start = now ();
+
+  char *uuid = NULL;
+  int uuid_callback (void *cookie, int argc, char **argv, char **names)
+  {
+    uuid = g_strdup (argv[0]);
+    return 0;
+  }
+
+  char *errmsg = NULL;
+  sqlite3_exec (db, "select uuid from pending_unregistrations limit 1;",
+		uuid_callback, NULL, &errmsg);
   if (errmsg)
     {
-      g_set_error (error, G_MURMELTIER_ERROR, 0,
-		   "Internal error at %s:%d: %s",
-		   __FILE__, __LINE__, errmsg);
+      debug (0, "Reading pending_unregistrations: %s", errmsg);
       sqlite3_free (errmsg);
       errmsg = NULL;
+      goto done;
+    }
 
-      return WOODCHUCK_ERROR_INTERNAL_ERROR;
+  if (! uuid)
+    /* Nothing left to do.  */
+    goto done;
+
+  GString *sql = g_string_new ("begin transaction;");
+  char *escaped = sqlite3_mprintf ("%Q", uuid);
+
+  int i;
+  for (i = 0; unregister_reap_tables[i]; i ++)
+    g_string_append_printf
+      (sql, QUERY_UNREGISTER_REAP, unregister_reap_tables[i], unregister_reap_tables[i],
+       escaped, UNREGISTER_REAP_CHUNK);
+
+  sqlite3_free (escaped);
+
+  g_string_append_printf (sql, "end transaction;");
+
+  int total_changes = sqlite3_total_changes (db);
+  sqlite3_exec (db, sql->str, NULL, NULL, &errmsg);
+  g_string_free (sql, TRUE);
+  if (errmsg)
+    {
+      /* We'll try again the next time something is unregistered or
+	 on restart.  */
+      debug (0, "Reaping %s: %s", uuid, errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+      sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+      g_free (uuid);
+      goto done;
+    }
+
+  int deleted_rows = sqlite3_total_changes (db) - total_changes;
+  if (deleted_rows == 0)
+    /* UUID has no more descendents.  */
+    {
+      sqlite3_exec_printf
+	(db, "delete from pending_unregistrations where uuid = %Q;",
+	 NULL, NULL, &errmsg, uuid);
+      if (errmsg)
+	{
+	  debug (0, "Removing %s from pending_unregistrations: %s",
+		 uuid, errmsg);
+	  sqlite3_free (errmsg);
+	  errmsg = NULL;
+	  g_free (uuid);
+	  goto done;
+	}
     }
 
-  debug (4, "%d objects matched.", (*objects)->len);
+  debug (4, "Reaped %d rows belonging to %s in "TIME_FMT".",
+	 deleted_rows, uuid, TIME_PRINTF (now () - start));
+  g_free (uuid);
 
-  return 0;
+  g_static_mutex_unlock (&db_write_lock);
+  return TRUE;
+
+ done:
+  g_static_mutex_unlock (&db_write_lock);
+  unregister_reap_id = 0;
+  return FALSE;
+}
+
+static void
+unregister_reap_start (void)
+{
+  if (g_thread_self () != main_thread)
+    /* Called from a D-Bus worker thread.  */
+    {
+      g_idle_add (unregister_reap_start_from_main_thread, NULL);
+      return;
+    }
+
+  if (! unregister_reap_id)
+    unregister_reap_id = g_idle_add_full (G_PRIORITY_LOW,
+					  unregister_reap, NULL, NULL);
 }
 
 static int
@@ -1620,13 +4876,11 @@ object_unregister (const char *uuid,
 
       char *escaped = sqlite3_mprintf ("%Q", uuid);
       g_string_append_printf (sql, "begin transaction;"
-			      "select uuid from %s where uuid = %s;",
-			      table, escaped);
+			      QUERY_UNREGISTER_EXISTS, table, escaped);
 
       int i;
       for (i = 0; child_tables && child_tables[i]; i ++)
-	g_string_append_printf (sql, 
-				"select uuid from %s where parent_uuid = %s;",
+	g_string_append_printf (sql, QUERY_UNREGISTER_CHILDREN,
 				child_tables[i], escaped);
 
       sqlite3_free (escaped);
@@ -1690,17 +4944,14 @@ object_unregister (const char *uuid,
 
       escaped = sqlite3_mprintf ("%Q", uuid);
       g_string_append_printf (sql, "begin transaction;"
-			      "delete from %s where uuid = %s;",
-			      table, escaped);
+			      QUERY_UNREGISTER_DELETE, table, escaped);
 
       for (i = 0; secondary_tables && secondary_tables[i]; i ++)
-	g_string_append_printf (sql,
-				"delete from %s where uuid = %s;",
+	g_string_append_printf (sql, QUERY_UNREGISTER_DELETE,
 				secondary_tables[i], escaped);
 
       for (i = 0; child_tables && child_tables[i]; i ++)
-	g_string_append_printf (sql,
-				"delete from %s where parent_uuid = %s;",
+	g_string_append_printf (sql, QUERY_UNREGISTER_DELETE_CHILDREN,
 				child_tables[i], escaped);
 
       sqlite3_free (escaped);
@@ -1732,65 +4983,150 @@ object_unregister (const char *uuid,
       return 0;
     }
   else
+    /* Remove the object, any descendent managers and streams (if
+       CHILD_TABLES includes managers or streams, respectively), and
+       their rows in SECONDARY_TABLES and CHILD_TABLES in a single
+       transaction.  This is enough to hide everything beneath them:
+       the scheduler and the upcall code only consider objects whose
+       stream and manager exist.  The remaining rows, of which there
+       may be very many, are reaped incrementally by
+       unregister_reap.  */
     {
-      if (strcmp (table, "managers") == 0)
-#warning Implement object_delete recursive for managers
-	return WOODCHUCK_ERROR_NOT_IMPLEMENTED;
+      int ret = 0;
+      char *errmsg = NULL;
 
-      /* Create the sql.  */
-      GString *sql = g_string_new ("begin transaction;");
+      bool is_child_table (const char *t)
+      {
+	int i;
+	for (i = 0; child_tables && child_tables[i]; i ++)
+	  if (strcmp (child_tables[i], t) == 0)
+	    return true;
+	return false;
+      }
 
-      char *escaped = sqlite3_mprintf ("%Q", uuid);
+      sqlite3_exec (db, "begin immediate transaction;", NULL, NULL, &errmsg);
+      if (errmsg)
+	goto internal_error;
+
+      /* Collect the UUIDs of the objects to remove in
+	 UNREGISTER_SET.  */
+      sqlite3_exec_printf
+	(db,
+	 "create temp table if not exists unregister_set"
+	 " (uuid PRIMARY KEY);"
+	 "delete from unregister_set;"
+	 "insert into unregister_set (uuid)"
+	 " select uuid from %s where uuid = %Q;",
+	 NULL, NULL, &errmsg, table, uuid);
+      if (errmsg)
+	goto internal_error;
+
+      if (sqlite3_changes (db) == 0)
+	{
+	  g_set_error (error, G_MURMELTIER_ERROR, 0,
+		       "Object '%s' does not exist", uuid);
+	  ret = WOODCHUCK_ERROR_NO_SUCH_OBJECT;
+	  goto out;
+	}
+
+      if (is_child_table ("managers"))
+	{
+	  /* Add the descendent managers.  */
+#ifdef HAVE_SQLITE_RECURSIVE_CTE
+	  sqlite3_exec_printf
+	    (db,
+	     "insert or ignore into unregister_set (uuid)"
+	     MANAGER_DESCENDENTS_CTE
+	     " select uuid from descendents;",
+	     NULL, NULL, &errmsg, uuid);
+	  if (errmsg)
+	    goto internal_error;
+#else
+	  /* Add a generation at a time.  */
+	  do
+	    {
+	      sqlite3_exec
+		(db,
+		 "insert or ignore into unregister_set (uuid)"
+		 " select uuid from managers"
+		 " where parent_uuid in (select uuid from unregister_set);",
+		 NULL, NULL, &errmsg);
+	      if (errmsg)
+		goto internal_error;
+	    }
+	  while (sqlite3_changes (db) > 0);
+#endif
+	}
+
+      if (is_child_table ("streams"))
+	{
+	  /* Add the streams.  */
+	  sqlite3_exec
+	    (db,
+	     "insert or ignore into unregister_set (uuid)"
+	     " select uuid from streams"
+	     " where parent_uuid in (select uuid from unregister_set);",
+	     NULL, NULL, &errmsg);
+	  if (errmsg)
+	    goto internal_error;
+	}
 
-      g_string_append_printf (sql, 
-			      "delete from %s where uuid = %s;",
-			      table, escaped);
+      GString *sql = g_string_new ("");
+      g_string_append_printf (sql,
+			      "delete from %s"
+			      " where uuid in (select uuid from unregister_set);",
+			      table);
 
       int i;
       for (i = 0; secondary_tables && secondary_tables[i]; i ++)
-	g_string_append_printf (sql, 
-				"delete from %s where uuid = %s;",
-				secondary_tables[i], escaped);
-      for (i = 0; child_tables && child_tables[i]; i ++)
-	g_string_append_printf (sql, 
-				"delete from %s where parent_uuid = %s;",
-				child_tables[i], escaped);
-
-      sqlite3_free (escaped);
+	g_string_append_printf (sql,
+				"delete from %s"
+				" where uuid in"
+				"  (select uuid from unregister_set);",
+				secondary_tables[i]);
 
-      g_string_append_printf (sql, "end transaction;");
+      for (i = 0; child_tables && child_tables[i]; i ++)
+	if (strcmp (child_tables[i], table) != 0)
+	  g_string_append_printf (sql,
+				  "delete from %s"
+				  " where uuid in"
+				  "  (select uuid from unregister_set);",
+				  child_tables[i]);
+
+      g_string_append (sql,
+		       "insert or ignore into pending_unregistrations (uuid)"
+		       " select uuid from unregister_set;"
+		       "delete from unregister_set;");
 
       int total_changes = sqlite3_total_changes (db);
-      char *errmsg = NULL;
-      sqlite3_exec_printf (db, sql->str, NULL, NULL, &errmsg);
+      sqlite3_exec (db, sql->str, NULL, NULL, &errmsg);
       g_string_free (sql, TRUE);
+      if (errmsg)
+	goto internal_error;
+      debug (0, "Removing %s removed %d rows.",
+	     uuid, sqlite3_total_changes (db) - total_changes);
 
+      sqlite3_exec (db, "end transaction;", NULL, NULL, &errmsg);
       if (errmsg)
-	{
-	  g_set_error (error, G_MURMELTIER_ERROR, 0,
-		       "Internal error at %s:%d: %s",
-		       __FILE__, __LINE__, errmsg);
-	  sqlite3_free (errmsg);
-	  errmsg = NULL;
-	  return WOODCHUCK_ERROR_INTERNAL_ERROR;
-	}
+	goto internal_error;
 
-      assert (total_changes != -1);
+      unregister_reap_start ();
+      return 0;
 
-      int deleted_rows = sqlite3_total_changes (db) - total_changes;
-      debug (0, "Removing %s removed %d objects.",
-	     uuid, deleted_rows);
-      if (deleted_rows == 0)
-	{
-	  g_set_error (error, G_MURMELTIER_ERROR, 0,
-		       "Object '%s' does not exist", uuid);
-	  return WOODCHUCK_ERROR_GENERIC;
-	}
+    internal_error:
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: %s",
+		   __FILE__, __LINE__, errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
 
-      return 0;
+    out:
+      sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+      return ret;
     }
 }
-
+
 enum woodchuck_error
 woodchuck_manager_register (GHashTable *properties,
 			    gboolean only_if_cookie_unique,
@@ -1803,18 +5139,21 @@ woodchuck_manager_register (GHashTable *properties,
 
 enum woodchuck_error
 woodchuck_list_managers (gboolean recursive,
-			 GPtrArray **managers, GError **error)
+			 woodchuck_row_callback callback, void *cookie,
+			 GError **error)
 {
-  return woodchuck_manager_list_managers (NULL, recursive, managers, error);
+  return woodchuck_manager_list_managers (NULL, recursive,
+					  callback, cookie, error);
 }
 
 enum woodchuck_error
 woodchuck_lookup_manager_by_cookie (const char *cookie, gboolean recursive,
-				    GPtrArray **managers, GError **error)
+				    woodchuck_row_callback callback,
+				    void *callback_cookie, GError **error)
 {
   return lookup_by ("managers", "Cookie", cookie, NULL, recursive,
 		    "uuid, HumanReadableName, parent_uuid",
-		    managers, error);
+		    callback, callback_cookie, error);
 }
 
 enum woodchuck_error
@@ -1844,80 +5183,79 @@ woodchuck_manager_unregister (const char *manager, bool only_if_no_descendents,
 {
   const char *child_tables[] = { "managers", "streams", "stream_updates",
 				 NULL };
-  return object_unregister (manager, "managers", NULL, child_tables,
-			    only_if_no_descendents, error);
+  enum woodchuck_error ret
+    = object_unregister (manager, "managers", NULL, child_tables,
+			 only_if_no_descendents, error);
+  if (ret == 0)
+    murmeltier_dbus_server_object_removed ("managers", manager);
+  return ret;
 }
 
 enum woodchuck_error
 woodchuck_manager_list_managers
- (const char *manager, gboolean recursive, GPtrArray **managers, GError **error)
+ (const char *manager, gboolean recursive,
+  woodchuck_row_callback callback, void *cookie, GError **error)
 {
-  *managers = g_ptr_array_new ();
-
   debug (0, "manager: %s, recursive: %d", manager, recursive);
 
-  char *errmsg = NULL;
   if (recursive && ! manager)
     /* List everything.  */
-    sqlite3_exec
-      (db,
-       "select uuid, Cookie, HumanReadableName, parent_uuid from managers;",
-       list_callback, *managers, &errmsg);
+    return rows_each_printf
+      (callback, cookie, error,
+       "select uuid, Cookie, HumanReadableName, parent_uuid from managers;");
   else if (recursive)
     /* List only those that are descended from MANAGER.  */
     {
+#ifdef HAVE_SQLITE_RECURSIVE_CTE
+      return rows_each_printf
+	(callback, cookie, error, QUERY_LIST_MANAGERS_RECURSIVE, manager);
+#else
+      /* The UUIDs of the managers that we have found.  */
+      GPtrArray *uuids = g_ptr_array_new ();
+      void found (void *cookie, int argc, const char *argv[])
+      {
+	g_ptr_array_add (uuids, g_strdup (argv[0]));
+	callback (cookie, argc, argv);
+      }
+
+      enum woodchuck_error ret = 0;
       int i = 0;
       for (;;)
 	{
-	  sqlite3_exec_printf
-	    (db,
-	     "select uuid, Cookie, HumanReadableName, parent_uuid"
-	     " from managers where parent_uuid = %Q;",
-	     list_callback, *managers, &errmsg, manager);
-	  if (errmsg)
+	  ret = rows_each_printf
+	    (found, cookie, error, QUERY_LIST_MANAGERS, manager);
+	  if (ret)
 	    break;
 
-	  debug (0, "Processed %d of %d managers", i, (*managers)->len);
+	  debug (0, "Processed %d of %d managers", i, uuids->len);
 
-	  if (i >= (*managers)->len)
+	  if (i >= uuids->len)
 	    break;
-	  GPtrArray *strct = g_ptr_array_index ((*managers), i);
-	  debug (0, "%d fields", strct->len);
-	  manager = g_ptr_array_index (strct, 0);
+	  manager = g_ptr_array_index (uuids, i);
 	  i ++;
 	}
-    }
-  else
-    /* List only those that are an immediate descendent of MANAGER.  */
-    sqlite3_exec_printf
-      (db,
-       "select uuid, Cookie, HumanReadableName, parent_uuid"
-       " from managers where parent_uuid = %Q;",
-       list_callback, *managers, &errmsg,
-       manager ?: "");
 
-  if (errmsg)
-    {
-      g_set_error (error, G_MURMELTIER_ERROR, 0,
-		   "Internal error at %s:%d: %s",
-		   __FILE__, __LINE__, errmsg);
-      sqlite3_free (errmsg);
-      errmsg = NULL;
+      for (i = 0; i < uuids->len; i ++)
+	g_free (g_ptr_array_index (uuids, i));
+      g_ptr_array_free (uuids, TRUE);
 
-      return WOODCHUCK_ERROR_INTERNAL_ERROR;
+      return ret;
+#endif
     }
-
-  return 0;
+  else
+    /* List only those that are an immediate descendent of MANAGER.  */
+    return rows_each_printf
+      (callback, cookie, error, QUERY_LIST_MANAGERS, manager ?: "");
 }
 
 enum woodchuck_error
 woodchuck_manager_lookup_manager_by_cookie
   (const char *manager, const char *cookie, gboolean recursive,
-   GPtrArray **managers, GError **error)
+   woodchuck_row_callback callback, void *callback_cookie, GError **error)
 {
   return lookup_by ("managers", "Cookie", cookie, manager, recursive,
 		    "uuid, HumanReadableName, parent_uuid",
-		    managers, error);
+		    callback, callback_cookie, error);
 }
 
 enum woodchuck_error
@@ -1933,37 +5271,31 @@ woodchuck_manager_stream_register (const char *manager, GHashTable *properties,
 
 enum woodchuck_error
 woodchuck_manager_list_streams
-  (const char *manager, GPtrArray **list, GError **error)
+  (const char *manager, woodchuck_row_callback callback, void *cookie,
+   GError **error)
 {
-  *list = g_ptr_array_new ();
-
-  char *errmsg = NULL;
-  sqlite3_exec_printf
-    (db,
-     "select uuid, Cookie, HumanReadablename from streams"
-     " where parent_uuid=%Q;",
-     list_callback, *list, &errmsg, manager);
-  if (errmsg)
-    {
-      g_set_error (error, G_MURMELTIER_ERROR, 0,
-		   "Internal error at %s:%d: %s",
-		   __FILE__, __LINE__, errmsg);
-      sqlite3_free (errmsg);
-      errmsg = NULL;
-
-      return WOODCHUCK_ERROR_INTERNAL_ERROR;
-    }
+  return rows_each_printf
+    (callback, cookie, error, QUERY_LIST_STREAMS, manager);
+}
 
-  return 0;
+enum woodchuck_error
+woodchuck_manager_list_streams_from
+  (const char *manager, const char *cursor, uint32_t limit,
+   woodchuck_row_callback callback, void *cookie,
+   char **next_cursor, GError **error)
+{
+  return list_page ("streams", manager, cursor, limit,
+		    callback, cookie, next_cursor, error);
 }
 
 enum woodchuck_error
 woodchuck_manager_lookup_stream_by_cookie
-  (const char *manager, const char *cookie, GPtrArray **list, GError **error)
+  (const char *manager, const char *cookie,
+   woodchuck_row_callback callback, void *callback_cookie, GError **error)
 {
   return lookup_by ("streams", "Cookie", cookie, manager, FALSE,
 		    "uuid, HumanReadableName",
-		    list, error);
+		    callback, callback_cookie, error);
 }
 
 
@@ -1999,6 +5331,12 @@ woodchuck_manager_feedback_subscribe
   /* Ensure that it is NUL terminated.  */
   p[sender_len + 1 + 16] = 0;
 
+  s->subscriber = NULL;
+  s->registered = false;
+  s->cursor = 0;
+  s->in_flight = 0;
+  s->stalled_until = 0;
+
 
   /* Add the subscription to the various hashes.  */
   g_hash_table_insert (mt->handle_to_subscription_hash, s->handle, s);
@@ -2012,12 +5350,64 @@ woodchuck_manager_feedback_subscribe
 
   l = g_hash_table_lookup (mt->bus_name_to_subscription_list_hash,
 			   s->dbus_name);
+  if (! l)
+    /* A new subscriber.  Watch for it exiting.  Passing a NULL error
+       means that we don't wait for the reply.  */
+    {
+      char *rule = subscriber_match_rule (s->dbus_name);
+      dbus_bus_add_match (dbus_g_connection_get_connection (mt->session_bus),
+			  rule, NULL);
+      g_free (rule);
+
+      org_freedesktop_DBus_name_has_owner_async
+	(mt->dbus_proxy, s->dbus_name, subscriber_has_owner_cb,
+	 g_strdup (s->dbus_name));
+    }
   l = g_slist_prepend (l, s);
   g_hash_table_replace (mt->bus_name_to_subscription_list_hash,
 			s->dbus_name, l);
 
   *handle = g_strdup (s->handle);
 
+  /* Record the subscriber's acknowledgements under the manager's
+     DBusServiceName if the subscriber owns it, so that they survive
+     the application restarting.  */
+  char *service_name = NULL;
+  int service_name_callback (void *cookie, int argc, char **argv,
+			     char **names)
+  {
+    service_name = g_strdup (argv[0]);
+    return 0;
+  }
+
+  char *errmsg = NULL;
+  sqlite3_exec_printf (db,
+		       "select DBusServiceName from managers where uuid = %Q;",
+		       service_name_callback, NULL, &errmsg, manager);
+  if (errmsg)
+    {
+      debug (0, "Looking up %s's DBusServiceName: %s", manager, errmsg);
+      sqlite3_free (errmsg);
+    }
+
+  if (service_name && *service_name)
+    {
+      char **names = g_new (char *, 3);
+      names[0] = g_strdup (s->handle);
+      names[1] = service_name;
+      names[2] = NULL;
+      org_freedesktop_DBus_get_name_owner_async
+	(mt->dbus_proxy, service_name, feedback_subscriber_cb, names);
+    }
+  else
+    {
+      g_free (service_name);
+      s->subscriber = g_strdup (s->dbus_name);
+    }
+
+  /* Send any feedback that has not yet been acknowledged.  */
+  feedback_deliver_start ();
+
   schedule ();
 
   return 0;
@@ -2032,6 +5422,8 @@ woodchuck_manager_feedback_unsubscribe
   if (! s)
     return WOODCHUCK_ERROR_NO_SUCH_OBJECT;
 
+  feedback_subscription_removed (s);
+
   /* Remove it from the handle to subscription hash.  */
   if (! g_hash_table_remove (mt->handle_to_subscription_hash, handle))
     {
@@ -2078,9 +5470,18 @@ woodchuck_manager_feedback_unsubscribe
 		 s->dbus_name);
 	  assert (0 == 1);
 	}
+
+      /* That was the client's last subscription.  */
+      char *rule = subscriber_match_rule (s->dbus_name);
+      dbus_bus_remove_match
+	(dbus_g_connection_get_connection (mt->session_bus), rule, NULL);
+      g_free (rule);
     }
 
 
+  /* This cancels any outstanding upcalls.  */
+  g_object_unref (s->proxy);
+  g_free (s->subscriber);
   g_free (s);
 
   return 0;
@@ -2091,8 +5492,36 @@ woodchuck_manager_feedback_ack
   (const char *sender, const char *manager,
    const char *object_uuid, uint32_t instance, GError **error)
 {
-#warning Implement woodchuck_manager_feedback_ack
-  return WOODCHUCK_ERROR_NOT_IMPLEMENTED;
+  /* Acknowledging feedback also acknowledges any feedback about
+     earlier instances of the object and the entries before it.  This
+     is executed on the writer thread, which doesn't have the
+     subscriptions; the sender is found by the bus name that it last
+     subscribed from.  An entry is deleted once all of the manager's
+     subscribers acknowledged it.  If the manager has no subscribers,
+     all of its entries are deleted.  */
+  char *errmsg = NULL;
+  sqlite3_exec_printf
+    (db,
+     "begin transaction;"
+     QUERY_FEEDBACK_ACK
+     QUERY_FEEDBACK_OUTBOX_TRIM
+     "end transaction;",
+     NULL, NULL, &errmsg,
+     object_uuid, manager, instance, sender, manager,
+     manager, manager, manager);
+  if (errmsg)
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d: %s",
+		   __FILE__, __LINE__, errmsg);
+      sqlite3_free (errmsg);
+
+      sqlite3_exec (db, "rollback transaction;", NULL, NULL, NULL);
+
+      return WOODCHUCK_ERROR_INTERNAL_ERROR;
+    }
+
+  return 0;
 }
 
 enum woodchuck_error
@@ -2105,8 +5534,12 @@ woodchuck_stream_unregister (const char *stream, bool only_if_empty,
 				 "object_use",
 				 NULL };
   const char *secondary_tables[] = { "stream_updates", NULL };
-  return object_unregister (stream, "streams", secondary_tables, child_tables,
-			    only_if_empty, error);
+  enum woodchuck_error ret
+    = object_unregister (stream, "streams", secondary_tables, child_tables,
+			 only_if_empty, error);
+  if (ret == 0)
+    murmeltier_dbus_server_object_removed ("streams", stream);
+  return ret;
 }
 
 enum woodchuck_error
@@ -2122,28 +5555,21 @@ woodchuck_stream_object_register (const char *stream, GHashTable *properties,
 
 enum woodchuck_error
 woodchuck_stream_list_objects (const char *stream,
-			       GPtrArray **list, GError **error)
+			       woodchuck_row_callback callback, void *cookie,
+			       GError **error)
 {
-  *list = g_ptr_array_new ();
-
-  char *errmsg = NULL;
-  sqlite3_exec_printf
-    (db,
-     "select uuid, Cookie, HumanReadableName from objects"
-     " where parent_uuid=%Q;",
-     list_callback, *list, &errmsg, stream);
-  if (errmsg)
-    {
-      g_set_error (error, G_MURMELTIER_ERROR, 0,
-		   "Internal error at %s:%d: %s",
-		   __FILE__, __LINE__, errmsg);
-      sqlite3_free (errmsg);
-      errmsg = NULL;
-
-      return WOODCHUCK_ERROR_INTERNAL_ERROR;
-    }
+  return rows_each_printf
+    (callback, cookie, error, QUERY_LIST_OBJECTS, stream);
+}
 
-  return 0;
+enum woodchuck_error
+woodchuck_stream_list_objects_from
+  (const char *stream, const char *cursor, uint32_t limit,
+   woodchuck_row_callback callback, void *cookie,
+   char **next_cursor, GError **error)
+{
+  return list_page ("objects", stream, cursor, limit,
+		    callback, cookie, next_cursor, error);
 }
 
 enum woodchuck_error
@@ -2186,7 +5612,7 @@ woodchuck_stream_update_status
 
   char *errmsg = NULL;
   sqlite3_exec_printf
-    (db, "select instance, parent_uuid from streams where uuid = %s;",
+    (db, QUERY_STREAM_INSTANCE,
      callback, NULL, &errmsg, stream);
   if (errmsg)
     {
@@ -2241,6 +5667,15 @@ woodchuck_stream_update_status
       goto out;
     }
 
+  /* These are derived from stream_updates.  */
+  murmeltier_dbus_server_property_changed ("streams", stream_raw,
+					   "LastUpdateAttemptTime", NULL);
+  murmeltier_dbus_server_property_changed ("streams", stream_raw,
+					   "LastUpdateAttemptStatus", NULL);
+  if (status == 0)
+    murmeltier_dbus_server_property_changed ("streams", stream_raw,
+					     "LastUpdateTime", NULL);
+
  out:
   sqlite3_free (stream);
   g_free (manager);
@@ -2255,9 +5690,14 @@ woodchuck_object_unregister (const char *object, GError **error)
 				     "object_instance_status",
 				     "object_instance_files",
 				     "object_use",
+				     "feedback_outbox",
 				     NULL };
-  return object_unregister (object, "objects", secondary_tables, NULL,
-			    TRUE, error);
+  enum woodchuck_error ret
+    = object_unregister (object, "objects", secondary_tables, NULL,
+			 TRUE, error);
+  if (ret == 0)
+    murmeltier_dbus_server_object_removed ("objects", object);
+  return ret;
 }
 
 enum woodchuck_error
@@ -2270,11 +5710,12 @@ woodchuck_object_transfer (const char *object, uint32_t request_type,
 
 enum woodchuck_error
 woodchuck_stream_lookup_object_by_cookie
-  (const char *stream, const char *cookie, GPtrArray **list, GError **error)
+  (const char *stream, const char *cookie,
+   woodchuck_row_callback callback, void *callback_cookie, GError **error)
 {
   return lookup_by ("objects", "Cookie", cookie, stream, FALSE,
 		    "uuid, HumanReadableName",
-		    list, error);
+		    callback, callback_cookie, error);
 }
 
 enum woodchuck_error
@@ -2306,7 +5747,7 @@ woodchuck_object_transfer_status
 
   char *errmsg = NULL;
   sqlite3_exec_printf
-    (db, "select instance, parent_uuid from objects where uuid = %s;",
+    (db, QUERY_OBJECT_INSTANCE,
      callback, NULL, &errmsg, object);
   if (errmsg)
     {
@@ -2327,6 +5768,8 @@ woodchuck_object_transfer_status
     }
 
   GString *sql = NULL;
+  /* The directories containing the files.  */
+  GSList *dirs = NULL;
 
   if (files_count > 0)
     {
@@ -2335,15 +5778,24 @@ woodchuck_object_transfer_status
       for (i = 0; i < files_count; i ++)
 	{
 	  char *filename_escaped = sqlite3_mprintf ("%Q", files[i].filename);
+	  /* A file with the same name registered by an older instance
+	     has been replaced.  */
 	  g_string_append_printf
 	    (sql,
+	     "update object_instance_files set size = 0"
+	     " where uuid = %s and filename = %s and instance < %d;\n"
 	     "insert into object_instance_files"
 	     " (uuid, instance, parent_uuid,"
-	     "  filename, dedicated, deletion_policy)"
-	     " values (%s, %d, '%s', %s, %d, %d);\n",
+	     "  filename, dedicated, deletion_policy, size)"
+	     " values (%s, %d, '%s', %s, %d, %d, %"PRId64");\n",
+	     object, filename_escaped, instance,
 	     object, instance, stream,
-	     filename_escaped, files[i].dedicated, files[i].deletion_policy);
+	     filename_escaped, files[i].dedicated, files[i].deletion_policy,
+	     disk_usage_of (files[i].filename));
 	  sqlite3_free (filename_escaped);
+
+	  dirs = g_slist_prepend (dirs,
+				  g_path_get_dirname (files[i].filename));
 	}
     }
 
@@ -2377,10 +5829,48 @@ woodchuck_object_transfer_status
 
       sqlite3_exec (db, "rollback transaction;\n", NULL, NULL, NULL);
 
+      while (dirs)
+	{
+	  g_free (dirs->data);
+	  dirs = g_slist_delete_link (dirs, dirs);
+	}
+
       ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
       goto out;
     }
 
+  GValue value = { 0 };
+  g_value_init (&value, G_TYPE_UINT);
+  g_value_set_uint (&value, instance + 1);
+  murmeltier_dbus_server_property_changed ("objects", object_raw,
+					   "Instance", &value);
+  g_value_unset (&value);
+
+  g_value_init (&value, G_TYPE_BOOLEAN);
+  g_value_set_boolean (&value, FALSE);
+  murmeltier_dbus_server_property_changed ("objects", object_raw,
+					   "NeedUpdate", &value);
+  g_value_unset (&value);
+
+  /* These are derived from object_instance_status.  */
+  murmeltier_dbus_server_property_changed ("objects", object_raw,
+					   "LastTransferAttemptTime", NULL);
+  murmeltier_dbus_server_property_changed ("objects", object_raw,
+					   "LastTransferAttemptStatus", NULL);
+  if (status == 0)
+    murmeltier_dbus_server_property_changed ("objects", object_raw,
+					     "LastTransferTime", NULL);
+
+  if (files_count > 0)
+    {
+      /* Add the files to the content index.  */
+      content_hash_start ();
+
+      disk_usage_watch (dirs);
+      dirs = NULL;
+      disk_usage_changed (g_slist_prepend (NULL, g_strdup (object_raw)));
+    }
+
  out:
   sqlite3_free (object);
   g_free (stream);
@@ -2409,7 +5899,7 @@ woodchuck_object_use (const char *object_raw, uint64_t start, uint64_t duration,
 
   char *errmsg = NULL;
   sqlite3_exec_printf
-    (db, "select instance, parent_uuid from objects where uuid = %s;",
+    (db, QUERY_OBJECT_INSTANCE,
      callback, NULL, &errmsg, object);
   if (errmsg)
     {
@@ -2463,14 +5953,22 @@ woodchuck_object_files_deleted (const char *object_raw,
 {
   char *object = sqlite3_mprintf ("%Q", object_raw);
   char *stream = NULL;
+  char *manager = NULL;
 
   int instance = -1;
+  /* The number of bytes the latest instance occupies on disk or -1 if
+     it was already deleted or is unknown.  */
+  int64_t on_disk = -1;
   int callback (void *cookie, int argc, char **argv, char **names)
   {
     assert (instance == -1);
     assert (stream == NULL);
     instance = argv[0] ? atoi (argv[0]) : 0;
     stream = g_strdup (argv[1]);
+    manager = g_strdup (argv[2]);
+    bool deleted = argv[3] ? atoi (argv[3]) : false;
+    if (! deleted && argv[4])
+      on_disk = atoll (argv[4]);
     return 0;
   }
 
@@ -2478,7 +5976,19 @@ woodchuck_object_files_deleted (const char *object_raw,
 
   char *errmsg = NULL;
   sqlite3_exec_printf
-    (db, "select instance, parent_uuid from objects where uuid = %s;",
+    (db,
+     "select objects.instance, objects.parent_uuid, streams.parent_uuid,"
+     "  object_instance_status.deleted,"
+     "  coalesce (object_instance_status.compressed_size,"
+     "            object_instance_status.object_size)"
+     " from objects"
+     " left join streams on streams.uuid = objects.parent_uuid"
+     " left join object_instance_status"
+     "  on object_instance_status.uuid = objects.uuid"
+     "   and object_instance_status.instance"
+     "    = (select max (instance) from object_instance_status"
+     "       where uuid = objects.uuid)"
+     " where objects.uuid = %s;",
      callback, NULL, &errmsg, object);
   if (errmsg)
     {
@@ -2521,12 +6031,7 @@ woodchuck_object_files_deleted (const char *object_raw,
     }
 
   sqlite3_exec_printf
-    (db,
-     "update object_instance_status set %s"
-     " where uuid = %s"
-     " and instance"
-     "  = (select max (instance) from object_instance_status where uuid = %s);",
-     NULL, NULL, &errmsg, sql, object, object);
+    (db, QUERY_FILES_DELETED, NULL, NULL, &errmsg, sql, object, object);
   sqlite3_free (sql);
   if (errmsg)
     {
@@ -2540,13 +6045,108 @@ woodchuck_object_files_deleted (const char *object_raw,
       goto out;
     }
 
+  if (manager && on_disk > 0)
+    {
+      if (update == WOODCHUCK_DELETE_DELETED)
+	space_reclaimed_add (manager, on_disk, 0);
+      else if (update == WOODCHUCK_DELETE_COMPRESSED
+	       && (int64_t) arg < on_disk)
+	space_reclaimed_add (manager, 0, on_disk - arg);
+    }
+
+  if (update != WOODCHUCK_DELETE_REFUSED)
+    /* The files were deleted or compressed.  Update their sizes.  */
+    {
+      GPtrArray *filenames = g_ptr_array_new ();
+      void files_callback (void *cookie, int argc, const char *argv[])
+      {
+	g_ptr_array_add (filenames, g_strdup (argv[0] ?: ""));
+      }
+      GError *e = NULL;
+      rows_each_printf
+	(files_callback, NULL, &e,
+	 "select filename from object_instance_files"
+	 " where uuid = %s"
+	 "  and instance = (select max (instance) from object_instance_status"
+	 "                  where uuid = %s);",
+	 object, object);
+      if (e)
+	{
+	  debug (0, "%s", e->message);
+	  g_error_free (e);
+	}
+
+      GSList *changed = NULL;
+      int i;
+      for (i = 0; i < filenames->len; i ++)
+	{
+	  disk_usage_update (g_ptr_array_index (filenames, i), &changed);
+	  g_free (g_ptr_array_index (filenames, i));
+	}
+      g_ptr_array_free (filenames, TRUE);
+      disk_usage_changed (changed);
+    }
+
  out:
   sqlite3_free (object);
   g_free (stream);
+  g_free (manager);
 
   return ret;
 }
 
+/* Initialize VALUE to the property PROPERTY_NAME's value, which
+   has type PROPERTY_TYPE and, as returned by SQLite, the string
+   representation VALUE_STR.  */
+static void
+property_value_set (GValue *value,
+		    const char *interface_name, const char *property_name,
+		    GType property_type, const char *value_str)
+{
+  debug (4, "Property %s.%s = %s",
+	 interface_name, property_name, value_str);
+
+  char *tailptr = NULL;
+  switch (property_type)
+    {
+    default:
+      debug (0, "Property %s.%s has unhandled type (%d)!",
+	     interface_name, property_name, (int) property_type);
+    case G_TYPE_STRING:
+      g_value_init (value, G_TYPE_STRING);
+      if (! value_str)
+	g_value_set_static_string (value, "");
+      else
+	g_value_set_string (value, value_str);
+      break;
+    case G_TYPE_BOOLEAN:
+      g_value_init (value, G_TYPE_BOOLEAN);
+      g_value_set_boolean (value,
+			   value_str ? strtol (value_str, &tailptr, 10) : 0);
+      break;
+    case G_TYPE_INT:
+      g_value_init (value, G_TYPE_INT);
+      g_value_set_int (value,
+		       value_str ? strtol (value_str, &tailptr, 10) : 0);
+      break;
+    case G_TYPE_UINT:
+      g_value_init (value, G_TYPE_UINT);
+      g_value_set_uint (value,
+			value_str ? strtoul (value_str, &tailptr, 10) : 0);
+      break;
+    case G_TYPE_INT64:
+      g_value_init (value, G_TYPE_INT64);
+      g_value_set_int64 (value,
+			 value_str ? strtoll (value_str, &tailptr, 10) : 0);
+      break;
+    case G_TYPE_UINT64:
+      g_value_init (value, G_TYPE_UINT64);
+      g_value_set_uint64 (value,
+			  value_str ? strtoull (value_str, &tailptr, 10) : 0);
+      break;
+    }
+}
+
 static enum woodchuck_error
 property_get_sql (const char *sql,
 		  const char *interface_name, const char *property_name,
@@ -2557,50 +6157,9 @@ property_get_sql (const char *sql,
 
   void set(const char *value_str)
   {
-    debug (4, "Property %s.%s = %s",
-	   interface_name, property_name, value_str);
-
     did_set = true;
-
-    char *tailptr = NULL;
-    switch (property_type)
-      {
-      default:
-	debug (0, "Property %s.%s has unhandled type (%d)!",
-	       interface_name, property_name, (int) property_type);
-      case G_TYPE_STRING:
-	g_value_init (value, G_TYPE_STRING);
-	if (! value_str)
-	  g_value_set_static_string (value, "");
-	else
-	  g_value_set_string (value, value_str);
-	break;
-      case G_TYPE_BOOLEAN:
-	g_value_init (value, G_TYPE_BOOLEAN);
-	g_value_set_boolean (value,
-			     value_str ? strtol (value_str, &tailptr, 10) : 0);
-	break;
-      case G_TYPE_INT:
-	g_value_init (value, G_TYPE_INT);
-	g_value_set_int (value,
-			 value_str ? strtol (value_str, &tailptr, 10) : 0);
-	break;
-      case G_TYPE_UINT:
-	g_value_init (value, G_TYPE_UINT);
-	g_value_set_uint (value,
-			  value_str ? strtoul (value_str, &tailptr, 10) : 0);
-	break;
-      case G_TYPE_INT64:
-	g_value_init (value, G_TYPE_INT64);
-	g_value_set_int64 (value,
-			   value_str ? strtoll (value_str, &tailptr, 10) : 0);
-	break;
-      case G_TYPE_UINT64:
-	g_value_init (value, G_TYPE_UINT64);
-	g_value_set_uint64 (value,
-			    value_str ? strtoull (value_str, &tailptr, 10) : 0);
-	break;
-      }
+    property_value_set (value, interface_name, property_name,
+			property_type, value_str);
   }
 
   int callback (void *cookie, int argc, char **argv, char **names)
@@ -2655,10 +6214,106 @@ property_get (const char *object,
       return DBUS_GERROR_INVALID_ARGS;
     }
 
-  char *sql = sqlite3_mprintf ("select %s from %s where uuid = '%s';",
-			       property_name, table, object);
-  return property_get_sql (sql, interface_name, property_name,
-			   properties[i].type, NULL, value, error);
+  char *sql = sqlite3_mprintf (QUERY_PROPERTY_GET,
+			       properties[i].sql ?: property_name,
+			       table, object);
+  enum woodchuck_error err
+    = property_get_sql (sql, interface_name, property_name,
+			properties[i].type, NULL, value, error);
+  sqlite3_free (sql);
+  return err;
+}
+
+static void
+property_value_free (gpointer data)
+{
+  GValue *value = data;
+  g_value_unset (value);
+  g_free (value);
+}
+
+/* Return OBJECT's properties in *VALUES.  All of the properties are
+   read using a single query.  */
+static enum woodchuck_error
+property_get_all (const char *object,
+		  const char *table, struct property *properties,
+		  const char *expected_interface_name,
+		  const char *interface_name,
+		  GHashTable **values, GError **error)
+{
+  if (! (*interface_name == '\0'
+	 || strcmp (interface_name, expected_interface_name) == 0))
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "No such interface: %s", interface_name);
+      return DBUS_GERROR_INVALID_ARGS;
+    }
+
+  *values = g_hash_table_new_full (g_str_hash, g_str_equal,
+				   NULL, property_value_free);
+  if (! properties)
+    return 0;
+
+  GString *columns = g_string_new ("");
+  int i;
+  for (i = 0; properties[i].name; i ++)
+    if (properties[i].type != G_TYPE_INVALID)
+      g_string_append_printf (columns, "%s%s", columns->len ? ", " : "",
+			      properties[i].sql ?: properties[i].name);
+  char *sql = sqlite3_mprintf (QUERY_PROPERTY_GET, columns->str,
+			       table, object);
+  g_string_free (columns, TRUE);
+
+  bool found = false;
+  int callback (void *cookie, int argc, char **argv, char **names)
+  {
+    found = true;
+
+    int i;
+    int column = 0;
+    for (i = 0; properties[i].name; i ++)
+      if (properties[i].type != G_TYPE_INVALID)
+	{
+	  GValue *value = g_new0 (GValue, 1);
+	  property_value_set (value, expected_interface_name,
+			      properties[i].name, properties[i].type,
+			      argv[column ++]);
+	  g_hash_table_insert (*values, properties[i].name, value);
+	}
+    assert (column == argc);
+
+    return 0;
+  }
+
+  enum woodchuck_error ret = 0;
+  char *errmsg = NULL;
+  sqlite3_exec (db, sql, callback, NULL, &errmsg);
+  if (errmsg)
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "Internal error at %s:%d executing '%s': %s",
+		   __FILE__, __LINE__, sql, errmsg);
+      sqlite3_free (errmsg);
+      errmsg = NULL;
+
+      ret = WOODCHUCK_ERROR_INTERNAL_ERROR;
+    }
+  else if (! found)
+    {
+      g_set_error (error, G_MURMELTIER_ERROR, 0,
+		   "No such object: %s", object);
+      ret = WOODCHUCK_ERROR_NO_SUCH_OBJECT;
+    }
+
+  sqlite3_free (sql);
+
+  if (ret)
+    {
+      g_hash_table_unref (*values);
+      *values = NULL;
+    }
+
+  return ret;
 }
 
 static enum woodchuck_error
@@ -2745,6 +6400,10 @@ property_set (const char *object,
       return WOODCHUCK_ERROR_INTERNAL_ERROR;
     }
 
+  if (sqlite3_changes (db) > 0)
+    murmeltier_dbus_server_property_changed (table, object,
+					     property_name, value);
+
   return 0;
 }
 
@@ -2768,6 +6427,14 @@ woodchuck_property_set (const char *object,
 		       value, error);
 }
 
+enum woodchuck_error
+woodchuck_property_get_all (const char *object, const char *interface_name,
+			    GHashTable **values, GError **error)
+{
+  return property_get_all (NULL, NULL, NULL,
+			   "org.woodchuck", interface_name, values, error);
+}
+
 enum woodchuck_error
 woodchuck_manager_property_get (const char *object, const char *interface_name,
 				const char *property_name,
@@ -2788,54 +6455,24 @@ woodchuck_manager_property_set (const char *object, const char *interface_name,
 		       value, error);
 }
 
+enum woodchuck_error
+woodchuck_manager_property_get_all (const char *object,
+				    const char *interface_name,
+				    GHashTable **values, GError **error)
+{
+  return property_get_all (object, "managers", manager_properties,
+			   "org.woodchuck.manager", interface_name,
+			   values, error);
+}
+
 enum woodchuck_error
 woodchuck_stream_property_get (const char *object, const char *interface_name,
 			       const char *property_name,
 			       GValue *value, GError **error)
 {
-  char *sql = NULL;
-  GType type;
-  const char *default_value;
-  if (strcmp (property_name, "LastUpdateTime") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select transfer_time from stream_updates"
-	 " where uuid = '%s' and status = 0 order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT64;
-      default_value = "0";
-    }
-  else if (strcmp (property_name, "LastUpdateAttemptTime") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select transfer_time from stream_updates"
-	 " where uuid = '%s' order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT64;
-      default_value = "0";
-    }
-  else if (strcmp (property_name, "LastUpdateAttemptStatus") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select status from stream_updates"
-	 " where uuid = '%s' order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT;
-      default_value = "0";
-    }
-
-  if (sql)
-    {
-      enum woodchuck_error err
-	= property_get_sql (sql, interface_name, property_name, type,
-			    default_value, value, error);
-      sqlite3_free (sql);
-      return err;
-    }
-  else
-    return property_get (object, "streams", stream_properties,
-			 "org.woodchuck.stream", interface_name, property_name,
-			 value, error);
+  return property_get (object, "streams", stream_properties,
+		       "org.woodchuck.stream", interface_name, property_name,
+		       value, error);
 }
 
 enum woodchuck_error
@@ -2848,42 +6485,22 @@ woodchuck_stream_property_set (const char *object, const char *interface_name,
 		       value, error);
 }
 
+enum woodchuck_error
+woodchuck_stream_property_get_all (const char *object,
+				   const char *interface_name,
+				   GHashTable **values, GError **error)
+{
+  return property_get_all (object, "streams", stream_properties,
+			   "org.woodchuck.stream", interface_name,
+			   values, error);
+}
+
 enum woodchuck_error
 woodchuck_object_property_get (const char *object, const char *interface_name,
 			       const char *property_name,
 			       GValue *value, GError **error)
 {
-  char *sql = NULL;
-  GType type;
-  const char *default_value;
-  if (strcmp (property_name, "LastTransferTime") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select transfer_time from object_instance_status"
-	 " where uuid = '%s' and status = 0 order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT64;
-      default_value = "0";
-    }
-  else if (strcmp (property_name, "LastTransferAttemptTime") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select transfer_time from object_instance_status"
-	 " where uuid = '%s' order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT64;
-      default_value = "0";
-    }
-  else if (strcmp (property_name, "LastTransferAttemptStatus") == 0)
-    {
-      sql = sqlite3_mprintf
-	("select status from object_instance_status"
-	 " where uuid = '%s' order by instance desc limit 1",
-	 object);
-      type = G_TYPE_UINT;
-      default_value = "0";
-    }
-  else if (strcmp (property_name, "Versions") == 0)
+  if (strcmp (property_name, "Versions") == 0)
     {
 #warning Support getting and setting object.Versions
       g_set_error (error, G_MURMELTIER_ERROR, 0,
@@ -2891,19 +6508,10 @@ woodchuck_object_property_get (const char *object, const char *interface_name,
       return WOODCHUCK_ERROR_NOT_IMPLEMENTED;
     }
 
-  if (sql)
-    {
-      enum woodchuck_error err
-	= property_get_sql (sql, interface_name, property_name, type,
-			    default_value, value, error);
-      sqlite3_free (sql);
-      return err;
-    }
-  else
-    return property_get
-      (object, "objects", object_properties,
-       "org.woodchuck.object", interface_name, property_name,
-       value, error);
+  return property_get
+    (object, "objects", object_properties,
+     "org.woodchuck.object", interface_name, property_name,
+     value, error);
 }
 
 enum woodchuck_error
@@ -2915,13 +6523,56 @@ woodchuck_object_property_set (const char *object, const char *interface_name,
 		       "org.woodchuck.object", interface_name, property_name,
 		       value, error);
 }
+
+enum woodchuck_error
+woodchuck_object_property_get_all (const char *object,
+				   const char *interface_name,
+				   GHashTable **values, GError **error)
+{
+  return property_get_all (object, "objects", object_properties,
+			   "org.woodchuck.object", interface_name,
+			   values, error);
+}
 
+void
+woodchuck_thread_init (void)
+{
+  if (db)
+    return;
+
+  int err = sqlite3_open (db_filename, &db);
+  if (err)
+    error (1, 0, "sqlite3_open (%s): %s",
+	   db_filename, sqlite3_errmsg (db));
+
+  db_setup (db);
+}
+
+void
+woodchuck_write_lock (void)
+{
+  /* The main thread must not block on the lock: a worker may hold it
+     for a long time.  Use g_static_mutex_trylock and try again
+     later (see unregister_reap).  */
+  assert (g_thread_self () != main_thread);
+
+  g_static_mutex_lock (&db_write_lock);
+}
+
+void
+woodchuck_write_unlock (void)
+{
+  g_static_mutex_unlock (&db_write_lock);
+}
+
 int
 main (int argc, char *argv[])
 {
   g_thread_init (NULL);
   g_type_init ();
 
+  main_thread = g_thread_self ();
+
   int err = dotdir_init ("murmeltier");
   if (err)
     {
@@ -2931,113 +6582,27 @@ main (int argc, char *argv[])
 
   /* Open the DB.  */
   db_filename = dotdir_filename (NULL, "config.db");
-  err = sqlite3_open (db_filename, &db);
-  if (err)
-    error (1, 0, "sqlite3_open (%s): %s",
-	   db_filename, sqlite3_errmsg (db));
+  woodchuck_thread_init ();
 
   debug (0, "STARTING (pid: %d, built on "__DATE__" at "__TIME__"): state: %s",
 	 (int) getpid (), db_filename);
 
-  /* Wait a while before timing out.  */
-  sqlite3_busy_timeout (db, 5 * 60 * 1000);
+  if (murmeltier_schema_migrate (db))
+    return 1;
 
-  char *errmsg = NULL;
-  sqlite3_exec
-    (db,
-     "create table if not exists managers"
-     " (uuid PRIMARY KEY, parent_uuid NOT NULL, HumanReadableName,"
-     "  DBusServiceName, DBusObject, Cookie, Priority, Enabled default 1,"
-     "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
-     "create index if not exists managers_cookie_index on managers (cookie);"
-     "create index if not exists managers_parent_uuid_index on managers"
-     " (parent_uuid);"
-
-     "create table if not exists streams"
-     " (uuid PRIMARY KEY, parent_uuid NOT NULL, instance,"
-     "  HumanReadableName, Cookie, Priority, Freshness, ObjectsMostlyInline,"
-     "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
-     "create index if not exists streams_cookie_index on streams (cookie);"
-     "create index if not exists streams_parent_uuid_index"
-     " on streams (parent_uuid);"
-
-     "create table if not exists stream_updates"
-     " (uuid NOT NULL, instance, parent_uuid NOT NULL,"
-     "  status, indicator, transferred_up, transferred_down,"
-     "  transfer_time, transfer_duration,"
-     "  new_objects, updated_objects, objects_inline,"
-     "  UNIQUE (uuid, instance));"
-     "create index if not exists stream_updates_parent_uuid_index"
-     " on stream_updates (parent_uuid);"
-
-     "create table if not exists objects"
-     " (uuid PRIMARY KEY, parent_uuid NOT NULL,"
-     "  Instance DEFAULT 0, HumanReadableName, Cookie, Filename, Wakeup,"
-     "  TriggerTarget, TriggerEarliest, TriggerLatest,"
-     "  TransferFrequency,"
-     "  DontTransfer DEFAULT 0, NeedUpdate, Priority,"
-     "  DiscoveryTime, PublicationTime,"
-     "  RegistrationTime DEFAULT (strftime ('%s', 'now')));"
-     "create index if not exists objects_cookie_index on objects (cookie);"
-     "create index if not exists objects_parent_uuid_index"
-     " on objects (parent_uuid);"
-
-     /* The available versions of an object.  Columns are as per the
-	org.woodchuck.Object.Versions property.  */
-     "create table if not exists object_versions"
-     " (uuid NOT NULL, version NOT NULL, parent_uuid NOT NULL,"
-     "  url, expected_size, expected_transfer_up, expected_transfer_down,"
-     "  utility, use_simple_transferer,"
-     "  UNIQUE (uuid, version, url));"
-     "create index if not exists object_versions_parent_uuid_index"
-     " on object_versions (parent_uuid);"
-
-     /* An object instance's status.  Columns are as per
-	org.woodchuck.object.TransferStatus.  */
-     "create table if not exists object_instance_status"
-     " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
-     "  status, transferred_up, transferred_down,"
-     "  transfer_time, transfer_duration, object_size, indicator,"
-     "  deleted, preserve_until, compressed_size,"
-     "  UNIQUE (uuid, instance));"
-     "create index if not exists object_status_parent_uuid_index"
-     " on object_instance_status (parent_uuid);"
-
-     "create table if not exists object_instance_files"
-     " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
-     "  filename, dedicated, deletion_policy,"
-     "  UNIQUE (uuid, instance, filename));"
-     "create index if not exists object_instance_files_parent_uuid_index"
-     " on object_instance_files (parent_uuid);"
-
-     "create table if not exists object_use"
-     " (uuid NOT NULL, instance NOT NULL, parent_uuid NOT NULL,"
-     "  reported, start, duration, use_mask);"
-     "create index if not exists object_use_parent_uuid_index"
-     " on object_use (parent_uuid);",
-     NULL, NULL, &errmsg);
-  if (errmsg)
-    {
-      debug (0, "Creating tables: %s", errmsg);
-      sqlite3_free (errmsg);
-      errmsg = NULL;
-      return 1;
-    }
+  feedback_subscribers_init ();
+  energy_mediums_init ();
 
-  sqlite3_exec
-    (db,
-     "alter table managers add column Enabled default 1;",
-     NULL, NULL, &errmsg);
-  if (errmsg)
-    {
-      if (! strstr (errmsg, "duplicate column name"))
-	debug (0, "Adding column managers.Enabled: %s", errmsg);
-      sqlite3_free (errmsg);
-      errmsg = NULL;
-    }
+  /* Finish any unregistrations that were interrupted.  */
+  unregister_reap_start ();
+  /* Index any files that were not yet hashed.  */
+  content_hash_start ();
+  disk_usage_init ();
 
   properties_init ();
   murmeltier_dbus_server_init ();
+  simple_transferer_init (SIMPLE_TRANSFERER_TRANSFERS,
+			  SIMPLE_TRANSFERER_BYTES_PER_SECOND);
 
   mt = MURMELTIER (g_object_new (MURMELTIER_TYPE, NULL));
   if (! mt)
@@ -910,6 +910,24 @@ class PyWoodchuck(DictMixin, _BaseObject):
 
             self.pywoodchuck.object_delete_files_cb (stream, object)
 
+        def object_files_compressed_cb (self, manager_UUID, manager_cookie,
+                                        stream_UUID, stream_cookie,
+                                        object_UUID, object_cookie,
+                                        files, object_size):
+            """org.woodchuck.upcalls.ObjectFilesCompressed"""
+            try:
+                stream = self.pywoodchuck._stream_lookup (
+                    stream_cookie, stream_UUID)
+                object = stream._object_lookup (object_cookie, object_UUID)
+            except woodchuck.NoSuchObject, exception:
+                print "Woodchuck invoked " \
+                    "org.woodchuck.upcall.ObjectFilesCompressed", \
+                    "for non-existant object: ", str (exception)
+                return False
+
+            self.pywoodchuck.object_files_compressed_cb (
+                stream, object, files, object_size)
+
     property_list = woodchuck.manager_properties
 
     def __init__(self, human_readable_name, dbus_service_name,
@@ -1000,7 +1018,9 @@ class PyWoodchuck(DictMixin, _BaseObject):
                 and (self.__class__.object_transfer_cb
                      == PyWoodchuck.object_transfer_cb)
                 and (self.__class__.object_delete_files_cb
-                     == PyWoodchuck.object_delete_files_cb)):
+                     == PyWoodchuck.object_delete_files_cb)
+                and (self.__class__.object_files_compressed_cb
+                     == PyWoodchuck.object_files_compressed_cb)):
                 # None of the call backs were overriden.  There is no
                 # need to subscribe.
                 #
@@ -1612,6 +1632,33 @@ class PyWoodchuck(DictMixin, _BaseObject):
         opening example to :class:`PyWoodchuck`.
         """
         pass
+
+    def object_files_compressed_cb(self, stream, object, files,
+                                   object_size):
+        """Virtual method that should be implemented by the child
+        class if it is interested in learning that Woodchuck
+        compressed an object's files
+        (:func:`org.woodchuck.upcall.ObjectFilesCompressed`).
+
+        .. note: This is only done for objects whose files all have
+            the deletion policy
+            :data:`woodchuck.DeletionPolicy.CompressWithoutConsultation`.
+            If no objects use it, there is no need to implement this
+            upcall.
+
+        :param stream: The stream, an instance of :class:`_Stream`.
+
+        :param object: The object, an instance of :class:`_Object`.
+
+        :param files: An array of <`filename`, `new_filename`,
+            `new_size`> tuples, one for each compressed file.
+
+        :param object_size: The object's new size in bytes.
+
+        Example: for an example of how to implement an upcall, see the
+        opening example to :class:`PyWoodchuck`.
+        """
+        pass
     
 
 if __name__ == "__main__":
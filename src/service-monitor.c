@@ -42,6 +42,7 @@
 #include "dbus-util.h"
 #include "util.h"
 #include "debug.h"
+#include "timers.h"
 
 struct _WCServiceMonitor
 {
@@ -427,7 +428,8 @@ name_owner_changed_signal_cb (DBusGProxy *proxy,
 
 	      if (! service_free_delayed_id)
 		service_free_delayed_id
-		  = g_timeout_add_seconds (5, service_free_delayed_cb, NULL);
+		  = timer_add_seconds ("services", 5, 5,
+				       service_free_delayed_cb, NULL);
 	    }
 	}
 
@@ -0,0 +1,1276 @@
+/* simple-transferer.c - A simple transferer.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "simple-transferer.h"
+#include "debug.h"
+#include "util.h"
+
+/* TransferStatus codes.  */
+#define STATUS_SUCCESS 0
+#define STATUS_TRANSIENT_OTHER 0x100
+#define STATUS_TRANSIENT_NETWORK 0x101
+#define STATUS_TRANSIENT_INTERRUPTED 0x102
+#define STATUS_FAILURE_OTHER 0x200
+#define STATUS_FAILURE_GONE 0x201
+
+/* The maximum number of redirects that we follow.  */
+#define REDIRECTS_MAX 5
+/* The maximum size of an HTTP response's header.  */
+#define HEADER_MAX (16 * 1024)
+/* How long to wait for a server to send something before giving up,
+   in seconds.  */
+#define TIMEOUT 60
+
+struct transfer
+{
+  struct transfer *next;
+  /* Whether a thread is executing this transfer.  */
+  bool started;
+
+  char *key;
+  char *url;
+  /* A local file with the same content as URL or NULL.  */
+  char *local_copy;
+  char *filename;
+  simple_transferer_callback callback;
+  void *cookie;
+  char data[];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* The queued and running transfers in the order they were queued.
+   Protected by LOCK.  */
+static struct transfer *transfers;
+static struct transfer **transfers_tail = &transfers;
+/* The number of worker threads.  Protected by LOCK.  */
+static int workers;
+
+static int max_transfers = 1;
+static uint32_t bandwidth_cap;
+
+void
+simple_transferer_init (int max, uint32_t bytes_per_second)
+{
+  max_transfers = max > 0 ? max : 1;
+  bandwidth_cap = bytes_per_second;
+
+  debug (1, "Simple transferer: %d concurrent transfers, "
+	 "%"PRIu32" bytes/second per transfer.",
+	 max_transfers, bandwidth_cap);
+}
+
+/* The state of a single transfer attempt.  */
+struct attempt
+{
+  const char *filename;
+  char *partial;
+  /* The partial file.  */
+  int fd;
+  /* The number of bytes in the partial file when the attempt
+     started.  */
+  uint64_t offset;
+
+  /* When the data started arriving.  */
+  uint64_t data_start;
+  /* Whether the data is being copied from a local file, which is
+     neither throttled nor counted as transferred.  */
+  bool local;
+
+  uint64_t transferred_up;
+  uint64_t transferred_down;
+};
+
+/* Sleep until transferring the data received so far would not exceed
+   the bandwidth cap.  */
+static void
+throttle (struct attempt *a, uint64_t received)
+{
+  if (! bandwidth_cap || a->local)
+    return;
+
+  uint64_t due = a->data_start + received * 1000 / bandwidth_cap;
+  uint64_t n = now ();
+  if (due > n)
+    usleep ((due - n) * 1000);
+}
+
+/* Write LEN bytes of BUFFER to the partial file.  Returns 0 on
+   success, otherwise an errno value.  */
+static int
+write_all (struct attempt *a, const char *buffer, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t l = write (a->fd, buffer, len);
+      if (l < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      buffer += l;
+      len -= l;
+    }
+  return 0;
+}
+
+/* Discard the partial file's content: the data must be transferred
+   from the start.  */
+static int
+restart (struct attempt *a)
+{
+  a->offset = 0;
+  if (ftruncate (a->fd, 0) < 0 || lseek (a->fd, 0, SEEK_SET) < 0)
+    return errno;
+  return 0;
+}
+
+/* Copy the data from FD to the partial file until the end of file is
+   reached.  BUFFER holds LEN bytes that were already read from FD.
+   Returns a TransferStatus code.  */
+static uint32_t
+receive (struct attempt *a, int fd, const char *buffer, size_t len)
+{
+  a->data_start = now ();
+
+  uint64_t received = 0;
+  if (len > 0)
+    {
+      int err = write_all (a, buffer, len);
+      if (err)
+	{
+	  debug (0, "Writing to %s: %s", a->partial, strerror (err));
+	  return STATUS_TRANSIENT_OTHER;
+	}
+      received = len;
+      throttle (a, received);
+    }
+
+  char data[16 * 1024];
+  for (;;)
+    {
+      ssize_t l = read (fd, data, sizeof (data));
+      if (l == 0)
+	break;
+      if (l < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  debug (1, "Reading data for %s: %m", a->filename);
+	  if (! a->local)
+	    a->transferred_down += received;
+	  return STATUS_TRANSIENT_INTERRUPTED;
+	}
+
+      int err = write_all (a, data, l);
+      if (err)
+	{
+	  debug (0, "Writing to %s: %s", a->partial, strerror (err));
+	  if (! a->local)
+	    a->transferred_down += received;
+	  return STATUS_TRANSIENT_OTHER;
+	}
+
+      received += l;
+      throttle (a, received);
+    }
+
+  if (! a->local)
+    a->transferred_down += received;
+  return STATUS_SUCCESS;
+}
+
+/* Decode the %-escapes in S in place.  */
+static void
+unescape (char *s)
+{
+  char *d = s;
+  for (; *s; s ++, d ++)
+    {
+      if (s[0] == '%' && s[1] && s[2])
+	{
+	  char hex[3] = { s[1], s[2], 0 };
+	  char *tail;
+	  long c = strtol (hex, &tail, 16);
+	  if (! *tail)
+	    {
+	      *d = c;
+	      s += 2;
+	      continue;
+	    }
+	}
+      *d = *s;
+    }
+  *d = 0;
+}
+
+static uint32_t
+transfer_file (struct attempt *a, const char *url)
+{
+  /* Skip the authority, which is normally empty or localhost.  */
+  const char *path = strchr (url + strlen ("file://"), '/');
+  if (! path)
+    {
+      debug (0, "Malformed URL: %s", url);
+      return STATUS_FAILURE_OTHER;
+    }
+
+  char *source = strdup (path);
+  unescape (source);
+
+  uint32_t status;
+  int fd = open (source, O_RDONLY);
+  if (fd < 0)
+    {
+      status = errno == ENOENT ? STATUS_FAILURE_GONE : STATUS_FAILURE_OTHER;
+      debug (1, "open (%s): %m", source);
+      goto out;
+    }
+
+  struct stat st;
+  if (fstat (fd, &st) == 0 && st.st_size < a->offset)
+    /* The source shrank.  */
+    restart (a);
+
+  if (a->offset && lseek (fd, a->offset, SEEK_SET) < 0)
+    restart (a);
+
+  status = receive (a, fd, NULL, 0);
+  close (fd);
+
+ out:
+  free (source);
+  return status;
+}
+
+/* Use the local copy LOCAL_COPY instead of transferring the data.
+   If possible, link it to A->FILENAME, which doesn't use any
+   additional space.  Otherwise, copy it.  Returns a TransferStatus
+   code.  */
+static uint32_t
+transfer_local_copy (struct attempt *a, const char *local_copy)
+{
+  if (link (local_copy, a->filename) == 0)
+    {
+      debug (3, "Linked %s to %s", local_copy, a->filename);
+      /* Replace the (presumably empty) partial file with the link so
+	 that it is renamed into place as usual.  */
+      if (rename (a->filename, a->partial) == 0)
+	{
+	  close (a->fd);
+	  a->fd = open (a->partial, O_RDONLY);
+	  return STATUS_SUCCESS;
+	}
+      debug (0, "rename (%s, %s): %m", a->filename, a->partial);
+      unlink (a->filename);
+    }
+  else
+    debug (3, "link (%s, %s): %m, copying instead", local_copy, a->filename);
+
+  int fd = open (local_copy, O_RDONLY);
+  if (fd < 0)
+    {
+      debug (1, "open (%s): %m", local_copy);
+      return STATUS_TRANSIENT_OTHER;
+    }
+
+  uint32_t status = STATUS_TRANSIENT_OTHER;
+  if (restart (a) == 0)
+    {
+      a->local = true;
+      status = receive (a, fd, NULL, 0);
+      a->local = false;
+    }
+  close (fd);
+
+  return status;
+}
+
+/* Parse an http URL.  Returns false if URL is malformed.  */
+static bool
+http_url_parse (const char *url, char **host, char **port, const char **path)
+{
+  const char *authority = url + strlen ("http://");
+  const char *end = authority + strcspn (authority, "/?#");
+  if (end == authority)
+    return false;
+
+  *path = *end == '/' ? end : "/";
+
+  const char *colon = memchr (authority, ':', end - authority);
+  if (colon)
+    {
+      *host = strndup (authority, colon - authority);
+      *port = strndup (colon + 1, end - colon - 1);
+    }
+  else
+    {
+      *host = strndup (authority, end - authority);
+      *port = strdup ("80");
+    }
+  return true;
+}
+
+/* Connect to HOST:PORT.  Returns the socket or -1 on failure.  */
+static int
+http_connect (const char *host, const char *port)
+{
+  struct addrinfo hints = { 0 };
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *addresses = NULL;
+  int err = getaddrinfo (host, port, &hints, &addresses);
+  if (err)
+    {
+      debug (1, "Resolving %s: %s", host, gai_strerror (err));
+      return -1;
+    }
+
+  int fd = -1;
+  struct addrinfo *ai;
+  for (ai = addresses; ai; ai = ai->ai_next)
+    {
+      fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0)
+	continue;
+      if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+	break;
+
+      debug (1, "Connecting to %s:%s: %m", host, port);
+      close (fd);
+      fd = -1;
+    }
+  freeaddrinfo (addresses);
+
+  if (fd >= 0)
+    {
+      struct timeval tv = { TIMEOUT, 0 };
+      setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+      setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    }
+
+  return fd;
+}
+
+/* Return the value of the header NAME in the header block HEADERS or
+   NULL if there is no such header.  The value extends to the end of
+   the line.  */
+static const char *
+http_header (const char *headers, const char *name)
+{
+  int len = strlen (name);
+  const char *line = strstr (headers, "\r\n");
+  while (line && line[2] != '\r')
+    {
+      line += 2;
+      if (strncasecmp (line, name, len) == 0 && line[len] == ':')
+	{
+	  const char *value = line + len + 1;
+	  while (*value == ' ' || *value == '\t')
+	    value ++;
+	  return value;
+	}
+      line = strstr (line, "\r\n");
+    }
+  return NULL;
+}
+
+/* Fetch URL over HTTP.  If the partial file is not empty, only
+   request the missing data.  If the server redirects us, *REDIRECT is
+   set to the new location.  If the partial file had to be discarded,
+   *REDIRECT is set to URL so that it is fetched again.  */
+static uint32_t
+transfer_http (struct attempt *a, const char *url, char **redirect)
+{
+  char *host = NULL;
+  char *port = NULL;
+  const char *path;
+  if (! http_url_parse (url, &host, &port, &path))
+    {
+      debug (0, "Malformed URL: %s", url);
+      return STATUS_FAILURE_OTHER;
+    }
+
+  uint32_t status;
+  char *request = NULL;
+  char *header = NULL;
+
+  int fd = http_connect (host, port);
+  if (fd < 0)
+    {
+      status = STATUS_TRANSIENT_NETWORK;
+      goto out;
+    }
+
+  /* We send an HTTP/1.0 request so that the response is not
+     chunked.  */
+  char range[64] = "";
+  if (a->offset)
+    snprintf (range, sizeof (range), "Range: bytes=%"PRIu64"-\r\n",
+	      a->offset);
+  int len = asprintf (&request,
+		      "GET %s HTTP/1.0\r\n"
+		      "Host: %s%s%s\r\n"
+		      "User-Agent: murmeltier\r\n"
+		      "%s"
+		      "Connection: close\r\n"
+		      "\r\n",
+		      path, host,
+		      strcmp (port, "80") == 0 ? "" : ":",
+		      strcmp (port, "80") == 0 ? "" : port,
+		      range);
+  if (len < 0)
+    {
+      request = NULL;
+      status = STATUS_TRANSIENT_OTHER;
+      goto out;
+    }
+
+  int sent = 0;
+  while (sent < len)
+    {
+      ssize_t l = send (fd, request + sent, len - sent, MSG_NOSIGNAL);
+      if (l < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  debug (1, "Sending request to %s: %m", host);
+	  status = STATUS_TRANSIENT_NETWORK;
+	  goto out;
+	}
+      sent += l;
+    }
+  a->transferred_up += len;
+
+  /* Read the response's header.  */
+  header = malloc (HEADER_MAX + 1);
+  int have = 0;
+  char *body = NULL;
+  while (! body)
+    {
+      if (have == HEADER_MAX)
+	{
+	  debug (0, "%s: Response header too long.", url);
+	  status = STATUS_TRANSIENT_OTHER;
+	  goto out;
+	}
+
+      ssize_t l = read (fd, header + have, HEADER_MAX - have);
+      if (l < 0 && errno == EINTR)
+	continue;
+      if (l <= 0)
+	{
+	  debug (1, "%s: Connection closed while reading header.", url);
+	  status = STATUS_TRANSIENT_NETWORK;
+	  goto out;
+	}
+      have += l;
+      header[have] = 0;
+
+      body = strstr (header, "\r\n\r\n");
+    }
+  /* Include the final CRLF in the header, which http_header
+     expects.  */
+  body += 4;
+  int header_len = body - header;
+  a->transferred_down += header_len;
+
+  int code = 0;
+  if (sscanf (header, "HTTP/%*d.%*d %d", &code) != 1)
+    {
+      debug (0, "%s: Malformed status line.", url);
+      status = STATUS_TRANSIENT_OTHER;
+      goto out;
+    }
+  debug (3, "%s: %d (offset: %"PRIu64")", url, code, a->offset);
+
+  const char *content_length = http_header (header, "Content-Length");
+  uint64_t expected = content_length ? strtoull (content_length, NULL, 10) : 0;
+
+  switch (code)
+    {
+    case 200:
+      if (a->offset)
+	{
+	  debug (3, "%s: Server ignored range request, restarting.", url);
+	  if (restart (a))
+	    {
+	      status = STATUS_TRANSIENT_OTHER;
+	      goto out;
+	    }
+	}
+      break;
+
+    case 206:
+      {
+	/* Make sure the server starts where we asked it to.  */
+	const char *content_range = http_header (header, "Content-Range");
+	uint64_t first = 0;
+	if (! content_range
+	    || sscanf (content_range, "bytes %"SCNu64"-", &first) != 1
+	    || first != a->offset)
+	  {
+	    debug (0, "%s: Unexpected content range.", url);
+	    restart (a);
+	    status = STATUS_TRANSIENT_INTERRUPTED;
+	    goto out;
+	  }
+	break;
+      }
+
+    case 416:
+      {
+	if (! a->offset)
+	  {
+	    status = STATUS_FAILURE_OTHER;
+	    goto out;
+	  }
+
+	/* If the range starts at the end of the object, whose size
+	   the server reports in the Content-Range header, we already
+	   have everything.  Otherwise, the object shrank or was
+	   replaced: fetch it again from the start.  */
+	const char *content_range = http_header (header, "Content-Range");
+	uint64_t size = 0;
+	if (content_range
+	    && sscanf (content_range, "bytes */%"SCNu64, &size) == 1
+	    && size == a->offset)
+	  {
+	    status = STATUS_SUCCESS;
+	    goto out;
+	  }
+
+	debug (1, "%s: Range starting at %"PRIu64" not satisfiable"
+	       " (object size: %"PRIu64"), restarting.",
+	       url, a->offset, size);
+	if (restart (a))
+	  {
+	    status = STATUS_TRANSIENT_OTHER;
+	    goto out;
+	  }
+	*redirect = strdup (url);
+	status = STATUS_SUCCESS;
+	goto out;
+      }
+
+    case 301:
+    case 302:
+    case 303:
+    case 307:
+    case 308:
+      {
+	const char *location = http_header (header, "Location");
+	if (! location)
+	  {
+	    status = STATUS_FAILURE_OTHER;
+	    goto out;
+	  }
+	int location_len = strcspn (location, "\r\n");
+	if (*location == '/')
+	  {
+	    if (asprintf (redirect, "http://%s:%s%.*s",
+			  host, port, location_len, location) < 0)
+	      *redirect = NULL;
+	  }
+	else
+	  *redirect = strndup (location, location_len);
+	status = STATUS_SUCCESS;
+	goto out;
+      }
+
+    case 404:
+    case 410:
+      status = STATUS_FAILURE_GONE;
+      goto out;
+
+    default:
+      if (400 <= code && code < 500)
+	status = STATUS_FAILURE_OTHER;
+      else
+	status = STATUS_TRANSIENT_OTHER;
+      goto out;
+    }
+
+  uint64_t before = a->transferred_down;
+  status = receive (a, fd, body, have - header_len);
+  if (status == STATUS_SUCCESS && content_length
+      && a->transferred_down - before < expected)
+    {
+      debug (1, "%s: Connection closed after %"PRIu64" of %"PRIu64" bytes.",
+	     url, a->transferred_down - before, expected);
+      status = STATUS_TRANSIENT_INTERRUPTED;
+    }
+
+ out:
+  if (fd >= 0)
+    close (fd);
+  free (header);
+  free (request);
+  free (host);
+  free (port);
+  return status;
+}
+
+/* Create the directories leading to FILENAME.  */
+static void
+make_parents (const char *filename)
+{
+  char *dir = strdup (filename);
+  char *p;
+  for (p = dir + 1; (p = strchr (p, '/')); p ++)
+    {
+      *p = 0;
+      if (mkdir (dir, 0700) < 0 && errno != EEXIST)
+	debug (0, "mkdir (%s): %m", dir);
+      *p = '/';
+    }
+  free (dir);
+}
+
+/* If FILENAME names a directory, return the name of the file in it
+   that URL should be saved as.  Otherwise, return a copy of
+   FILENAME.  */
+static char *
+target_filename (const char *url, const char *filename)
+{
+  int len = strlen (filename);
+  if (len == 0 || filename[len - 1] != '/')
+    return strdup (filename);
+
+  const char *path = strstr (url, "://");
+  path = path ? strchr (path + 3, '/') : NULL;
+
+  char *base = NULL;
+  if (path)
+    {
+      int path_len = strcspn (path, "?#");
+      while (path_len > 0 && path[path_len - 1] == '/')
+	path_len --;
+      int start = path_len;
+      while (start > 0 && path[start - 1] != '/')
+	start --;
+      if (start < path_len)
+	{
+	  base = strndup (path + start, path_len - start);
+	  unescape (base);
+	  if (strchr (base, '/') || strcmp (base, ".") == 0
+	      || strcmp (base, "..") == 0)
+	    {
+	      free (base);
+	      base = NULL;
+	    }
+	}
+    }
+
+  char *target = NULL;
+  if (asprintf (&target, "%s%s", filename, base ?: "index") < 0)
+    target = NULL;
+  free (base);
+  return target;
+}
+
+static void
+transfer_execute (struct transfer *t)
+{
+  struct simple_transferer_result result = { 0 };
+  result.start = now ();
+
+  struct attempt a = { 0 };
+  a.fd = -1;
+
+  char *filename = target_filename (t->url, t->filename);
+  a.filename = filename;
+  result.filename = filename;
+  if (! filename || asprintf (&a.partial, "%s.part", filename) < 0)
+    {
+      a.partial = NULL;
+      result.status = STATUS_TRANSIENT_OTHER;
+      goto out;
+    }
+
+  debug (3, "Transferring %s to %s", t->url, filename);
+
+  make_parents (a.partial);
+  a.fd = open (a.partial, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (a.fd < 0)
+    {
+      debug (0, "open (%s): %m", a.partial);
+      result.status = STATUS_TRANSIENT_OTHER;
+      goto out;
+    }
+
+  struct stat st;
+  if (fstat (a.fd, &st) == 0)
+    a.offset = st.st_size;
+  if (a.offset)
+    debug (3, "Resuming %s at %"PRIu64, t->url, a.offset);
+
+  if (t->local_copy)
+    {
+      result.status = transfer_local_copy (&a, t->local_copy);
+      if (result.status == STATUS_SUCCESS)
+	goto done;
+      debug (3, "Using %s failed, transferring %s",
+	     t->local_copy, t->url);
+    }
+
+  char *url = strdup (t->url);
+  int redirects = 0;
+  for (;;)
+    {
+      char *redirect = NULL;
+
+      if (strncmp (url, "file://", strlen ("file://")) == 0)
+	result.status = transfer_file (&a, url);
+      else if (strncmp (url, "http://", strlen ("http://")) == 0)
+	result.status = transfer_http (&a, url, &redirect);
+      else
+	{
+	  debug (0, "%s: Unsupported URL scheme.", url);
+	  result.status = STATUS_FAILURE_OTHER;
+	}
+
+      if (! redirect)
+	break;
+
+      debug (3, "%s redirected to %s", url, redirect);
+      free (url);
+      url = redirect;
+
+      if (++ redirects > REDIRECTS_MAX)
+	{
+	  debug (0, "%s: Too many redirects.", t->url);
+	  result.status = STATUS_FAILURE_OTHER;
+	  break;
+	}
+    }
+  free (url);
+
+ done:
+  if (fstat (a.fd, &st) == 0)
+    result.object_size = st.st_size;
+
+  close (a.fd);
+
+  if (result.status == STATUS_SUCCESS)
+    {
+      if (rename (a.partial, filename) < 0)
+	{
+	  debug (0, "rename (%s, %s): %m", a.partial, filename);
+	  result.status = STATUS_TRANSIENT_OTHER;
+	}
+    }
+  else if (result.status >= STATUS_FAILURE_OTHER)
+    /* We won't try again.  */
+    unlink (a.partial);
+
+ out:
+  result.duration = now () - result.start;
+  result.transferred_up = a.transferred_up;
+  result.transferred_down = a.transferred_down;
+
+  debug (3, "%s -> %s: status: %"PRIx32"; "
+	 "%"PRIu64" bytes in "TIME_FMT,
+	 t->url, filename, result.status, result.transferred_down,
+	 TIME_PRINTF (result.duration));
+
+  t->callback (t->cookie, &result);
+
+  free (a.partial);
+  free (filename);
+}
+
+static void *
+worker (void *arg)
+{
+  pthread_mutex_lock (&lock);
+  for (;;)
+    {
+      struct transfer *t;
+      for (t = transfers; t && t->started; t = t->next)
+	;
+      if (! t)
+	break;
+
+      t->started = true;
+      pthread_mutex_unlock (&lock);
+
+      transfer_execute (t);
+
+      pthread_mutex_lock (&lock);
+      struct transfer **p;
+      for (p = &transfers; *p != t; p = &(*p)->next)
+	;
+      *p = t->next;
+      if (transfers_tail == &t->next)
+	transfers_tail = p;
+      free (t);
+    }
+
+  workers --;
+  pthread_mutex_unlock (&lock);
+
+  return NULL;
+}
+
+bool
+simple_transferer_queue (const char *key, const char *url,
+			 const char *local_copy, const char *filename,
+			 simple_transferer_callback callback, void *cookie)
+{
+  pthread_mutex_lock (&lock);
+
+  struct transfer *t;
+  for (t = transfers; t; t = t->next)
+    if (strcmp (t->key, key) == 0)
+      {
+	pthread_mutex_unlock (&lock);
+	debug (4, "%s: Transfer already queued.", key);
+	return false;
+      }
+
+  int key_len = strlen (key) + 1;
+  int url_len = strlen (url) + 1;
+  int local_copy_len = local_copy ? strlen (local_copy) + 1 : 0;
+  int filename_len = strlen (filename) + 1;
+
+  t = malloc (sizeof (*t) + key_len + url_len + local_copy_len
+	      + filename_len);
+  t->next = NULL;
+  t->started = false;
+  t->callback = callback;
+  t->cookie = cookie;
+
+  void *p = (void *) &t[1];
+
+  t->key = p;
+  p = mempcpy (p, key, key_len);
+
+  t->url = p;
+  p = mempcpy (p, url, url_len);
+
+  if (local_copy)
+    {
+      t->local_copy = p;
+      p = mempcpy (p, local_copy, local_copy_len);
+    }
+  else
+    t->local_copy = NULL;
+
+  t->filename = p;
+  p = mempcpy (p, filename, filename_len);
+
+  *transfers_tail = t;
+  transfers_tail = &t->next;
+
+  if (workers < max_transfers)
+    {
+      pthread_t tid;
+      if (pthread_create (&tid, NULL, worker, NULL) == 0)
+	{
+	  pthread_detach (tid);
+	  workers ++;
+	}
+      else
+	debug (0, "Failed to create transfer thread: %m");
+    }
+
+  pthread_mutex_unlock (&lock);
+
+  debug (4, "Queued %s: %s -> %s", key, url, filename);
+
+  return true;
+}
+
+#ifdef SIMPLE_TRANSFERER_TEST
+#include <error.h>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* A stand-in HTTP server.  It serves DATA at /data (honoring range
+   requests), at /norange (ignoring them) and at /truncated (closing
+   the connection half way through).  /redirect redirects to /data.
+   Anything else is not found.  */
+#define DATA_SIZE (64 * 1024)
+static char data[DATA_SIZE];
+
+static void *
+server (void *arg)
+{
+  int listener = (intptr_t) arg;
+
+  for (;;)
+    {
+      int fd = accept (listener, NULL, NULL);
+      if (fd < 0)
+	continue;
+
+      char request[4096];
+      int have = 0;
+      while (have < sizeof (request) - 1)
+	{
+	  ssize_t l = read (fd, request + have, sizeof (request) - 1 - have);
+	  if (l <= 0)
+	    break;
+	  have += l;
+	  request[have] = 0;
+	  if (strstr (request, "\r\n\r\n"))
+	    break;
+	}
+      request[have] = 0;
+
+      char path[256] = "";
+      sscanf (request, "GET %255s", path);
+      long first = 0;
+      const char *range = http_header (request, "Range");
+      if (range)
+	sscanf (range, "bytes=%ld-", &first);
+
+      char header[256];
+      const char *body = data;
+      int len = DATA_SIZE;
+      if (strcmp (path, "/data") == 0 && first > 0 && first < DATA_SIZE)
+	{
+	  body = data + first;
+	  len = DATA_SIZE - first;
+	  snprintf (header, sizeof (header),
+		    "HTTP/1.0 206 Partial Content\r\n"
+		    "Content-Range: bytes %ld-%d/%d\r\n"
+		    "Content-Length: %d\r\n\r\n",
+		    first, DATA_SIZE - 1, DATA_SIZE, len);
+	}
+      else if (strcmp (path, "/data") == 0 && first >= DATA_SIZE)
+	{
+	  len = 0;
+	  snprintf (header, sizeof (header),
+		    "HTTP/1.0 416 Range Not Satisfiable\r\n"
+		    "Content-Range: bytes */%d\r\n\r\n", DATA_SIZE);
+	}
+      else if (strcmp (path, "/data") == 0
+	       || strcmp (path, "/norange") == 0
+	       || strcmp (path, "/truncated") == 0)
+	{
+	  snprintf (header, sizeof (header),
+		    "HTTP/1.0 200 OK\r\nContent-Length: %d\r\n\r\n", len);
+	  if (strcmp (path, "/truncated") == 0)
+	    len /= 2;
+	}
+      else if (strcmp (path, "/redirect") == 0)
+	{
+	  len = 0;
+	  snprintf (header, sizeof (header),
+		    "HTTP/1.0 302 Found\r\nLocation: /data\r\n\r\n");
+	}
+      else
+	{
+	  len = 0;
+	  snprintf (header, sizeof (header),
+		    "HTTP/1.0 404 Not Found\r\n\r\n");
+	}
+
+      send (fd, header, strlen (header), MSG_NOSIGNAL);
+      send (fd, body, len, MSG_NOSIGNAL);
+      close (fd);
+    }
+
+  return NULL;
+}
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int done;
+static struct simple_transferer_result last;
+
+static void
+done_callback (void *cookie, const struct simple_transferer_result *result)
+{
+  pthread_mutex_lock (&done_lock);
+  last = *result;
+  last.filename = NULL;
+  done ++;
+  pthread_cond_broadcast (&done_cond);
+  pthread_mutex_unlock (&done_lock);
+}
+
+/* Transfer URL (or LOCAL_COPY) to FILENAME and wait for the
+   result.  */
+static struct simple_transferer_result
+fetch_with_copy (const char *url, const char *local_copy,
+		 const char *filename)
+{
+  pthread_mutex_lock (&done_lock);
+  int target = done + 1;
+  pthread_mutex_unlock (&done_lock);
+
+  if (! simple_transferer_queue (filename, url, local_copy, filename,
+				 done_callback, NULL))
+    error (1, 0, "simple_transferer_queue (%s) failed", url);
+
+  pthread_mutex_lock (&done_lock);
+  while (done < target)
+    pthread_cond_wait (&done_cond, &done_lock);
+  struct simple_transferer_result result = last;
+  pthread_mutex_unlock (&done_lock);
+
+  printf ("%s -> %s: status: %x; %"PRIu64" bytes down in %"PRIu64" ms\n",
+	  url, filename, result.status, result.transferred_down,
+	  result.duration);
+  return result;
+}
+
+static struct simple_transferer_result
+fetch (const char *url, const char *filename)
+{
+  return fetch_with_copy (url, NULL, filename);
+}
+
+/* Check that FILENAME contains the first LEN bytes of DATA.  */
+static bool
+check_content (const char *filename, int len)
+{
+  static char buffer[DATA_SIZE + 1];
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  int have = 0;
+  ssize_t l;
+  while ((l = read (fd, buffer + have, sizeof (buffer) - have)) > 0)
+    have += l;
+  close (fd);
+  return have == len && memcmp (buffer, data, len) == 0;
+}
+
+static void
+write_partial (const char *filename, int len)
+{
+  int fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || write (fd, data, len) != len)
+    error (1, errno, "Writing %s", filename);
+  close (fd);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int i;
+  for (i = 0; i < DATA_SIZE; i ++)
+    data[i] = random ();
+
+  char dir[] = "/tmp/simple-transferer-XXXXXX";
+  if (! mkdtemp (dir))
+    error (1, errno, "mkdtemp");
+
+  int listener = socket (AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = { 0 };
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof (addr);
+  if (bind (listener, (struct sockaddr *) &addr, sizeof (addr)) < 0
+      || listen (listener, 8) < 0
+      || getsockname (listener, (struct sockaddr *) &addr, &addr_len) < 0)
+    error (1, errno, "Starting server");
+
+  pthread_t tid;
+  pthread_create (&tid, NULL, server, (void *) (intptr_t) listener);
+
+  char *base = NULL;
+  if (asprintf (&base, "http://127.0.0.1:%d", ntohs (addr.sin_port)) < 0)
+    error (1, errno, "asprintf");
+
+  int failures = 0;
+  void check (bool ok, const char *what)
+  {
+    printf ("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (! ok)
+      failures ++;
+  }
+
+  char url[600];
+  char filename[512];
+  char partial[600];
+
+  simple_transferer_init (2, 0);
+
+  /* A file:// URL.  */
+  char source[512];
+  snprintf (source, sizeof (source), "%s/source", dir);
+  write_partial (source, DATA_SIZE);
+  snprintf (url, sizeof (url), "file://%s", source);
+  snprintf (filename, sizeof (filename), "%s/file", dir);
+  struct simple_transferer_result r = fetch (url, filename);
+  check (r.status == 0 && check_content (filename, DATA_SIZE), "file://");
+
+  /* Resume a file:// transfer.  */
+  snprintf (filename, sizeof (filename), "%s/file-resume", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  write_partial (partial, 1000);
+  r = fetch (url, filename);
+  check (r.status == 0 && r.transferred_down == DATA_SIZE - 1000
+	 && check_content (filename, DATA_SIZE), "file:// resume");
+
+  /* A missing file.  */
+  snprintf (url, sizeof (url), "file://%s/missing", dir);
+  snprintf (filename, sizeof (filename), "%s/missing", dir);
+  r = fetch (url, filename);
+  check (r.status == STATUS_FAILURE_GONE && access (filename, F_OK) < 0,
+	 "file:// missing");
+
+  /* A complete HTTP transfer into a directory.  */
+  snprintf (url, sizeof (url), "%s/data", base);
+  snprintf (filename, sizeof (filename), "%s/http/", dir);
+  r = fetch (url, filename);
+  snprintf (filename, sizeof (filename), "%s/http/data", dir);
+  check (r.status == 0 && check_content (filename, DATA_SIZE), "http://");
+
+  /* Resume an HTTP transfer.  */
+  snprintf (filename, sizeof (filename), "%s/http-resume", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  write_partial (partial, 5000);
+  r = fetch (url, filename);
+  check (r.status == 0 && r.transferred_down < DATA_SIZE
+	 && check_content (filename, DATA_SIZE), "http:// resume");
+
+  /* The partial file is already complete.  */
+  snprintf (filename, sizeof (filename), "%s/http-complete", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  write_partial (partial, DATA_SIZE);
+  r = fetch (url, filename);
+  check (r.status == 0 && check_content (filename, DATA_SIZE),
+	 "http:// already complete");
+
+  /* The partial file is longer than the object: it shrank or was
+     replaced.  */
+  snprintf (filename, sizeof (filename), "%s/http-shrank", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  write_partial (partial, DATA_SIZE);
+  int fd = open (partial, O_WRONLY | O_APPEND);
+  if (fd < 0 || write (fd, data, 1000) != 1000)
+    error (1, errno, "Writing %s", partial);
+  close (fd);
+  r = fetch (url, filename);
+  check (r.status == 0 && check_content (filename, DATA_SIZE),
+	 "http:// object shrank");
+
+  /* The server ignores the range.  */
+  snprintf (url, sizeof (url), "%s/norange", base);
+  snprintf (filename, sizeof (filename), "%s/http-norange", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  write_partial (partial, 5000);
+  r = fetch (url, filename);
+  check (r.status == 0 && check_content (filename, DATA_SIZE),
+	 "http:// range ignored");
+
+  /* A redirect.  */
+  snprintf (url, sizeof (url), "%s/redirect", base);
+  snprintf (filename, sizeof (filename), "%s/http-redirect", dir);
+  r = fetch (url, filename);
+  check (r.status == 0 && check_content (filename, DATA_SIZE),
+	 "http:// redirect");
+
+  /* An interrupted transfer keeps the partial file.  */
+  snprintf (url, sizeof (url), "%s/truncated", base);
+  snprintf (filename, sizeof (filename), "%s/http-truncated", dir);
+  snprintf (partial, sizeof (partial), "%s.part", filename);
+  r = fetch (url, filename);
+  check (r.status == STATUS_TRANSIENT_INTERRUPTED
+	 && check_content (partial, DATA_SIZE / 2),
+	 "http:// interrupted");
+
+  /* Not found.  */
+  snprintf (url, sizeof (url), "%s/missing", base);
+  snprintf (filename, sizeof (filename), "%s/http-missing", dir);
+  r = fetch (url, filename);
+  check (r.status == STATUS_FAILURE_GONE, "http:// not found");
+
+  /* Nothing is listening.  */
+  snprintf (url, sizeof (url), "http://127.0.0.1:1/data");
+  snprintf (filename, sizeof (filename), "%s/http-refused", dir);
+  r = fetch (url, filename);
+  check (r.status == STATUS_TRANSIENT_NETWORK, "http:// refused");
+
+  /* A local copy is linked and the URL is not fetched.  */
+  snprintf (url, sizeof (url), "%s/missing", base);
+  snprintf (filename, sizeof (filename), "%s/local-copy", dir);
+  r = fetch_with_copy (url, source, filename);
+  struct stat source_st, st;
+  check (r.status == 0 && r.transferred_down == 0
+	 && stat (source, &source_st) == 0 && stat (filename, &st) == 0
+	 && source_st.st_ino == st.st_ino
+	 && check_content (filename, DATA_SIZE), "local copy");
+
+  /* If the local copy is gone, the URL is fetched.  */
+  snprintf (url, sizeof (url), "%s/data", base);
+  snprintf (filename, sizeof (filename), "%s/local-copy-gone", dir);
+  snprintf (partial, sizeof (partial), "%s/gone", dir);
+  r = fetch_with_copy (url, partial, filename);
+  check (r.status == 0 && r.transferred_down >= DATA_SIZE
+	 && check_content (filename, DATA_SIZE), "local copy gone");
+
+  /* The bandwidth cap: DATA_SIZE at DATA_SIZE * 2 bytes per second
+     should take about half a second.  */
+  simple_transferer_init (2, DATA_SIZE * 2);
+  snprintf (url, sizeof (url), "%s/data", base);
+  snprintf (filename, sizeof (filename), "%s/http-capped", dir);
+  r = fetch (url, filename);
+  check (r.status == 0 && r.duration >= 400
+	 && check_content (filename, DATA_SIZE), "bandwidth cap");
+
+  /* A transfer can't be queued twice.  */
+  snprintf (filename, sizeof (filename), "%s/http-twice", dir);
+  pthread_mutex_lock (&done_lock);
+  int target = done + 1;
+  pthread_mutex_unlock (&done_lock);
+  bool first = simple_transferer_queue ("twice", url, NULL, filename,
+					done_callback, NULL);
+  bool second = simple_transferer_queue ("twice", url, NULL, filename,
+					 done_callback, NULL);
+  pthread_mutex_lock (&done_lock);
+  while (done < target)
+    pthread_cond_wait (&done_cond, &done_lock);
+  pthread_mutex_unlock (&done_lock);
+  check (first && ! second, "duplicate key");
+
+  int remove_callback (const char *path, const struct stat *st,
+		       int type, struct FTW *ftw)
+  {
+    if (remove (path) < 0)
+      error (0, errno, "remove (%s)", path);
+    return 0;
+  }
+  nftw (dir, remove_callback, 16, FTW_DEPTH | FTW_PHYS);
+
+  printf ("%d failures.\n", failures);
+  return failures ? 1 : 0;
+}
+#endif
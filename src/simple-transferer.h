@@ -0,0 +1,79 @@
+/* simple-transferer.h - A simple transferer.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef SIMPLE_TRANSFERER_H
+#define SIMPLE_TRANSFERER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The simple transferer fetches a URL into a file on behalf of
+   applications that set an object version's UseSimpleTransferer
+   flag.  file:// and http:// URLs are supported.  Data is first
+   written to FILENAME.part, which is renamed to FILENAME once the
+   transfer completes.  If a transfer is interrupted, the next attempt
+   resumes from the end of the partial file (for http:// using a range
+   request).  */
+
+/* The result of a transfer.  */
+struct simple_transferer_result
+{
+  /* 0 on success.  Otherwise, one of the error codes of
+     org.woodchuck.object.TransferStatus: 0x1xx for transient errors
+     and 0x2xx for hard errors.  */
+  uint32_t status;
+  /* The file that the data was written to.  */
+  const char *filename;
+  /* When the transfer started, in milliseconds since the epoch.  */
+  uint64_t start;
+  /* How long the transfer took, in milliseconds.  */
+  uint64_t duration;
+  /* The number of bytes sent and received during this attempt.  */
+  uint64_t transferred_up;
+  uint64_t transferred_down;
+  /* The size of FILENAME (or of the partial file on failure).  */
+  uint64_t object_size;
+};
+
+/* Called from one of the transferer's threads when a transfer
+   finishes.  RESULT is only valid until the function returns.  */
+typedef void (*simple_transferer_callback)
+  (void *cookie, const struct simple_transferer_result *result);
+
+/* Initialize the simple transferer.  At most MAX_TRANSFERS transfers
+   are executed concurrently.  If BYTES_PER_SECOND is not zero, each
+   transfer's rate is limited to that many bytes per second.  */
+extern void simple_transferer_init (int max_transfers,
+				    uint32_t bytes_per_second);
+
+/* Fetch URL and save it in FILENAME.  If FILENAME ends in a /, it is
+   interpreted as a directory and the file is named after the last
+   component of URL's path.  Missing directories are created.  If
+   LOCAL_COPY is not NULL, it is a local file with the same content as
+   URL: it is hard linked to (or, if that fails, copied to) FILENAME
+   instead, and URL is only fetched if that fails.  When the transfer
+   finishes, CALLBACK is called with COOKIE.  KEY identifies the
+   transfer (e.g., the object's UUID).  If a transfer with the same
+   KEY is queued or running, does nothing and returns false.
+   Otherwise, returns true.  */
+extern bool simple_transferer_queue (const char *key, const char *url,
+				     const char *local_copy,
+				     const char *filename,
+				     simple_transferer_callback callback,
+				     void *cookie);
+
+#endif
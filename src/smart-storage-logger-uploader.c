@@ -36,6 +36,7 @@
 #include "util.h"
 #include "sqlq.h"
 #include "files.h"
+#include "timers.h"
 
 #include "network-monitor.h"
 #include "user-activity-monitor.h"
@@ -854,8 +855,9 @@ upload_schedule (gpointer user_data)
 	 TIME_PRINTF (connect_timeout), TIME_PRINTF (inactivity_timeout),
 	 TIME_PRINTF (age_timeout), TIME_PRINTF (retry_timeout));
 
+  /* Uploading is not urgent: allow up to a minute of slack.  */
   upload_schedule_source_id
-    = g_timeout_add_seconds ((999 + timeout) / 1000, upload_schedule, NULL);
+    = timer_add ("uploader", timeout, 60 * 1000, upload_schedule, NULL);
 
   return FALSE;
 }
@@ -42,6 +42,7 @@
 #include "battery-monitor.h"
 #include "service-monitor.h"
 #include "shutdown-monitor.h"
+#include "timers.h"
 
 /* DB for logging events.  */
 static char *db_filename;
@@ -616,7 +617,8 @@ nm_new_connection (NCNetworkMonitor *nm, NCNetworkConnection *nc,
 
   if (nm_connections_stat_cb_id == 0)
     nm_connections_stat_cb_id
-      = g_timeout_add_seconds (5 * 60, nm_connections_stat_cb, nm);
+      = timer_add_seconds ("connection stats", 5 * 60, 60,
+			   nm_connections_stat_cb, nm);
 }
 
 /* An existing connection has been brought down.  */
@@ -904,8 +906,10 @@ nm_init (void)
 		    G_CALLBACK (nm_cell_info_changed), NULL);
 
   nm_connections_stat_cb_id
-    = g_timeout_add_seconds (5 * 60, nm_connections_stat_cb, nm);
-  g_timeout_add_seconds (30 * 60, nm_network_scan_cb, nm);
+    = timer_add_seconds ("connection stats", 5 * 60, 60,
+			 nm_connections_stat_cb, nm);
+  timer_add_seconds ("network scan", 30 * 60, 5 * 60,
+		     nm_network_scan_cb, nm);
 }
 
 static
@@ -997,6 +1001,10 @@ battery_status (WCBatteryMonitor *m,
 		      TM_PRINTF (now_tm ()), wc_battery_id (b),
 		      is_charging, wc_battery_charger_to_string (charger),
 		      is_discharging, mv, mah);
+
+  /* On battery, limit the number of timer wakeups.  */
+  timers_wakeup_budget (wc_battery_monitor_discharging (m)
+			? TIMERS_BATTERY_WAKEUP_BUDGET : 0);
 }
 
 static void
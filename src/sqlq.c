@@ -23,6 +23,7 @@
 #include <inttypes.h>
 
 #include "sqlq.h"
+#include "timers.h"
 #undef sqlq_append
 #undef sqlq_append_printf
 #include "debug.h"
@@ -291,9 +292,12 @@ sqlq_append (const char *file, const char *func, int line,
       assert (! s);
 
       if (! q->flush_source)
-	/* Wait at most Q->FLUSH_DELAY seconds before flushing.  */
-	q->flush_source = g_timeout_add_seconds (q->flush_delay,
-						 do_delayed_flush, q);
+	/* Wait about Q->FLUSH_DELAY seconds before flushing.  The flush
+	   may be delayed by up to half as much again so that it rides
+	   on another timer's wakeup.  */
+	q->flush_source = timer_add_seconds ("sqlq", q->flush_delay,
+					     q->flush_delay / 2,
+					     do_delayed_flush, q);
     }
 
   return q->used != 0;
@@ -0,0 +1,306 @@
+/* timers.c - Coalesced timers.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "timers.h"
+#include "debug.h"
+#include "util.h"
+
+/* Dispatches that occur within this many milliseconds of the
+   previous dispatch ride on the same wakeup.  */
+#define TIMERS_COALESCE 100
+
+/* How often to report the wakeup statistics, in seconds.  */
+#define TIMERS_REPORT_INTERVAL (60 * 60)
+
+/* The shared windows, largest first, in milliseconds.  */
+static const guint windows[] = { 300000, 60000, 15000, 5000, 1000 };
+
+struct source_stats
+{
+  const char *name;
+  /* Since the last report.  */
+  int fires;
+  int wakeups;
+};
+
+struct timer
+{
+  GSource source;
+  struct source_stats *stats;
+  guint interval;
+  guint slack;
+  /* When to fire, in milliseconds since the epoch.  */
+  uint64_t fire;
+  /* Whether the timer's dispatches count towards the wakeup budget.
+     Only timers_report's timer is not accounted: it is not subject
+     to the budget and its wakeups are not counted.  */
+  bool accounted;
+};
+
+static GStaticMutex lock = G_STATIC_MUTEX_INIT;
+/* Maps source names to struct source_stats.  Protected by LOCK.  */
+static GHashTable *sources;
+/* The time of the last dispatch.  Protected by LOCK.  */
+static uint64_t last_dispatch;
+/* The number of wakeups since the last report.  Protected by
+   LOCK.  */
+static int wakeups;
+/* The number of wakeups in the last reporting period or -1.
+   Protected by LOCK.  */
+static int wakeups_last_hour = -1;
+/* The wakeup budget and whether it was exceeded in the current
+   reporting period.  Protected by LOCK.  */
+static int budget;
+static bool over_budget;
+
+/* Returns the time at which a timer with deadline DEADLINE and slack
+   SLACK should fire.  LOCK must be held.  */
+static uint64_t
+timer_fire (uint64_t deadline, guint slack)
+{
+  int i;
+  for (i = 0; i < sizeof (windows) / sizeof (windows[0]); i ++)
+    if (slack >= windows[i])
+      {
+	guint w = windows[i];
+	if (over_budget)
+	  /* Fire as late as possible.  */
+	  return (deadline + slack) / w * w;
+	else
+	  return (deadline + w - 1) / w * w;
+      }
+
+  return deadline;
+}
+
+static gboolean
+timer_prepare (GSource *source, gint *timeout)
+{
+  struct timer *t = (struct timer *) source;
+  uint64_t n = now ();
+
+  g_static_mutex_lock (&lock);
+  if (t->fire > n + t->interval + t->slack)
+    /* The clock went backwards.  */
+    t->fire = timer_fire (n + t->interval, t->slack);
+  bool deferred = over_budget && t->slack && t->accounted;
+  g_static_mutex_unlock (&lock);
+
+  if (n >= t->fire)
+    {
+      *timeout = 0;
+      return TRUE;
+    }
+
+  if (deferred)
+    /* The wakeup budget is exhausted.  Don't wake up for this timer:
+       it is dispatched (by timer_check) when something else wakes
+       the main loop after its deadline.  */
+    {
+      *timeout = -1;
+      return FALSE;
+    }
+
+  uint64_t delta = t->fire - n;
+  *timeout = delta > G_MAXINT ? G_MAXINT : delta;
+  return FALSE;
+}
+
+static gboolean
+timer_check (GSource *source)
+{
+  struct timer *t = (struct timer *) source;
+  return now () >= t->fire;
+}
+
+static gboolean
+timer_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+  struct timer *t = (struct timer *) source;
+
+  if (! callback)
+    {
+      debug (0, "Timer for %s has no callback.", t->stats->name);
+      return FALSE;
+    }
+
+  uint64_t n = now ();
+  bool exceeded = false;
+
+  g_static_mutex_lock (&lock);
+
+  if (t->accounted)
+    {
+      t->stats->fires ++;
+      if (n - last_dispatch >= TIMERS_COALESCE)
+	{
+	  t->stats->wakeups ++;
+	  wakeups ++;
+
+	  if (budget && wakeups > budget && ! over_budget)
+	    {
+	      over_budget = true;
+	      exceeded = true;
+	    }
+	}
+      last_dispatch = n;
+    }
+
+  t->fire = timer_fire (n + t->interval, t->slack);
+
+  g_static_mutex_unlock (&lock);
+
+  if (exceeded)
+    debug (0, "%s exceeded the wakeup budget (%d per hour).  "
+	   "Timers with slack only fire on other wakeups"
+	   " for the rest of the hour.",
+	   t->stats->name, budget);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs timer_funcs =
+  {
+    timer_prepare,
+    timer_check,
+    timer_dispatch,
+    NULL
+  };
+
+static gboolean
+timers_report (gpointer user_data)
+{
+  GString *s = g_string_new ("");
+
+  g_static_mutex_lock (&lock);
+
+  void iter (gpointer key, gpointer value, gpointer user_data)
+  {
+    struct source_stats *stats = value;
+
+    if (stats->fires)
+      g_string_append_printf (s, "%s%s: %d/%d",
+			      s->len ? "; " : "",
+			      stats->name, stats->wakeups, stats->fires);
+
+    stats->fires = stats->wakeups = 0;
+  }
+  g_hash_table_foreach (sources, iter, NULL);
+
+  int w = wakeups;
+  bool exceeded = over_budget;
+
+  wakeups_last_hour = wakeups;
+  wakeups = 0;
+  over_budget = false;
+
+  g_static_mutex_unlock (&lock);
+
+  debug (exceeded ? 0 : 1,
+	 "%d wakeups in the last hour (budget: %d); "
+	 "wakeups/dispatches by source: %s",
+	 w, budget, s->str);
+
+  g_string_free (s, TRUE);
+
+  return TRUE;
+}
+
+static guint
+timer_new (gint priority, const char *source,
+	   guint interval, guint slack, bool accounted,
+	   GSourceFunc func, gpointer data, GDestroyNotify notify)
+{
+  GSource *s = g_source_new (&timer_funcs, sizeof (struct timer));
+  struct timer *t = (struct timer *) s;
+
+  t->interval = interval;
+  t->slack = slack;
+  t->accounted = accounted;
+
+  bool start_report = false;
+
+  g_static_mutex_lock (&lock);
+
+  if (! sources)
+    {
+      sources = g_hash_table_new (g_str_hash, g_str_equal);
+      start_report = true;
+    }
+
+  t->stats = g_hash_table_lookup (sources, source);
+  if (! t->stats)
+    {
+      t->stats = g_malloc0 (sizeof (*t->stats));
+      t->stats->name = source;
+      g_hash_table_insert (sources, (gpointer) source, t->stats);
+    }
+
+  t->fire = timer_fire (now () + interval, slack);
+
+  g_static_mutex_unlock (&lock);
+
+  if (priority != G_PRIORITY_DEFAULT)
+    g_source_set_priority (s, priority);
+  g_source_set_callback (s, func, data, notify);
+  guint id = g_source_attach (s, NULL);
+  g_source_unref (s);
+
+  if (start_report)
+    timer_new (G_PRIORITY_LOW, "timers",
+	       TIMERS_REPORT_INTERVAL * 1000, 5 * 60 * 1000, false,
+	       timers_report, NULL, NULL);
+
+  return id;
+}
+
+guint
+timer_add_full (gint priority, const char *source,
+		guint interval, guint slack,
+		GSourceFunc func, gpointer data,
+		GDestroyNotify notify)
+{
+  return timer_new (priority, source, interval, slack, true,
+		    func, data, notify);
+}
+
+void
+timers_wakeup_budget (int b)
+{
+  g_static_mutex_lock (&lock);
+  int old = budget;
+  budget = b;
+  over_budget = budget && wakeups > budget;
+  g_static_mutex_unlock (&lock);
+
+  if (old != b)
+    debug (3, "Wakeup budget: %d -> %d", old, b);
+}
+
+int
+timers_wakeups_per_hour (void)
+{
+  g_static_mutex_lock (&lock);
+  int w = wakeups_last_hour >= 0 ? wakeups_last_hour : wakeups;
+  g_static_mutex_unlock (&lock);
+
+  return w;
+}
@@ -0,0 +1,82 @@
+/* timers.h - Coalesced timers.
+   Copyright (C) 2011 Neal H. Walfield <neal@walfield.org>
+
+   Woodchuck is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3, or (at
+   your option) any later version.
+
+   Woodchuck is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <glib.h>
+
+/* A replacement for g_timeout_add and friends that lets the caller
+   say how late a timer may fire.  A timer with a slack of at least a
+   second fires on the first boundary of a shared window (1, 5, 15,
+   60 or 300 seconds, the largest that is no larger than the slack)
+   after its deadline.  Windows are aligned to the wall clock, so
+   timers in different processes also fire together.  Timers with
+   less slack fire at their deadline.
+
+   Each timer is charged to a named source.  A dispatch that does not
+   follow another dispatch within a short interval counts as a wakeup.
+   Once an hour, the number of dispatches and wakeups per source is
+   logged.  The timer that logs them is not counted.  */
+
+/* A reasonable wakeup budget when running on battery.  */
+#define TIMERS_BATTERY_WAKEUP_BUDGET 60
+
+/* Call FUNC with DATA in INTERVAL milliseconds and then every
+   INTERVAL milliseconds until FUNC returns FALSE.  Each dispatch may
+   be delayed by up to SLACK milliseconds.  SOURCE names the timer's
+   owner for the wakeup accounting; it must remain valid for the
+   lifetime of the program (i.e., use a string literal).  When the
+   timer is destroyed, NOTIFY is called with DATA.  Returns the
+   source's id, which can be passed to g_source_remove.  May be called
+   from any thread; the timer is dispatched by the main loop.  */
+extern guint timer_add_full (gint priority, const char *source,
+			     guint interval, guint slack,
+			     GSourceFunc func, gpointer data,
+			     GDestroyNotify notify);
+
+static inline guint
+timer_add (const char *source, guint interval, guint slack,
+	   GSourceFunc func, gpointer data)
+{
+  return timer_add_full (G_PRIORITY_DEFAULT, source, interval, slack,
+			 func, data, NULL);
+}
+
+/* Like timer_add, but INTERVAL and SLACK are in seconds.  */
+static inline guint
+timer_add_seconds (const char *source, guint interval, guint slack,
+		   GSourceFunc func, gpointer data)
+{
+  return timer_add_full (G_PRIORITY_DEFAULT, source,
+			 interval * 1000, slack * 1000, func, data, NULL);
+}
+
+/* Limit the number of wakeups per hour to BUDGET.  If zero (the
+   default), there is no limit.  When the limit is exceeded, a warning
+   is logged and, for the rest of the hour, timers with slack no
+   longer wake the process: once their deadline has passed, they are
+   dispatched on the next wakeup that something else causes (e.g., a
+   timer without slack or a D-Bus message).  Timers without slack are
+   considered critical and still fire at their deadline.  */
+extern void timers_wakeup_budget (int budget);
+
+/* Returns the number of wakeups in the last complete hour or, if the
+   program has not yet run for an hour, so far.  */
+extern int timers_wakeups_per_hour (void);
+
+#endif
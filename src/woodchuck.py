@@ -18,9 +18,11 @@
 # <http://www.gnu.org/licenses/>.
 
 import dbus
+import dbus.connection
 import dbus.service
 import time
 import threading
+import weakref
 from functools import wraps
 import sys
 import logging
@@ -108,6 +110,14 @@ class DeletionPolicy:
     #: Woodchuck may ask the application to delete the file.
     DeleteWithConsultation = 2
 
+    #: Woodchuck may compress the file (replacing FILE with FILE.gz)
+    #: without consulting the application, provided all of the
+    #: object's files are dedicated to it and have this policy.  The
+    #: application is told using
+    #: :func:`Upcalls.object_files_compressed_cb`.  Otherwise, the
+    #: file is treated like :data:`DeleteWithConsultation`.
+    CompressWithoutConsultation = 3
+
 class DeletionResponse:
     """Values for the Update arguments of
     :func:`woodchuck._Object.files_deleted`"""
@@ -176,6 +186,10 @@ def _dbus_exception_to_woodchuck_exception(exception):
 
 # The default amount of time to cache values.
 _ttl = 1
+# If we receive the server's change signals, cached values are only
+# stale if they have been changed by a signal.  We still refresh them
+# every so often in case we missed a signal.
+_signalled_ttl = 60
 
 def _str_to_dbus_str(s, strict=False):
     """
@@ -211,6 +225,7 @@ _manager_properties_to_camel_case = \
            "enabled": ("Enabled", dbus.Boolean, True, _ttl),
            "registration_time": ("RegistrationTime", dbus.UInt64, 0,
                                  float("inf")),
+           "disk_usage": ("DiskUsage", dbus.UInt64, 0, _ttl),
           })
 _manager_properties_from_camel_case = \
     dict([[k2, (k, t, d, ttl)] for k, (k2, t, d, ttl)
@@ -236,6 +251,7 @@ _stream_properties_to_camel_case = \
                ("LastUpdateAttemptTime", dbus.UInt64, 0, _ttl),
            "last_update_attempt_status":
                ("LastUpdateAttemptStatus", dbus.UInt32, 0, _ttl),
+           "disk_usage": ("DiskUsage", dbus.UInt64, 0, _ttl),
            })
 _stream_properties_from_camel_case = \
     dict([[k2, (k, t, d, ttl)] for k, (k2, t, d, ttl)
@@ -271,6 +287,7 @@ _object_properties_to_camel_case = \
                ("LastTransferAttemptTime", dbus.UInt64, 0, _ttl),
            "last_transfer_attempt_status":
                ("LastTransferAttemptStatus", dbus.UInt32, 0, _ttl),
+           "disk_usage": ("DiskUsage", dbus.UInt64, 0, _ttl),
            })
 _object_properties_from_camel_case = \
     dict([[k2, (k, t, d, ttl)] for k, (k2, t, d, ttl)
@@ -319,16 +336,27 @@ class DBusIndirectObject(object):
     Wrap a DBus object.  Bind the server name lazily, i.e., if the
     server exits and appears under a different private name,
     transparently use that.
+
+    If the keyword argument peer is True, send the method calls over
+    a direct connection to the server, if it offers one (see
+    org.woodchuck.PeerAddress), rather than via the bus.
     """
-    __slots__ = ('bus', 'args', 'kwargs', 'real_object')
+    __slots__ = ('bus', 'args', 'kwargs', 'peer', 'real_object')
     def __init__(self, bus, *args, **kwargs):
         self.bus = bus
         self.args = args
+        self.peer = kwargs.pop('peer', False)
         self.kwargs = kwargs
         self.bind_object()
 
     def bind_object(self):
-        self.real_object = self.bus.get_object(*self.args, **self.kwargs)
+        connection = self.peer and _peer_connection()
+        if connection:
+            # A peer connection has no bus names.
+            self.real_object = connection.get_object(
+                None, *self.args[1:], **self.kwargs)
+        else:
+            self.real_object = self.bus.get_object(*self.args, **self.kwargs)
 
     def __getattr__(self, attr):
         if attr in self.__slots__:
@@ -355,16 +383,95 @@ class DBusIndirectObject(object):
                 if dbus_name == "org.freedesktop.DBus.Error.ServiceUnknown":
                     self.bind_object()
                     return invoke()
+                elif (dbus_name == "org.freedesktop.DBus.Error.Disconnected"
+                      and self.peer):
+                    # The server exited.  Get its new address.
+                    _peer_disconnected()
+                    self.bind_object()
+                    return invoke()
                 else:
                     raise
 
         return wrap
 
+# A direct connection to the server, None if we haven't asked for one
+# yet, or False if the server doesn't offer one.
+_peer = None
+def _peer_connection():
+    """Return a connection to the server's private D-Bus server or
+    None, if method calls should be sent via the session bus."""
+    global _peer
+    if _peer is None:
+        _peer = False
+        try:
+            address = dbus.SessionBus().get_object(
+                'org.woodchuck', '/org/woodchuck', introspect=False
+                ).PeerAddress(dbus_interface='org.woodchuck')
+            if address:
+                _peer = dbus.connection.Connection(address)
+        except dbus.exceptions.DBusException, exception:
+            # An old server.  Use the bus.
+            logger.debug("Not using a peer connection: %s" % str(exception))
+    return _peer or None
+
+def _peer_disconnected():
+    """The server closed the peer connection.  The next call to
+    _peer_connection asks for a new one."""
+    global _peer
+    _peer = None
+
+# Map from object paths to the _BaseObjects that represent them.
+# Used to find the objects whose cached properties a signal updates.
+_local_objects = weakref.WeakValueDictionary()
+# Whether we are listening for the server's change signals.
+_signals_watched = False
+
+def _properties_changed(interface, changed, invalidated, path=None):
+    """Handler for org.freedesktop.DBus.Properties.PropertiesChanged."""
+    o = _local_objects.get(path)
+    if o is not None:
+        o._properties_changed(changed, invalidated)
+
+def _removed(path=None):
+    """Handler for the manager, stream and object Removed signals."""
+    o = _local_objects.pop(path, None)
+    if o is not None:
+        o._properties_changed({}, [dbus_name for dbus_name, _, _, _
+                                   in o.property_map.values ()])
+
+def _signals_watch():
+    """Start listening for the server's change signals.  Returns
+    whether the signals will be delivered.  They are only delivered if
+    a main loop has been set as the default, e.g., using
+    DBusGMainLoop(set_as_default=True)."""
+    global _signals_watched
+    if _signals_watched:
+        return True
+    if dbus.get_default_main_loop() is None:
+        return False
+
+    bus = dbus.SessionBus()
+    bus.add_signal_receiver(_properties_changed,
+                            signal_name='PropertiesChanged',
+                            dbus_interface='org.freedesktop.DBus.Properties',
+                            bus_name='org.woodchuck',
+                            path_keyword='path')
+    bus.add_signal_receiver(_removed,
+                            signal_name='Removed',
+                            bus_name='org.woodchuck',
+                            path_keyword='path')
+    _signals_watched = True
+    return True
+
 class _BaseObject(object):
     """
     _Object, _Stream and _Manager inherit from this class, which
     implements common functionality, such as getting and setting
     properties.
+
+    Property values are cached.  If the application runs a main loop,
+    the server's change signals keep the cache up to date.
+    Otherwise, values are cached for a short time.
     """
     @_check_main_thread
     def __init__(self, initial_properties, property_map):
@@ -381,6 +488,9 @@ class _BaseObject(object):
             = dict ([[k, [ v, now ]] for k, v in initial_properties.items ()])
         self.property_map = property_map
 
+        if _signals_watch():
+            _local_objects[self.proxy.object_path] = self
+
         try:
             self.dbus_properties = dbus.Interface(
                 self.proxy,
@@ -401,11 +511,22 @@ class _BaseObject(object):
 
         properties = self.__dict__['properties']
 
+        ttl = property_map[name][3]
+        if ttl is not None and _signals_watched:
+            ttl = max(ttl, _signalled_ttl)
+
         if (name in properties
-            and (time.time () - properties[name][1] < property_map[name][3])):
+            and (time.time () - properties[name][1] < ttl)):
             # name is cached and it is still valid.
             return properties[name][0]
 
+        if property_map[name][3] is not None:
+            # Prefetch all of the properties: it costs a single round
+            # trip and a single query.
+            self._get_all_properties ()
+            if name in properties:
+                return properties[name][0]
+
         try:
             value = self.dbus_properties.Get(
                 dbus.String(""), dbus.String(property_map[name][0]))
@@ -418,6 +539,75 @@ class _BaseObject(object):
 
         return value
 
+    def _get_all_properties(self):
+        """
+        Fetch all of the object's properties and cache those that may
+        be cached.  If the server doesn't support
+        org.freedesktop.DBus.Properties.GetAll, does nothing.
+        """
+        if self.__dict__.get ('_get_all_unsupported'):
+            return
+
+        try:
+            values = self.dbus_properties.GetAll(dbus.String(""))
+        except dbus.exceptions.DBusException, exception:
+            if (exception.get_dbus_name ()
+                == "org.freedesktop.DBus.Error.UnknownMethod"):
+                # An old server.  Fall back to Get.
+                self.__dict__['_get_all_unsupported'] = True
+                return
+            _dbus_exception_to_woodchuck_exception(exception)
+
+        now = time.time ()
+        properties = self.__dict__['properties']
+        for name, (dbus_name, _, _, ttl) in self.property_map.items ():
+            if ttl is not None and dbus_name in values:
+                properties[name] = [ values[dbus_name], now ]
+
+    def _list_paged(self, paged_method, method):
+        """
+        Call the D-Bus method PAGED_METHOD (e.g., ListObjectsFrom)
+        until it returns an empty cursor and return the concatenated
+        rows.  This keeps each reply small for objects with many
+        children.  If the server doesn't support PAGED_METHOD, calls
+        METHOD (e.g., ListObjects) instead.
+        """
+        if not self.__dict__.get ('_list_paged_unsupported'):
+            rows = []
+            cursor = ""
+            try:
+                while True:
+                    page, cursor = getattr (self.dbus, paged_method)(
+                        dbus.String(cursor), dbus.UInt32(0))
+                    rows.extend (page)
+                    if not cursor:
+                        return rows
+            except dbus.exceptions.DBusException, exception:
+                if (exception.get_dbus_name ()
+                    != "org.freedesktop.DBus.Error.UnknownMethod"):
+                    raise
+                # An old server.
+                self.__dict__['_list_paged_unsupported'] = True
+
+        return getattr (self.dbus, method)()
+
+    def _properties_changed(self, changed, invalidated):
+        """
+        Update the cache.  CHANGED is a dictionary mapping D-Bus
+        property names to their new values.  INVALIDATED is a list of
+        D-Bus property names whose values are no longer valid.
+        """
+        now = time.time ()
+        properties = self.__dict__['properties']
+        for name, (dbus_name, _, _, ttl) in self.property_map.items ():
+            if ttl is None or ttl == float("inf"):
+                # Not cached or never changes.
+                continue
+            if dbus_name in changed:
+                properties[name] = [ changed[dbus_name], now ]
+            elif dbus_name in invalidated:
+                properties.pop(name, None)
+
     @_check_main_thread
     def __setattr__(self, name, value):
         if ('property_map' in self.__dict__ and name in self.property_map):
@@ -467,7 +657,7 @@ class _Object(_BaseObject):
         self.proxy = DBusIndirectObject(
             dbus.SessionBus(),
             'org.woodchuck', '/org/woodchuck/object/' + properties['UUID'],
-            introspect=False)
+            introspect=False, peer=True)
         try:
             self.dbus = dbus.Interface (self.proxy,
                                         dbus_interface='org.woodchuck.object')
@@ -728,7 +918,7 @@ class _Stream(_BaseObject):
         self.proxy = DBusIndirectObject(
             dbus.SessionBus(),
             'org.woodchuck', '/org/woodchuck/stream/' + properties['UUID'],
-            introspect=False)
+            introspect=False, peer=True)
         try:
             self.dbus = dbus.Interface (self.proxy,
                                         dbus_interface='org.woodchuck.stream')
@@ -809,7 +999,7 @@ class _Stream(_BaseObject):
             return [Object(UUID=UUID, human_readable_name=human_readable_name,
                            cookie=cookie, parent_UUID=self.UUID)
                     for UUID, cookie, human_readable_name
-                    in self.dbus.ListObjects()]
+                    in self._list_paged("ListObjectsFrom", "ListObjects")]
         except dbus.exceptions.DBusException, exception:
             _dbus_exception_to_woodchuck_exception(exception)
 
@@ -993,10 +1183,18 @@ class _Manager(_BaseObject):
         self.proxy = DBusIndirectObject(
             dbus.SessionBus(),
             'org.woodchuck', '/org/woodchuck/manager/' + properties['UUID'],
-            introspect=False)
+            introspect=False, peer=True)
         try:
             self.dbus = dbus.Interface (self.proxy,
                                         dbus_interface='org.woodchuck.manager')
+            # Upcalls are sent to the subscriber's bus name.  Thus,
+            # the feedback methods must be called via the bus.
+            self.feedback_proxy = DBusIndirectObject(
+                dbus.SessionBus(), 'org.woodchuck',
+                '/org/woodchuck/manager/' + properties['UUID'],
+                introspect=False)
+            self.feedback_dbus = dbus.Interface (
+                self.feedback_proxy, dbus_interface='org.woodchuck.manager')
         except dbus.exceptions.DBusException, exception:
             _dbus_exception_to_woodchuck_exception (exception)
 
@@ -1186,7 +1384,7 @@ class _Manager(_BaseObject):
             return [Stream(UUID=UUID, human_readable_name=human_readable_name,
                            cookie=cookie, parent_UUID=self.UUID)
                     for UUID, cookie, human_readable_name
-                    in self.dbus.ListStreams()]
+                    in self._list_paged("ListStreamsFrom", "ListStreams")]
         except dbus.exceptions.DBusException, exception:
             _dbus_exception_to_woodchuck_exception(exception)
 
@@ -1247,8 +1445,8 @@ class _Manager(_BaseObject):
                 # subscription (which can be shared).
                 assert self.feedback_subscriptions[0] > 0
 
-                h = self.dbus.FeedbackSubscribe(dbus.Boolean(True))
-                self.dbus.FeedbackUnsubscribe(
+                h = self.feedback_dbus.FeedbackSubscribe(dbus.Boolean(True))
+                self.feedback_dbus.FeedbackUnsubscribe(
                     dbus.String(self.feedback_subscription_handle))
                 self.feedback_subscription_handle = h
 
@@ -1262,7 +1460,8 @@ class _Manager(_BaseObject):
             assert self.feedback_subscriptions[1] == 0
 
             self.feedback_subscription_handle \
-                = self.dbus.FeedbackSubscribe(dbus.Boolean(descendents_too))
+                = self.feedback_dbus.FeedbackSubscribe(
+                    dbus.Boolean(descendents_too))
             self.feedback_subscriptions[idx] = 1
 
         return idx
@@ -1281,7 +1480,7 @@ class _Manager(_BaseObject):
         if (self.feedback_subscriptions[0]
             + self.feedback_subscriptions[1] == 1):
             # No subscriptions left.
-            self.dbus.FeedbackUnsubscribe(
+            self.feedback_dbus.FeedbackUnsubscribe(
                 dbus.String(self.feedback_subscription_handle))
             self.feedback_subscription_handle = None
 
@@ -1294,8 +1493,8 @@ class _Manager(_BaseObject):
             # The last descendents_too subscription is now gone, but
             # we still have non-descendent subscriptions.  Get an
             # appropriate subscription.
-            h = self.dbus.FeedbackSubscribe(dbus.Boolean(False))
-            self.dbus.FeedbackUnsubscribe(
+            h = self.feedback_dbus.FeedbackSubscribe(dbus.Boolean(False))
+            self.feedback_dbus.FeedbackUnsubscribe(
                 dbus.String(self.feedback_subscription_handle))
             self.feedback_subscription_handle = h
 
@@ -1306,7 +1505,7 @@ class _Manager(_BaseObject):
     def feedback_ack(self, object_UUID, object_instance):
         """Invoke org.woodchuck.manager.FeedbackAck."""
         try:
-            self.dbus.FeedbackAck(
+            self.feedback_dbus.FeedbackAck(
                 dbus.String(_str_to_dbus_str(object_UUID)),
                 dbus.UInt32(object_instance))
         except dbus.exceptions.DBusException, exception:
@@ -1346,7 +1545,7 @@ class _Woodchuck(object):
         try:
             self._woodchuck_object = DBusIndirectObject(
                 dbus.SessionBus(),
-                'org.woodchuck', '/org/woodchuck', introspect=False)
+                'org.woodchuck', '/org/woodchuck', introspect=False, peer=True)
             self._woodchuck \
                 = dbus.Interface (self._woodchuck_object,
                                   dbus_interface='org.woodchuck')
@@ -1572,7 +1771,7 @@ Woodchuck)?"""
             _woodchuck_owner_update (owner)
 
     @dbus.service.method(dbus_interface='org.woodchuck.upcall',
-                         in_signature='ssssssuu(ustub)sttt',
+                         in_signature='ssssssuu(usxttub)sttt',
                          out_signature='',
                          sender_keyword="sender")
     def ObjectTransferred(self, manager_UUID, manager_cookie,
@@ -1725,6 +1924,52 @@ Woodchuck)?"""
         """
         pass
 
+    def object_transfer_local_copy_cb (self, manager_UUID, manager_cookie,
+                                       stream_UUID, stream_cookie,
+                                       object_UUID, object_cookie,
+                                       version, filename, quality,
+                                       local_copy):
+        """Virtual method that may be implemented by the child
+        class if it is able to make use of a local copy of an object.
+
+        This upcall (:func:`org.woodchuck.upcall.ObjectTransferLocalCopy`)
+        is invoked instead of :func:`object_transfer_cb` if Woodchuck
+        has a local file whose content is identical to
+        that of the version to transfer, e.g., because another
+        application already transferred it from the same URL.  The
+        application can hard link or copy the file instead of
+        transferring it.  The file belongs to another object and must
+        not be modified or moved.
+
+        The default implementation ignores the local copy and calls
+        :func:`object_transfer_cb`.
+
+        :param local_copy: The name of the local copy.
+
+        The other parameters are as for :func:`object_transfer_cb`.
+        """
+        self.object_transfer_cb (manager_UUID, manager_cookie,
+                                 stream_UUID, stream_cookie,
+                                 object_UUID, object_cookie,
+                                 version, filename, quality)
+
+    @dbus.service.method(dbus_interface='org.woodchuck.upcall',
+                         in_signature='ssssss(usxttub)sus', out_signature='',
+                         sender_keyword="sender")
+    def ObjectTransferLocalCopy(self, manager_UUID, manager_cookie,
+                                stream_UUID, stream_cookie,
+                                object_UUID, object_cookie,
+                                version, filename, quality, local_copy,
+                                sender):
+        if not _is_woodchuck (sender):
+            return False
+
+        self.object_transfer_local_copy_cb (manager_UUID, manager_cookie,
+                                            stream_UUID, stream_cookie,
+                                            object_UUID, object_cookie,
+                                            version, filename, quality,
+                                            local_copy)
+
     @dbus.service.method(dbus_interface='org.woodchuck.upcall',
                          in_signature='ssssss', out_signature='',
                          sender_keyword="sender")
@@ -1761,6 +2006,52 @@ Woodchuck)?"""
         :param object_cookie: The object's cookie.
         """
         pass
+
+    @dbus.service.method(dbus_interface='org.woodchuck.upcall',
+                         in_signature='ssssssa(sst)t', out_signature='',
+                         sender_keyword="sender")
+    def ObjectFilesCompressed(self, manager_UUID, manager_cookie,
+                              stream_UUID, stream_cookie,
+                              object_UUID, object_cookie,
+                              files, object_size, sender):
+        if not _is_woodchuck (sender):
+            return False
+
+        self.object_files_compressed_cb (manager_UUID, manager_cookie,
+                                         stream_UUID, stream_cookie,
+                                         object_UUID, object_cookie,
+                                         files, object_size)
+
+    def object_files_compressed_cb (self, manager_UUID, manager_cookie,
+                                    stream_UUID, stream_cookie,
+                                    object_UUID, object_cookie,
+                                    files, object_size):
+        """Virtual method that should be implemented by the child
+        class if it is interested in
+        org.woodchuck.upcall.ObjectFilesCompressed upcalls.
+
+        This upcall is invoked when Woodchuck compressed some of an
+        object's files, whose deletion policy is
+        :data:`DeletionPolicy.CompressWithoutConsultation`.
+
+        :param manager_UUID: The manager's UUID.
+
+        :param manager_cookie: The manager's cookie.
+
+        :param stream_UUID: The stream's UUID.
+
+        :param stream_cookie: The stream's cookie.
+
+        :param object_UUID: The object's UUID.
+
+        :param object_cookie: The object's cookie.
+
+        :param files: An array of <`filename`, `new_filename`,
+            `new_size`> tuples, one for each compressed file.
+
+        :param object_size: The object's new size in bytes.
+        """
+        pass
 
 if __name__ == "__main__":
     import random